@@ -0,0 +1,58 @@
+#include "annotation.h"
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Function-local so that programs can intern texts during static
+// initialization.
+static std::vector<std::string>& Texts() {
+  static std::vector<std::string> texts;
+  return texts;
+}
+
+static std::vector<std::vector<Annotation>>& Lists() {
+  static std::vector<std::vector<Annotation>> lists(1);
+  return lists;
+}
+
+int32_t InternAnnotationText(const std::string& text) {
+  static std::map<std::string, int32_t> ids;
+  auto it = ids.find(text);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  int32_t id = Texts().size();
+  Texts().push_back(text);
+  ids[text] = id;
+  return id;
+}
+
+int32_t InternAnnotations(const std::vector<Annotation>& annotations) {
+  static std::map<std::vector<Annotation>, int32_t> ids;
+  if (annotations.empty()) {
+    return kNoAnnotations;
+  }
+  auto it = ids.find(annotations);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  int32_t id = Lists().size();
+  Lists().push_back(annotations);
+  ids[annotations] = id;
+  return id;
+}
+
+std::vector<std::string> FormatAnnotations(int32_t annotations) {
+  std::vector<std::string> formatted;
+  for (const Annotation& annotation : Lists()[annotations]) {
+    std::stringstream ss;
+    ss << Texts()[annotation.text];
+    if (annotation.has_value) {
+      ss << annotation.value;
+    }
+    formatted.push_back(ss.str());
+  }
+  return formatted;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Annotations describe upcoming transitions for trace dumps. They are
+// interned so that annotating stays off the allocator on every run: each
+// distinct text is stored once, and so is each distinct list of annotations
+// attached to a transition, which then carries just the id of its list.
+// Nothing is formatted until a trace is dumped.
+//
+// Ids are only meaningful in the process that interned them.
+
+struct Annotation {
+  int32_t text;
+  bool has_value;
+  int64_t value;
+
+  Annotation(int32_t text) : text(text), has_value(false), value(0) {}
+  Annotation(int32_t text, int64_t value) :
+      text(text), has_value(true), value(value) {}
+
+  bool operator<(const Annotation& o) const {
+    if (text != o.text) {
+      return text < o.text;
+    } else if (has_value != o.has_value) {
+      return has_value < o.has_value;
+    } else {
+      return value < o.value;
+    }
+  }
+};
+
+// The id of the empty list, carried by unannotated transitions.
+static const int32_t kNoAnnotations = 0;
+
+int32_t InternAnnotationText(const std::string& text);
+int32_t InternAnnotations(const std::vector<Annotation>& annotations);
+
+// Formats the annotations in the list with the given id, as the text
+// followed by the value, if any.
+std::vector<std::string> FormatAnnotations(int32_t annotations);
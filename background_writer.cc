@@ -0,0 +1,146 @@
+#include "background_writer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "statistics.h"
+
+size_t background_queue_bytes = 64 << 20;
+
+static int64_t& background_writes =
+    RegisterStatistic<int64_t>("background-writes");
+// The times queueing had to wait for the writer to make room.
+static int64_t& background_waits =
+    RegisterStatistic<int64_t>("background-waits");
+
+struct BackgroundWrite {
+  int fd; // or -1 to write path
+  std::string path;
+  std::string data;
+};
+
+// Counts the bytes of the write being written along with those queued, so
+// that the bound covers all the memory held.
+struct WriterState {
+  std::mutex mutex;
+  std::condition_variable queued, written;
+  std::deque<BackgroundWrite> queue;
+  size_t queued_bytes = 0;
+  bool writing = false;
+  bool started = false;
+};
+
+// Replaced in forked children, whose copy may be locked by the fork and is
+// not served by any thread.
+static WriterState* state;
+
+static void WriteAll(int fd, const std::string& data, const char* name) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = write(fd, data.data() + written, data.size() - written);
+    if (result < 0 && errno != EINTR) {
+      perror(name);
+      return;
+    }
+    written += result > 0 ? result : 0;
+  }
+}
+
+static void Perform(const BackgroundWrite& item) {
+  if (item.fd >= 0) {
+    WriteAll(item.fd, item.data, "write");
+    return;
+  }
+  int fd = open(item.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    perror(item.path.c_str());
+    return;
+  }
+  WriteAll(fd, item.data, item.path.c_str());
+  close(fd);
+}
+
+static void RunWriter(WriterState* writer) {
+  std::unique_lock<std::mutex> lock(writer->mutex);
+  while (true) {
+    writer->queued.wait(lock, [writer]() { return !writer->queue.empty(); });
+    BackgroundWrite item = std::move(writer->queue.front());
+    writer->queue.pop_front();
+    writer->writing = true;
+    lock.unlock();
+    Perform(item);
+    lock.lock();
+    writer->queued_bytes -= item.data.size();
+    writer->writing = false;
+    writer->written.notify_all();
+  }
+}
+
+static void LockForFork() {
+  state->mutex.lock();
+}
+
+static void UnlockAfterFork() {
+  state->mutex.unlock();
+}
+
+static void ResetAfterFork() {
+  state = new WriterState();
+}
+
+static void Queue(BackgroundWrite item) {
+  if (state == nullptr) {
+    state = new WriterState();
+    pthread_atfork(LockForFork, UnlockAfterFork, ResetAfterFork);
+    atexit(FlushBackgroundWrites);
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  if (!state->started) {
+    std::thread(RunWriter, state).detach();
+    state->started = true;
+  }
+  size_t size = item.data.size();
+  if (state->queued_bytes > 0 &&
+      state->queued_bytes + size > background_queue_bytes) {
+    background_waits++;
+    state->written.wait(lock, [size]() {
+      return state->queued_bytes == 0 ||
+          state->queued_bytes + size <= background_queue_bytes;
+    });
+  }
+  state->queued_bytes += size;
+  state->queue.push_back(std::move(item));
+  background_writes++;
+  state->queued.notify_one();
+}
+
+void WriteFileInBackground(const std::string& path, std::string data) {
+  Queue(BackgroundWrite{-1, path, std::move(data)});
+}
+
+void WriteInBackground(int fd, std::string data) {
+  Queue(BackgroundWrite{fd, std::string(), std::move(data)});
+}
+
+void FlushBackgroundWrites() {
+  if (state == nullptr) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->written.wait(lock, []() {
+    return state->queue.empty() && !state->writing;
+  });
+}
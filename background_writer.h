@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Trace dumps and statistics are handed to a thread of their own to write,
+// so that explorers never wait for the disk, or for whoever reads a stream of
+// statistics. Writes happen in the order they were queued. The queue holds up
+// to background_queue_bytes, and queueing more waits for room; a single write
+// larger than that waits for the queue to empty.
+//
+// A forked process starts out with an empty queue and a writer of its own,
+// leaving what was queued before the fork to its parent, and must call
+// FlushBackgroundWrites before it _exits. Processes that exit otherwise flush
+// on their way out.
+extern size_t background_queue_bytes;
+
+// Writes data to path, replacing what it held.
+void WriteFileInBackground(const std::string& path, std::string data);
+// Writes data to the file descriptor fd.
+void WriteInBackground(int fd, std::string data);
+// Waits until everything queued so far is written, as before reading back a
+// file written in the background.
+void FlushBackgroundWrites();
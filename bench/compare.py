@@ -0,0 +1,37 @@
+# Compares two tables written by bench/explore.py --tsv, such as before and
+# after a change, and prints the transitions/s of each binary and explorer in
+# both, their ratio, and the geometric mean of the ratios.
+#
+# usage: python bench/compare.py before.tsv after.tsv
+
+import csv
+import math
+import sys
+
+if len(sys.argv) != 3:
+    print('usage: python bench/compare.py before.tsv after.tsv',
+          file=sys.stderr)
+    sys.exit(1)
+
+def load(path):
+    with open(path) as f:
+        return {(row['binary'], row['explorer']): float(row['transitions/s'])
+                for row in csv.DictReader(f, delimiter='\t')}
+
+before = load(sys.argv[1])
+after = load(sys.argv[2])
+
+keys = sorted(key for key in before if key in after)
+width = max([len(binary) for binary, _ in keys] + [6])
+print('%-*s %-8s %13s %13s %7s' % (width, 'binary', 'explorer', 'before/s',
+                                   'after/s', 'ratio'))
+log_ratios = []
+for key in keys:
+    ratio = after[key] / before[key] if before[key] > 0 else float('nan')
+    if before[key] > 0 and after[key] > 0:
+        log_ratios.append(math.log(ratio))
+    print('%-*s %-8s %13.1f %13.1f %7.2f' % (width, key[0], key[1],
+                                             before[key], after[key], ratio))
+if log_ratios:
+    print('geometric mean ratio: %.2f' %
+          math.exp(sum(log_ratios) / len(log_ratios)))
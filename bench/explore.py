@@ -0,0 +1,119 @@
+# Runs every explorer over built test binaries with a fixed budget, and
+# prints a table of runs/s, transitions/s, the first run that found a bug, the
+# seconds it took to and the peak RSS of each combination. With --repeat=N
+# each combination runs N times and the table holds the median of each
+# column, to keep the noise of one run out of comparisons. With --tsv the
+# table is also written as tab-separated values, for comparing before and
+# after a change, see bench/compare.py and bench/regress.py, or runs with
+# and without the flags given with --flags, separated by spaces.
+#
+# usage: python bench/explore.py [--explorers=dpor,...] [--max-runs=N]
+#            [--max-seconds=S] [--repeat=N] [--flags=FLAGS] [--tsv=FILE]
+#            binary...
+#
+# make benchmark builds every case in cases/ and runs this over them.
+
+import json
+import os
+import subprocess
+import sys
+import time
+
+explorers = ['dpor', 'cbdpor', 'pbpor', 'chess', 'delay', 'pct']
+max_runs = 20000
+max_seconds = 60
+repeat = 1
+tsv = None
+flags = []
+binaries = []
+
+for arg in sys.argv[1:]:
+    if arg.startswith('--explorers='):
+        explorers = arg.split('=', 1)[1].split(',')
+    elif arg.startswith('--max-runs='):
+        max_runs = int(arg.split('=', 1)[1])
+    elif arg.startswith('--max-seconds='):
+        max_seconds = float(arg.split('=', 1)[1])
+    elif arg.startswith('--repeat='):
+        repeat = int(arg.split('=', 1)[1])
+    elif arg.startswith('--flags='):
+        flags = arg.split('=', 1)[1].split()
+    elif arg.startswith('--tsv='):
+        tsv = arg.split('=', 1)[1]
+    else:
+        binaries.append(arg)
+
+if not binaries:
+    print('usage: python bench/explore.py [--explorers=dpor,...] '
+          '[--max-runs=N] [--max-seconds=S] [--repeat=N] [--flags=FLAGS] '
+          '[--tsv=FILE] binary...',
+          file=sys.stderr)
+    sys.exit(1)
+
+def run(binary, explorer):
+    # The last line of the statistics stream holds the final statistics.
+    read_fd, write_fd = os.pipe()
+    command = [binary, '--explorer=' + explorer,
+               '--max-runs=%d' % max_runs, '--max-seconds=%g' % max_seconds,
+               '--stats-fd=%d' % write_fd, '--stats-interval=1e9'] + flags
+    start = time.time()
+    with open(os.devnull, 'w') as devnull:
+        process = subprocess.Popen(command, stderr=devnull, stdout=devnull,
+                                   pass_fds=(write_fd,))
+    os.close(write_fd)
+    with os.fdopen(read_fd) as stream:
+        lines = stream.read().splitlines()
+    _, status, usage = os.wait4(process.pid, 0)
+    seconds = time.time() - start
+
+    statistics = json.loads(lines[-1])['statistics'] if lines else {}
+    runs = statistics.get('runs', 0)
+    transitions = statistics.get('transitions', 0)
+    return {
+        'binary': os.path.basename(binary),
+        'explorer': explorer,
+        'status': os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1,
+        'seconds': seconds,
+        'runs': runs,
+        'runs/s': runs / seconds,
+        'transitions/s': transitions / seconds,
+        'first_found': statistics.get('first_found', -1),
+        'first-found-seconds': statistics.get('first-found-seconds', 0.0),
+        'peak-rss-mb': usage.ru_maxrss / 1024.0,
+    }
+
+# The median of each measure over repeated runs, each taken on its own.
+def run_repeatedly(binary, explorer):
+    results = [run(binary, explorer) for _ in range(repeat)]
+    median = dict(results[0])
+    for column in median:
+        if column not in ('binary', 'explorer'):
+            values = sorted(result[column] for result in results)
+            median[column] = values[len(values) // 2]
+    return median
+
+columns = ['binary', 'explorer', 'status', 'seconds', 'runs', 'runs/s',
+           'transitions/s', 'first_found', 'first-found-seconds',
+           'peak-rss-mb']
+
+def format_value(value):
+    return '%.1f' % value if isinstance(value, float) else str(value)
+
+results = []
+width = max(len(os.path.basename(binary)) for binary in binaries)
+print('%-*s %-8s %6s %8s %8s %10s %13s %11s %19s %11s' % ((width,) +
+      tuple(columns)))
+for binary in binaries:
+    for explorer in explorers:
+        result = run_repeatedly(binary, explorer)
+        results.append(result)
+        print('%-*s %-8s %6s %8s %8s %10s %13s %11s %19s %11s' % ((width,) +
+              tuple(format_value(result[column]) for column in columns)))
+        sys.stdout.flush()
+
+if tsv is not None:
+    with open(tsv, 'w') as f:
+        f.write('\t'.join(columns) + '\n')
+        for result in results:
+            f.write('\t'.join(format_value(result[column])
+                              for column in columns) + '\n')
@@ -0,0 +1,132 @@
+# Runs explorers over the cases that partial-order reduction finds hard, see
+# the por_* cases of generator.py, and measures how far each is from an
+# optimal one: the runs it takes against the number of Mazurkiewicz traces of
+# the case, which an optimal explorer runs once each, and what each run costs
+# as the cases grow. The traces follow from the name of each case: a breaker
+# of n waiters and m workers has 2^m - 1 traces where the watcher misses a
+# worker, plus 2^n where it sets done, n writers have n!, and n overwriters,
+# which store twice each, (2n)!/2^n. Searches that finish must count as many
+# distinct traces; a mismatch is flagged, as a sound explorer misses none and
+# no explorer can find more.
+#
+# The reads-from explorer is measured against the reads-from traces instead,
+# n for n writers or overwriters, as only the last store tells them apart.
+# Its runs are Mazurkiewicz traces of their own, so a search of it that
+# finishes is only flagged if it counts fewer distinct traces than that.
+#
+# usage: python bench/por.py [--explorers=dpor,...] [--max-seconds=S]
+#            [--tsv=FILE] binary...
+#
+# make benchmark-por builds the cases and runs this over them.
+
+import json
+import math
+import os
+import re
+import subprocess
+import sys
+import time
+
+explorers = ['dpor', 'reads-from', 'cbdpor', 'source-bpor', 'pbpor',
+             'chess']
+max_seconds = 60
+tsv = None
+binaries = []
+
+for arg in sys.argv[1:]:
+    if arg.startswith('--explorers='):
+        explorers = arg.split('=', 1)[1].split(',')
+    elif arg.startswith('--max-seconds='):
+        max_seconds = float(arg.split('=', 1)[1])
+    elif arg.startswith('--tsv='):
+        tsv = arg.split('=', 1)[1]
+    else:
+        binaries.append(arg)
+
+if not binaries:
+    print('usage: python bench/por.py [--explorers=dpor,...] '
+          '[--max-seconds=S] [--tsv=FILE] binary...',
+          file=sys.stderr)
+    sys.exit(1)
+
+def expected_traces(binary, explorer):
+    name = os.path.basename(binary)
+    match = re.match(r'por_(over)?writers_(\d+)$', name)
+    if match and explorer == 'reads-from':
+        return int(match.group(2))
+    elif explorer == 'reads-from':
+        return None
+    match = re.match(r'por_breaker_(\d+)x(\d+)$', name)
+    if match:
+        n, m = int(match.group(1)), int(match.group(2))
+        return 2 ** m - 1 + 2 ** n
+    match = re.match(r'por_writers_(\d+)$', name)
+    if match:
+        return math.factorial(int(match.group(1)))
+    match = re.match(r'por_overwriters_(\d+)$', name)
+    if match:
+        n = int(match.group(1))
+        return math.factorial(2 * n) // 2 ** n
+    return None
+
+def run(binary, explorer):
+    read_fd, write_fd = os.pipe()
+    command = [os.path.abspath(binary), '--explorer=' + explorer,
+               '--max-seconds=%g' % max_seconds,
+               '--stats-fd=%d' % write_fd, '--stats-interval=1e9']
+    start = time.time()
+    with open(os.devnull, 'w') as devnull:
+        process = subprocess.Popen(command, stderr=devnull, stdout=devnull,
+                                   pass_fds=(write_fd,))
+    os.close(write_fd)
+    with os.fdopen(read_fd) as stream:
+        lines = stream.read().splitlines()
+    status = process.wait()
+    seconds = time.time() - start
+
+    statistics = json.loads(lines[-1])['statistics'] if lines else {}
+    runs = statistics.get('runs', 0)
+    distinct = statistics.get('distinct', 0)
+    expected = expected_traces(binary, explorer)
+    # out-of-budget is only streamed once set.
+    complete = status == 0 and not statistics.get('out-of-budget', False)
+    return {
+        'binary': os.path.basename(binary),
+        'explorer': explorer,
+        'complete': complete,
+        'traces': expected,
+        'runs': runs,
+        'distinct': distinct,
+        'redundancy': runs / float(expected) if expected else 0.0,
+        'us/run': 1e6 * seconds / runs if runs else 0.0,
+        'wrong': complete and expected is not None and
+                 (distinct < expected if explorer == 'reads-from' else
+                  distinct != expected),
+    }
+
+columns = ['binary', 'explorer', 'complete', 'traces', 'runs', 'distinct',
+           'redundancy', 'us/run']
+
+def format_value(value):
+    if isinstance(value, float):
+        return '%.2f' % value
+    return str(value)
+
+results = []
+print('\t'.join(columns))
+for binary in binaries:
+    for explorer in explorers:
+        result = run(binary, explorer)
+        results.append(result)
+        print('\t'.join(format_value(result[column]) for column in columns) +
+              ('\tWRONG' if result['wrong'] else ''))
+        sys.stdout.flush()
+
+if tsv is not None:
+    with open(tsv, 'w') as f:
+        f.write('\t'.join(columns) + '\n')
+        for result in results:
+            f.write('\t'.join(format_value(result[column])
+                              for column in columns) + '\n')
+
+sys.exit(1 if any(result['wrong'] for result in results) else 0)
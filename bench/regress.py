@@ -0,0 +1,82 @@
+# Compares a table written by bench/explore.py --tsv against a stored
+# baseline of the same cases, and flags every binary and explorer whose
+# runs/s or transitions/s dropped, or whose seconds to the first bug or peak
+# RSS grew, by more than --threshold, a fraction of the baseline. Measures
+# too small to compare, under a tenth of a second or a megabyte, are never
+# flagged, nor are cases missing from either table; a case that found a bug
+# in the baseline and no longer does always is. Exits with 1 if any was
+# flagged.
+#
+# usage: python bench/regress.py [--threshold=0.1] baseline.tsv current.tsv
+#
+# make benchmark-regress runs the benchmark and this over it, and make
+# benchmark-baseline stores a new baseline.
+
+import csv
+import sys
+
+threshold = 0.1
+tables = []
+
+for arg in sys.argv[1:]:
+    if arg.startswith('--threshold='):
+        threshold = float(arg.split('=', 1)[1])
+    else:
+        tables.append(arg)
+
+if len(tables) != 2:
+    print('usage: python bench/regress.py [--threshold=0.1] baseline.tsv '
+          'current.tsv', file=sys.stderr)
+    sys.exit(1)
+
+# Each measure, whether more of it is better, and the least of it that is
+# not noise.
+measures = [
+    ('runs/s', True, 0.0),
+    ('transitions/s', True, 0.0),
+    ('first-found-seconds', False, 0.1),
+    ('peak-rss-mb', False, 1.0),
+]
+
+def load(path):
+    with open(path) as f:
+        return {(row['binary'], row['explorer']): row
+                for row in csv.DictReader(f, delimiter='\t')}
+
+def found(row):
+    return int(row.get('first_found', -1)) >= 0
+
+baseline = load(tables[0])
+current = load(tables[1])
+
+keys = sorted(key for key in baseline if key in current)
+width = max([len(binary) for binary, _ in keys] + [6])
+print('%-*s %-8s %-19s %13s %13s %7s' % (width, 'binary', 'explorer',
+                                         'measure', 'baseline', 'current',
+                                         'ratio'))
+regressions = 0
+for key in keys:
+    before, after = baseline[key], current[key]
+    if found(before) and not found(after):
+        regressions += 1
+        print('%-*s %-8s no longer finds its bug' % (width, key[0], key[1]))
+        continue
+    for measure, higher_is_better, floor in measures:
+        if measure not in before or measure not in after:
+            continue
+        if measure == 'first-found-seconds' and not found(before):
+            continue
+        old, new = float(before[measure]), float(after[measure])
+        if max(old, new) <= floor or old <= 0:
+            continue
+        ratio = new / old
+        worse = ratio < 1 - threshold if higher_is_better else \
+            ratio > 1 + threshold
+        if worse:
+            regressions += 1
+            print('%-*s %-8s %-19s %13.1f %13.1f %7.2f' % (width, key[0],
+                  key[1], measure, old, new, ratio))
+
+print('%d cases compared, %d regressions beyond %g%%' % (len(keys),
+      regressions, 100 * threshold))
+sys.exit(1 if regressions else 0)
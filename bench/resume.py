@@ -0,0 +1,106 @@
+# Checks that searches sliced by --max-runs and resumed from the frontier
+# each slice saves cover the same distinct traces as one search does: for
+# each explorer, a binary is searched once in full and once in slices of
+# --slice runs, each --save-frontier one resumed by the next until a slice
+# no longer runs out of budget, and the hashes their --coverage-file got are
+# compared. Bugs do not stop either search. Exits with 1 if any explorer
+# missed or added a trace.
+#
+# usage: python bench/resume.py [--explorers=pbpor,cbdpor,chess,delay]
+#            [--slice=50] [--max-slices=1000] binary...
+#
+# make check-resume runs this over a few tests.
+
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+explorers = ['pbpor', 'cbdpor', 'chess', 'delay']
+slice_runs = 50
+max_slices = 1000
+binaries = []
+
+for arg in sys.argv[1:]:
+    if arg.startswith('--explorers='):
+        explorers = arg.split('=', 1)[1].split(',')
+    elif arg.startswith('--slice='):
+        slice_runs = int(arg.split('=', 1)[1])
+    elif arg.startswith('--max-slices='):
+        max_slices = int(arg.split('=', 1)[1])
+    else:
+        binaries.append(arg)
+
+if not binaries:
+    print('usage: python bench/resume.py [--explorers=pbpor,cbdpor,chess,'
+          'delay] [--slice=50] [--max-slices=1000] binary...',
+          file=sys.stderr)
+    sys.exit(1)
+
+def search(binary, explorer, directory, flags):
+    """Runs one search and returns its final statistics."""
+    read_fd, write_fd = os.pipe()
+    command = [os.path.abspath(binary), '--explorer=' + explorer,
+               '--stats-fd=%d' % write_fd, '--stats-interval=1e9'] + flags
+    with open(os.devnull, 'w') as devnull:
+        process = subprocess.Popen(command, cwd=directory, stderr=devnull,
+                                   stdout=devnull, pass_fds=(write_fd,))
+    os.close(write_fd)
+    with os.fdopen(read_fd) as stream:
+        lines = stream.read().splitlines()
+    if process.wait() != 0 or not lines:
+        return None
+    return json.loads(lines[-1])['statistics']
+
+def hashes(path):
+    if not os.path.exists(path):
+        return set()
+    with open(path, 'rb') as f:
+        data = f.read()
+    return set(data[i:i + 8] for i in range(0, len(data), 8))
+
+failures = 0
+for binary in binaries:
+    for explorer in explorers:
+        with tempfile.TemporaryDirectory() as directory:
+            whole = os.path.join(directory, 'whole')
+            sliced = os.path.join(directory, 'sliced')
+            frontier = os.path.join(directory, 'frontier')
+            problem = None
+            if search(binary, explorer, directory,
+                      ['--coverage-file=' + whole]) is None:
+                problem = 'the whole search failed'
+            slices = 0
+            while problem is None:
+                flags = ['--coverage-file=' + sliced,
+                         '--max-runs=%d' % slice_runs,
+                         '--save-frontier=' + frontier + '.new']
+                if slices:
+                    flags.append('--resume=' + frontier)
+                statistics = search(binary, explorer, directory, flags)
+                slices += 1
+                if statistics is None:
+                    problem = 'slice %d failed' % slices
+                elif not statistics.get('out-of-budget', True):
+                    break
+                elif not os.path.exists(frontier + '.new'):
+                    problem = 'slice %d saved no frontier' % slices
+                elif slices == max_slices:
+                    problem = 'still out of budget after %d slices' % slices
+                else:
+                    os.replace(frontier + '.new', frontier)
+            if problem is None:
+                expected, covered = hashes(whole), hashes(sliced)
+                if expected != covered:
+                    problem = '%d traces missed, %d added' % (
+                        len(expected - covered), len(covered - expected))
+            name = os.path.basename(binary)
+            if problem is None:
+                print('%s %s: %d traces in %d slices' % (name, explorer,
+                      len(expected), slices))
+            else:
+                failures += 1
+                print('%s %s: %s' % (name, explorer, problem))
+
+sys.exit(1 if failures else 0)
@@ -0,0 +1,273 @@
+// Measures the core data structures of the runtime in isolation, on
+// synthetic inputs of the sizes real searches see: ClockVector::Maximize,
+// HashTable::operator[], ThreadSet operations, HHBHistory::AddTransition with
+// its hashing, and Linearizability's search. Scheduler::SwitchTo has
+// bench/switch.cc.
+//
+// usage: bench-structures [name...]
+//
+// runs the benchmarks whose names start with one of the names given, or all
+// of them, and prints the time each operation took. Thread counts go up to
+// the kMaxThreads of the build, so build with MAX_THREADS=64 to measure 64
+// threads.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "clockvector.h"
+#include "hashtable.h"
+#include "hhbhistory.h"
+#include "linearizability.h"
+#include "threadset.h"
+#include "transition.h"
+
+// The runtime entry points that the benchmarked code refers to, but that
+// the benchmarks never reach, as nothing runs in program threads.
+class PredictableAlloc;
+PredictableAlloc* GetPredictableAlloc() { abort(); }
+bool record_allocation_sites = false;
+int linearizability_workers = 1;
+int stress_repeat = 1;
+std::string workload;
+bool commuting_adds = false;
+std::string hb_graph_format;
+void Found() { abort(); }
+bool RunningNatively() { return false; }
+int ThreadId() { abort(); }
+void Annotate(int) { abort(); }
+void Annotate(int, int64_t) { abort(); }
+ClockVector GetClockVector(int) { abort(); }
+void RunTransparently(const std::function<void()>&) { abort(); }
+void BeginOperationStep(int) { abort(); }
+void EndOperationStep() { abort(); }
+int InternAnnotation(const std::string&) { return 0; }
+
+static std::vector<std::string> selected;
+static std::mt19937_64 prng(1);
+
+// Runs body, which makes ops operations, until a tenth of a second has
+// passed, and prints the time per operation if name was selected.
+static void Measure(const std::string& name, int64_t ops,
+    const std::function<void()>& body) {
+  bool run = selected.empty();
+  for (const std::string& prefix : selected) {
+    run |= name.compare(0, prefix.size(), prefix) == 0;
+  }
+  if (!run) {
+    return;
+  }
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  int64_t rounds = 0;
+  std::chrono::duration<double> elapsed;
+  do {
+    body();
+    rounds++;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < 0.1);
+  printf("%-44s %12.1f ns/op\n", name.c_str(),
+      elapsed.count() * 1e9 / (rounds * ops));
+}
+
+// Sizes from 2 up to kMaxThreads, doubling.
+static std::vector<int> ThreadCounts() {
+  std::vector<int> counts;
+  for (int threads = 2; threads < kMaxThreads; threads *= 2) {
+    counts.push_back(threads);
+  }
+  counts.push_back(kMaxThreads);
+  return counts;
+}
+
+static void BenchmarkClockVectors() {
+  std::vector<ClockVector> cvs(1024);
+  for (ClockVector& cv : cvs) {
+    for (int thread = 0; thread < kMaxThreads; thread++) {
+      cv[thread] = prng() % 100000;
+    }
+  }
+  ClockVector max;
+  Measure("clockvector-maximize", cvs.size(), [&]() {
+    for (const ClockVector& cv : cvs) {
+      max.Maximize(cv);
+    }
+  });
+  int after = 0;
+  Measure("clockvector-happens-after-any", cvs.size(), [&]() {
+    for (size_t i = 1; i < cvs.size(); i++) {
+      after += cvs[i].happens_after_any(cvs[i - 1]);
+    }
+  });
+  if (max[0] < 0 || after < 0) {
+    printf("\n");
+  }
+}
+
+struct Counter {
+  int64_t value;
+  void Reset() {
+    value = 0;
+  }
+};
+
+static void BenchmarkHashTable() {
+  for (int size = 100; size <= 100000; size *= 10) {
+    std::vector<intptr_t> addresses(size);
+    for (intptr_t& address : addresses) {
+      address = (prng() % (1 << 30)) * 8;
+    }
+    HashTable<Counter> table;
+    Measure("hashtable-insert/" + std::to_string(size), size, [&]() {
+      table.Reset();
+      for (intptr_t address : addresses) {
+        table[address].value++;
+      }
+    });
+    Measure("hashtable-lookup/" + std::to_string(size), size, [&]() {
+      for (intptr_t address : addresses) {
+        table[address].value++;
+      }
+    });
+  }
+}
+
+static void BenchmarkThreadSets() {
+  for (int threads : ThreadCounts()) {
+    std::vector<ThreadSet> sets(1024);
+    for (ThreadSet& set : sets) {
+      for (int thread = 0; thread < threads; thread++) {
+        if (prng() % 2) {
+          set.insert(thread);
+        }
+      }
+    }
+    int64_t sum = 0;
+    std::string suffix = "/" + std::to_string(threads);
+    Measure("threadset-set-ops" + suffix, sets.size(), [&]() {
+      for (size_t i = 1; i < sets.size(); i++) {
+        ThreadSet set = (sets[i] - sets[i - 1]) | (sets[i] & sets[i - 1]);
+        sum += set.size() + set.count(threads - 1);
+      }
+    });
+    Measure("threadset-iterate" + suffix, sets.size(), [&]() {
+      for (const ThreadSet& set : sets) {
+        for (int thread : set) {
+          sum += thread;
+        }
+      }
+    });
+    if (sum < 0) {
+      printf("\n");
+    }
+  }
+}
+
+static void BenchmarkHistory() {
+  // Accesses go to a few hot locations and many cold ones, as in a data
+  // structure with a head and its nodes.
+  std::vector<int64_t> memory(4096);
+  for (int threads : ThreadCounts()) {
+    for (int steps = 100; steps <= 100000; steps *= 10) {
+      std::vector<std::pair<int, Transition>> run;
+      for (int step = 0; step < steps; step++) {
+        int64_t* address = prng() % 4 == 0 ?
+            &memory[prng() % 8] : &memory[prng() % memory.size()];
+        TransitionType type = prng() % 3 == 0 ?
+            TransitionType::WRITE : TransitionType::READ;
+        run.push_back(std::make_pair(prng() % threads,
+            Transition(type, reinterpret_cast<int8_t*>(address), 8,
+              static_cast<int64_t>(step), 0, MemoryOrder::SEQ_CST)));
+      }
+      HHBHistory history;
+      std::string suffix =
+          "/" + std::to_string(threads) + "x" + std::to_string(steps);
+      Measure("hhbhistory-add-transition" + suffix, steps, [&]() {
+        history.Reset();
+        for (const std::pair<int, Transition>& step : run) {
+          history.AddTransition(step.first, step.second);
+        }
+      });
+    }
+  }
+}
+
+// Threads increment a shared counter, each increment taking effect at some
+// point between its start and its end, so the histories are linearizable.
+static int model_counter;
+
+static void BenchmarkLinearizability() {
+  for (int threads : ThreadCounts()) {
+    for (int ops = 4; ops <= 64 && threads * ops <= 256; ops *= 4) {
+      Linearizability checker(threads);
+      checker.RegisterModel([]() { model_counter = 0; }, []() {});
+      checker.RegisterModelHash([]() {
+        return static_cast<uint64_t>(model_counter);
+      });
+      for (int thread = 0; thread < threads; thread++) {
+        for (int op = 0; op < ops; op++) {
+          checker.AddStep(thread, []() { return model_counter++; }, "inc");
+        }
+      }
+
+      // Each operation is started, takes effect and ends in steps of its
+      // thread, which interleave at random.
+      std::vector<Ordering> history;
+      std::vector<int> next(threads, 0), phase(threads, 0), current(threads);
+      ClockVector now;
+      int counter = 0, completions = 0, step = 0;
+      for (int left = threads * ops * 3; left > 0; left--) {
+        int thread;
+        do {
+          thread = prng() % threads;
+        } while (next[thread] == ops);
+        now[thread] = step++;
+        if (phase[thread] == 0) {
+          current[thread] = history.size();
+          history.push_back(Ordering());
+          Ordering& o = history.back();
+          o.thread = o.actual_thread = thread;
+          o.function = next[thread];
+          o.start_cv = now;
+          o.executed = false;
+          o.completion = -1;
+          o.completions_at_start = completions;
+        } else if (phase[thread] == 1) {
+          history[current[thread]].result = counter++;
+        } else {
+          Ordering& o = history[current[thread]];
+          o.end_cv = now;
+          o.completion = completions++;
+          next[thread]++;
+        }
+        phase[thread] = (phase[thread] + 1) % 3;
+      }
+
+      std::string suffix =
+          "/" + std::to_string(threads) + "x" + std::to_string(ops);
+      Measure("linearizability-check" + suffix, 1, [&]() {
+        if (!checker.CheckHistory(history)) {
+          fprintf(stderr, "synthetic history not linearizable\n");
+          exit(1);
+        }
+      });
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    selected.push_back(argv[i]);
+  }
+  BenchmarkClockVectors();
+  BenchmarkHashTable();
+  BenchmarkThreadSets();
+  BenchmarkHistory();
+  BenchmarkLinearizability();
+  return 0;
+}
@@ -0,0 +1,192 @@
+# Runs built tests and cases in parallel, each with its own budget, and checks
+# each against the verdict its name implies: cases named *_bug_* have to find
+# a bug, and *_rand_* cases must not. Programs stop at their first bug, which
+# settles the verdict. Other programs are only reported. The
+# results are printed in the order the binaries were given, whichever
+# finishes first, and with --json the final statistics of every program are
+# written out as well. Exits with 1 if any verdict was not as expected.
+#
+# With --cache=DIR, the outcome of each program is kept in DIR under the
+# SHA-256 of its binary, which covers the tested code as intercepted as well
+# as the runtime, so that a later run over an unchanged binary with the same
+# explorer does not explore it again: a program whose search finished, or
+# that found a bug, is reported as it was, and one that ran out of budget
+# resumes from the frontier it saved (see frontier.h), if its explorer saves
+# one, with a budget of its own, so that searches too large for one run
+# progress from run to run. A
+# changed binary starts over, as its interleavings at the bounds explored
+# before are not covered by the old ones.
+#
+# usage: python bench/suite.py [--explorer=cbdpor] [--max-runs=N]
+#            [--max-seconds=S] [--jobs=N] [--json=FILE] [--cache=DIR]
+#            binary...
+#
+# make check builds every test and case and runs this over them.
+
+import concurrent.futures
+import hashlib
+import json
+import os
+import subprocess
+import sys
+import time
+
+explorer = 'cbdpor'
+max_runs = 0
+max_seconds = 300
+jobs = os.cpu_count() or 1
+json_file = None
+cache = None
+binaries = []
+
+for arg in sys.argv[1:]:
+    if arg.startswith('--explorer='):
+        explorer = arg.split('=', 1)[1]
+    elif arg.startswith('--max-runs='):
+        max_runs = int(arg.split('=', 1)[1])
+    elif arg.startswith('--max-seconds='):
+        max_seconds = float(arg.split('=', 1)[1])
+    elif arg.startswith('--jobs='):
+        jobs = int(arg.split('=', 1)[1])
+    elif arg.startswith('--json='):
+        json_file = arg.split('=', 1)[1]
+    elif arg.startswith('--cache='):
+        cache = os.path.abspath(arg.split('=', 1)[1])
+    else:
+        binaries.append(arg)
+
+if not binaries:
+    print('usage: python bench/suite.py [--explorer=cbdpor] [--max-runs=N] '
+          '[--max-seconds=S] [--jobs=N] [--json=FILE] [--cache=DIR] '
+          'binary...',
+          file=sys.stderr)
+    sys.exit(1)
+
+if cache is not None and not os.path.isdir(cache):
+    os.makedirs(cache)
+
+def expected_verdict(binary):
+    name = os.path.basename(binary)
+    if '_bug' in name:
+        return 'bug'
+    elif '_rand_' in name:
+        return 'ok'
+    return None
+
+def fingerprint(binary):
+    digest = hashlib.sha256()
+    with open(binary, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+def load_entry(path, key):
+    try:
+        with open(path) as f:
+            entry = json.load(f)
+    except (OSError, ValueError):
+        return None
+    return entry if entry.get('key') == key else None
+
+def run(binary):
+    # Each program runs in a directory of its own, as they dump their traces
+    # to the working directory.
+    directory = os.path.abspath(binary) + '.suite'
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+    expected = expected_verdict(binary)
+
+    entry = None
+    if cache is not None:
+        name = os.path.basename(binary)
+        key = '%s %s' % (fingerprint(binary), explorer)
+        entry_file = os.path.join(cache, name + '.json')
+        frontier_file = os.path.join(cache, name + '.frontier')
+        entry = load_entry(entry_file, key)
+        if entry is not None and (entry['complete'] or
+                                  entry['verdict'] == 'bug'):
+            return {
+                'binary': name,
+                'status': 0,
+                'seconds': 0.0,
+                'verdict': entry['verdict'],
+                'expected': expected,
+                'passed': expected is None or entry['verdict'] == expected,
+                'statistics': entry['statistics'],
+                'cached': True,
+            }
+
+    read_fd, write_fd = os.pipe()
+    command = [os.path.abspath(binary), '--explorer=' + explorer,
+               '--max-runs=%d' % max_runs, '--max-seconds=%g' % max_seconds,
+               '--stop-on-bug', '--stats-fd=%d' % write_fd,
+               '--stats-interval=1e9']
+    if cache is not None:
+        saved_file = frontier_file + '.new'
+        if os.path.exists(saved_file):
+            os.remove(saved_file)
+        command.append('--save-frontier=' + saved_file)
+        if entry is not None and os.path.exists(frontier_file):
+            command.append('--resume=' + frontier_file)
+    start = time.time()
+    with open(os.devnull, 'w') as devnull:
+        process = subprocess.Popen(command, cwd=directory, stderr=devnull,
+                                   stdout=devnull, pass_fds=(write_fd,))
+    os.close(write_fd)
+    with os.fdopen(read_fd) as stream:
+        lines = stream.read().splitlines()
+    status = process.wait()
+    seconds = time.time() - start
+
+    statistics = json.loads(lines[-1])['statistics'] if lines else {}
+    verdict = 'bug' if statistics.get('found', 0) > 0 else 'ok'
+    if status != 0:
+        verdict = 'crash'
+
+    # Searches that ran out of budget save a frontier if their explorer can
+    # resume, and otherwise start over. Crashes are not kept, so that they
+    # are run again.
+    if cache is not None and status == 0:
+        complete = not statistics.get('out-of-budget', True)
+        if os.path.exists(saved_file):
+            os.replace(saved_file, frontier_file)
+        elif os.path.exists(frontier_file):
+            os.remove(frontier_file)
+        with open(entry_file + '.new', 'w') as f:
+            json.dump({'key': key, 'complete': complete, 'verdict': verdict,
+                       'statistics': statistics}, f, sort_keys=True)
+        os.replace(entry_file + '.new', entry_file)
+
+    return {
+        'binary': os.path.basename(binary),
+        'status': status,
+        'seconds': seconds,
+        'verdict': verdict,
+        'expected': expected,
+        'passed': expected is None or verdict == expected,
+        'statistics': statistics,
+        'cached': False,
+    }
+
+with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as executor:
+    futures = [executor.submit(run, binary) for binary in binaries]
+    results = []
+    width = max(len(os.path.basename(binary)) for binary in binaries)
+    for future in futures:
+        result = future.result()
+        results.append(result)
+        print('%-*s %-6s %-8s %8.1fs %10s runs %s%s' % (width,
+              result['binary'], result['verdict'], result['expected'] or '-',
+              result['seconds'], result['statistics'].get('runs', 0),
+              'cached ' if result['cached'] else '',
+              '' if result['passed'] else 'FAILED'))
+        sys.stdout.flush()
+
+failed = [result['binary'] for result in results if not result['passed']]
+print('%d of %d passed' % (len(results) - len(failed), len(results)))
+
+if json_file is not None:
+    with open(json_file, 'w') as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+sys.exit(1 if failed else 0)
@@ -0,0 +1,39 @@
+// Measures how many context switches per second Scheduler::SwitchTo makes,
+// by bouncing between the original thread and one program thread.
+//
+// usage: bench-switch [switches] [preserve-fpu]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "scheduler.h"
+
+static Scheduler* scheduler;
+
+static void Bounce(void*, int) {
+  while (true) {
+    scheduler->SwitchTo(Scheduler::kOriginalThread);
+  }
+}
+
+int main(int argc, char** argv) {
+  long long switches = argc > 1 ? atoll(argv[1]) : 10000000;
+  bool preserve_fpu = argc > 2 && atoi(argv[2]) != 0;
+
+  scheduler = new Scheduler(64 * 1024, preserve_fpu, false, &Bounce, nullptr);
+  scheduler->AddThread(0);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long long i = 0; i < switches / 2; i++) {
+    scheduler->SwitchTo(0);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  printf("%lld switches in %.3f s: %.1f million switches/s%s\n",
+      switches / 2 * 2, elapsed.count(),
+      switches / 2 * 2 / elapsed.count() / 1e6,
+      preserve_fpu ? " (preserving fpu state)" : "");
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include "helper.h"
 #include "linearizability.h"
+#include "reference_model.h"
 
 #include <cds/container/treiber_stack.h>
 #include <cds/container/basket_queue.h>
@@ -37,6 +38,8 @@ namespace cds {
 
 Linearizability linearizability(3);
 cds::container::LazyList<cds::gc::HP, int>* ds;
+// Runs in place of ds when linearizing, uninstrumented.
+SetModel model;
 
 void Create() {
   ds = new cds::container::LazyList<cds::gc::HP, int>();
@@ -49,16 +52,16 @@ void Destroy() {
 struct Configure {
   Configure() {
     linearizability.RegisterImplementation(&Create, &Destroy);
-    linearizability.RegisterModel(&Create, &Destroy);
-    linearizability.AddStep(0, []() { return ds->erase(1); }, "return ds->erase(1);");
-    linearizability.AddStep(0, []() { return ds->empty(); }, "return ds->empty();");
-    linearizability.AddStep(0, []() { return ds->empty(); }, "return ds->empty();");
-    linearizability.AddStep(1, []() { return ds->find(1); }, "return ds->find(1);");
-    linearizability.AddStep(1, []() { return ds->empty(); }, "return ds->empty();");
-    linearizability.AddStep(1, []() { return ds->find(1); }, "return ds->find(1);");
-    linearizability.AddStep(2, []() { ds->insert(1); return 0; }, "ds->insert(1); return 0;");
-    linearizability.AddStep(2, []() { ds->insert(1); return 0; }, "ds->insert(1); return 0;");
-    linearizability.AddStep(2, []() { return ds->erase(1); }, "return ds->erase(1);");
+    model.Register(linearizability);
+    linearizability.AddStep(0, [](int) -> int { return ds->erase(1); }, [](int) -> int { return model.erase(1); }, 0, "return ds->erase(1);");
+    linearizability.AddStep(0, [](int) -> int { return ds->empty(); }, [](int) -> int { return model.empty(); }, 0, "return ds->empty();");
+    linearizability.AddStep(0, [](int) -> int { return ds->empty(); }, [](int) -> int { return model.empty(); }, 0, "return ds->empty();");
+    linearizability.AddStep(1, [](int) -> int { return ds->find(1); }, [](int) -> int { return model.find(1); }, 0, "return ds->find(1);");
+    linearizability.AddStep(1, [](int) -> int { return ds->empty(); }, [](int) -> int { return model.empty(); }, 0, "return ds->empty();");
+    linearizability.AddStep(1, [](int) -> int { return ds->find(1); }, [](int) -> int { return model.find(1); }, 0, "return ds->find(1);");
+    linearizability.AddStep(2, [](int) -> int { ds->insert(1); return 0; }, [](int) -> int { model.insert(1); return 0; }, 0, "ds->insert(1); return 0;");
+    linearizability.AddStep(2, [](int) -> int { ds->insert(1); return 0; }, [](int) -> int { model.insert(1); return 0; }, 0, "ds->insert(1); return 0;");
+    linearizability.AddStep(2, [](int) -> int { return ds->erase(1); }, [](int) -> int { return model.erase(1); }, 0, "return ds->erase(1);");
   }
 };
 
@@ -1,5 +1,6 @@
 #include "helper.h"
 #include "linearizability.h"
+#include "reference_model.h"
 
 #include <cds/container/treiber_stack.h>
 #include <cds/container/basket_queue.h>
@@ -37,6 +38,8 @@ namespace cds {
 
 Linearizability linearizability(5);
 cds::container::MoirQueue<cds::gc::HP, int>* ds;
+// Runs in place of ds when linearizing, uninstrumented.
+QueueModel model;
 
 void Create() {
   ds = new cds::container::MoirQueue<cds::gc::HP, int>();
@@ -49,12 +52,12 @@ void Destroy() {
 struct Configure {
   Configure() {
     linearizability.RegisterImplementation(&Create, &Destroy);
-    linearizability.RegisterModel(&Create, &Destroy);
-    linearizability.AddStep(0, []() { ds->enqueue(49865); return 0; }, "ds->enqueue(49865); return 0;");
-    linearizability.AddStep(1, []() { ds->enqueue(67007); return 0; }, "ds->enqueue(67007); return 0;");
-    linearizability.AddStep(2, []() { ds->enqueue(20199); return 0; }, "ds->enqueue(20199); return 0;");
-    linearizability.AddStep(3, []() { int x; return ds->dequeue(x) ? x : -1; }, "int x; return ds->dequeue(x) ? x : -1;");
-    linearizability.AddStep(4, []() { int x; return ds->dequeue(x) ? x : -1; }, "int x; return ds->dequeue(x) ? x : -1;");
+    model.Register(linearizability);
+    linearizability.AddStep(0, [](int) -> int { ds->enqueue(49865); return 0; }, [](int) -> int { model.enqueue(49865); return 0; }, 0, "ds->enqueue(49865); return 0;");
+    linearizability.AddStep(1, [](int) -> int { ds->enqueue(67007); return 0; }, [](int) -> int { model.enqueue(67007); return 0; }, 0, "ds->enqueue(67007); return 0;");
+    linearizability.AddStep(2, [](int) -> int { ds->enqueue(20199); return 0; }, [](int) -> int { model.enqueue(20199); return 0; }, 0, "ds->enqueue(20199); return 0;");
+    linearizability.AddStep(3, [](int) -> int { int x; return ds->dequeue(x) ? x : -1; }, [](int) -> int { int x; return model.dequeue(x) ? x : -1; }, 0, "int x; return ds->dequeue(x) ? x : -1;");
+    linearizability.AddStep(4, [](int) -> int { int x; return ds->dequeue(x) ? x : -1; }, [](int) -> int { int x; return model.dequeue(x) ? x : -1; }, 0, "int x; return ds->dequeue(x) ? x : -1;");
   }
 };
 
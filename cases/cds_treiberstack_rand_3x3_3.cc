@@ -1,5 +1,6 @@
 #include "helper.h"
 #include "linearizability.h"
+#include "reference_model.h"
 
 #include <cds/container/treiber_stack.h>
 #include <cds/container/basket_queue.h>
@@ -37,6 +38,8 @@ namespace cds {
 
 Linearizability linearizability(3);
 cds::container::TreiberStack<cds::gc::HP, int>* ds;
+// Runs in place of ds when linearizing, uninstrumented.
+StackModel model;
 
 void Create() {
   ds = new cds::container::TreiberStack<cds::gc::HP, int>();
@@ -49,16 +52,16 @@ void Destroy() {
 struct Configure {
   Configure() {
     linearizability.RegisterImplementation(&Create, &Destroy);
-    linearizability.RegisterModel(&Create, &Destroy);
-    linearizability.AddStep(0, []() { int x; return ds->pop(x) ? x : -1; }, "int x; return ds->pop(x) ? x : -1;");
-    linearizability.AddStep(0, []() { return ds->empty(); }, "return ds->empty();");
-    linearizability.AddStep(0, []() { ds->push(43417); return 0; }, "ds->push(43417); return 0;");
-    linearizability.AddStep(1, []() { return ds->empty(); }, "return ds->empty();");
-    linearizability.AddStep(1, []() { int x; return ds->pop(x) ? x : -1; }, "int x; return ds->pop(x) ? x : -1;");
-    linearizability.AddStep(1, []() { int x; return ds->pop(x) ? x : -1; }, "int x; return ds->pop(x) ? x : -1;");
-    linearizability.AddStep(2, []() { return ds->empty(); }, "return ds->empty();");
-    linearizability.AddStep(2, []() { int x; return ds->pop(x) ? x : -1; }, "int x; return ds->pop(x) ? x : -1;");
-    linearizability.AddStep(2, []() { ds->push(80503); return 0; }, "ds->push(80503); return 0;");
+    model.Register(linearizability);
+    linearizability.AddStep(0, [](int) -> int { int x; return ds->pop(x) ? x : -1; }, [](int) -> int { int x; return model.pop(x) ? x : -1; }, 0, "int x; return ds->pop(x) ? x : -1;");
+    linearizability.AddStep(0, [](int) -> int { return ds->empty(); }, [](int) -> int { return model.empty(); }, 0, "return ds->empty();");
+    linearizability.AddStep(0, [](int) -> int { ds->push(43417); return 0; }, [](int) -> int { model.push(43417); return 0; }, 0, "ds->push(43417); return 0;");
+    linearizability.AddStep(1, [](int) -> int { return ds->empty(); }, [](int) -> int { return model.empty(); }, 0, "return ds->empty();");
+    linearizability.AddStep(1, [](int) -> int { int x; return ds->pop(x) ? x : -1; }, [](int) -> int { int x; return model.pop(x) ? x : -1; }, 0, "int x; return ds->pop(x) ? x : -1;");
+    linearizability.AddStep(1, [](int) -> int { int x; return ds->pop(x) ? x : -1; }, [](int) -> int { int x; return model.pop(x) ? x : -1; }, 0, "int x; return ds->pop(x) ? x : -1;");
+    linearizability.AddStep(2, [](int) -> int { return ds->empty(); }, [](int) -> int { return model.empty(); }, 0, "return ds->empty();");
+    linearizability.AddStep(2, [](int) -> int { int x; return ds->pop(x) ? x : -1; }, [](int) -> int { int x; return model.pop(x) ? x : -1; }, 0, "int x; return ds->pop(x) ? x : -1;");
+    linearizability.AddStep(2, [](int) -> int { ds->push(80503); return 0; }, [](int) -> int { model.push(80503); return 0; }, 0, "ds->push(80503); return 0;");
   }
 };
 
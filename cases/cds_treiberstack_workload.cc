@@ -0,0 +1,87 @@
+#include "helper.h"
+#include "linearizability.h"
+#include "reference_model.h"
+
+#include <cds/container/treiber_stack.h>
+#include <cds/container/basket_queue.h>
+#include <cds/container/moir_queue.h>
+#include <cds/container/msqueue.h>
+#include <cds/container/optimistic_queue.h>
+#include <cds/container/rwqueue.h>
+#include <cds/container/vyukov_mpmc_cycle_queue.h>
+#include <cds/container/lazy_list_hp.h>
+#include <cds/container/skip_list_set_hp.h>
+#include <boost/lockfree/fifo.hpp>
+
+#include <cds/init.h>
+#include <cds/gc/hp.h>
+
+cds::gc::HP *hpHolder;
+cds::gc::HP::thread_gc *gcHolder;
+
+ThreadLocalStorage<cds::threading::ThreadData*> cdsTLS;
+
+namespace cds {
+  CDS_ATOMIC::atomic<size_t> threading::ThreadData::s_nLastUsedProcNo(0);
+  size_t threading::ThreadData::s_nProcCount = 1;
+
+  namespace details {
+    bool init_first_call() {
+      return true;
+    }
+
+    bool fini_last_call() {
+      return true;
+    }
+  }
+}
+
+Linearizability linearizability(0);
+cds::container::TreiberStack<cds::gc::HP, int>* ds;
+// Runs in place of ds when linearizing, uninstrumented.
+StackModel model;
+
+void Create() {
+  ds = new cds::container::TreiberStack<cds::gc::HP, int>();
+}
+
+void Destroy() {
+  delete ds;
+}
+
+struct Configure {
+  Configure() {
+    linearizability.RegisterImplementation(&Create, &Destroy);
+    model.Register(linearizability);
+    linearizability.RegisterOperation("empty", +[](int argument) -> int { return ds->empty(); }, +[](int argument) -> int { return model.empty(); }, 0);
+    linearizability.RegisterOperation("pop", +[](int argument) -> int { int x; return ds->pop(x) ? x : -1; }, +[](int argument) -> int { int x; return model.pop(x) ? x : -1; }, 0);
+    linearizability.RegisterOperation("push", +[](int argument) -> int { ds->push(argument); return 0; }, +[](int argument) -> int { model.push(argument); return 0; }, 100000, false, true);
+  }
+};
+
+static Configure config;
+
+volatile int x;
+void ThreadBody(int i) {
+  cds::gc::HP::thread_gc gc;
+  linearizability.ThreadBody(i);
+  int y = x;
+}
+
+void Setup() {
+  cds::Initialize();
+  hpHolder = new cds::gc::HP();
+  gcHolder = new cds::gc::HP::thread_gc();
+  linearizability.Setup();
+
+  for (int i = 0; i < linearizability.num_threads(); i++) {
+    StartThread(ThreadBody, i);
+  }
+}
+
+void Finish() {
+  linearizability.Finish();
+  delete gcHolder;
+  delete hpHolder;
+  cds::Terminate();
+}
@@ -1,11 +1,15 @@
 #include "helper.h"
 #include "linearizability.h"
+#include "reference_model.h"
 #include "../tests/test-crange.cc"
 Linearizability linearizability(3);
 crange* ds;
+// Runs in place of ds when linearizing, uninstrumented.
+SetModel model;
 
 void Create() {
   seed_tls.Reset();
+  gc_epochs.Reset();
   ds = new crange(8);
 }
 
@@ -16,16 +20,16 @@ void Destroy() {
 struct Configure {
   Configure() {
     linearizability.RegisterImplementation(&Create, &Destroy);
-    linearizability.RegisterModel(&Create, &Destroy);
-    linearizability.AddStep(0, []() { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
-    linearizability.AddStep(0, []() { ds->del(1, 1); return 0; }, "ds->del(1, 1); return 0;");
-    linearizability.AddStep(0, []() { ds->del(1, 1); return 0; }, "ds->del(1, 1); return 0;");
-    linearizability.AddStep(1, []() { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
-    linearizability.AddStep(1, []() { ds->del(1, 1); return 0; }, "ds->del(1, 1); return 0;");
-    linearizability.AddStep(1, []() { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
-    linearizability.AddStep(2, []() { ds->add(1, 1, (void*) 1); return 0; }, "ds->add(1, 1, (void*) 1); return 0;");
-    linearizability.AddStep(2, []() { ds->del(1, 1); return 0; }, "ds->del(1, 1); return 0;");
-    linearizability.AddStep(2, []() { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
+    model.Register(linearizability);
+    linearizability.AddStep(0, [](int) -> int { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, [](int) -> int { return model.find(1); }, 0, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
+    linearizability.AddStep(0, [](int) -> int { ds->del(1, 1); return 0; }, [](int) -> int { model.erase(1); return 0; }, 0, "ds->del(1, 1); return 0;");
+    linearizability.AddStep(0, [](int) -> int { ds->del(1, 1); return 0; }, [](int) -> int { model.erase(1); return 0; }, 0, "ds->del(1, 1); return 0;");
+    linearizability.AddStep(1, [](int) -> int { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, [](int) -> int { return model.find(1); }, 0, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
+    linearizability.AddStep(1, [](int) -> int { ds->del(1, 1); return 0; }, [](int) -> int { model.erase(1); return 0; }, 0, "ds->del(1, 1); return 0;");
+    linearizability.AddStep(1, [](int) -> int { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, [](int) -> int { return model.find(1); }, 0, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
+    linearizability.AddStep(2, [](int) -> int { ds->add(1, 1, (void*) 1); return 0; }, [](int) -> int { model.insert(1); return 0; }, 0, "ds->add(1, 1, (void*) 1); return 0;");
+    linearizability.AddStep(2, [](int) -> int { ds->del(1, 1); return 0; }, [](int) -> int { model.erase(1); return 0; }, 0, "ds->del(1, 1); return 0;");
+    linearizability.AddStep(2, [](int) -> int { return ds->search(1, 1, 0) != nullptr ? 1 : 0; }, [](int) -> int { return model.find(1); }, 0, "return ds->search(1, 1, 0) != nullptr ? 1 : 0;");
   }
 };
 
@@ -0,0 +1,21 @@
+#include "helper.h"
+
+const int N = 3;
+
+std::atomic<int> a;
+
+void thread(int tid) {
+  a = 2 * tid + 1;
+  a = 2 * tid + 2;
+}
+
+void Setup() {
+  a = 0;
+  for (int i = 0; i < N; i++)
+    StartThread(thread, i);
+}
+
+void Finish() {
+  Output("a=%d", a.load());
+  Output("\n");
+}
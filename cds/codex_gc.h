@@ -0,0 +1,22 @@
+#ifndef __CDSIMPL_CODEX_GC_H
+#define __CDSIMPL_CODEX_GC_H
+
+/*
+    File: codex_gc.h
+
+    Tuning of the reclamation schemas for exploring them under Codex.
+
+    Every access of the schemas would otherwise be a transition. Those that
+    no other thread can observe, or that cannot change what it observes, run
+    transparently instead: event counters, which every thread bumps and so
+    would order all threads against each other, and the bookkeeping of
+    retired pointers a thread holds on its own. Reads and writes of hazards,
+    and the frees of retired nodes, stay transitions, as the correctness of
+    the schema rests on them.
+*/
+
+#include "program_interface.h"
+
+#define CDS_CODEX_TRANSPARENT( _x )    RunTransparently( [&]() { _x; } )
+
+#endif    // #ifndef __CDSIMPL_CODEX_GC_H
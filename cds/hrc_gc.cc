@@ -21,10 +21,11 @@
 #include <cds/gc/hrc/hrc.h>
 
 #include "hzp_const.h"
+#include "codex_gc.h"
 #include <vector>
 #include <algorithm>    // std::sort
 
-#define    CDS_HRC_STATISTIC( _x )    if ( m_bStatEnabled ) { _x; }
+#define    CDS_HRC_STATISTIC( _x )    if ( m_bStatEnabled ) { CDS_CODEX_TRANSPARENT( _x ); }
 
 namespace cds { namespace gc {
     namespace hrc {
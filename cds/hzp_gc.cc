@@ -22,8 +22,9 @@
 
 #include <algorithm>    // std::sort
 #include "hzp_const.h"
+#include "codex_gc.h"
 
-#define    CDS_HAZARDPTR_STATISTIC( _x )    if ( m_bStatEnabled ) { _x; }
+#define    CDS_HAZARDPTR_STATISTIC( _x )    if ( m_bStatEnabled ) { CDS_CODEX_TRANSPARENT( _x ); }
 
 namespace cds { namespace gc {
     namespace hzp {
@@ -150,7 +151,9 @@ namespace cds { namespace gc {
             assert( pRec != NULL )    ;
             CDS_HAZARDPTR_STATISTIC( ++m_Stat.m_RetireHPRec )    ;
 
-            pRec->clear()   ;
+            // The guards of the record were all freed, and so cleared, before
+            // it is retired; clearing them again changes nothing.
+            CDS_CODEX_TRANSPARENT( pRec->clear() )   ;
             hplist_node * pNode = static_cast<hplist_node *>( pRec )  ;
             pNode->m_idOwner.store( cds::OS::nullThreadId(), CDS_ATOMIC::memory_order_release ) ;
         }
@@ -192,25 +195,33 @@ namespace cds { namespace gc {
             std::sort( plist.begin(), plist.end() ) ;
 
             // Stage 2: Search plist
-            details::retired_vector& arrRetired = pRec->m_arrRetired    ;
-
-            details::retired_vector::iterator itRetired     = arrRetired.begin()    ;
-            details::retired_vector::iterator itRetiredEnd  = arrRetired.end()    ;
-            // arrRetired is not a std::vector!
-            // clear is just set up item counter to 0, the items is not destroying
-            arrRetired.clear()    ;
-
-            std::vector< void * >::iterator itBegin = plist.begin()    ;
-            std::vector< void * >::iterator itEnd = plist.end()    ;
-            while ( itRetired != itRetiredEnd ) {
-                if ( std::binary_search( itBegin, itEnd, itRetired->m_p) ) {
-                    CDS_HAZARDPTR_STATISTIC( ++m_Stat.m_DeferredNode )    ;
-                    arrRetired.push( *itRetired )    ;
+            // The retired array is the thread's own, so it is sorted out
+            // transparently, and only the frees are explored.
+            std::vector< details::retired_ptr > arrFree ;
+            RunTransparently( [&]() {
+                details::retired_vector& arrRetired = pRec->m_arrRetired    ;
+
+                details::retired_vector::iterator itRetired     = arrRetired.begin()    ;
+                details::retired_vector::iterator itRetiredEnd  = arrRetired.end()    ;
+                // arrRetired is not a std::vector!
+                // clear is just set up item counter to 0, the items is not destroying
+                arrRetired.clear()    ;
+
+                std::vector< void * >::iterator itBegin = plist.begin()    ;
+                std::vector< void * >::iterator itEnd = plist.end()    ;
+                while ( itRetired != itRetiredEnd ) {
+                    if ( std::binary_search( itBegin, itEnd, itRetired->m_p) ) {
+                        CDS_HAZARDPTR_STATISTIC( ++m_Stat.m_DeferredNode )    ;
+                        arrRetired.push( *itRetired )    ;
+                    }
+                    else
+                        arrFree.push_back( *itRetired )    ;
+                    ++itRetired    ;
                 }
-                else
-                    DeletePtr( *itRetired )            ;
-                ++itRetired    ;
-            }
+            } ) ;
+
+            for ( size_t i = 0; i < arrFree.size(); ++i )
+                DeletePtr( arrFree[i] )            ;
         }
 
         void GarbageCollector::inplace_scan( details::HPRec * pRec )
@@ -221,56 +232,76 @@ namespace cds { namespace gc {
             // It is correct if all retired pointers are ar least 2-byte aligned (LSB is zero).
             // If it is wrong, we use classic scan algorithm
 
-            // Check if all retired pointers has zero LSB
-            // LSB is used for marking pointers that cannot be deleted yet
+            // The retired array is the thread's own, so it is checked, sorted
+            // and compacted transparently. Only the reads of the hazards and
+            // the frees are explored.
             details::retired_vector::iterator itRetired     = pRec->m_arrRetired.begin()    ;
             details::retired_vector::iterator itRetiredEnd  = pRec->m_arrRetired.end()    ;
-            for ( details::retired_vector::iterator it = itRetired; it != itRetiredEnd; ++it ) {
-                if ( reinterpret_cast<ptr_atomic_t>(it->m_p) & 1 ) {
-                    // found a pointer with LSB bit set - use classic_scan
-                    classic_scan( pRec )    ;
-                    return ;
+            bool bClassic = false ;
+            RunTransparently( [&]() {
+                // Check if all retired pointers has zero LSB
+                // LSB is used for marking pointers that cannot be deleted yet
+                for ( details::retired_vector::iterator it = itRetired; it != itRetiredEnd; ++it ) {
+                    if ( reinterpret_cast<ptr_atomic_t>(it->m_p) & 1 ) {
+                        bClassic = true ;
+                        return ;
+                    }
                 }
-            }
 
-            // Sort retired pointer array
-            std::sort( itRetired, itRetiredEnd, cds::gc::details::retired_ptr::less ) ;
+                // Sort retired pointer array
+                std::sort( itRetired, itRetiredEnd, cds::gc::details::retired_ptr::less ) ;
+            } ) ;
+            if ( bClassic ) {
+                // found a pointer with LSB bit set - use classic_scan
+                classic_scan( pRec )    ;
+                return ;
+            }
 
             // Search guarded pointers in retired array
 
+            std::vector< void * >   plist    ;
             hplist_node * pNode = m_pListHead.load(CDS_ATOMIC::memory_order_acquire) ;
 
             while ( pNode ) {
                 for ( size_t i = 0; i < m_nHazardPointerCount; ++i ) {
                     void * hptr = pNode->m_hzp[i]  ;
-                    if ( hptr ) {
-                        details::retired_ptr    dummyRetired ;
-                        dummyRetired.m_p = hptr ;
-                        details::retired_vector::iterator it = std::lower_bound( itRetired, itRetiredEnd, dummyRetired, cds::gc::details::retired_ptr::less ) ;
-                        if ( it != itRetiredEnd && it->m_p == hptr )  {
-                            // Mark retired pointer as guarded
-                            it->m_p = reinterpret_cast<void *>(reinterpret_cast<ptr_atomic_t>(it->m_p ) | 1) ;
-                        }
-                    }
+                    if ( hptr )
+                        plist.push_back( hptr )     ;
                 }
                 pNode = pNode->m_pNextNode  ;
             }
 
-            // Move all marked pointers to head of array
-            details::retired_vector::iterator itInsert = itRetired ;
-            for ( details::retired_vector::iterator it = itRetired; it != itRetiredEnd; ++it ) {
-                if ( reinterpret_cast<ptr_atomic_t>(it->m_p) & 1 ) {
-                    it->m_p = reinterpret_cast<void *>(reinterpret_cast<ptr_atomic_t>(it->m_p ) & ~1) ;
-                    *itInsert = *it ;
-                    ++itInsert      ;
-                    CDS_HAZARDPTR_STATISTIC( ++m_Stat.m_DeferredNode )    ;
+            std::vector< details::retired_ptr > arrFree ;
+            RunTransparently( [&]() {
+                for ( size_t i = 0; i < plist.size(); ++i ) {
+                    details::retired_ptr    dummyRetired ;
+                    dummyRetired.m_p = plist[i] ;
+                    details::retired_vector::iterator it = std::lower_bound( itRetired, itRetiredEnd, dummyRetired, cds::gc::details::retired_ptr::less ) ;
+                    if ( it != itRetiredEnd && it->m_p == plist[i] )  {
+                        // Mark retired pointer as guarded
+                        it->m_p = reinterpret_cast<void *>(reinterpret_cast<ptr_atomic_t>(it->m_p ) | 1) ;
+                    }
                 }
-                else {
-                    // Retired pointer may be freed
-                    DeletePtr( *it )            ;
+
+                // Move all marked pointers to head of array
+                details::retired_vector::iterator itInsert = itRetired ;
+                for ( details::retired_vector::iterator it = itRetired; it != itRetiredEnd; ++it ) {
+                    if ( reinterpret_cast<ptr_atomic_t>(it->m_p) & 1 ) {
+                        it->m_p = reinterpret_cast<void *>(reinterpret_cast<ptr_atomic_t>(it->m_p ) & ~1) ;
+                        *itInsert = *it ;
+                        ++itInsert      ;
+                        CDS_HAZARDPTR_STATISTIC( ++m_Stat.m_DeferredNode )    ;
+                    }
+                    else {
+                        // Retired pointer may be freed
+                        arrFree.push_back( *it )    ;
+                    }
                 }
-            }
-            pRec->m_arrRetired.size( itInsert - itRetired ) ;
+                pRec->m_arrRetired.size( itInsert - itRetired ) ;
+            } ) ;
+
+            for ( size_t i = 0; i < arrFree.size(); ++i )
+                DeletePtr( arrFree[i] )            ;
         }
 
         void GarbageCollector::HelpScan( details::HPRec * pThis )
@@ -17,6 +17,8 @@
 #include <cds/details/hash_functor_selector.h>
 #include <algorithm>   // std::fill
 
+#include "codex_gc.h"
+
 namespace cds { namespace gc { namespace ptb {
 
     namespace details {
@@ -206,13 +208,17 @@ namespace cds { namespace gc { namespace ptb {
             details::liberate_set set( beans::ceil2( retiredList.second > nLiberateThreshold ? retiredList.second : nLiberateThreshold ) ) ;
 
             // Get list of retired pointers
-            details::retired_ptr_node * pHead = retiredList.first ;
-            while ( pHead ) {
-                details::retired_ptr_node * pNext = pHead->m_pNext ;
-                pHead->m_pNextFree = null_ptr<details::retired_ptr_node *>() ;
-                set.insert( *pHead )   ;
-                pHead = pNext ;
-            }
+            // The list is private once privatized, so it is hashed into the
+            // set transparently.
+            RunTransparently( [&]() {
+                details::retired_ptr_node * pHead = retiredList.first ;
+                while ( pHead ) {
+                    details::retired_ptr_node * pNext = pHead->m_pNext ;
+                    pHead->m_pNextFree = null_ptr<details::retired_ptr_node *>() ;
+                    set.insert( *pHead )   ;
+                    pHead = pNext ;
+                }
+            } ) ;
 
             // Liberate cycle
             for ( details::guard_data * pGuard = m_GuardPool.begin(); pGuard; pGuard = pGuard->pGlobalNext.load(CDS_ATOMIC::memory_order_acquire) )
@@ -221,7 +227,8 @@ namespace cds { namespace gc { namespace ptb {
                 details::guard_data::guarded_ptr  valGuarded = pGuard->pPost.load(CDS_ATOMIC::memory_order_acquire)    ;
 
                 if ( valGuarded ) {
-                    details::retired_ptr_node * pRetired = set.erase( valGuarded ) ;
+                    details::retired_ptr_node * pRetired ;
+                    RunTransparently( [&]() { pRetired = set.erase( valGuarded ) ; } ) ;
                     if ( pRetired ) {
                         // Retired pointer is being guarded
                         // pRetired is the head of retired pointers list for which the m_ptr.m_p field is equal
@@ -0,0 +1,341 @@
+// Checks histories of operations logged outside of Codex, such as by a
+// service in production, for linearizability against one of the models of
+// reference_model.h. A history is a text file of one operation per line,
+//
+//   <thread> <start> <end> <operation>[(<argument>)] <result>
+//
+// as in "7 1520 1533 enqueue(4) 0", where thread is any integer naming the
+// thread or client that made the call, start and end are timestamps of its
+// invocation and response in any unit that all threads share, and result is
+// what it returned, with operations and results as the steps of the cases
+// return them (see cases/cds_*_workload.cc). An operation that never
+// returned has - for its end and result. Lines starting with # are skipped.
+//
+// The file is read as a stream into the histories of each key, when every
+// operation of the history has one, as those of a set do, and otherwise into
+// a single history. Each is checked on its own, see AddStep, with the
+// memoising search of CheckHistory, by workers forked for the purpose that
+// take the histories in turn, the longest first. An operation precedes
+// those that started after it ended, so the timestamps of different threads
+// have to be comparable, if not exact; a log whose clocks drift apart may
+// be reported as not linearizable.
+//
+// usage: check-history --model=queue|stack|set [--workers=N] [file]
+//
+// reads standard input without a file, and prints the histories that are
+// not linearizable. Exits with 1 if there are any.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "clockvector.h"
+#include "config.h"
+#include "linearizability.h"
+#include "parallel.h"
+#include "reference_model.h"
+
+// The runtime entry points that Linearizability refers to, but that an
+// offline check never reaches, as nothing runs in program threads.
+class PredictableAlloc;
+PredictableAlloc* GetPredictableAlloc() { abort(); }
+int linearizability_workers = 1;
+int stress_repeat = 1;
+std::string workload;
+void Found() { abort(); }
+bool RunningNatively() { return false; }
+int ThreadId() { abort(); }
+void Annotate(int) { abort(); }
+void Annotate(int, int64_t) { abort(); }
+ClockVector GetClockVector(int) { abort(); }
+void RunTransparently(const std::function<void()>&) { abort(); }
+void BeginOperationStep(int) { abort(); }
+void EndOperationStep() { abort(); }
+int InternAnnotation(const std::string&) { return 0; }
+
+static QueueModel queue_model;
+static StackModel stack_model;
+static SetModel set_model;
+
+// The operations of a model, which return what the steps of the cases
+// return: the value taken out or -1, and booleans as 0 or 1. Keyed
+// operations take the key as their argument.
+struct ModelOperation {
+  const char* name;
+  int (*run)(int argument);
+  bool keyed;
+};
+
+struct Model {
+  const char* name;
+  ReferenceModel* model;
+  std::vector<ModelOperation> operations;
+};
+
+static const Model kModels[] = {
+  {"queue", &queue_model, {
+    {"enqueue", +[](int value) { queue_model.enqueue(value); return 0; },
+      false},
+    {"dequeue", +[](int) { int value; return queue_model.dequeue(value) ?
+        value : -1; }, false},
+    {"empty", +[](int) -> int { return queue_model.empty(); }, false},
+  }},
+  {"stack", &stack_model, {
+    {"push", +[](int value) { stack_model.push(value); return 0; }, false},
+    {"pop", +[](int) { int value; return stack_model.pop(value) ?
+        value : -1; }, false},
+    {"empty", +[](int) -> int { return stack_model.empty(); }, false},
+  }},
+  {"set", &set_model, {
+    {"insert", +[](int key) -> int { return set_model.insert(key); }, true},
+    {"erase", +[](int key) -> int { return set_model.erase(key); }, true},
+    {"find", +[](int key) -> int { return set_model.find(key); }, true},
+    {"empty", +[](int) -> int { return set_model.empty(); }, false},
+  }},
+};
+
+static const Model* model = nullptr;
+
+struct LoggedOperation {
+  int64_t thread;
+  uint64_t start;
+  uint64_t end;
+  bool pending;
+  int operation;
+  int argument;
+  int result;
+};
+
+// The histories to check, the longest first, each with its key, or kNoKey
+// for the history of the whole file.
+static std::vector<std::pair<int, std::vector<LoggedOperation>>> histories;
+
+static void ExitWithBadLine(int line_number, const std::string& line) {
+  fprintf(stderr, "line %d: invalid operation %s\n", line_number,
+      line.c_str());
+  exit(1);
+}
+
+static bool ParseOperation(const std::string& line, LoggedOperation* o) {
+  std::istringstream in(line);
+  std::string end, call, result;
+  if (!(in >> o->thread >> o->start >> end >> call >> result)) {
+    return false;
+  }
+  o->pending = end == "-";
+  o->end = ~0ULL;
+  o->result = 0;
+  if (o->pending) {
+    if (result != "-") {
+      return false;
+    }
+  } else if (!(std::istringstream(end) >> o->end) ||
+      !(std::istringstream(result) >> o->result)) {
+    return false;
+  }
+
+  std::string name = call.substr(0, call.find('('));
+  o->argument = 0;
+  if (name.size() < call.size() &&
+      sscanf(call.c_str() + name.size(), "(%d)", &o->argument) != 1) {
+    return false;
+  }
+  o->operation = 0;
+  while (o->operation < model->operations.size() &&
+      model->operations[o->operation].name != name) {
+    o->operation++;
+  }
+  return o->operation < model->operations.size() &&
+      (o->pending || o->end >= o->start);
+}
+
+// Streams the operations of in into the history of their key, and falls
+// back to a single history at the first operation without one.
+static int64_t ReadHistories(std::istream& in) {
+  std::map<int, std::vector<LoggedOperation>> of_key;
+  bool keyed = true;
+  int64_t count = 0;
+  std::string line;
+  for (int line_number = 1; std::getline(in, line); line_number++) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    LoggedOperation o;
+    if (!ParseOperation(line, &o)) {
+      ExitWithBadLine(line_number, line);
+    }
+    count++;
+    if (keyed && !model->operations[o.operation].keyed) {
+      keyed = false;
+      std::vector<LoggedOperation> all;
+      for (auto& key : of_key) {
+        all.insert(all.end(), key.second.begin(), key.second.end());
+      }
+      of_key.clear();
+      of_key[Linearizability::kNoKey].swap(all);
+    }
+    of_key[keyed ? o.argument : Linearizability::kNoKey].push_back(o);
+  }
+
+  for (auto& key : of_key) {
+    histories.emplace_back(key.first, std::vector<LoggedOperation>());
+    histories.back().second.swap(key.second);
+  }
+  std::stable_sort(histories.begin(), histories.end(),
+      [](const std::pair<int, std::vector<LoggedOperation>>& a,
+          const std::pair<int, std::vector<LoggedOperation>>& b) {
+        return a.second.size() > b.second.size();
+      });
+  return count;
+}
+
+// Checks a history, in which the operations of each thread are its steps in
+// the order they started, with the threads numbered as they first appear.
+static bool CheckLoggedHistory(std::vector<LoggedOperation> operations) {
+  std::stable_sort(operations.begin(), operations.end(),
+      [](const LoggedOperation& a, const LoggedOperation& b) {
+        return a.start < b.start;
+      });
+  std::map<int64_t, int> thread_of;
+  for (const LoggedOperation& o : operations) {
+    thread_of.emplace(o.thread, thread_of.size());
+  }
+
+  Linearizability checker(thread_of.size());
+  model->model->Register(checker);
+  std::vector<int> steps(thread_of.size(), 0);
+  std::vector<Ordering> history(operations.size());
+  for (int i = 0; i < operations.size(); i++) {
+    const LoggedOperation& logged = operations[i];
+    const ModelOperation& operation = model->operations[logged.operation];
+    int thread = thread_of[logged.thread];
+    checker.AddStep(thread, operation.run, operation.run, logged.argument,
+        operation.name, Linearizability::kNoKey);
+    Ordering& o = history[i];
+    o.thread = o.actual_thread = thread;
+    o.function = steps[thread]++;
+    o.result = logged.result;
+    o.start_time = logged.start;
+    o.end_time = logged.end;
+    o.executed = false;
+    o.completion = -1;
+    o.completions_at_start = 0;
+  }
+
+  // Completions are numbered in the order operations returned.
+  std::vector<int> by_end;
+  for (int i = 0; i < operations.size(); i++) {
+    if (!operations[i].pending) {
+      by_end.push_back(i);
+    }
+  }
+  std::stable_sort(by_end.begin(), by_end.end(), [&](int a, int b) {
+    return operations[a].end < operations[b].end;
+  });
+  for (int k = 0; k < by_end.size(); k++) {
+    history[by_end[k]].completion = k;
+  }
+  return checker.CheckHistory(history, true);
+}
+
+// What the workers share: the next history to claim, and the verdict on
+// each, 0 until it is checked.
+static std::atomic<int>* next_history;
+static int8_t* verdicts;
+static const int8_t kLinearizable = 1;
+static const int8_t kNotLinearizable = 2;
+
+static void CheckHistories(int) {
+  while (true) {
+    int claimed = next_history->fetch_add(1);
+    if (claimed >= histories.size()) {
+      return;
+    }
+    verdicts[claimed] = CheckLoggedHistory(histories[claimed].second) ?
+        kLinearizable : kNotLinearizable;
+  }
+}
+
+static void PrintUsageAndExit() {
+  fprintf(stderr, "usage: check-history --model=queue|stack|set "
+      "[--workers=N] [file]\n");
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int workers = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* file = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--model=", 8) == 0) {
+      for (const Model& candidate : kModels) {
+        if (strcmp(argv[i] + 8, candidate.name) == 0) {
+          model = &candidate;
+        }
+      }
+    } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+      workers = atoi(argv[i] + 10);
+    } else if (argv[i][0] != '-' && file == nullptr) {
+      file = argv[i];
+    } else {
+      PrintUsageAndExit();
+    }
+  }
+  if (model == nullptr || workers < 1) {
+    PrintUsageAndExit();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  int64_t operations;
+  if (file != nullptr) {
+    std::ifstream in(file);
+    if (!in) {
+      perror(file);
+      return 1;
+    }
+    operations = ReadHistories(in);
+  } else {
+    operations = ReadHistories(std::cin);
+  }
+
+  next_history = new (AllocateShared(sizeof(std::atomic<int>)))
+      std::atomic<int>(0);
+  verdicts = static_cast<int8_t*>(AllocateShared(histories.size() + 1));
+  workers = std::min<int>(workers, histories.size());
+  if (workers <= 1) {
+    CheckHistories(0);
+  } else {
+    RunWorkers(workers, CheckHistories);
+  }
+
+  int failed = 0;
+  for (int i = 0; i < histories.size(); i++) {
+    if (verdicts[i] == kLinearizable) {
+      continue;
+    }
+    failed++;
+    std::string key = histories[i].first == Linearizability::kNoKey ?
+        "history" : "key " + std::to_string(histories[i].first);
+    printf("%s of %zu operations is %s\n", key.c_str(),
+        histories[i].second.size(), verdicts[i] == kNotLinearizable ?
+        "not linearizable" : "unchecked");
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("%lld operations in %zu histories, %d not linearizable, "
+      "%.1f seconds\n", (long long)operations, histories.size(), failed,
+      elapsed.count());
+  return failed > 0 ? 1 : 0;
+}
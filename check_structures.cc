@@ -0,0 +1,80 @@
+// Checks the data structures of the runtime on inputs that real searches
+// rarely produce but must not break on, such as keys that all collide.
+//
+// usage: check-structures
+//
+// prints each check that failed, and exits with 1 if any did.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "fingerprint_table.h"
+#include "hashtable.h"
+
+static int failures = 0;
+
+static void Expect(bool ok, const std::string& what) {
+  if (!ok) {
+    fprintf(stderr, "failed: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+// Fills the probe window of one slot with entries of the largest budget,
+// whose top 56 bits all start in that slot, and visits one more: it has to
+// evict one of them rather than probe forever.
+static void CheckFingerprintTableEviction() {
+  FingerprintTable* table = FingerprintTable::Create(1 << 12);
+  uint64_t slots = table->bytes() / sizeof(uint64_t);
+  for (uint64_t i = 0; i < 9; i++) {
+    // The slot is bits 8 and up; the rest sets the fingerprints apart.
+    uint64_t fingerprint = (i * slots) << 8;
+    Expect(table->Visit(fingerprint, 1000),
+        "a new fingerprint is visited, evicting one when the window is full");
+  }
+  Expect(!table->Visit(8 * slots << 8, 1000),
+      "the fingerprint that evicted another is kept");
+}
+
+struct Counter {
+  int value;
+
+  void Reset() {
+    value = 0;
+  }
+};
+
+// Adds addresses that all hash to a few neighbouring slots of the initial
+// table, so that it grows several times with long probe sequences, and
+// looks every one of them up again, both without adding it and with.
+static void CheckHashTableCollisions() {
+  HashTable<Counter> table;
+  std::vector<intptr_t> addresses;
+  for (intptr_t address = 8; addresses.size() < 500; address += 8) {
+    uint64_t hash = (static_cast<uint64_t>(address) >> 3) *
+        0x9e3779b97f4a7c15ULL >> (64 - kLogInitialHashSize);
+    if (hash < 4) {
+      addresses.push_back(address);
+      table[address].value = addresses.size();
+    }
+  }
+  for (size_t i = 0; i < addresses.size(); i++) {
+    Counter* counter = table.Find(addresses[i]);
+    Expect(counter != nullptr && counter->value == static_cast<int>(i + 1),
+        "Find sees every colliding address the table grew with");
+    Expect(table[addresses[i]].value == static_cast<int>(i + 1),
+        "operator[] finds a colliding address rather than adding it again");
+  }
+}
+
+int main() {
+  CheckFingerprintTableEviction();
+  CheckHashTableCollisions();
+  if (failures == 0) {
+    printf("all checks passed\n");
+  }
+  return failures ? 1 : 0;
+}
@@ -3,43 +3,94 @@
 #include "config.h"
 
 #include <cassert>
+#include <cstdint>
 #include <algorithm>
 
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// The times of clock vectors are the steps of the run, and -1 for none.
+// Builds with SHORT_CLOCKS=1 keep them in 16 bits, which halves the memory
+// of histories and doubles the lanes of each vector operation, and exit at
+// the first run that reaches kMaxClockTime steps, unless max_run_steps cuts
+// it off before.
+#ifdef CODEX_SHORT_CLOCKS
+typedef int16_t ClockTime;
+static const int kMaxClockTime = INT16_MAX;
+#else
+typedef int32_t ClockTime;
+static const int kMaxClockTime = INT32_MAX;
+#endif
+
+// Clock vectors are padded to a whole number of 16-byte vectors. The padding
+// lanes take part in Maximize and Minimize, but never in comparisons.
+#if defined(__SSE4_1__) || defined(__ARM_NEON)
+static const int kClockVectorLanes = 16 / sizeof(ClockTime);
+#else
+static const int kClockVectorLanes = 1;
+#endif
+static const int kClockVectorSize =
+    (kMaxThreads + kClockVectorLanes - 1) / kClockVectorLanes *
+    kClockVectorLanes;
+
 class ClockVector {
  public:
   ClockVector(int value=-1) { Reset(value); }
 
   inline void Reset(int value=-1) {
-    std::fill(times_, times_ + kMaxThreads, value);
+    std::fill(times_, times_ + kClockVectorSize, value);
   }
 
   inline void Maximize(const ClockVector& other) {
-    for (int i = 0; i < kMaxThreads; i++)
+    for (int i = 0; i < kClockVectorSize; i += kClockVectorLanes) {
+#if defined(__SSE4_1__) || defined(__ARM_NEON)
+      Store(i, Max(Load(i), other.Load(i)));
+#else
       times_[i] = std::max(times_[i], other.times_[i]);
+#endif
+    }
   }
 
   inline void Minimize(const ClockVector& other) {
-    for (int i = 0; i < kMaxThreads; i++)
+    for (int i = 0; i < kClockVectorSize; i += kClockVectorLanes) {
+#if defined(__SSE4_1__) || defined(__ARM_NEON)
+      Store(i, Min(Load(i), other.Load(i)));
+#else
       times_[i] = std::min(times_[i], other.times_[i]);
+#endif
+    }
   }
 
-  inline int& operator[](int thread) {
+  inline ClockTime& operator[](int thread) {
     assert(0 <= thread && thread < kMaxThreads);
     return times_[thread];
   }
 
-  inline int operator[](int thread) const {
+  inline ClockTime operator[](int thread) const {
     assert(0 <= thread && thread < kMaxThreads);
     return times_[thread];
   }
 
   inline bool happens_after_any(const ClockVector& other) const {
+#if defined(__SSE4_1__) || defined(__ARM_NEON)
+    for (int i = 0; i < kClockVectorSize; i += kClockVectorLanes) {
+      // Some thread lane is not strictly before other.
+      if (!AllOf(LessThan(Load(i), other.Load(i)), LaneMask(i))) {
+        return true;
+      }
+    }
+    return false;
+#else
     for (int i = 0; i < kMaxThreads; i++) {
       if (times_[i] >= other.times_[i]) {
         return true;
       }
     }
     return false;
+#endif
   }
 
   inline bool has_any_besides(int thread) const {
@@ -52,6 +103,117 @@ class ClockVector {
   }
 
  private:
-  int times_[kMaxThreads];
+#if defined(__SSE4_1__)
+  typedef __m128i Lanes;
+
+  inline Lanes Load(int i) const {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(times_ + i));
+  }
+
+  inline void Store(int i, Lanes value) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(times_ + i), value);
+  }
+
+#ifdef CODEX_SHORT_CLOCKS
+  static inline Lanes Max(Lanes a, Lanes b) {
+    return _mm_max_epi16(a, b);
+  }
+  static inline Lanes Min(Lanes a, Lanes b) {
+    return _mm_min_epi16(a, b);
+  }
+  static inline Lanes LessThan(Lanes a, Lanes b) {
+    return _mm_cmplt_epi16(a, b);
+  }
+  // All ones in the lanes starting at i that belong to a thread. This folds
+  // to a constant once the loops are unrolled.
+  static inline Lanes LaneMask(int i) {
+    return _mm_cmplt_epi16(_mm_setr_epi16(i, i + 1, i + 2, i + 3, i + 4,
+          i + 5, i + 6, i + 7), _mm_set1_epi16(kMaxThreads));
+  }
+#else
+  static inline Lanes Max(Lanes a, Lanes b) {
+    return _mm_max_epi32(a, b);
+  }
+  static inline Lanes Min(Lanes a, Lanes b) {
+    return _mm_min_epi32(a, b);
+  }
+  static inline Lanes LessThan(Lanes a, Lanes b) {
+    return _mm_cmplt_epi32(a, b);
+  }
+  // All ones in the lanes starting at i that belong to a thread. This folds
+  // to a constant once the loops are unrolled.
+  static inline Lanes LaneMask(int i) {
+    return _mm_cmplt_epi32(_mm_setr_epi32(i, i + 1, i + 2, i + 3),
+        _mm_set1_epi32(kMaxThreads));
+  }
+#endif
+
+  // Whether every lane of mask is set in lanes.
+  static inline bool AllOf(Lanes lanes, Lanes mask) {
+    return _mm_testc_si128(lanes, mask);
+  }
+#elif defined(__ARM_NEON)
+#ifdef CODEX_SHORT_CLOCKS
+  typedef int16x8_t Lanes;
+  typedef uint16x8_t Mask;
+
+  inline Lanes Load(int i) const {
+    return vld1q_s16(times_ + i);
+  }
+  inline void Store(int i, Lanes value) {
+    vst1q_s16(times_ + i, value);
+  }
+  static inline Lanes Max(Lanes a, Lanes b) {
+    return vmaxq_s16(a, b);
+  }
+  static inline Lanes Min(Lanes a, Lanes b) {
+    return vminq_s16(a, b);
+  }
+  static inline Mask LessThan(Lanes a, Lanes b) {
+    return vcltq_s16(a, b);
+  }
+  static inline Mask LaneMask(int i) {
+    const int16_t lanes[8] = {static_cast<int16_t>(i),
+        static_cast<int16_t>(i + 1), static_cast<int16_t>(i + 2),
+        static_cast<int16_t>(i + 3), static_cast<int16_t>(i + 4),
+        static_cast<int16_t>(i + 5), static_cast<int16_t>(i + 6),
+        static_cast<int16_t>(i + 7)};
+    return vcltq_s16(vld1q_s16(lanes), vdupq_n_s16(kMaxThreads));
+  }
+  static inline bool AllOf(Mask lanes, Mask mask) {
+    uint64x2_t missing = vreinterpretq_u64_u16(vbicq_u16(mask, lanes));
+    return (vgetq_lane_u64(missing, 0) | vgetq_lane_u64(missing, 1)) == 0;
+  }
+#else
+  typedef int32x4_t Lanes;
+  typedef uint32x4_t Mask;
+
+  inline Lanes Load(int i) const {
+    return vld1q_s32(times_ + i);
+  }
+  inline void Store(int i, Lanes value) {
+    vst1q_s32(times_ + i, value);
+  }
+  static inline Lanes Max(Lanes a, Lanes b) {
+    return vmaxq_s32(a, b);
+  }
+  static inline Lanes Min(Lanes a, Lanes b) {
+    return vminq_s32(a, b);
+  }
+  static inline Mask LessThan(Lanes a, Lanes b) {
+    return vcltq_s32(a, b);
+  }
+  static inline Mask LaneMask(int i) {
+    const int32_t lanes[4] = {i, i + 1, i + 2, i + 3};
+    return vcltq_s32(vld1q_s32(lanes), vdupq_n_s32(kMaxThreads));
+  }
+  static inline bool AllOf(Mask lanes, Mask mask) {
+    uint64x2_t missing = vreinterpretq_u64_u32(vbicq_u32(mask, lanes));
+    return (vgetq_lane_u64(missing, 0) | vgetq_lane_u64(missing, 1)) == 0;
+  }
+#endif
+#endif
+
+  ClockTime times_[kClockVectorSize];
 };
 
@@ -0,0 +1,68 @@
+#include "clockvector_log.h"
+
+static const int kSnapshotInterval = 8;
+
+void ClockVectorLog::Add(int previous, const ClockVector& previous_cv,
+    const ClockVector& cv, const ThreadSet& threads) {
+  int steps_since_snapshot = 0;
+  if (previous != -1) {
+    steps_since_snapshot = steps_since_snapshot_at_[previous] + 1;
+  }
+  if (steps_since_snapshot == kSnapshotInterval) {
+    steps_since_snapshot = 0;
+  }
+
+  if (steps_since_snapshot == 0) {
+    for (int thread : threads) {
+      if (cv[thread] != -1) {
+        entries_.push_back(
+            Entry{static_cast<ClockTime>(thread), cv[thread]});
+      }
+    }
+    follows_.push_back(-1);
+  } else {
+    for (int thread : threads) {
+      if (cv[thread] != previous_cv[thread]) {
+        entries_.push_back(
+            Entry{static_cast<ClockTime>(thread), cv[thread]});
+      }
+    }
+    follows_.push_back(previous);
+  }
+  entries_end_at_.push_back(entries_.size());
+  steps_since_snapshot_at_.push_back(steps_since_snapshot);
+}
+
+void ClockVectorLog::Truncate(int length) {
+  entries_.resize(length > 0 ? entries_end_at_[length - 1] : 0);
+  entries_end_at_.resize(length);
+  follows_.resize(length);
+  steps_since_snapshot_at_.resize(length);
+}
+
+void ClockVectorLog::Reset() {
+  Truncate(0);
+}
+
+void ClockVectorLog::Reserve(int capacity) {
+  entries_end_at_.reserve(capacity);
+  follows_.reserve(capacity);
+  steps_since_snapshot_at_.reserve(capacity);
+}
+
+ClockVector ClockVectorLog::Full(int time) const {
+  ClockVector cv;
+  // Later steps along the chain override earlier ones.
+  ThreadSet known;
+  while (time != -1) {
+    int begin = time > 0 ? entries_end_at_[time - 1] : 0;
+    for (int i = begin; i < entries_end_at_[time]; i++) {
+      if (!known.count(entries_[i].thread)) {
+        known.insert(entries_[i].thread);
+        cv[entries_[i].thread] = entries_[i].time;
+      }
+    }
+    time = follows_[time];
+  }
+  return cv;
+}
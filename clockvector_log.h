@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "clockvector.h"
+#include "spill_vector.h"
+#include "threadset.h"
+
+// The clock vectors of every step of a history, delta-encoded: each step
+// stores only the components that differ from the clock vector of the step
+// it follows, the previous step of the same thread. Every kSnapshotInterval
+// steps along such a chain, all components are stored instead, which bounds
+// the work of a lookup. This keeps memory close to the number of
+// synchronizing accesses rather than length times threads.
+class ClockVectorLog {
+ public:
+  // Appends step length(), whose clock vector is cv and which follows step
+  // previous with clock vector previous_cv, or -1 and ClockVector(). Only
+  // the components of threads can be set.
+  void Add(int previous, const ClockVector& previous_cv, const ClockVector& cv,
+      const ThreadSet& threads);
+  void Truncate(int length);
+  void Reset();
+  void Reserve(int capacity);
+
+  // Component thread of the clock vector of step time.
+  inline int Get(int time, int thread) const {
+    while (time != -1) {
+      int begin = time > 0 ? entries_end_at_[time - 1] : 0;
+      for (int i = begin; i < entries_end_at_[time]; i++) {
+        if (entries_[i].thread == thread) {
+          return entries_[i].time;
+        }
+      }
+      time = follows_[time];
+    }
+    return -1;
+  }
+
+  ClockVector Full(int time) const;
+
+  inline int length() const {
+    return entries_end_at_.size();
+  }
+
+ private:
+  struct Entry {
+    ClockTime thread;
+    ClockTime time;
+  };
+
+  SpillVector<Entry> entries_;
+  SpillVector<int> entries_end_at_;
+  // The step whose clock vector a step's entries are relative to, or -1 for
+  // a full snapshot.
+  SpillVector<int> follows_;
+  SpillVector<int> steps_since_snapshot_at_;
+};
@@ -1,4 +1,24 @@
 #pragma once
 
+#include <cstdint>
+
 class Interceptor;
+class PredictableAlloc;
 extern Interceptor* SetupInterfaceAndInterceptor();
+// The allocator of the tested program's memory.
+extern PredictableAlloc* GetPredictableAlloc();
+// Runs the program once on OS threads of its own instead of under the
+// interceptor: Setup, every thread it starts, at once, and Finish, with
+// accesses running directly and atomically and waits spinning, see
+// RunningNatively. Returns whether the program called Found.
+extern bool RunProgramNatively();
+// With operation_steps, the number of operations that the runs so far, in
+// any process of the search, refined, see BeginOperationStep.
+extern int64_t RefinedOperations();
+// Whether scheduling_points leaves out atomic accesses, which the search
+// then has to find racing, see PromotedSchedulingPoints.
+extern bool RefinesSchedulingPoints();
+// Under such scheduling_points, the number of locations that the runs so
+// far, in any process of the search, found an access that is no step to
+// race at, and made scheduling points from then on.
+extern int64_t PromotedSchedulingPoints();
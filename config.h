@@ -1,8 +1,141 @@
 #pragma once
 
-static const int kMaxThreads = 9; // Limited <= 64 by ThreadSet
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The thread count is fixed at build time. Building with a smaller
+// CODEX_MAX_THREADS shrinks clock vectors, thread maps and node hashes for
+// small tests, and a larger one lets tests such as test-filesystem start more
+// threads; see MAX_THREADS in the Makefile.
+#ifndef CODEX_MAX_THREADS
+#define CODEX_MAX_THREADS 9
+#endif
+
+static const int kMaxThreads = CODEX_MAX_THREADS;
+static_assert(0 < kMaxThreads && kMaxThreads <= 126,
+    "kMaxThreads is limited to 126 as paths store threads in an int8_t");
 
 extern bool show_all_transitions;
 extern bool show_program_output;
 extern bool show_debug_output;
-
+// Whether accesses to heap allocations that only one thread can reach are
+// still explored as transitions.
+extern bool intercept_private_accesses;
+// Whether threads run through non-atomic accesses without being interleaved,
+// which assumes the tested program is data-race free.
+extern bool coalesce_accesses;
+// Which accesses are steps of the search, that a thread can be switched out
+// before: all of them, atomic ones, those that synchronize (locks, CAS and
+// read-modify-writes), or those made at the location ids set in
+// scheduling_locations. The others run directly as part of the step before
+// them, so bugs that need a thread switched out there are missed, except
+// that under the last two, atomic accesses found to race with another
+// thread become scheduling points, see PromotedSchedulingPoints. Waits, and
+// the accesses of TSO threads, are always steps.
+enum class SchedulingPoints { ALL, ATOMIC, SYNC, LOCATIONS };
+extern SchedulingPoints scheduling_points;
+extern std::vector<bool> scheduling_locations;
+// Whether threads started with SymmetricStartThread in the same group are
+// treated as interchangeable, see Interceptor::StartThread.
+extern bool symmetry_reduction;
+// Whether memory freed during a run is handed out again by later allocations
+// of the same size class.
+extern bool reuse_freed_memory;
+// Whether PredictableAlloc keeps the call site of every allocation, see
+// PredictableAlloc::FindSite.
+extern bool record_allocation_sites;
+// Whether Setup only runs before the first run. The memory it leaves, in the
+// arena and in globals passed to RegisterGlobal, is saved, and later runs
+// start from it and start the same threads again instead of running Setup.
+// Only for programs whose Setup does the same in every run, and that
+// register every global their runs write.
+extern bool setup_once;
+// Whether every thread runs with a store buffer, see TSOStartThread, with the
+// orders of its accesses mapped as compilers map C11 atomics to x86: stores
+// weaker than seq_cst are buffered, and seq_cst ones, like read-modify-writes,
+// first wait for the stores before them. This explores the weak behaviors of
+// relaxed, release and acquire atomics that TSO allows, store buffering, but
+// not those only weaker machines allow.
+extern bool weak_atomics;
+// Whether runs are checked for data races, see RaceDetector, which count as
+// bugs.
+extern bool detect_races;
+// Whether accesses to memory freed during a run, and frees of it, count as
+// bugs, see PredictableAlloc.
+extern bool detect_frees;
+// Whether writes keep the hash of memory in memory_hash.h up to date, for
+// explorers that tell states apart by their contents, see --state-key.
+extern bool hash_memory_state;
+// Whether the operations between BeginOperationStep and EndOperationStep,
+// such as those of a linearizability harness, run as part of a single step
+// until they are found to conflict with another thread.
+extern bool operation_steps;
+// The number of times in a row a thread can read the same value from a
+// location before its next read there waits for the value to change; 0
+// never blocks spinning threads.
+extern int spin_reads;
+// The number of steps a run may take before it is cut off, its threads left
+// where they stand; 0 leaves runs unbounded. With retry_cutoff, a thread that
+// took that many steps in a row that wrote nothing, while no other thread
+// wrote anything either, gets no further steps in the run, and the run is cut
+// off once no other thread can run. Cut-off runs count as livelocks, unless
+// prune_cut_off_runs is set and the search drops them as it drops deadends.
+extern int max_run_steps;
+extern int retry_cutoff;
+extern bool prune_cut_off_runs;
+// With stop_run_on_found, a run that finds a bug through Found ends with the
+// step that found it, without the program's checks, and the search does not
+// explore below it.
+extern bool stop_run_on_found;
+// Whether atomic adds and subtracts of the same bytes commute, so that the
+// search does not reorder them among themselves; they still conflict with
+// every other access. This collapses the interleavings of counters, but is
+// only sound for programs that do not look at the values the adds return,
+// as the order of two adds decides which of them returns which.
+extern bool commuting_adds;
+// Memory for counting distinct traces exactly, beyond which they are
+// estimated.
+extern size_t distinct_table_bytes;
+// Whether the program's Finish runs after every run, rather than only after
+// those not happens-before equivalent to a run whose Finish passed, for
+// programs whose Finish does more than check.
+extern bool finish_every_run;
+// File descriptor that the hash of every distinct trace is appended to as it
+// is seen, as 8 bytes in native byte order, or -1. Hashes only depend on the
+// happens-before structure of the trace, so they can be compared across
+// processes, as fuzz.py does.
+extern int coverage_fd;
+// Directory to dump the first trace of each class of bugs to, see
+// Interceptor::BugClass. Only the first bug is dumped if it is empty.
+extern std::string bug_directory;
+// File of schedules, see LoadSchedules, that found bugs before: they are
+// replayed before the search, and the schedule of the first run of each
+// class of bugs is added, as is each trace --minimize minimizes. Empty if
+// there is none.
+extern std::string bug_corpus_file;
+// The steps of linearizability checks that register their operations, see
+// Linearizability::RegisterOperation.
+extern std::string workload;
+// Size of the stack of each program thread, and whether switching between
+// them keeps their floating point control state (rounding mode and such).
+extern size_t fiber_stack_size;
+extern bool preserve_fpu_state;
+// Whether the arena and the stacks of program threads are backed with
+// transparent huge pages, where the kernel has them; stacks need to be at
+// least 2 MB for it.
+extern bool huge_pages;
+// The number of processes that search for a linearization of a long history
+// at once, see Linearizability::SearchInParallel; 1 searches in the process
+// itself.
+extern int linearizability_workers;
+// How many times over each thread of a linearizability check runs its steps
+// in native runs, see Linearizability::ThreadBody.
+extern int stress_repeat;
+// The number of slowest runs whose schedules are kept, see PrintSlowestRuns.
+// When it is above zero, each run's time in happens-before bookkeeping and in
+// the program's checks is also measured.
+extern int slow_runs;
+// The form, "bin" or "dot", in which every dumped trace is accompanied by its
+// happens-before graph, see HBHistory::Dump; empty for none.
+extern std::string hb_graph_format;
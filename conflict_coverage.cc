@@ -0,0 +1,57 @@
+#include "conflict_coverage.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include "statistics.h"
+
+uint8_t* conflict_coverage;
+
+static int64_t& new_conflict_coverage =
+    RegisterStatistic<int64_t>("conflict-coverage");
+
+void EnableConflictCoverage(const std::string& file) {
+  void* map = mmap(nullptr, kConflictCoverageBits / 8, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  conflict_coverage = static_cast<uint8_t*>(map);
+  if (file.empty()) {
+    return;
+  }
+  // A missing file is an empty map, as on the first run of a fuzzer.
+  FILE* in = fopen(file.c_str(), "rb");
+  if (in != nullptr) {
+    if (fread(conflict_coverage, 1, kConflictCoverageBits / 8, in) !=
+        kConflictCoverageBits / 8) {
+      fprintf(stderr, "%s is not a coverage map\n", file.c_str());
+      exit(1);
+    }
+    fclose(in);
+  }
+}
+
+void SaveConflictCoverage(const std::string& file) {
+  FILE* out = fopen(file.c_str(), "wb");
+  if (out == nullptr ||
+      fwrite(conflict_coverage, 1, kConflictCoverageBits / 8, out) !=
+        kConflictCoverageBits / 8 || fclose(out) != 0) {
+    fprintf(stderr, "failed to write %s\n", file.c_str());
+    exit(1);
+  }
+}
+
+int64_t NewConflictCoverage() {
+  return new_conflict_coverage;
+}
+
+void SetNewConflictCoverage(uint8_t* byte, uint8_t bit) {
+  // Another process may be setting a bit of the same byte.
+  if ((__atomic_fetch_or(byte, bit, __ATOMIC_RELAXED) & bit) == 0) {
+    new_conflict_coverage++;
+  }
+}
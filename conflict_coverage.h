@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// An AFL-style map of the interleavings the search has covered, coarser than
+// the distinct traces: every conflict FindFirstConflicts finds, between an
+// earlier step at one location and a later step at another, sets the bit
+// that the ordered pair of locations hashes to. A run that sets bits no run
+// set before ordered some pair of accesses in a new way, which makes it worth
+// exploring around, as PCT does with its change points.
+//
+// The map lives in a MAP_SHARED mapping, so that the processes forked for
+// checkpoints and parallel workers set bits in the same one, and can be kept
+// in a file, so that a fuzzer running the binary again and again counts what
+// each run adds to all before it.
+static const int kLogConflictCoverageBits = 16;
+static const int kConflictCoverageBits = 1 << kLogConflictCoverageBits;
+
+// Null unless enabled, and otherwise kConflictCoverageBits / 8 bytes.
+extern uint8_t* conflict_coverage;
+
+// Starts covering conflicts, with the bits set in file if it is given and
+// exists.
+void EnableConflictCoverage(const std::string& file);
+// Writes the map to file.
+void SaveConflictCoverage(const std::string& file);
+// The bits that this process was the first to set.
+int64_t NewConflictCoverage();
+void SetNewConflictCoverage(uint8_t* byte, uint8_t bit);
+
+inline void CoverConflict(uint32_t earlier_location, uint32_t location) {
+  // Only the earlier location is multiplied in first, so that the two orders
+  // of a pair set different bits.
+  uint32_t hash = (earlier_location * 0x9e3779b1u + location) * 0x85ebca6bu;
+  hash >>= 32 - kLogConflictCoverageBits;
+  uint8_t bit = 1 << (hash & 7);
+  uint8_t* byte = &conflict_coverage[hash >> 3];
+  if ((*byte & bit) == 0) {
+    SetNewConflictCoverage(byte, bit);
+  }
+}
@@ -0,0 +1,240 @@
+import argparse, ast, base64, json, os, socket, socketserver, subprocess
+import sys, tempfile, threading, time
+
+# Spreads a DPOR search over processes on any number of machines. The
+# coordinator explores for a while itself, saving what is left of the search
+# as a frontier (see frontier.h), and then runs rounds: each round splits the
+# frontier into shares, every share being every Kth item (--resume-share),
+# and hands the shares to whichever workers ask for one. A worker resumes its
+# share with a budget, and sends back the frontier it did not get to, its
+# statistics and the bugs it dumped. The next round splits what all of them
+# left, so work moves to where it is, until nothing is left or time runs out.
+#
+# Runs are deterministic given the schedule, so workers share nothing but the
+# binary, which must be at the same path on every machine unless given with
+# --binary. With --job-runs instead of a time budget, the rounds, and so the
+# whole search, are the same every time.
+#
+#   python distribute.py serve obj/test-lock --port=7070 --seconds=3600
+#   python distribute.py work coordinator:7070      (on each machine)
+#
+# Statistics are added up over all processes; distinct traces are counted
+# per process, so their sum can count a trace more than once.
+
+parser = argparse.ArgumentParser()
+subparsers = parser.add_subparsers(dest='command')
+serve = subparsers.add_parser('serve')
+serve.add_argument('binary')
+serve.add_argument('--port', type=int, default=7070)
+serve.add_argument('--seconds', type=float, default=3600)
+serve.add_argument('--seed-runs', type=int, default=1000)
+serve.add_argument('--job-seconds', type=float, default=60)
+serve.add_argument('--job-runs', type=int, default=0)
+serve.add_argument('--shares-per-worker', type=int, default=4)
+serve.add_argument('--out', default='distribute-out')
+serve.add_argument('flags', nargs='*',
+                   help='flags for every process, after --')
+work = subparsers.add_parser('work')
+work.add_argument('address')
+work.add_argument('--binary')
+work.add_argument('--poll-seconds', type=float, default=1)
+args = parser.parse_args()
+
+
+def run(binary, flags, cwd):
+    process = subprocess.run([binary] + flags, cwd=cwd,
+                             stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                             universal_newlines=True)
+    lines = [l for l in process.stderr.splitlines() if l.startswith('{')]
+    return ast.literal_eval(lines[-1]) if lines else {}
+
+
+def read_items(frontier):
+    lines = frontier.splitlines()
+    return lines[1:] if lines and lines[0].startswith('frontier ') else []
+
+
+def merge_statistics(total, statistics):
+    for key, value in statistics.items():
+        if 'max' in key or 'high-water' in key:
+            total[key] = max(total.get(key, value), value)
+        elif isinstance(value, list):
+            old = total.get(key, [])
+            old += [0] * (len(value) - len(old))
+            total[key] = [a + b for a, b in zip(old, value + [0] * len(old))]
+        elif isinstance(value, (int, float)) and not key.startswith('estimated'):
+            total[key] = total.get(key, 0) + value
+
+
+def send(address, message):
+    host, port = address.rsplit(':', 1)
+    with socket.create_connection((host, int(port))) as connection:
+        connection.sendall((json.dumps(message) + '\n').encode())
+        return json.loads(connection.makefile().readline())
+
+
+class Coordinator:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.statistics = {}
+        self.frontier = ''
+        self.jobs = []
+        self.running = {}
+        self.results = {}
+        self.workers = set()
+        self.done = False
+        self.deadline = time.time() + args.seconds
+        self.round = 0
+        os.makedirs(os.path.join(args.out, 'bugs'), exist_ok=True)
+
+    # Splits the frontier into the jobs of the next round, or finishes.
+    def start_round(self):
+        items = read_items(self.frontier)
+        if not items or time.time() >= self.deadline:
+            self.done = True
+            return
+        self.round += 1
+        shares = min(len(items),
+                     max(1, len(self.workers)) * args.shares_per_worker)
+        self.jobs = [{'round': self.round, 'share': i, 'shares': shares}
+                     for i in range(shares)]
+        self.results = {}
+        print('round %d: %d items in %d shares, %d workers' %
+              (self.round, len(items), shares, len(self.workers)))
+
+    def handle(self, message):
+        if message['op'] == 'binary':
+            return {'binary': os.path.abspath(args.binary)}
+        with self.lock:
+            self.workers.add(message['worker'])
+            if message['op'] == 'result':
+                self.finish_job(message)
+            if self.done:
+                return {'op': 'done'}
+            # A job whose worker went quiet is handed out again.
+            for key, (job, started) in list(self.running.items()):
+                if time.time() - started > 3 * args.job_seconds + 60:
+                    del self.running[key]
+                    self.jobs.append(job)
+            if not self.jobs:
+                return {'op': 'wait'}
+            job = self.jobs.pop(0)
+            self.running[(job['round'], job['share'])] = (job, time.time())
+            budget = (['--max-runs=%d' % args.job_runs] if args.job_runs else
+                      ['--max-seconds=%g' % args.job_seconds])
+            return dict(job, op='job', frontier=self.frontier,
+                        flags=args.flags + budget)
+
+    def finish_job(self, message):
+        key = (message['round'], message['share'])
+        if key not in self.running:
+            return
+        del self.running[key]
+        self.results[message['share']] = read_items(message['frontier'])
+        merge_statistics(self.statistics, message['statistics'])
+        for name, data in message['bugs'].items():
+            with open(os.path.join(args.out, 'bugs', name), 'wb') as f:
+                f.write(base64.b64decode(data))
+        if not self.jobs and not self.running:
+            # Merged in share order, so that rounds do not depend on timing.
+            items = [item for share in sorted(self.results)
+                     for item in self.results[share]]
+            self.frontier = 'frontier dpor -1 %d\n' % len(items) + ''.join(
+                item + '\n' for item in items)
+            self.start_round()
+            if self.done:
+                self.report()
+
+    def report(self):
+        with open(os.path.join(args.out, 'statistics.txt'), 'w') as f:
+            f.write(repr(self.statistics) + '\n')
+        print('done after %d rounds: %s' % (self.round, self.statistics))
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        message = json.loads(self.rfile.readline())
+        reply = coordinator.handle(message)
+        self.wfile.write((json.dumps(reply) + '\n').encode())
+
+
+def serve_forever():
+    global coordinator
+    coordinator = Coordinator()
+    out = os.path.abspath(args.out)
+    frontier_file = os.path.join(out, 'frontier')
+    statistics = run(os.path.abspath(args.binary),
+                     ['--explorer=dpor', '--max-runs=%d' % args.seed_runs,
+                      '--save-frontier=' + frontier_file,
+                      '--bug-dir=' + os.path.join(out, 'bugs')] + args.flags,
+                     out)
+    merge_statistics(coordinator.statistics, statistics)
+    if os.path.exists(frontier_file):
+        with open(frontier_file) as f:
+            coordinator.frontier = f.read()
+    coordinator.start_round()
+    if coordinator.done:
+        coordinator.report()
+        return
+
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    server = socketserver.ThreadingTCPServer(('', args.port), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    # Workers learn that the search is over when they next ask for work.
+    while not coordinator.done:
+        time.sleep(1)
+    time.sleep(5)
+    server.shutdown()
+
+
+def work_forever():
+    worker = '%s:%d' % (socket.gethostname(), os.getpid())
+    message = {'op': 'get', 'worker': worker}
+    while True:
+        reply = send(args.address, message)
+        if reply['op'] == 'done':
+            return
+        if reply['op'] == 'wait':
+            time.sleep(args.poll_seconds)
+            message = {'op': 'get', 'worker': worker}
+            continue
+
+        with tempfile.TemporaryDirectory() as directory:
+            resume = os.path.join(directory, 'resume')
+            left = os.path.join(directory, 'left')
+            bugs = os.path.join(directory, 'bugs')
+            os.makedirs(bugs)
+            with open(resume, 'w') as f:
+                f.write(reply['frontier'])
+            statistics = run(args.binary or os.path.abspath(serve_binary()),
+                             reply['flags'] + [
+                                 '--resume=' + resume,
+                                 '--resume-share=%d/%d' % (reply['share'],
+                                                           reply['shares']),
+                                 '--save-frontier=' + left,
+                                 '--bug-dir=' + bugs], directory)
+            frontier = ''
+            if os.path.exists(left):
+                with open(left) as f:
+                    frontier = f.read()
+            found = {}
+            for name in os.listdir(bugs):
+                with open(os.path.join(bugs, name), 'rb') as f:
+                    found[name] = base64.b64encode(f.read()).decode()
+        message = {'op': 'result', 'worker': worker, 'round': reply['round'],
+                   'share': reply['share'], 'frontier': frontier,
+                   'statistics': statistics, 'bugs': found}
+
+
+def serve_binary():
+    reply = send(args.address, {'op': 'binary'})
+    return reply['binary']
+
+
+if args.command == 'serve':
+    serve_forever()
+elif args.command == 'work':
+    work_forever()
+else:
+    parser.print_usage()
+    sys.exit(1)
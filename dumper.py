@@ -1,23 +1,157 @@
-from data import data
 import collections
+import mmap
+import struct
+import sys
 
-readers = collections.defaultdict(set)
-writers = collections.defaultdict(set)
+# The layout of trace.bin, see trace_file.h.
+HEADER = struct.Struct('=8sIIQQ')
+RECORD = struct.Struct('=QqqqqqIiiBBH')
+LOCATION = struct.Struct('=IIIiiI')
+ANNOTATION = 0xff
 
-for t in data:
-    if t['type'] == 'transition':
-        if t['does_write']:
-            writers[t['address']].add(t['thread'])
-        else:
-            readers[t['address']].add(t['thread'])
+# TransitionType in transition.h.
+(WRITE, READ, CAS, READ_GE, ATOMICRMW, MEMSET, MEMCPY, BUFFERED_WRITE,
+ FLUSH, FREE, LOCK, UNLOCK) = range(1, 13)
+RMW_OPERATORS = ['=', '+=', '-=', '&=', '~&=', '|=', '^=', 'max=', 'min=',
+                 'umax=', 'umin=']
+
+def p(value):
+    return '0x%x' % (value & 0xffffffffffffffff)
+
+def describe(type, address, value, arg0, arg1):
+    if type == READ:
+        return 'Read %s = %s' % (p(address), p(value))
+    elif type == WRITE:
+        return 'Write %s = %s' % (p(address), p(arg0))
+    elif type == CAS and value == arg0:
+        return 'CAS %s from %s to %s' % (p(address), p(arg0), p(arg1))
+    elif type == CAS:
+        return 'CAS fail %s from %s to %s; was %s' % (
+            p(address), p(arg0), p(arg1), p(value))
+    elif type == READ_GE:
+        return 'Compared %s = %s to %s' % (p(address), p(value), p(arg0))
+    elif type == ATOMICRMW and arg0 == 0:
+        return 'Exchanged %s = %s with %s' % (p(address), p(value), p(arg1))
+    elif type == ATOMICRMW:
+        return '%s = %s %s %s' % (
+            p(address), p(value), RMW_OPERATORS[arg0], p(arg1))
+    elif type == MEMSET:
+        return 'Set %s to %s' % (p(address), p(arg0))
+    elif type == MEMCPY:
+        return 'Copied %s to %s' % (p(arg0), p(address))
+    elif type == BUFFERED_WRITE:
+        return 'Buffered write %s = %s' % (p(address), p(arg0))
+    elif type == FREE:
+        return 'Freed %s' % p(address)
+    elif type == LOCK:
+        return 'Locked %s' % p(address)
+    elif type == UNLOCK:
+        return 'Unlocked %s' % p(address)
+    else:
+        return 'Flushed write %s = %s' % (p(address), p(arg0))
+
+def load(path):
+    with open(path, 'rb') as f:
+        m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    magic, version, record_size, num_records, offset = HEADER.unpack_from(m)
+    assert magic == b'CODEXTRC' and version == 1
+    assert record_size == RECORD.size
+
+    strings = []
+    (count,) = struct.unpack_from('=I', m, offset)
+    offset += 4
+    for _ in range(count):
+        (length,) = struct.unpack_from('=I', m, offset)
+        strings.append(m[offset + 4:offset + 4 + length].decode())
+        offset += 4 + length
+
+    locations = {}
+    (count,) = struct.unpack_from('=I', m, offset)
+    offset += 4
+    for _ in range(count):
+        (id, file, function, line, column,
+         inlined_at) = LOCATION.unpack_from(m, offset)
+        locations[id] = ({'function': strings[function],
+                          'file': strings[file],
+                          'line': line, 'column': column}, inlined_at)
+        offset += LOCATION.size
+
+    def trace(location):
+        result = []
+        while location != 0:
+            l, location = locations[location]
+            result.append(dict(l))
+        return result
+
+    data = []
+    for (address, value, written_value, arg0, arg1, length, location, step,
+         thread, type, does_write, _) in RECORD.iter_unpack(
+             m[HEADER.size:HEADER.size + num_records * RECORD.size]):
+        if type == ANNOTATION:
+            data.append({'thread': thread, 'type': 'annotation',
+                         'description': strings[location]})
+            continue
+        t = {'does_write': bool(does_write), 'address': p(address),
+             'type': 'transition', 'value': p(value), 'thread': thread,
+             'step': step, 'length': length,
+             'description': describe(type, address, value, arg0, arg1),
+             'trace': trace(location)}
+        if does_write:
+            t['new_value'] = p(written_value)
+        data.append(t)
+    return data
+
+# The happens-before graph that --hb-graph=bin writes next to a trace, see
+# HBHistory::Dump: the steps each step happens after directly, and whether
+# each is relevant.
+HB_HEADER = struct.Struct('=8sIIQQ')
+
+def load_hb_graph(path):
+    with open(path, 'rb') as f:
+        m = f.read()
+    magic, version, _, num_steps, num_edges = HB_HEADER.unpack_from(m)
+    assert magic == b'CODEXHBG' and version == 1
+    offset = HB_HEADER.size
+    begins = struct.unpack_from('=%dI' % (num_steps + 1), m, offset)
+    offset += 4 * (num_steps + 1)
+    sources = struct.unpack_from('=%di' % num_edges, m, offset)
+    offset += 4 * num_edges
+    relevant = m[offset:offset + num_steps]
+    return ([list(sources[begins[i]:begins[i + 1]]) for i in range(num_steps)],
+            [bool(r) for r in relevant])
+
+trace_path = sys.argv[1] if len(sys.argv) > 1 else 'trace.bin'
+data = load(trace_path)
+hb_path = (trace_path[:-4] if trace_path.endswith('.bin') else trace_path) + '.hb'
+
+import os
+if os.path.exists(hb_path):
+    after, relevant = load_hb_graph(hb_path)
+    for t in data:
+        if t['type'] == 'transition':
+            t['after'] = after[t['step']]
+            t['relevant'] = relevant[t['step']]
+else:
+    readers = collections.defaultdict(set)
+    writers = collections.defaultdict(set)
+
+    for t in data:
+        if t['type'] == 'transition':
+            if t['does_write']:
+                writers[t['address']].add(t['thread'])
+            else:
+                readers[t['address']].add(t['thread'])
+
+    for t in data:
+        if t['type'] == 'transition':
+            t['relevant'] = (len(writers[t['address']]) > 1 or
+                len(writers[t['address']]) == 1 and len(readers[t['address']] - writers[t['address']]) > 0)
 
 import re
 address_pat = re.compile("(0x[0-9a-f]*)")
 
 for t in data:
     if t['type'] == 'transition':
-        t['relevant'] = (len(writers[t['address']]) > 1 or
-            len(writers[t['address']]) == 1 and len(readers[t['address']] - writers[t['address']]) > 0)
 
         t['description'] = address_pat.sub(r'<span class="addr p\1">\1</span>', t['description'])
 
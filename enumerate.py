@@ -0,0 +1,133 @@
+import argparse, ast, itertools, os, subprocess, sys, tempfile
+
+# Enumerates every workload of a workload case, see make_workload_case in
+# generator.py, of up to --threads threads of up to --steps steps each, and
+# explores each of them once, for small-scope completeness where fuzz.py
+# samples. Workloads that only differ by the order of their threads or by a
+# renaming of their values are the same to the data structure, so only one of
+# each is explored: values are opaque and renamed in the order they first
+# appear, and keys, which ordered structures compare, keep their order but
+# not their gaps. Operations are given as name, name:value or name:key, as
+# their step in generator.py takes a {value}, a {key} or neither. With
+# --batch, the binary checks them all in one process, see --workloads, and
+# --run-seconds is for all of them.
+#
+#   python enumerate.py obj/cases/cds_msqueue_workload \
+#       --operations enqueue:value dequeue empty -- --explorer=cbdpor
+
+parser = argparse.ArgumentParser()
+parser.add_argument('binary')
+parser.add_argument('--operations', nargs='+', required=True)
+parser.add_argument('--threads', type=int, default=2)
+parser.add_argument('--steps', type=int, default=2)
+parser.add_argument('--keys', type=int, default=2,
+                    help='keys of keyed operations, as num_arguments')
+parser.add_argument('--run-seconds', type=float, default=60)
+parser.add_argument('--list', action='store_true',
+                    help='only print the workloads')
+parser.add_argument('--batch', action='store_true',
+                    help='check every workload in one process')
+parser.add_argument('flags', nargs='*', default=['--explorer=cbdpor'],
+                    help='flags of each search (default --explorer=cbdpor)')
+args = parser.parse_args()
+
+binary = os.path.abspath(args.binary)
+operations = [tuple(operation.split(':')) if ':' in operation
+              else (operation, None) for operation in args.operations]
+
+# A workload is a tuple of threads, each a tuple of steps (name, kind,
+# argument).
+def canonical(threads):
+    best = None
+    for order in itertools.permutations(threads):
+        values = {}
+        keys = sorted(set(argument for thread in order
+                          for _, kind, argument in thread if kind == 'key'))
+        renamed = []
+        for thread in order:
+            steps = []
+            for name, kind, argument in thread:
+                if kind == 'value':
+                    argument = values.setdefault(argument, len(values) + 1)
+                elif kind == 'key':
+                    argument = keys.index(argument)
+                steps.append((name, kind, argument))
+            renamed.append(tuple(steps))
+        renamed = tuple(renamed)
+        if best is None or renamed < best:
+            best = renamed
+    return best
+
+# The ways to give count steps values, up to renaming: each takes a value
+# used before or the next new one.
+def value_assignments(count, used=0):
+    if count == 0:
+        yield ()
+        return
+    for value in range(1, used + 2):
+        for rest in value_assignments(count - 1, max(used, value)):
+            yield (value,) + rest
+
+def workloads():
+    shapes = [shape for steps in range(1, args.steps + 1)
+              for shape in itertools.product(operations, repeat=steps)]
+    seen = set()
+    for num_threads in range(1, args.threads + 1):
+        for threads in itertools.combinations_with_replacement(shapes,
+                                                               num_threads):
+            steps = [operation for thread in threads for operation in thread]
+            num_values = sum(1 for _, kind in steps if kind == 'value')
+            num_keys = sum(1 for _, kind in steps if kind == 'key')
+            for values in value_assignments(num_values):
+                for keys in itertools.product(range(args.keys),
+                                              repeat=num_keys):
+                    arguments = {'value': iter(values), 'key': iter(keys)}
+                    workload = canonical(tuple(
+                        tuple((name, kind, next(arguments[kind]) if kind
+                               else None) for name, kind in thread)
+                        for thread in threads))
+                    if workload not in seen:
+                        seen.add(workload)
+                        yield workload
+
+def format_workload(threads):
+    return ';'.join(','.join(name if kind is None else
+                             '%s(%d)' % (name, argument)
+                             for name, kind, argument in thread)
+                    for thread in threads)
+
+def fails(workload):
+    command = [binary, '--workload=' + workload,
+               '--max-seconds=%g' % args.run_seconds] + args.flags
+    process = subprocess.run(command, stdout=subprocess.DEVNULL,
+                             stderr=subprocess.PIPE, universal_newlines=True)
+    lines = [l for l in process.stderr.splitlines() if l.startswith('{')]
+    statistics = ast.literal_eval(lines[-1]) if lines else {}
+    return statistics.get('found', 0) > 0 or process.returncode != 0
+
+if args.batch and not args.list:
+    with tempfile.NamedTemporaryFile('w', suffix='.txt') as f:
+        for threads in workloads():
+            f.write(format_workload(threads) + '\n')
+        f.flush()
+        command = [binary, '--workloads=' + f.name,
+                   '--max-seconds=%g' % args.run_seconds] + args.flags
+        sys.exit(subprocess.run(command).returncode)
+
+count = 0
+failing = []
+for threads in workloads():
+    count += 1
+    workload = format_workload(threads)
+    if args.list:
+        print(workload)
+        continue
+    found = fails(workload)
+    print('%-48s %s' % (workload, 'fails' if found else 'passes'))
+    if found:
+        failing.append(workload)
+
+if not args.list:
+    print('%d workloads, %d failing' % (count, len(failing)))
+    for workload in failing:
+        print('--workload=\'%s\'' % workload)
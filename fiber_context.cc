@@ -0,0 +1,207 @@
+#include "fiber_context.h"
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+// Both switches push the callee-saved registers onto the current stack, store
+// the stack pointer in *from, load to as the stack pointer and pop the same
+// registers back off it. A new context starts out with such a frame whose
+// return address is the trampoline, which calls entry(arg) from the saved
+// registers.
+extern "C" void CodexSwitchContext(void** from, void* to);
+extern "C" void CodexSwitchContextFPU(void** from, void* to);
+extern "C" void CodexContextTrampoline();
+
+#if defined(__APPLE__)
+#define CODEX_SYMBOL(name) "_" #name
+#define CODEX_FUNCTION(name) \
+  ".globl " CODEX_SYMBOL(name) "\n" \
+  CODEX_SYMBOL(name) ":\n"
+#else
+#define CODEX_SYMBOL(name) #name
+#define CODEX_FUNCTION(name) \
+  ".globl " CODEX_SYMBOL(name) "\n" \
+  ".type " CODEX_SYMBOL(name) ", @function\n" \
+  CODEX_SYMBOL(name) ":\n"
+#endif
+
+#if defined(__x86_64__)
+
+// Callee-saved are rbx, rbp and r12-r15. The FPU variant adds the SSE control
+// and status register and the x87 control word in an extra slot.
+asm(".text\n"
+    ".p2align 4\n"
+    CODEX_FUNCTION(CodexSwitchContext)
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".p2align 4\n"
+    CODEX_FUNCTION(CodexSwitchContextFPU)
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".p2align 4\n"
+    CODEX_FUNCTION(CodexContextTrampoline)
+    "  movq %r12, %rdi\n"
+    "  callq *%r13\n"
+    "  ud2\n");
+
+// The frame a new context starts from, lowest address first.
+struct InitialFrame {
+  // The slot that the FPU variant pops the control state from.
+  uint32_t mxcsr;
+  uint32_t x87_control;
+  void* r15;
+  void* r14;
+  void* r13;
+  void* r12;
+  void* rbx;
+  void* rbp;
+  void* return_address;
+};
+
+#elif defined(__aarch64__)
+
+// Callee-saved are x19-x28, the frame pointer x29, the link register x30 and
+// the low halves of v8-v15, which the convention preserves as well. The FPU
+// variant adds the control register FPCR in an extra 16-byte slot.
+#define CODEX_SAVE_REGISTERS \
+    "  sub sp, sp, #160\n" \
+    "  stp x19, x20, [sp, #0]\n" \
+    "  stp x21, x22, [sp, #16]\n" \
+    "  stp x23, x24, [sp, #32]\n" \
+    "  stp x25, x26, [sp, #48]\n" \
+    "  stp x27, x28, [sp, #64]\n" \
+    "  stp x29, x30, [sp, #80]\n" \
+    "  stp d8, d9, [sp, #96]\n" \
+    "  stp d10, d11, [sp, #112]\n" \
+    "  stp d12, d13, [sp, #128]\n" \
+    "  stp d14, d15, [sp, #144]\n"
+#define CODEX_RESTORE_REGISTERS \
+    "  ldp x19, x20, [sp, #0]\n" \
+    "  ldp x21, x22, [sp, #16]\n" \
+    "  ldp x23, x24, [sp, #32]\n" \
+    "  ldp x25, x26, [sp, #48]\n" \
+    "  ldp x27, x28, [sp, #64]\n" \
+    "  ldp x29, x30, [sp, #80]\n" \
+    "  ldp d8, d9, [sp, #96]\n" \
+    "  ldp d10, d11, [sp, #112]\n" \
+    "  ldp d12, d13, [sp, #128]\n" \
+    "  ldp d14, d15, [sp, #144]\n" \
+    "  add sp, sp, #160\n"
+
+asm(".text\n"
+    ".p2align 4\n"
+    CODEX_FUNCTION(CodexSwitchContext)
+    CODEX_SAVE_REGISTERS
+    "  mov x2, sp\n"
+    "  str x2, [x0]\n"
+    "  mov sp, x1\n"
+    CODEX_RESTORE_REGISTERS
+    "  ret\n"
+    ".p2align 4\n"
+    CODEX_FUNCTION(CodexSwitchContextFPU)
+    CODEX_SAVE_REGISTERS
+    "  mrs x2, fpcr\n"
+    "  str x2, [sp, #-16]!\n"
+    "  mov x2, sp\n"
+    "  str x2, [x0]\n"
+    "  mov sp, x1\n"
+    "  ldr x2, [sp], #16\n"
+    "  msr fpcr, x2\n"
+    CODEX_RESTORE_REGISTERS
+    "  ret\n"
+    ".p2align 4\n"
+    CODEX_FUNCTION(CodexContextTrampoline)
+    "  mov x0, x19\n"
+    "  blr x20\n"
+    "  brk #0\n");
+
+// The frame a new context starts from, lowest address first.
+struct InitialFrame {
+  // The slot that the FPU variant pops the control state from.
+  uint64_t fpcr;
+  uint64_t padding;
+  void* x[10];  // x19-x28
+  void* x29;
+  void* x30;
+  double d[8];  // d8-d15
+};
+
+#endif
+
+void FiberContext::Make(uint8_t* stack_top, size_t stack_size,
+    void (*entry)(intptr_t), intptr_t arg, bool preserve_fpu) {
+  uintptr_t top = reinterpret_cast<uintptr_t>(stack_top) & ~uintptr_t(15);
+  InitialFrame* frame = reinterpret_cast<InitialFrame*>(top - 16) - 1;
+  *frame = InitialFrame();
+#if defined(__x86_64__)
+  // Default control state: all exceptions masked, round to nearest.
+  frame->mxcsr = 0x1f80;
+  frame->x87_control = 0x37f;
+  frame->r12 = reinterpret_cast<void*>(arg);
+  frame->r13 = reinterpret_cast<void*>(entry);
+  frame->return_address = reinterpret_cast<void*>(&CodexContextTrampoline);
+  // The plain switch pops the frame without the control state slot.
+  stack_pointer_ = preserve_fpu ? static_cast<void*>(frame) : &frame->r15;
+#else
+  frame->x[0] = reinterpret_cast<void*>(arg);
+  frame->x[1] = reinterpret_cast<void*>(entry);
+  frame->x30 = reinterpret_cast<void*>(&CodexContextTrampoline);
+  stack_pointer_ = preserve_fpu ? static_cast<void*>(frame) : &frame->x;
+#endif
+}
+
+void FiberContext::Switch(FiberContext* from, FiberContext* to,
+    bool preserve_fpu) {
+  if (preserve_fpu) {
+    CodexSwitchContextFPU(&from->stack_pointer_, to->stack_pointer_);
+  } else {
+    CodexSwitchContext(&from->stack_pointer_, to->stack_pointer_);
+  }
+}
+
+#else
+
+void FiberContext::Make(uint8_t* stack_top, size_t stack_size,
+    void (*entry)(intptr_t), intptr_t arg, bool preserve_fpu) {
+  context_ = boost::context::make_fcontext(stack_top, stack_size, entry);
+  arg_ = arg;
+}
+
+void FiberContext::Switch(FiberContext* from, FiberContext* to,
+    bool preserve_fpu) {
+  boost::context::jump_fcontext(from->context_, to->context_, to->arg_,
+      preserve_fpu);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#include <boost/context/all.hpp>
+#endif
+
+// A context switch for fibers that all run on one OS thread. On x86-64 and
+// AArch64 it only saves the registers the calling convention has callees
+// preserve, plus the floating point control state if asked to, which is all
+// a switch made from an ordinary function call has to keep. Elsewhere it
+// falls back to boost.context.
+class FiberContext {
+ public:
+  // Prepares context to call entry(arg) on the stack below stack_top when it
+  // is first switched to. entry must never return. A context must always be
+  // switched to with the preserve_fpu it was made with.
+  void Make(uint8_t* stack_top, size_t stack_size, void (*entry)(intptr_t),
+      intptr_t arg, bool preserve_fpu);
+
+  // Saves the current context in from and continues in to.
+  static void Switch(FiberContext* from, FiberContext* to,
+      bool preserve_fpu);
+
+ private:
+#if defined(__x86_64__) || defined(__aarch64__)
+  void* stack_pointer_;
+#else
+  boost::context::fcontext_t original_;
+  boost::context::fcontext_t* context_ = &original_;
+  intptr_t arg_ = 0;
+#endif
+};
@@ -0,0 +1,210 @@
+#include "fingerprint_set.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include "statistics.h"
+
+static bool& distinct_estimated =
+    RegisterStatistic<bool>("distinct-estimated");
+
+static const size_t kInitialSlots = 1 << 12;
+
+FingerprintSet::FingerprintSet(size_t max_bytes) :
+    max_bytes_(max_bytes), size_(0), slots_(kInitialSlots),
+    register_sum_(0), zero_registers_(0) {}
+
+// The low bits of a fingerprint pick its slot, and its high bits its sketch
+// register, so both need to be well mixed.
+void FingerprintSet::Insert(uint64_t fingerprint) {
+  uint64_t key = KeyOf(fingerprint);
+  if (estimating()) {
+    AddToSketch(key);
+    size_ = std::max<int64_t>(size_, llround(Estimate()));
+    return;
+  }
+
+  size_t slot = Find(key);
+  if (slots_[slot] != 0) {
+    return;
+  }
+  slots_[slot] = key;
+  if (2 * ++size_ > static_cast<int64_t>(slots_.size())) {
+    Grow();
+  }
+}
+
+size_t FingerprintSet::Find(uint64_t key) const {
+  size_t mask = slots_.size() - 1;
+  size_t slot = (key >> 1) & mask;
+  while (slots_[slot] != 0 && (slots_[slot] & ~kMark) != key) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void FingerprintSet::Mark(uint64_t fingerprint) {
+  if (estimating()) {
+    return;
+  }
+  uint64_t& slot = slots_[Find(KeyOf(fingerprint))];
+  if (slot != 0) {
+    slot |= kMark;
+  }
+}
+
+bool FingerprintSet::Marked(uint64_t fingerprint) const {
+  return !estimating() && (slots_[Find(KeyOf(fingerprint))] & kMark);
+}
+
+void FingerprintSet::ClearMarks() {
+  for (uint64_t& slot : slots_) {
+    slot &= ~kMark;
+  }
+}
+
+void FingerprintSet::Grow() {
+  if (2 * slots_.size() * sizeof(uint64_t) > max_bytes_) {
+    Fold();
+    return;
+  }
+
+  std::vector<uint64_t> old_slots(2 * slots_.size());
+  old_slots.swap(slots_);
+  for (uint64_t stored : old_slots) {
+    if (stored != 0) {
+      slots_[Find(stored & ~kMark)] = stored;
+    }
+  }
+}
+
+size_t FingerprintSet::Fold() {
+  if (estimating()) {
+    return 0;
+  }
+  size_t freed = bytes();
+  std::vector<uint64_t> old_slots;
+  old_slots.swap(slots_);
+  registers_.resize(1 << kLogRegisters);
+  register_sum_ = zero_registers_ = registers_.size();
+  for (uint64_t stored : old_slots) {
+    if (stored != 0) {
+      AddToSketch(stored & ~kMark);
+    }
+  }
+  distinct_estimated = true;
+  return freed;
+}
+
+void FingerprintSet::AddToSketch(uint64_t fingerprint) {
+  uint64_t index = fingerprint >> (64 - kLogRegisters);
+  // One more than the number of leading zeros of the remaining bits, with a
+  // sentinel bit so that they are never all zero.
+  uint64_t rest = (fingerprint << kLogRegisters) | (1ULL << (kLogRegisters - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  uint8_t& old_rank = registers_[index];
+  if (rank > old_rank) {
+    register_sum_ += std::ldexp(1.0, -rank) - std::ldexp(1.0, -old_rank);
+    zero_registers_ -= old_rank == 0;
+    old_rank = rank;
+  }
+}
+
+double FingerprintSet::Estimate() const {
+  const double m = 1 << kLogRegisters;
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / register_sum_;
+  // Linear counting is more accurate while many registers are still empty.
+  if (estimate <= 2.5 * m && zero_registers_ > 0) {
+    estimate = m * std::log(m / zero_registers_);
+  }
+  return estimate;
+}
+
+SharedFingerprintSet* SharedFingerprintSet::Create(size_t max_bytes) {
+  size_t num_slots = kInitialSlots;
+  while (offsetof(SharedFingerprintSet, slots_) +
+      2 * num_slots * sizeof(std::atomic<uint64_t>) <= max_bytes) {
+    num_slots *= 2;
+  }
+
+  size_t size = offsetof(SharedFingerprintSet, slots_) +
+      num_slots * sizeof(std::atomic<uint64_t>);
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+
+  // Anonymous mappings are zero-filled, which leaves the slots and the
+  // registers empty.
+  SharedFingerprintSet* set = reinterpret_cast<SharedFingerprintSet*>(memory);
+  set->mask_ = num_slots - 1;
+  set->register_sum_ = static_cast<int64_t>(1) << (kLogRegisters + kSumBits);
+  set->zero_registers_ = 1 << kLogRegisters;
+  return set;
+}
+
+bool SharedFingerprintSet::Insert(uint64_t fingerprint) {
+  bool raised = AddToSketch(fingerprint);
+
+  // The table stops taking fingerprints at half full, so that probing for
+  // one that is missing still ends at an empty slot.
+  uint64_t key = fingerprint != 0 ? fingerprint : 1;
+  uint64_t slot = key & mask_;
+  while (true) {
+    uint64_t value = slots_[slot].load(std::memory_order_relaxed);
+    if (value == key) {
+      return false;
+    } else if (value != 0) {
+      slot = (slot + 1) & mask_;
+    } else if (estimating()) {
+      break;
+    } else if (slots_[slot].compare_exchange_strong(value, key)) {
+      if (2 * (size_.fetch_add(1) + 1) > static_cast<int64_t>(mask_ + 1)) {
+        estimating_ = true;
+      }
+      return true;
+    }
+    // Lost a race for this slot; look at it again.
+  }
+
+  distinct_estimated = true;
+  int64_t estimate = llround(Estimate());
+  int64_t size = size_.load(std::memory_order_relaxed);
+  while (estimate > size && !size_.compare_exchange_weak(size, estimate)) {}
+  return raised;
+}
+
+bool SharedFingerprintSet::AddToSketch(uint64_t fingerprint) {
+  uint64_t index = fingerprint >> (64 - kLogRegisters);
+  uint64_t rest = (fingerprint << kLogRegisters) | (1ULL << (kLogRegisters - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  auto units = [](int rank) {
+    return rank <= kSumBits ? static_cast<int64_t>(1) << (kSumBits - rank) : 0;
+  };
+  uint8_t old_rank = registers_[index].load(std::memory_order_relaxed);
+  while (rank > old_rank) {
+    if (registers_[index].compare_exchange_weak(old_rank, rank)) {
+      register_sum_ += units(rank) - units(old_rank);
+      zero_registers_ -= old_rank == 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+double SharedFingerprintSet::Estimate() const {
+  const double m = 1 << kLogRegisters;
+  double sum = std::ldexp(static_cast<double>(register_sum_), -kSumBits);
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  int zero_registers = zero_registers_;
+  if (estimate <= 2.5 * m && zero_registers > 0) {
+    estimate = m * std::log(m / zero_registers);
+  }
+  return estimate;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A set of 64-bit fingerprints that only needs to report its size, such as
+// the distinct traces seen so far. Fingerprints are kept in an open-addressing
+// table that doubles when half full. Once doubling would take more than
+// max_bytes, the table is folded into a HyperLogLog sketch and from then on
+// the size is an estimate, within about 1% with the 16 KB sketch used here.
+//
+// Until then, each fingerprint in the table can also carry a mark, such as
+// that its run passed the program's checks, in the lowest bit of its slot.
+// Fingerprints that only differ in that bit are the same to the set.
+class FingerprintSet {
+ public:
+  explicit FingerprintSet(size_t max_bytes);
+
+  void Insert(uint64_t fingerprint);
+
+  // Marks the fingerprint, if the table holds it.
+  void Mark(uint64_t fingerprint);
+  // Whether the table holds the fingerprint marked. Never once folded.
+  bool Marked(uint64_t fingerprint) const;
+  // Unmarks every fingerprint.
+  void ClearMarks();
+
+  // The exact number of distinct fingerprints inserted, or an estimate that
+  // never decreases once the set has been folded into a sketch.
+  int64_t size() const {
+    return size_;
+  }
+
+  bool estimating() const {
+    return slots_.empty();
+  }
+
+  // The bytes of the table, until it is folded.
+  size_t bytes() const {
+    return slots_.capacity() * sizeof(uint64_t);
+  }
+
+  // Folds the table into the sketch now, as Insert does once the table
+  // would outgrow max_bytes, and returns the bytes freed.
+  size_t Fold();
+
+ private:
+  static const int kLogRegisters = 14;
+
+  static const uint64_t kMark = 1;
+
+  // The fingerprint as stored, with the mark bit clear, and zero as two.
+  static uint64_t KeyOf(uint64_t fingerprint) {
+    uint64_t key = fingerprint & ~kMark;
+    return key != 0 ? key : 2;
+  }
+  // The slot of key, or of the empty slot where it would go.
+  size_t Find(uint64_t key) const;
+  void Grow();
+  void AddToSketch(uint64_t fingerprint);
+  double Estimate() const;
+
+  size_t max_bytes_;
+  int64_t size_;
+  // Zero marks an empty slot. Slots are picked by the bits above the mark.
+  std::vector<uint64_t> slots_;
+  std::vector<uint8_t> registers_;
+  // The sum of 2^-rank over all registers, and how many are still zero.
+  double register_sum_;
+  int zero_registers_;
+};
+
+// The counterpart of FingerprintSet for processes forked after Create, such
+// as parallel workers and checkpoints, which all insert into one set: it
+// lives in a MAP_SHARED mapping and is only updated with compare-and-swap.
+// Its table cannot grow, so it takes max_bytes from the start; as fingerprints
+// are spread over it, most of its pages are touched by the time it holds
+// max_bytes / 64 of them. The sketch is kept up from the start as well, and
+// once the table is half full, the set estimates its size from it.
+class SharedFingerprintSet {
+ public:
+  // Allocates a set with a table of at most max_bytes, rounded down to a
+  // power of two.
+  static SharedFingerprintSet* Create(size_t max_bytes);
+
+  // Returns whether the fingerprint is new. Once estimating, fingerprints
+  // that are new may be taken for ones seen before, but not the other way
+  // around.
+  bool Insert(uint64_t fingerprint);
+
+  // As FingerprintSet::size, counting the fingerprints of all processes.
+  int64_t size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+  bool estimating() const {
+    return estimating_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static const int kLogRegisters = 14;
+  // The sketch sums 2^-rank in fixed point, in units of 2^-kSumBits; the
+  // few ranks beyond add nothing.
+  static const int kSumBits = 48;
+
+  bool AddToSketch(uint64_t fingerprint);
+  double Estimate() const;
+
+  uint64_t mask_;
+  std::atomic<int64_t> size_;
+  std::atomic<bool> estimating_;
+  std::atomic<int64_t> register_sum_;
+  std::atomic<int> zero_registers_;
+  std::atomic<uint8_t> registers_[1 << kLogRegisters];
+  // Zero marks an empty slot, so a zero fingerprint is stored as one.
+  std::atomic<uint64_t> slots_[1];
+};
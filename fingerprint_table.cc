@@ -0,0 +1,100 @@
+#include "fingerprint_table.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "statistics.h"
+
+static const int kProbes = 8;
+static const int kMaxBudget = 254;
+
+static int64_t& total_evictions =
+    RegisterStatistic<int64_t>("fingerprint-evictions");
+
+FingerprintTable* FingerprintTable::Create(size_t max_bytes) {
+  size_t num_slots = 1;
+  while (offsetof(FingerprintTable, slots_) +
+      2 * num_slots * sizeof(std::atomic<uint64_t>) <= max_bytes) {
+    num_slots *= 2;
+  }
+
+  size_t size = offsetof(FingerprintTable, slots_) +
+      num_slots * sizeof(std::atomic<uint64_t>);
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+
+  // Anonymous mappings are zero-filled, and zero marks an empty slot.
+  FingerprintTable* table = reinterpret_cast<FingerprintTable*>(memory);
+  table->mask_ = num_slots - 1;
+  return table;
+}
+
+bool FingerprintTable::Visit(uint64_t fingerprint, int budget) {
+  // Budgets are stored off by one, so that no entry is zero.
+  uint64_t key = fingerprint & ~0xffULL;
+  uint64_t entry = key | (std::min(budget, kMaxBudget) + 1);
+
+  while (true) {
+    uint64_t slot = (fingerprint >> 8) & mask_;
+    uint64_t victim = slot;
+    uint64_t victim_value = 0;
+
+    for (int probe = 0; probe < kProbes; probe++) {
+      uint64_t value = slots_[slot].load(std::memory_order_relaxed);
+      if (value == 0 || (value & ~0xffULL) == key) {
+        if (value >= entry) {
+          return false;
+        }
+        if (slots_[slot].compare_exchange_strong(value, entry)) {
+          return true;
+        }
+        // Lost a race for this slot; look at it again.
+        probe--;
+        continue;
+      }
+      // The first slot probed is the victim until one with a smaller budget
+      // turns up, so that a window of entries that all have the largest
+      // budget still gives one up.
+      if (victim_value == 0 || (value & 0xff) < (victim_value & 0xff)) {
+        victim = slot;
+        victim_value = value;
+      }
+      slot = (slot + 1) & mask_;
+    }
+
+    if (slots_[victim].compare_exchange_strong(victim_value, entry)) {
+      total_evictions++;
+      return true;
+    }
+  }
+}
+
+size_t FingerprintTable::Clear() {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(slots_);
+  uintptr_t end = begin + bytes();
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t first_page = (begin + page_size - 1) / page_size * page_size;
+  uint64_t slot = 0;
+  for (; slot <= mask_ && reinterpret_cast<uintptr_t>(&slots_[slot]) <
+      first_page; slot++) {
+    slots_[slot].store(0, std::memory_order_relaxed);
+  }
+  // The mapping is shared, so only removing its pages frees them; they read
+  // as zero, empty slots, afterwards.
+  if (first_page < end && madvise(reinterpret_cast<void*>(first_page),
+          end - first_page, MADV_REMOVE) == 0) {
+    return end - first_page;
+  }
+  for (; slot <= mask_; slot++) {
+    slots_[slot].store(0, std::memory_order_relaxed);
+  }
+  return 0;
+}
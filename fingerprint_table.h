@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A fixed-size table mapping state fingerprints to the largest exploration
+// budget (such as CHESS's remaining preemptions) they have been visited with.
+// It lives in a MAP_SHARED mapping and is only updated with compare-and-swap,
+// so processes forked after Create, such as checkpoints and parallel workers,
+// share what they have seen.
+//
+// Each slot packs the top 56 bits of a fingerprint with an 8-bit budget.
+// When all probed slots are taken, the entry with the smallest budget is
+// evicted, as it prunes the fewest subtrees. Fingerprints that agree in their
+// top bits collide, which like any hash collision can hide a state.
+class FingerprintTable {
+ public:
+  // Allocates a table of at most max_bytes, rounded down to a power of two.
+  static FingerprintTable* Create(size_t max_bytes);
+
+  // Records that the state with the given fingerprint is visited with
+  // budget, and returns false if it was already visited with at least as
+  // large a budget, in which case the visit can be pruned.
+  bool Visit(uint64_t fingerprint, int budget);
+
+  size_t bytes() const {
+    return (mask_ + 1) * sizeof(uint64_t);
+  }
+
+  // Forgets every visit and hands the pages of the table back to the kernel,
+  // returning the bytes freed. Visits racing with it may survive, which only
+  // prunes what would have been pruned before.
+  size_t Clear();
+
+ private:
+  uint64_t mask_;
+  std::atomic<uint64_t> slots_[1];
+};
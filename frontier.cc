@@ -0,0 +1,97 @@
+#include "frontier.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// The file is a header line followed by one line per item:
+//
+//   frontier <explorer> <preemptions> <number of items>
+//   <thread> <sleepset> <remaining> <path length> <path...> <number of sets>
+//       <available...> <explored...>
+//
+// Thread sets are written as their bitsets, one word per 64 threads.
+
+static void WriteThreadSet(std::ostream& out, const ThreadSet& set) {
+  for (int i = 0; i < kThreadSetWords; i++) {
+    out << " " << set.words[i];
+  }
+}
+
+static void ReadThreadSet(std::istream& in, ThreadSet* set) {
+  for (int i = 0; i < kThreadSetWords; i++) {
+    in >> set->words[i];
+  }
+}
+
+void SaveFrontier(const std::string& filename, const Frontier& frontier) {
+  // Written next to the destination first, so that a crash while saving
+  // leaves the previous frontier intact.
+  std::string temporary = filename + ".tmp";
+  std::ofstream out(temporary);
+  out << "frontier " << frontier.explorer << " " << frontier.preemptions
+      << " " << frontier.items.size() << "\n";
+  for (const FrontierItem& item : frontier.items) {
+    out << item.thread;
+    WriteThreadSet(out, item.sleepset);
+    out << " " << item.remaining << " " << item.path.size();
+    for (int8_t thread : item.path) {
+      out << " " << static_cast<int>(thread);
+    }
+    out << " " << item.available.size();
+    for (ThreadSet available : item.available) {
+      WriteThreadSet(out, available);
+    }
+    for (ThreadSet explored : item.explored) {
+      WriteThreadSet(out, explored);
+    }
+    out << "\n";
+  }
+  out.close();
+
+  if (!out || rename(temporary.c_str(), filename.c_str()) != 0) {
+    fprintf(stderr, "failed to save frontier to %s\n", filename.c_str());
+    exit(1);
+  }
+  fprintf(stderr, "saved %zu frontier items to %s\n", frontier.items.size(),
+      filename.c_str());
+}
+
+void LoadFrontier(const std::string& filename, Frontier* frontier) {
+  std::ifstream in(filename);
+  std::string magic;
+  size_t num_items = 0;
+  in >> magic >> frontier->explorer >> frontier->preemptions >> num_items;
+
+  frontier->items.clear();
+  for (size_t i = 0; in && magic == "frontier" && i < num_items; i++) {
+    FrontierItem item;
+    size_t length, sets;
+    in >> item.thread;
+    ReadThreadSet(in, &item.sleepset);
+    in >> item.remaining >> length;
+    for (size_t j = 0; in && j < length; j++) {
+      int thread;
+      in >> thread;
+      item.path.push_back(thread);
+    }
+    in >> sets;
+    for (size_t j = 0; in && j < sets; j++) {
+      ThreadSet available;
+      ReadThreadSet(in, &available);
+      item.available.push_back(available);
+    }
+    for (size_t j = 0; in && j < sets; j++) {
+      ThreadSet explored;
+      ReadThreadSet(in, &explored);
+      item.explored.push_back(explored);
+    }
+    frontier->items.push_back(item);
+  }
+
+  if (!in || magic != "frontier") {
+    fprintf(stderr, "failed to load frontier from %s\n", filename.c_str());
+    exit(1);
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "threadset.h"
+
+// The unexplored part of a search that ran out of budget, which a later
+// invocation can pick up with --resume.
+//
+// DPOR saves its outstanding backtrack points as items, in the same form as
+// the WorkItems handed between parallel workers. Bounded explorers save the
+// bound they were exploring along with what they had left of it. PBPOR and
+// CB-DPOR save the stack of their search as a single item, whose available
+// sets are the backtrack sets of the nodes along its path, and resume by
+// restoring it. CHESS and delay bounding save the children they had yet to
+// explore, each as the path to its parent, its thread and the bound left
+// after its step, in the order they would have explored them.
+
+struct FrontierItem {
+  FrontierItem() : thread(-1), remaining(0) {}
+
+  std::vector<int8_t> path;
+  // The available sets along the path, including its last node.
+  std::vector<ThreadSet> available;
+  // The threads already explored, or queued, from the nodes along the path.
+  std::vector<ThreadSet> explored;
+  // Thread to extend the last node with.
+  int thread;
+  ThreadSet sleepset;
+  // For CHESS and delay bounding, the preemptions or delays left after the
+  // step of thread, or -1 for a preemption CHESS deferred to the next
+  // bound, see chess_deferred.
+  int remaining;
+};
+
+struct Frontier {
+  Frontier() : preemptions(-1) {}
+
+  std::string explorer;
+  int preemptions;
+  std::deque<FrontierItem> items;
+};
+
+// Both exit the process if the file can not be written or parsed.
+void SaveFrontier(const std::string& filename, const Frontier& frontier);
+void LoadFrontier(const std::string& filename, Frontier* frontier);
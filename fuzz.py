@@ -0,0 +1,74 @@
+import argparse, ast, heapq, os, random, subprocess, time
+
+# Fuzzes a workload case, see make_workload_case in generator.py, by running
+# it on random workloads until the time budget runs out. Each new workload is
+# first explored broadly with PCT. Workloads whose runs order conflicting
+# accesses in ways no earlier run did, by the bits they add to the map of
+# --coverage-map, are queued by how many they added, and the best of them are
+# explored again in depth with CB-DPOR under growing preemption bounds.
+#
+#   python fuzz.py obj/cases/cds_msqueue_workload --seconds=3600
+
+parser = argparse.ArgumentParser()
+parser.add_argument('binary')
+parser.add_argument('--seconds', type=float, default=600)
+parser.add_argument('--run-seconds', type=float, default=10)
+parser.add_argument('--threads', type=int, nargs=2, default=[2, 3])
+parser.add_argument('--steps', type=int, nargs=2, default=[1, 3])
+parser.add_argument('--max-preemptions', type=int, default=3)
+parser.add_argument('--out', default='fuzz-out')
+parser.add_argument('--seed', type=int, default=0)
+args = parser.parse_args()
+
+random.seed(args.seed)
+binary = os.path.abspath(args.binary)
+out = os.path.abspath(args.out)
+if not os.path.isdir(os.path.join(out, 'bugs')):
+    os.makedirs(os.path.join(out, 'bugs'))
+coverage_map = os.path.join(out, 'coverage.map')
+
+# Entries are (-new coverage bits, number, workload, preemption bound to
+# explore next).
+queue = []
+bugs = open(os.path.join(out, 'bugs.txt'), 'a')
+deadline = time.time() + args.seconds
+
+def run(number, workload, flags):
+    command = [binary, '--workload=' + workload,
+               '--max-seconds=%g' % args.run_seconds,
+               '--coverage-map=' + coverage_map,
+               '--bug-dir=' + os.path.join(out, 'bugs', str(number))] + flags
+    process = subprocess.run(command, cwd=out, stdout=subprocess.DEVNULL,
+                             stderr=subprocess.PIPE, universal_newlines=True)
+    lines = [l for l in process.stderr.splitlines() if l.startswith('{')]
+    statistics = ast.literal_eval(lines[-1]) if lines else {}
+
+    new = statistics.get('conflict-coverage', 0)
+    total = 0
+    if os.path.exists(coverage_map):
+        with open(coverage_map, 'rb') as f:
+            total = sum(bin(byte).count('1') for byte in f.read())
+
+    if statistics.get('found', 0) > 0 or process.returncode != 0:
+        bugs.write(' '.join(command) + '\n')
+        bugs.flush()
+    print('%-24s %-36s %6d new %8d total %s' % (workload, ' '.join(flags), new,
+        total, 'found' if statistics.get('found', 0) else ''))
+    return new
+
+number = 0
+while time.time() < deadline:
+    number += 1
+    if queue and random.random() < 0.5:
+        new, _, workload, bound = heapq.heappop(queue)
+        flags = ['--explorer=cbdpor', '--min-preemptions=%d' % bound,
+                 '--max-preemptions=%d' % bound]
+        bound += 1
+    else:
+        workload = 'random:%dx%d:%d' % (random.randint(*args.threads),
+            random.randint(*args.steps), random.getrandbits(32))
+        flags = ['--explorer=pct', '--seed=%d' % random.getrandbits(32)]
+        bound = 1
+    new = run(number, workload, flags)
+    if new > 0 and bound <= args.max_preemptions:
+        heapq.heappush(queue, (-new, number, workload, bound))
@@ -41,6 +41,34 @@ crange_actions = {
     'find': 'return ds->search({key}, 1, 0) != nullptr ? 1 : 0;'
 }
 
+# The steps of a reference model, see reference_model.h, which run in place
+# of the instrumented data structure when linearizing.
+empty_models = {
+    'empty': "return model.empty();",
+}
+
+stack_models = {
+    'pop': "int x; return model.pop(x) ? x : -1;",
+    'push': "model.push({value}); return 0;",
+}
+
+queue_models = {
+    'dequeue': "int x; return model.dequeue(x) ? x : -1;",
+    'enqueue': "model.enqueue({value}); return 0;",
+}
+
+set_models = {
+    'find': "return model.find({key});",
+    'insert': "model.insert({key}); return 0;",
+    'erase': "return model.erase({key});",
+}
+
+crange_models = {
+    'insert': "model.insert({key}); return 0;",
+    'erase': "model.erase({key}); return 0;",
+    'find': "return model.find({key});",
+}
+
 data_structures = {
     "cds::container::TreiberStack<{GC}, int>": merge(stack_actions, empty_clear),
     "cds::container::BasketQueue<{GC}, int>": merge(queue_actions, empty_clear),       # found bug
@@ -55,6 +83,20 @@ data_structures = {
     "crange": crange_actions,
 }
 
+# The reference model of each data structure, and its steps.
+reference_models = {
+    "cds::container::TreiberStack<{GC}, int>": ("StackModel", merge(stack_models, empty_models)),
+    "cds::container::BasketQueue<{GC}, int>": ("QueueModel", merge(queue_models, empty_models)),
+    "cds::container::MoirQueue<{GC}, int>": ("QueueModel", merge(queue_models, empty_models)),
+    "cds::container::MSQueue<{GC}, int>": ("QueueModel", merge(queue_models, empty_models)),
+    "cds::container::OptimisticQueue<{GC}, int>": ("QueueModel", merge(queue_models, empty_models)),
+    "cds::container::RWQueue<int>": ("QueueModel", merge(queue_models, empty_models)),
+    "cds::container::LazyList<{GC}, int>": ("SetModel", merge(set_models, empty_models)),
+    "cds::container::SkipListSet<{GC}, int>": ("SetModel", merge(set_models, empty_models)),
+    "boost::lockfree::fifo<int>": ("QueueModel", merge(queue_models, empty_models)),
+    "crange": ("SetModel", crange_models),
+}
+
 simple_data_structures = {
     'cds_treiberstack': "cds::container::TreiberStack<{GC}, int>",
     'cds_rwqueue': "cds::container::RWQueue<int>",
@@ -83,29 +125,66 @@ def instantiate(line):
         line = line.replace("{GC}", "cds::gc::HP")
     return line
 
+# An action and the step of the reference model that mirrors it, with the
+# same key or value, and the key, or None if the action has none.
+def instantiate_step(data_structure, action):
+    line = data_structures[data_structure][action]
+    model = reference_models[data_structure][1][action]
+    key = None
+    if "{key}" in line:
+        key = str(random.choice(keys))
+        line, model = line.replace("{key}", key), model.replace("{key}", key)
+    if "{value}" in line:
+        value = str(random.randint(0, 100000))
+        line, model = line.replace("{value}", value), model.replace("{value}", value)
+    return (instantiate(line), model, key)
+
+def render(data_structure, threads):
+    return template.render({'data_structure': instantiate(data_structure), 'model': reference_models[data_structure][0], 'threads': threads, 'num_threads': len(threads)})
+
 def make_test_case(data_structure, num_threads, num_actions):
     data_structure = simple_data_structures[data_structure]
     threads = []
     for i in range(num_threads):
-        thread = [instantiate(random.choice(data_structures[data_structure].values())) for j in range(num_actions)]
+        thread = [instantiate_step(data_structure, random.choice(data_structures[data_structure].keys())) for j in range(num_actions)]
         threads.append(thread)
-
-    return template.render({'data_structure': instantiate(data_structure), 'threads': threads, 'num_threads': len(threads)})
+    return render(data_structure, threads)
 
 def make_general_case(data_structure, num_actions):
     data_structure = simple_data_structures[data_structure]
     threads = []
     for i in range(num_actions):
-        for line in data_structures[data_structure].values():
-            threads.append([instantiate(line)])
-    return template.render({'data_structure': instantiate(data_structure), 'threads': threads, 'num_threads': len(threads)})
+        for action in data_structures[data_structure]:
+            threads.append([instantiate_step(data_structure, action)])
+    return render(data_structure, threads)
 
 def make_specific_case(ds, threads):
     ds = simple_data_structures[ds]
-    threads = [[instantiate(data_structures[ds][action]) for action in thread] for thread in threads]
-    return template.render({'data_structure': instantiate(ds), 'threads': threads, 'num_threads': len(threads)})
+    threads = [[instantiate_step(ds, action) for action in thread] for thread in threads]
+    return render(ds, threads)
 
 
+# Workload cases register every operation and take their steps from the
+# --workload flag at run time, so sweeping workloads needs no rebuilds.
+def make_workload_case(data_structure):
+    data_structure = simple_data_structures[data_structure]
+    model_type, models = reference_models[data_structure]
+    operations = []
+    for name, line in sorted(data_structures[data_structure].items()):
+        num_arguments = 0
+        keyed = "{key}" in line
+        # Values are only stored and handed back, unlike keys, which sets
+        # compare.
+        data_independent = "{value}" in line
+        if keyed:
+            num_arguments = max(keys) + 1
+        elif data_independent:
+            num_arguments = 100000
+        line = line.replace("{key}", "argument").replace("{value}", "argument")
+        model = models[name].replace("{key}", "argument").replace("{value}", "argument")
+        operations.append((name, line, model, num_arguments, keyed, data_independent))
+    return template.render({'data_structure': instantiate(data_structure), 'model': model_type, 'operations': operations, 'num_threads': 0})
+
 #print make_test_case(random.choice(simple_data_structures.keys()), 4, 1)
 #print make_general_case(random.choice(simple_data_structures.keys()), 2)
 
@@ -115,6 +194,125 @@ for ds in ["crange"]:
         with open("cases/%s_rand_3x3_%d.cc" % (ds, i + 1), "w") as f:
             f.write(make_test_case(ds, 3, 3))
 
+for ds in ["cds_msqueue", "cds_treiberstack", "cds_lazylist"]:
+    with open("cases/%s_workload.cc" % ds, "w") as f:
+        f.write(make_workload_case(ds))
+
+# Cases that partial-order reduction finds hard, scaled up from
+# tests/test-dpor-breaker.cc and tests/test-many.cc to sizes that fit
+# kMaxThreads, see bench/por.py for their numbers of Mazurkiewicz traces.
+# In a breaker, n waiters write a[i] if they read done set, m workers set
+# b[i], and a watcher sets done if it reads all of b set, so only one order
+# of the watcher's reads after the workers' writes lets the waiters race.
+por_breaker = """#include "helper.h"
+
+const int N = %(n)d, M = %(m)d;
+std::atomic<int> a[N], b[M], done;
+
+void Waiter(int i) {
+  if (done)
+    a[i] = 1;
+}
+
+void Worker(int i) {
+  b[i] = 1;
+}
+
+void Watcher(int i) {
+  int all = 1;
+  for (int i = 0; i < M; i++) {
+    all = all & b[i];
+  }
+  if (all) {
+    done = 1;
+  }
+}
+
+void Setup() {
+  for (int i = 0; i < N; i++) {
+    a[i] = 0;
+    StartThread(Waiter, i);
+  }
+
+  for (int i = 0; i < M; i++) {
+    b[i] = 0;
+    StartThread(Worker, i);
+  }
+
+  done = 0;
+  StartThread(Watcher, 0);
+}
+
+void Finish() {
+  for (int i = 0; i < N; i++)
+    Output("%%d ", a[i].load());
+  for (int i = 0; i < M; i++)
+    Output("%%d ", b[i].load());
+  Output("%%d", done.load());
+  Output("\\n");
+}
+"""
+
+# n threads writing one location, in any of n! orders.
+por_writers = """#include "helper.h"
+
+const int N = %(n)d;
+
+std::atomic<int> a;
+
+void thread(int tid) {
+  a = tid;
+}
+
+void Setup() {
+  a = 0;
+  for (int i = 0; i < N; i++)
+    StartThread(thread, i);
+}
+
+void Finish() {
+  Output("a=%%d", a.load());
+  Output("\\n");
+}
+"""
+
+# n threads storing to one location twice, in any of (2n)!/2^n orders, of
+# which only the thread that stores last tells n reads-from traces apart.
+por_overwriters = """#include "helper.h"
+
+const int N = %(n)d;
+
+std::atomic<int> a;
+
+void thread(int tid) {
+  a = 2 * tid + 1;
+  a = 2 * tid + 2;
+}
+
+void Setup() {
+  a = 0;
+  for (int i = 0; i < N; i++)
+    StartThread(thread, i);
+}
+
+void Finish() {
+  Output("a=%%d", a.load());
+  Output("\\n");
+}
+"""
+
+for n, m in [(1, 1), (2, 2), (3, 3), (4, 3)]:
+    with open("cases/por_breaker_%dx%d.cc" % (n, m), "w") as f:
+        f.write(por_breaker % {'n': n, 'm': m})
+
+for n in [4, 5, 6, 7]:
+    with open("cases/por_writers_%d.cc" % n, "w") as f:
+        f.write(por_writers % {'n': n})
+
+for n in [3, 4, 5]:
+    with open("cases/por_overwriters_%d.cc" % n, "w") as f:
+        f.write(por_overwriters % {'n': n})
+
 '''
 bugs = [("cds_basketqueue", [["enqueue"], ["dequeue"], ["enqueue"], ["empty"], ["empty"]]),
     ("cds_msqueue", [["enqueue"], ["dequeue"], ["enqueue"], ["dequeue"]]),
@@ -1,52 +1,124 @@
 #pragma once
 
-const int kLogHashSize = 13;
-const int kHashSize = 1 << kLogHashSize;
-const int kHashMask = kHashSize - 1;
+#include <cstdint>
+#include <deque>
+#include <vector>
 
-template<class T>
-struct HashElement {
-  HashElement() {}
-  intptr_t address;
-  T value;
-  int epoch;
-};
+// An open-addressing table from addresses to values that is cleared in
+// constant time by bumping an epoch. The slot array doubles whenever it gets
+// half full or a probe sequence gets too long. Every address sits within
+// kMaxHashProbes slots of where it hashes to, which lookups rely on to stop
+// early, so growing doubles again until the addresses all fit that way. Values live in a separate
+// deque, so references to them stay valid while the table grows. They are
+// also reused after a Reset, which keeps any memory they hold. A slot's value
+// is Reset when it is handed out for a new address.
+
+const int kLogInitialHashSize = 13;
+const int kMaxHashProbes = 32;
 
 template<class T>
 class HashTable {
  public:
-  HashTable() {
-    for (int i = 0; i < kHashSize; i++) {
-      elements_[i].epoch = 0;
-    }
-    epoch = 1;
-  }
+  HashTable() : log_size_(kLogInitialHashSize), size_(0), epoch_(1),
+      slots_(1 << kLogInitialHashSize) {}
 
   T& operator[](intptr_t address) {
-    int key = address & kHashMask;
     while (true) {
-      HashElement<T>& element = elements_[key];
-      if (element.epoch == epoch) {
-        if (element.address == address) {
-          return element.value;
-        } else {
-          key = (key + 1) & kHashMask;
+      int mask = slots_.size() - 1;
+      int key = Hash(address);
+      for (int probe = 0; probe < kMaxHashProbes; probe++) {
+        Slot& slot = slots_[key];
+        if (slot.epoch != epoch_) {
+          if (2 * (size_ + 1) > static_cast<int>(slots_.size())) {
+            break;
+          }
+          slot.address = address;
+          slot.epoch = epoch_;
+          slot.index = size_++;
+          if (slot.index == static_cast<int>(values_.size())) {
+            values_.emplace_back();
+          }
+          T& value = values_[slot.index];
+          value.Reset();
+          return value;
+        } else if (slot.address == address) {
+          return values_[slot.index];
         }
-      } else {
-        element.address = address;
-        element.value.Reset();
-        element.epoch = epoch;
-        return element.value;
+        key = (key + 1) & mask;
       }
+      Grow();
     }
   }
 
+  // The value for address, or null if it has none, without adding it.
+  T* Find(intptr_t address) {
+    int mask = slots_.size() - 1;
+    int key = Hash(address);
+    for (int probe = 0; probe < kMaxHashProbes; probe++) {
+      Slot& slot = slots_[key];
+      if (slot.epoch != epoch_) {
+        return nullptr;
+      } else if (slot.address == address) {
+        return &values_[slot.index];
+      }
+      key = (key + 1) & mask;
+    }
+    return nullptr;
+  }
+
   void Reset() {
-    epoch++;
+    epoch_++;
+    size_ = 0;
   }
 
  private:
-  HashElement<T> elements_[kHashSize];
-  int epoch;
-};
+  struct Slot {
+    Slot() : epoch(0) {}
+    intptr_t address;
+    int epoch;
+    int index;
+  };
+
+  // Fibonacci hashing of the address without its low bits, which are zero
+  // for all aligned allocations.
+  inline int Hash(intptr_t address) const {
+    uint64_t key = static_cast<uint64_t>(address) >> 3;
+    return (key * 0x9e3779b97f4a7c15ULL) >> (64 - log_size_);
+  }
+
+  void Grow() {
+    std::vector<Slot> old_slots;
+    old_slots.swap(slots_);
+    while (!Rehash(old_slots)) {
+    }
+  }
 
+  // Puts the addresses of old_slots in a slot array twice the size of the
+  // current one, and returns false if one of them would not be within
+  // kMaxHashProbes slots of where it hashes to.
+  bool Rehash(const std::vector<Slot>& old_slots) {
+    slots_.assign(1 << ++log_size_, Slot());
+    int mask = slots_.size() - 1;
+    for (const Slot& old : old_slots) {
+      if (old.epoch != epoch_) {
+        continue;
+      }
+      int key = Hash(old.address);
+      int probe = 0;
+      while (slots_[key].epoch == epoch_) {
+        if (++probe == kMaxHashProbes) {
+          return false;
+        }
+        key = (key + 1) & mask;
+      }
+      slots_[key] = old;
+    }
+    return true;
+  }
+
+  int log_size_;
+  int size_;
+  int epoch_;
+  std::vector<Slot> slots_;
+  std::deque<T> values_;
+};
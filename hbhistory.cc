@@ -1,62 +1,552 @@
 #include "hbhistory.h"
 
-std::vector<int> HBHistory::FindFirstConflicts(int thread, const Transition& transition) {
-  Object& object = objects_[(intptr_t)transition.address()];
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
 
-  std::vector<int> first_conflicts;
+#include "background_writer.h"
+#include "conflict_coverage.h"
+#include "location_profile.h"
+#include "threadset.h"
+#include "timer.h"
 
-  std::vector<int>& conflicts = 
-      transition.can_write() ? object.accesses : object.writes;
-  for (int time : conflicts) {
-    if (!time_happens_before_thread(time, thread)) {
-      first_conflicts.push_back(time);
+CODEX_TIMER(hb_timer, "timer-hb");
+
+static inline intptr_t CellOf(const int8_t* address) {
+  return reinterpret_cast<intptr_t>(address) & ~(intptr_t)(kCellSize - 1);
+}
+
+// What store_at_ holds for each step of a reads-from history.
+enum : uint8_t {
+  kNotAStore = 0,
+  kUnobservedStore = 1,
+  kObservedStore = 2,
+};
+
+static inline intptr_t ObjectKey(const int8_t* start, int32_t length) {
+  // Lengths are at most 16, the size of the widest access.
+  return (reinterpret_cast<intptr_t>(start) << 5) | length;
+}
+
+Object& HBHistory::ObjectAt(int8_t* start, int32_t length) {
+  Object& object = objects_[ObjectKey(start, length)];
+  if (object.cells[0] == nullptr) {
+    // New since it was last accessed: make it known to the cells it
+    // overlaps.
+    object.start = start;
+    object.length = length;
+    intptr_t first = CellOf(start), last = CellOf(start + length - 1);
+    object.cells[0] = &cells_[first];
+    object.cells[0]->objects.push_back(&object);
+    object.cells[1] = nullptr;
+    if (last != first) {
+      object.cells[1] = &cells_[last];
+      object.cells[1]->objects.push_back(&object);
     }
   }
+  return object;
+}
 
-  return first_conflicts;
+// Called once the last access to object was rolled back, so that it no
+// longer stands in for the bytes it covers.
+void HBHistory::ForgetObject(Object* object) {
+  for (int i = 0; i < 2 && object->cells[i] != nullptr; i++) {
+    std::vector<Object*>& objects = object->cells[i]->objects;
+    *std::find(objects.begin(), objects.end(), object) = objects.back();
+    objects.pop_back();
+  }
+  object->cells[0] = nullptr;
+}
+
+template<class F>
+void HBHistory::ForEachOverlapping(int8_t* start, int32_t length, bool write,
+    bool commutes, bool add, const F& f) {
+  Object* object = add ? &ObjectAt(start, length) :
+      objects_.Find(ObjectKey(start, length));
+  if (object != nullptr && object->cells[0] == nullptr) {
+    object = nullptr;
+  }
+  if (object != nullptr) {
+    f(*object, write, commutes);
+  }
+
+  intptr_t first = CellOf(start), last = CellOf(start + length - 1);
+  for (intptr_t address = first; address <= last; address += kCellSize) {
+    Cell* cell;
+    if (object != nullptr) {
+      cell = object->cells[address == first ? 0 : 1];
+      if (cell->objects.size() == 1) {
+        continue;
+      }
+    } else {
+      cell = cells_.Find(address);
+      if (cell == nullptr) {
+        continue;
+      }
+    }
+    for (Object* other : cell->objects) {
+      // Objects in both cells were already found in the first.
+      if (other != object && other->start < start + length &&
+          start < other->start + other->length &&
+          (address == first || CellOf(other->start) == address)) {
+        f(*other, write, false);
+      }
+    }
+  }
+}
+
+template<class F>
+void HBHistory::ForEachObject(const Transition& transition, int64_t value,
+    bool add, const F& f, bool may_write) {
+  if (transition.is_simple()) {
+    bool write =
+        may_write ? transition.can_write() : transition.DoesWrite(value);
+    ForEachOverlapping(transition.address(), transition.length(), write,
+        write && transition.commutes(), add, f);
+    return;
+  }
+  // Other transitions have an object for their part of each cell of each
+  // range they access.
+  AccessRange ranges[2];
+  int num_ranges = transition.AccessRanges(ranges);
+  for (int i = 0; i < num_ranges; i++) {
+    int8_t* end = ranges[i].start + ranges[i].length;
+    for (int8_t* piece = ranges[i].start; piece < end;) {
+      int8_t* next = reinterpret_cast<int8_t*>(CellOf(piece) + kCellSize);
+      next = std::min(next, end);
+      ForEachOverlapping(piece, next - piece, ranges[i].write, false, add, f);
+      piece = next;
+    }
+  }
+}
+
+void HBHistory::FindFirstConflicts(int thread, const Transition& transition,
+    std::vector<int>* first_conflicts, bool may_write) {
+  const ClockVector& cv = current_cv_for_[thread];
+  int begin = first_conflicts->size();
+  ForEachObject(transition, may_write ? 0 : transition.Read(), false,
+      [&](Object& object, bool write, bool commutes) {
+    const AccessList& conflicts = commutes ? object.non_adds :
+        write ? object.accesses : object.writes;
+    // The accesses of one thread are ordered by happens-before, so those
+    // that do not happen before thread are the ones after the latest that
+    // does.
+    size_t found = first_conflicts->size();
+    for (int other_thread : conflicts.threads) {
+      if (other_thread == thread) {
+        continue;
+      }
+      for (int i = conflicts.last_of[other_thread];
+          i != -1 && access_entries_[i].time > cv[other_thread];
+          i = access_entries_[i].previous_of_thread) {
+        first_conflicts->push_back(access_entries_[i].time);
+      }
+    }
+    ProfileAddressConflicts(object.start, first_conflicts->size() - found);
+  }, may_write);
+  std::sort(first_conflicts->begin() + begin, first_conflicts->end());
+  // A step that accessed several of the same objects was found for each.
+  first_conflicts->erase(std::unique(first_conflicts->begin() + begin,
+        first_conflicts->end()), first_conflicts->end());
+  ProfileConflicts(transition, first_conflicts->size() - begin);
+  if (conflict_coverage != nullptr) {
+    for (size_t i = begin; i < first_conflicts->size(); i++) {
+      CoverConflict(transition_at((*first_conflicts)[i]).location(),
+          transition.location());
+    }
+  }
+}
+
+void HBHistory::RaiseAndRecord(Object* object, const ClockVector& by,
+    ClockVector Object::* which) {
+  ClockVector& cv = object->*which;
+  for (int thread : threads_) {
+    if (by[thread] > cv[thread]) {
+      undo_entries_.push_back(UndoEntry{object, which, thread, cv[thread]});
+      cv[thread] = by[thread];
+    }
+  }
 }
 
 void HBHistory::AddTransition(int thread, const Transition& transition) {
   History::AddTransition(thread, transition);
+  if (!lazy_) {
+    IndexStep(length() - 1);
+  }
+}
 
-  Object& object = objects_[(intptr_t)transition.address()];
+void HBHistory::CatchUp() {
+  if (reads_from_ && indexed_ < length()) {
+    FindObservedStores();
+  }
+  while (indexed_ < length()) {
+    IndexStep(indexed_);
+  }
+}
 
-  int time = length() - 1;
+void HBHistory::CopySteps(const History& history) {
+  Reset();
+  for (int time = 0; time < history.length(); time++) {
+    AddStep(history.thread_at(time), history.transition_at(time),
+        history.previous_value_at(time));
+  }
+  if (!lazy_) {
+    CatchUp();
+  }
+}
 
-  current_cv_for_[thread][thread] = time;
+// A store is unobserved if the next step to touch any of its cells is a
+// store of the same bytes, which then touches all of them; any other step,
+// or none, observes it. Steps that only touch other bytes of its cells count
+// as observers too, which orders more than needed but never too little.
+void HBHistory::FindObservedStores() {
+  store_at_.resize(length());
+  // The next step from the current one on that touches each cell.
+  std::unordered_map<intptr_t, int> next_in_cell;
+  for (int time = length() - 1; time >= indexed_; time--) {
+    const Transition& transition = transition_at(time);
+    AccessRange ranges[2];
+    int num_ranges = transition.AccessRanges(ranges);
+    store_at_[time] = kNotAStore;
+    if (transition.type() == TransitionType::WRITE && !transition.is_wide() &&
+        transition.DoesWrite(previous_value_at(time))) {
+      int next = -1;
+      bool overwritten = true;
+      intptr_t first = CellOf(transition.address());
+      intptr_t last =
+          CellOf(transition.address() + transition.length() - 1);
+      for (intptr_t cell = first; cell <= last; cell += kCellSize) {
+        auto it = next_in_cell.find(cell);
+        if (it == next_in_cell.end() || (next != -1 && it->second != next)) {
+          overwritten = false;
+          break;
+        }
+        next = it->second;
+      }
+      overwritten = overwritten && store_at_[next] != kNotAStore &&
+          transition_at(next).address() == transition.address() &&
+          transition_at(next).length() == transition.length();
+      store_at_[time] = overwritten ? kUnobservedStore : kObservedStore;
+    }
+    for (int i = 0; i < num_ranges; i++) {
+      intptr_t first = CellOf(ranges[i].start);
+      intptr_t last = CellOf(ranges[i].start + ranges[i].length - 1);
+      for (intptr_t cell = first; cell <= last; cell += kCellSize) {
+        next_in_cell[cell] = time;
+      }
+    }
+  }
+}
 
-  if (transition.can_write()) {
-    current_cv_for_[thread].Maximize(object.access_cv);
-    object.access_cv.Maximize(current_cv_for_[thread]);
-    object.write_cv.Maximize(current_cv_for_[thread]);
-    object.accesses.push_back(time);
-    object.writes.push_back(time);
-  } else {
-    current_cv_for_[thread].Maximize(object.write_cv);
-    object.access_cv.Maximize(current_cv_for_[thread]);
-    object.accesses.push_back(time);
+void HBHistory::NoteRaces(int time, const ClockVector& previous_cv,
+    int begin, int end) {
+  int thread = thread_at(time);
+  bool unobserved = store_at_[time] == kUnobservedStore;
+  size_t first = races_.size();
+  for (int i = begin; i < end; i++) {
+    const ObjectAccess& access = object_accesses_[i];
+    const AccessList& conflicts = access.add ? access.object->non_adds :
+        !access.write ? access.object->writes :
+        unobserved ? access.object->reads : access.object->accesses;
+    for (int other_thread : conflicts.threads) {
+      if (other_thread == thread) {
+        continue;
+      }
+      for (int j = conflicts.last_of[other_thread];
+          j != -1 && access_entries_[j].time > previous_cv[other_thread];
+          j = access_entries_[j].previous_of_thread) {
+        races_.push_back(std::make_pair(access_entries_[j].time, time));
+      }
+    }
+  }
+  std::sort(races_.begin() + first, races_.end());
+  races_.erase(std::unique(races_.begin() + first, races_.end()),
+      races_.end());
+  // Only the steps that no other of them happens after race directly.
+  size_t kept = first;
+  for (size_t i = first; i < races_.size(); i++) {
+    int earlier = races_[i].first;
+    bool direct = true;
+    for (size_t j = first; j < races_.size(); j++) {
+      if (j != i &&
+          cv_at_.Get(races_[j].first, thread_at(earlier)) >= earlier) {
+        direct = false;
+        break;
+      }
+    }
+    if (direct) {
+      races_[kept++] = races_[i];
+    }
   }
+  races_.resize(kept);
+}
+
+void HBHistory::IndexStep(int time) {
+  CODEX_TIMED_SCOPE(hb_timer);
+  int thread = thread_at(time);
+  const Transition& transition = transition_at(time);
+  indexed_ = time + 1;
+  threads_.insert(thread);
 
-  cv_at_.push_back(current_cv_for_[thread]);
+  int begin = object_accesses_.size();
+  ForEachObject(transition, previous_value_at(time), true,
+      [&](Object& object, bool write, bool commutes) {
+    object_accesses_.push_back(ObjectAccess{&object, write, commutes});
+  });
+  int end = object_accesses_.size();
+
+  ClockVector previous_cv = current_cv_for_[thread];
+  ClockVector& cv = current_cv_for_[thread];
+  cv[thread] = time;
+  if (reads_from_) {
+    NoteRaces(time, previous_cv, begin, end);
+  }
+  bool unobserved = reads_from_ && store_at_[time] == kUnobservedStore;
+  bool reads = reads_from_ && store_at_[time] == kNotAStore;
+
+  // The step happens after every conflicting access to any of its objects,
+  // and every later conflicting access happens after it. An unobserved store
+  // only conflicts with the reads.
+  for (int i = begin; i < end; i++) {
+    const ObjectAccess& access = object_accesses_[i];
+    cv.Maximize(access.add ? access.object->non_add_cv :
+        !access.write ? access.object->write_cv :
+        unobserved ? access.object->read_cv : access.object->access_cv);
+  }
+  for (int i = begin; i < end; i++) {
+    const ObjectAccess& access = object_accesses_[i];
+    RaiseAndRecord(access.object, cv, &Object::access_cv);
+    access.object->accesses.Add(&access_entries_, thread, time);
+    if (access.write) {
+      RaiseAndRecord(access.object, cv, &Object::write_cv);
+      access.object->writes.Add(&access_entries_, thread, time);
+    }
+    if (commuting_adds && !access.add) {
+      RaiseAndRecord(access.object, cv, &Object::non_add_cv);
+      access.object->non_adds.Add(&access_entries_, thread, time);
+    }
+    if (reads) {
+      RaiseAndRecord(access.object, cv, &Object::read_cv);
+      access.object->reads.Add(&access_entries_, thread, time);
+    }
+  }
+  object_accesses_end_at_.push_back(end);
+  undo_entries_end_at_.push_back(undo_entries_.size());
+
+  cv_at_.Add(last_time_of_[thread], previous_cv, current_cv_for_[thread],
+      threads_);
 
   previous_time_of_thread_at_.push_back(last_time_of_[thread]);
-  last_time_of_[thread] = length() - 1;
+  last_time_of_[thread] = time;
 }
 
 void HBHistory::Reset() {
   History::Reset();
+  indexed_ = 0;
 
   objects_.Reset();
-  cv_at_.clear();
+  cells_.Reset();
+  access_entries_.clear();
+  object_accesses_.clear();
+  object_accesses_end_at_.clear();
+  undo_entries_.clear();
+  undo_entries_end_at_.clear();
+  cv_at_.Reset();
   current_cv_for_.clear();
 
-  for (int i = 0; i < kMaxThreads; i++) {
-    current_cv_for_[i] = ClockVector();
-  }
-
   previous_time_of_thread_at_.clear();
   for (int i = 0; i < kMaxThreads; i++) {
     last_time_of_[i] = -1;
   }
+  threads_.clear();
+  store_at_.clear();
+  races_.clear();
+}
+
+void HBHistory::Reserve(int capacity) {
+  History::Reserve(capacity);
+  access_entries_.reserve(capacity);
+  object_accesses_.reserve(capacity);
+  object_accesses_end_at_.reserve(capacity);
+  undo_entries_end_at_.reserve(capacity);
+  cv_at_.Reserve(capacity);
+  previous_time_of_thread_at_.reserve(capacity);
+}
+
+void HBHistory::Truncate(int new_length) {
+  // Steps not indexed yet have nothing to undo.
+  if (new_length >= indexed_) {
+    History::Truncate(new_length);
+    return;
+  }
+  History::Truncate(indexed_);
+  indexed_ = new_length;
+
+  ThreadSet rolled_back;
+  for (int time = length() - 1; time >= new_length; time--) {
+    int thread = thread_at(time);
+
+    int begin = time > 0 ? object_accesses_end_at_[time - 1] : 0;
+    for (int i = object_accesses_end_at_[time] - 1; i >= begin; i--) {
+      const ObjectAccess& access = object_accesses_[i];
+      if (commuting_adds && !access.add) {
+        access.object->non_adds.RemoveLast(&access_entries_, thread);
+      }
+      if (reads_from_ && store_at_[time] == kNotAStore) {
+        access.object->reads.RemoveLast(&access_entries_, thread);
+      }
+      if (access.write) {
+        access.object->writes.RemoveLast(&access_entries_, thread);
+      }
+      access.object->accesses.RemoveLast(&access_entries_, thread);
+      if (access.object->accesses.empty()) {
+        ForgetObject(access.object);
+      }
+    }
+    begin = time > 0 ? undo_entries_end_at_[time - 1] : 0;
+    for (int i = undo_entries_end_at_[time] - 1; i >= begin; i--) {
+      const UndoEntry& undo = undo_entries_[i];
+      (undo.object->*undo.cv)[undo.thread] = undo.time;
+    }
+
+    last_time_of_[thread] = previous_time_of_thread_at_[time];
+    rolled_back.insert(thread);
+  }
+
+  object_accesses_.resize(
+      new_length > 0 ? object_accesses_end_at_[new_length - 1] : 0);
+  object_accesses_end_at_.resize(new_length);
+  undo_entries_.resize(new_length > 0 ? undo_entries_end_at_[new_length - 1] : 0);
+  undo_entries_end_at_.resize(new_length);
+  cv_at_.Truncate(new_length);
+  previous_time_of_thread_at_.resize(new_length);
+  if (reads_from_) {
+    store_at_.resize(new_length);
+    while (!races_.empty() && races_.back().second >= new_length) {
+      races_.pop_back();
+    }
+  }
+
+  for (int thread : rolled_back) {
+    int previous = last_time_of_[thread];
+    current_cv_for_[thread] =
+        previous == -1 ? ClockVector() : cv_at_.Full(previous);
+    if (previous == -1) {
+      threads_.erase(thread);
+    }
+  }
+
+  History::Truncate(new_length);
+}
+
+void HBHistory::ComputeHBGraph(std::vector<uint8_t>* relevant,
+    std::vector<uint32_t>* edges_begin, std::vector<int32_t>* sources) const {
+  std::unordered_map<uint64_t, std::pair<ThreadSet, ThreadSet>> accessors;
+  std::vector<uint64_t> address_at(length());
+  for (int time = 0; time < length(); time++) {
+    TraceRecord record;
+    transition_at(time).Dump(thread_at(time), time, previous_value_at(time),
+        &record);
+    address_at[time] = record.address;
+    std::pair<ThreadSet, ThreadSet>& threads = accessors[record.address];
+    (record.does_write ? threads.first : threads.second).insert(
+        thread_at(time));
+  }
+
+  std::vector<int> candidates;
+  for (int time = 0; time < length(); time++) {
+    const std::pair<ThreadSet, ThreadSet>& threads =
+        accessors[address_at[time]];
+    ThreadSet readers = threads.second - threads.first;
+    relevant->push_back(threads.first.size() > 1 ||
+        (threads.first.size() == 1 && !readers.empty()));
+
+    // The latest step of each other thread that happens before this one,
+    // unless the previous step of this thread already happens after it.
+    int thread = thread_at(time);
+    int previous = previous_time_of_thread_at(time);
+    candidates.clear();
+    for (int other : threads_) {
+      int latest = other == thread ? -1 : cv_at(time, other);
+      if (latest >= 0 && (previous < 0 || cv_at(previous, other) < latest)) {
+        candidates.push_back(latest);
+      }
+    }
+    edges_begin->push_back(sources->size());
+    for (int candidate : candidates) {
+      bool direct = true;
+      for (int other : candidates) {
+        if (other != candidate &&
+            cv_at(other, thread_at(candidate)) >= candidate) {
+          direct = false;
+          break;
+        }
+      }
+      if (direct) {
+        sources->push_back(candidate);
+      }
+    }
+  }
+  edges_begin->push_back(sources->size());
+}
+
+template<class T>
+static void AppendBytes(std::string* data, const T* values, size_t count) {
+  data->append(reinterpret_cast<const char*>(values), count * sizeof(T));
 }
 
+void HBHistory::Dump(const char* path) const {
+  History::Dump(path);
+  if (hb_graph_format.empty()) {
+    return;
+  }
+  // Catching up only works out what the steps already imply.
+  const_cast<HBHistory*>(this)->CatchUp();
+
+  std::vector<uint8_t> relevant;
+  std::vector<uint32_t> edges_begin;
+  std::vector<int32_t> sources;
+  ComputeHBGraph(&relevant, &edges_begin, &sources);
+
+  std::string graph_path = path;
+  if (graph_path.size() >= 4 &&
+      graph_path.compare(graph_path.size() - 4, 4, ".bin") == 0) {
+    graph_path.resize(graph_path.size() - 4);
+  }
+  std::string data;
+  if (hb_graph_format == "dot") {
+    graph_path += ".dot";
+    std::stringstream dot;
+    dot << "digraph hb {\n";
+    for (int time = 0; time < length(); time++) {
+      dot << "  s" << time << " [label=\"" << time << ": thread " <<
+          thread_at(time) << "\"" << (relevant[time] ? ", style=bold" : "") <<
+          "];\n";
+      if (previous_time_of_thread_at(time) >= 0) {
+        dot << "  s" << previous_time_of_thread_at(time) << " -> s" << time <<
+            " [style=dashed];\n";
+      }
+      for (uint32_t i = edges_begin[time]; i < edges_begin[time + 1]; i++) {
+        dot << "  s" << sources[i] << " -> s" << time << ";\n";
+      }
+    }
+    dot << "}\n";
+    data = dot.str();
+  } else {
+    graph_path += ".hb";
+    uint32_t version = 1, reserved = 0;
+    uint64_t num_steps = length(), num_edges = sources.size();
+    data.append("CODEXHBG", 8);
+    AppendBytes(&data, &version, 1);
+    AppendBytes(&data, &reserved, 1);
+    AppendBytes(&data, &num_steps, 1);
+    AppendBytes(&data, &num_edges, 1);
+    AppendBytes(&data, edges_begin.data(), edges_begin.size());
+    AppendBytes(&data, sources.data(), sources.size());
+    AppendBytes(&data, relevant.data(), relevant.size());
+  }
+  WriteFileInBackground(graph_path, std::move(data));
+}
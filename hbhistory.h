@@ -1,60 +1,229 @@
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "clockvector.h"
+#include "clockvector_log.h"
 #include "hashtable.h"
 #include "history.h"
+#include "spill_vector.h"
 #include "threadmap.h"
+#include "threadset.h"
 #include "transition.h"
 
+// The times at which an object was accessed, with the accesses of each thread
+// linked from its latest one backwards. The entries of all the lists of a
+// history live in one buffer, in the order they were added, so that adding
+// to a list allocates nothing and a reset frees them all at once.
+struct AccessList {
+  struct Entry {
+    int time;
+    int previous_of_thread;
+  };
+  typedef SpillVector<Entry> Buffer;
+
+  ThreadSet threads;
+  // Indices into the buffer, only valid for threads in threads.
+  int last_of[kMaxThreads];
+
+  void Reset() {
+    threads = ThreadSet();
+  }
+
+  inline bool empty() const {
+    return threads.empty();
+  }
+
+  void Add(Buffer* buffer, int thread, int time) {
+    int previous = threads.count(thread) ? last_of[thread] : -1;
+    buffer->push_back(Entry{time, previous});
+    threads.insert(thread);
+    last_of[thread] = buffer->size() - 1;
+  }
+
+  // Removes the latest entry, which must belong to thread and be the last in
+  // the buffer.
+  void RemoveLast(Buffer* buffer, int thread) {
+    assert(last_of[thread] == static_cast<int>(buffer->size()) - 1);
+    int previous = buffer->back().previous_of_thread;
+    buffer->pop_back();
+    if (previous == -1) {
+      threads.erase(thread);
+    } else {
+      last_of[thread] = previous;
+    }
+  }
+};
+
+struct Cell;
+
+// The bytes [start, start + length) as accessed by a transition, of at most
+// 16 bytes; the 16-byte ones are aligned, so an object overlaps at most two
+// cells. Accesses of different sizes to the same memory are different
+// objects, which find each other through the cells they overlap.
+//
+// With commuting_adds, the adds of an object, see Transition::commutes, only
+// conflict with its other accesses, which are also kept apart.
+//
+// A reads-from history, see HBHistory::set_reads_from, also keeps the
+// accesses that read the object, which are all but its stores.
 struct Object {
-  std::vector<int> accesses;
-  std::vector<int> writes;
-  ClockVector access_cv, write_cv;
+  AccessList accesses;
+  AccessList writes;
+  AccessList non_adds; // only with commuting_adds
+  AccessList reads; // only in a reads-from history
+  ClockVector access_cv, write_cv, non_add_cv, read_cv;
+  int8_t* start;
+  int32_t length;
+  // The cells the object overlaps; the second is null unless it straddles
+  // two.
+  Cell* cells[2];
 
   // Objects are stored in a Hashtable that uses Reset to clear out objects.
   void Reset() {
-    accesses.clear();
-    writes.clear();
+    accesses.Reset();
+    writes.Reset();
+    non_adds.Reset();
+    reads.Reset();
     access_cv.Reset();
     write_cv.Reset();
+    non_add_cv.Reset();
+    read_cv.Reset();
+    cells[0] = nullptr;
+  }
+
+  inline bool Overlaps(const Object& o) const {
+    return start < o.start + o.length && o.start < start + length;
+  }
+};
+
+// An aligned kCellSize bytes of memory, and every object that overlaps it.
+// Nearly all memory is only ever accessed with one size, in which case the
+// cell holds a single object.
+const int kCellSize = 8;
+
+struct Cell {
+  std::vector<Object*> objects;
+
+  void Reset() {
+    objects.clear();
   }
 };
 
 class HBHistory : public History {
  public:
+  HBHistory() : lazy_(false), reads_from_(false), indexed_(0) {}
+
   virtual void AddTransition(int thread, const Transition& transition);
   virtual void Reset();
-  std::vector<int> FindFirstConflicts(int thread, const Transition& transition);
+  virtual void Truncate(int length);
+  virtual void Reserve(int capacity);
+
+  // Writes the steps as History::Dump does, and with hb_graph_format their
+  // happens-before graph next to them, to path with .hb or .dot in place of
+  // .bin, so that viewers need not work it out again. The graph is the
+  // transitive reduction of happens-before between the steps of different
+  // threads: each step lists the steps of other threads that it happens
+  // after directly, not through another listed step or the previous step of
+  // its thread. A step is relevant, as dumper.py shows them, if its address
+  // is written by more than one thread, or written by one and read by
+  // another. The .hb file holds, in native byte order,
+  //
+  //   char magic[8] = "CODEXHBG", uint32_t version = 1, uint32_t reserved,
+  //   uint64_t num_steps, uint64_t num_edges,
+  //   uint32_t edges_begin[num_steps + 1], the range of each step's edges,
+  //   int32_t sources[num_edges], the times of the steps they come from,
+  //   uint8_t relevant[num_steps];
+  //
+  // the .dot file has a node per step, relevant ones in bold, and the edges
+  // of the reduction along with those of program order, dashed.
+  virtual void Dump(const char* path = kTraceFile) const;
 
+  // A lazy history only records the steps as they are added, and leaves
+  // their clock vectors, access lists and hashes until CatchUp, so that
+  // explorers that only replay and count steps do not pay for them. Queries
+  // of happens-before need CatchUp first; those of the steps themselves do
+  // not. PHHBHistory, which queries as it adds, cannot be lazy.
+  inline void set_lazy(bool lazy) {
+    lazy_ = lazy;
+  }
+  inline bool lazy() const {
+    return lazy_;
+  }
+  void CatchUp();
+
+  // A reads-from history leaves out the orders between writes that no step
+  // observes: a store that writes only happens after the earlier writes to
+  // its memory if a later step reads what it wrote, or nothing overwrites it
+  // before the run ends, and Finish sees it. Runs that only differ in the
+  // order of such stores have the same reads-from function and final memory,
+  // and are one trace here. Which stores are observed follows from the steps
+  // after them, so a reads-from history is lazy, and is caught up once its
+  // run is complete, as CatchUp would otherwise order stores that are
+  // observed later after the writes before them. It also notes the races of
+  // the steps as it catches up, see races.
+  void set_reads_from(bool reads_from) {
+    reads_from_ = reads_from;
+    lazy_ = lazy_ || reads_from;
+  }
+  inline bool reads_from() const {
+    return reads_from_;
+  }
+  // The races of a caught up reads-from history, as pairs of the times of
+  // their steps: the earlier steps of other threads that each step depends
+  // on directly, not through another step, in the order of the later step.
+  inline const std::vector<std::pair<int, int>>& races() const {
+    return races_;
+  }
+  // Replaces the steps with those of history, to be indexed anew.
+  void CopySteps(const History& history);
+
+  // Appends the times of the earlier steps that conflict with transition, as
+  // it would run on the current memory, and do not happen before the next
+  // step of thread, in increasing order. With may_write, a CAS or
+  // read-modify-write counts as a write whatever memory holds.
+  void FindFirstConflicts(int thread, const Transition& transition,
+      std::vector<int>* first_conflicts, bool may_write = false);
+
+  // A step's own component of its clock vector is its time.
   inline bool time_happens_before_time(int a, int b) const {
-    int thread = thread_at(a);
-    return cv_at_[b][thread] >= cv_at_[a][thread];
+    return cv_at_.Get(b, thread_at(a)) >= a;
   }
   inline bool time_happens_before_thread(int time, int thread) const {
-    int other_thread = thread_at(time);
-    return current_cv_for_[thread][other_thread] >= cv_at_[time][other_thread];
+    return current_cv_for_.count(thread) &&
+        current_cv_for_[thread][thread_at(time)] >= time;
   }
-  inline const ClockVector& cv_at(int time) const {
-    return cv_at_[time];
+  inline int cv_at(int time, int thread) const {
+    return cv_at_.Get(time, thread);
+  }
+  inline ClockVector cv_at(int time) const {
+    return cv_at_.Full(time);
   }
   inline ClockVector current_cv_for(int thread) const {
-    return current_cv_for_[thread];
+    return current_cv_for_.count(thread) ?
+        current_cv_for_[thread] : ClockVector();
   }
   inline int64_t previous_time_of_thread_at(int time) const {
     return previous_time_of_thread_at_[time];
   }
+  // The threads that took a step in the history. Clock vectors only have
+  // components for these, so loops over threads need not visit the others.
+  inline const ThreadSet& threads() const {
+    return threads_;
+  }
 
   bool IsSplit(int a, int b) {
     int thread = thread_at(b);
-    for (int other_thread = 0; other_thread < kMaxThreads; other_thread++) {
+    for (int other_thread : threads_) {
       if (thread == other_thread) {
         continue;
       }
-      int seen_them = cv_at(b)[other_thread];
+      int seen_them = cv_at(b, other_thread);
       if (seen_them != -1) {
-        int seen_us = cv_at(seen_them)[thread];
+        int seen_us = cv_at(seen_them, thread);
         if (seen_us >= a) {
           return true;
         }
@@ -63,11 +232,82 @@ class HBHistory : public History {
     return false;
   }
 
+ protected:
+  // Computes the happens-before of the step at time, the first that does
+  // not have it yet.
+  virtual void IndexStep(int time);
+
  private:
+  // An object a step accessed, whether it wrote it, and whether that was an
+  // add that commutes with the object's other adds. Most steps access a
+  // single object; a step also accesses every object that overlaps one of
+  // its own, and a ranged transition has an object in each cell it covers.
+  struct ObjectAccess {
+    Object* object;
+    bool write;
+    bool add;
+  };
+
+  // What AddTransition overwrote, so that Truncate can undo it: the
+  // components of the objects' clock vectors the step raised. The clock
+  // vector and last time of the thread are recovered from earlier steps.
+  struct UndoEntry {
+    Object* object;
+    ClockVector Object::* cv;
+    int32_t thread;
+    int32_t time;
+  };
+
+  Object& ObjectAt(int8_t* start, int32_t length);
+  void ForgetObject(Object* object);
+  // The relevance and reduced happens-before edges of each step, see Dump.
+  void ComputeHBGraph(std::vector<uint8_t>* relevant,
+      std::vector<uint32_t>* edges_begin, std::vector<int32_t>* sources) const;
+  // Calls f(object, write, commutes) for the object of the bytes [start,
+  // start + length) and every other object that overlaps them, where only
+  // the first can commute. Unless add is set, objects that no step accessed
+  // yet are left out rather than added.
+  template<class F>
+  void ForEachOverlapping(int8_t* start, int32_t length, bool write,
+      bool commutes, bool add, const F& f);
+  // Calls f(object, write, commutes) for each object transition accesses
+  // when it runs with value in memory. Steps count as writes by what they
+  // do, so that a failed CAS is independent of other reads, unless
+  // may_write.
+  template<class F>
+  void ForEachObject(const Transition& transition, int64_t value, bool add,
+      const F& f, bool may_write = false);
+  void RaiseAndRecord(Object* object, const ClockVector& by,
+      ClockVector Object::* cv);
+  // Works out which of the stores from indexed_ on are observed, see
+  // set_reads_from.
+  void FindObservedStores();
+  // Notes the races of the step at time, whose objects are the accesses from
+  // begin to end and whose thread had previous_cv before it, see races.
+  void NoteRaces(int time, const ClockVector& previous_cv, int begin,
+      int end);
+
+  bool lazy_;
+  bool reads_from_;
+  // The steps before indexed_ have their happens-before computed.
+  int indexed_;
   HashTable<Object> objects_;
-  std::vector<ClockVector> cv_at_;
+  HashTable<Cell> cells_;
+  // The entries of every object's access lists.
+  AccessList::Buffer access_entries_;
+  SpillVector<ObjectAccess> object_accesses_;
+  SpillVector<int> object_accesses_end_at_;
+  SpillVector<UndoEntry> undo_entries_;
+  SpillVector<int> undo_entries_end_at_;
+  ClockVectorLog cv_at_;
+  // Threads that took no step since the reset have no entry.
   ThreadMap<ClockVector> current_cv_for_;
-  std::vector<int> previous_time_of_thread_at_;
+  SpillVector<int> previous_time_of_thread_at_;
   ThreadMap<int> last_time_of_;
+  ThreadSet threads_;
+  // Reads-from histories only: for each step, whether it is a store, and
+  // whether one that is observed, and the races noted so far.
+  std::vector<uint8_t> store_at_;
+  std::vector<std::pair<int, int>> races_;
 };
 
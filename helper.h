@@ -3,6 +3,7 @@
 #include "program_interface.h"
 
 #include <atomic>
+#include <cassert>
 
 #include "config.h"
 #include "clockvector.h"
@@ -20,9 +21,7 @@ class Mutex {
   }
 
   void Acquire() {
-    bool old = false;
-    RequireResult(old);
-    while (!held.compare_exchange_weak(old, true)) {}
+    AcquireLock(&held);
   }
 
   bool TryAcquire() {
@@ -31,7 +30,7 @@ class Mutex {
   }
 
   void Release() {
-    held = false;
+    ReleaseLock(&held);
   }
 
  private:
@@ -52,9 +51,7 @@ class RecursiveMutex {
       return;
     }
 
-    bool old = false;
-    RequireResult(old);
-    while (!held.compare_exchange_weak(old, true)) {}
+    AcquireLock(&held);
   }
 
   bool TryAcquire() {
@@ -73,7 +70,7 @@ class RecursiveMutex {
       return;
     }
 
-    held = false;
+    ReleaseLock(&held);
   }
 
  private:
@@ -81,6 +78,38 @@ class RecursiveMutex {
   int count[kMaxThreadId];
 };
 
+// The waits of program_interface.h on a std::atomic.
+template<class T>
+void WaitUntilEquals(const std::atomic<T>& atomic, T value) {
+  WaitUntilEquals(&atomic, sizeof(T), static_cast<int64_t>(value));
+}
+
+template<class T>
+void WaitUntilAtLeast(const std::atomic<T>& atomic, T value) {
+  WaitUntilAtLeast(&atomic, sizeof(T), static_cast<int64_t>(value));
+}
+
+template<class T>
+void FutexWait(const std::atomic<T>& atomic, T expected) {
+  FutexWait(&atomic, sizeof(T), static_cast<int64_t>(expected));
+}
+
+// Runs the accesses of the current thread from construction to destruction
+// as a single step, see BeginAtomicSection.
+class AtomicSection {
+ public:
+  AtomicSection() {
+    BeginAtomicSection();
+  }
+
+  ~AtomicSection() {
+    EndAtomicSection();
+  }
+
+  AtomicSection(const AtomicSection&) = delete;
+  AtomicSection& operator=(const AtomicSection&) = delete;
+};
+
 template<class T>
 class ThreadLocalStorage {
  public:
@@ -98,3 +127,100 @@ class ThreadLocalStorage {
   T data[kMaxThreadId];
 };
 
+
+// Epoch-based reclamation for code written against RCU. Readers bracket
+// their accesses with BeginReadSection and EndReadSection, which nest, and
+// Retire(object) deletes object once every thread that was in a read section
+// when it was retired has left it. The state of each thread is one word, its
+// epoch while in a section. Advancing the global epoch is an ordinary CAS
+// step, tried on every Retire, so the search interleaves reclamation with
+// readers; with --detect-frees, a reader that holds on to a retired object
+// past its section is reported as a use after free. Objects are deleted by
+// the thread that retired them, and their memory is reused as any other's.
+//
+// Each thread may have kMaxRetired objects waiting at a time.
+class Epochs {
+ public:
+  static const int kMaxRetired = 64;
+
+  void Reset() {
+    global = 1;
+    for (int i = 0; i < kMaxThreadId; i++) {
+      local[i] = 0;
+      nesting[i] = 0;
+      retired_count[i] = 0;
+    }
+  }
+
+  void BeginReadSection() {
+    int thread = ThreadId();
+    if (nesting[thread]++ == 0) {
+      local[thread].store(global.load());
+    }
+  }
+
+  void EndReadSection() {
+    int thread = ThreadId();
+    if (--nesting[thread] == 0) {
+      local[thread].store(0);
+    }
+  }
+
+  template<class T>
+  void Retire(T* object) {
+    int thread = ThreadId();
+    TryAdvance();
+    Reclaim(thread);
+    assert(retired_count[thread] < kMaxRetired);
+    retired[thread][retired_count[thread]++] =
+        Retired{object, &Delete<T>, global.load()};
+  }
+
+ private:
+  struct Retired {
+    void* object;
+    void (*destroy)(void* object);
+    int64_t epoch;
+  };
+
+  template<class T>
+  static void Delete(void* object) {
+    delete static_cast<T*>(object);
+  }
+
+  // Advances the global epoch if no thread is in a section entered before
+  // it.
+  void TryAdvance() {
+    int64_t epoch = global.load();
+    for (int i = 0; i < kMaxThreadId; i++) {
+      int64_t seen = local[i].load();
+      if (seen != 0 && seen != epoch) {
+        return;
+      }
+    }
+    global.compare_exchange_strong(epoch, epoch + 1);
+  }
+
+  // Deletes the objects of thread retired two epochs ago or earlier, which
+  // no section can still reach.
+  void Reclaim(int thread) {
+    int64_t epoch = global.load();
+    int kept = 0;
+    for (int i = 0; i < retired_count[thread]; i++) {
+      Retired& entry = retired[thread][i];
+      if (entry.epoch + 2 <= epoch) {
+        entry.destroy(entry.object);
+      } else {
+        retired[thread][kept++] = entry;
+      }
+    }
+    retired_count[thread] = kept;
+  }
+
+  std::atomic<int64_t> global;
+  std::atomic<int64_t> local[kMaxThreadId];
+  // Only ever touched by their own thread.
+  int nesting[kMaxThreadId];
+  Retired retired[kMaxThreadId][kMaxRetired];
+  int retired_count[kMaxThreadId];
+};
@@ -1,64 +1,68 @@
 #include "hhbhistory.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 
 #include "config.h"
+#include "timer.h"
 
-struct __attribute__ ((__packed__)) NodeHashBuffer {
-  int thread;
-  Hash hashes[kMaxThreads];
-};
+CODEX_TIMER(hash_timer, "timer-hash");
 
-void HHBHistory::AddTransition(int thread, const Transition& transition) {
-  HBHistory::AddTransition(thread, transition);
+// The splitmix64 finalizer, which spreads every bit of z over the result.
+static inline Hash Mix(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
 
-  NodeHashBuffer buffer;
-  buffer.thread = thread;
-  for (int other_thread = 0; other_thread < kMaxThreads; other_thread++) {
-    if (other_thread == thread) {
-      continue;
-    }
+static inline uint64_t ThreadSeed(int thread) {
+  return 0x9e3779b97f4a7c15ULL * (thread + 1);
+}
+
+// What a thread's current hash adds to the combined hash. Threads that have
+// not run add nothing.
+static inline Hash CombineTerm(int thread, Hash hash) {
+  return hash == 0 ? 0 : Mix(hash ^ ThreadSeed(thread) ^ 0x5851f42d4c957f2dULL);
+}
 
-    int time = current_cv_for(thread)[other_thread];
+void HHBHistory::IndexStep(int time) {
+  HBHistory::IndexStep(time);
+  CODEX_TIMED_SCOPE(hash_timer);
+  int thread = thread_at(time);
 
-    if (time >= 0) {
-      buffer.hashes[other_thread] = hash_at_[time];
-    } else {
-      buffer.hashes[other_thread] = 0;
+  // A step is identified by its thread and the steps that happen before it:
+  // the thread's previous step and the latest step of every other thread it
+  // has synchronized with. The latter are summed, so that their order, which
+  // swapping symmetric threads changes, does not matter.
+  int as = hashed_as_[thread];
+  Hash hash = Mix(current_hash_for_[thread] ^ ThreadSeed(as));
+  Hash synchronized = 0;
+  const ClockVector& cv = current_cv_for(thread);
+  for (int other_thread : threads()) {
+    int other_time = cv[other_thread];
+    if (other_thread != thread && other_time >= 0) {
+      synchronized +=
+          Mix(hash_at_[other_time] + ThreadSeed(hashed_as_[other_thread]));
     }
   }
+  hash = Mix(hash ^ synchronized);
 
-  buffer.hashes[thread] = current_hash_for_[thread];
-
-  Hash hash = CityHash64((char*)&buffer, sizeof(buffer)); 
+  combined_hash_ += CombineTerm(as, hash) -
+      CombineTerm(as, current_hash_for_[thread]);
   current_hash_for_[thread] = hash;
   hash_at_.push_back(hash);
 }
 
-struct __attribute__ ((__packed__)) CombineHashBuffer {
-  Hash hashes[kMaxThreads];
-};
-
 Hash HHBHistory::CombineCurrentHashes() const {
-  CombineHashBuffer buffer;
-  for (int thread = 0; thread < kMaxThreads; thread++) {
-    buffer.hashes[thread] = current_hash_for_[thread];
-  }
-  return CityHash64((char*)&buffer, sizeof(buffer)); 
+  return combined_hash_;
 }
 
 Hash HHBHistory::CombineCurrentHashesWithLast() const {
-  NodeHashBuffer buffer;
-  for (int thread = 0; thread < kMaxThreads; thread++) {
-    buffer.hashes[thread] = current_hash_for_[thread];
-  }
-  if (length() > 0) {
-    buffer.thread = thread_at(length() - 1);
-  } else {
-    buffer.thread = -1;
-  }
-  return CityHash64((char*)&buffer, sizeof(buffer)); 
+  // The last thread is told by its own current hash rather than its id,
+  // which symmetric threads swap.
+  Hash last = length() > 0 ? current_hash_for_[thread_at(length() - 1)] : 0;
+  return Mix(combined_hash_ ^ Mix(last ^ 0x2545f4914f6cdd1dULL));
 }
 
 void HHBHistory::Reset() {
@@ -66,8 +70,31 @@ void HHBHistory::Reset() {
   current_hash_for_.clear();
   hash_at_.clear();
   for (int i = 0; i < kMaxThreads; i++) {
-    current_hash_for_[i] = 0;
+    hashed_as_[i] = i;
+  }
+  combined_hash_ = 0;
+}
+
+void HHBHistory::Truncate(int new_length) {
+  // Only the steps that were indexed have hashes.
+  int indexed = hash_at_.size();
+  for (int time = indexed - 1; time >= new_length; time--) {
+    int previous = previous_time_of_thread_at(time);
+    current_hash_for_[thread_at(time)] = previous == -1 ? 0 : hash_at_[previous];
   }
+  hash_at_.resize(std::min(indexed, new_length));
+  HBHistory::Truncate(new_length);
+
+  combined_hash_ = 0;
+  for (int thread : threads()) {
+    combined_hash_ +=
+        CombineTerm(hashed_as_[thread], current_hash_for_[thread]);
+  }
+}
+
+void HHBHistory::Reserve(int capacity) {
+  HBHistory::Reserve(capacity);
+  hash_at_.reserve(capacity);
 }
 
 std::string ConvertHashToString(Hash hash) {
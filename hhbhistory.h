@@ -5,6 +5,7 @@
 #include <city.h>
 
 #include "hbhistory.h"
+#include "spill_vector.h"
 #include "threadset.h"
 #include "transition.h"
 
@@ -12,9 +13,18 @@ typedef uint64 Hash;
 
 class HHBHistory : public HBHistory {
  public:
-  virtual void AddTransition(int thread, const Transition& transition);
+  HHBHistory() : combined_hash_(0) {
+    for (int i = 0; i < kMaxThreads; i++) {
+      hashed_as_[i] = i;
+    }
+  }
+
   virtual void Reset();
+  virtual void Truncate(int length);
+  virtual void Reserve(int capacity);
 
+  // A hash of the current hashes of all threads, kept up to date as
+  // transitions are added, and one that also covers the last thread to run.
   Hash CombineCurrentHashes() const;
   Hash CombineCurrentHashesWithLast() const;
 
@@ -23,12 +33,27 @@ class HHBHistory : public HBHistory {
   }
   
   inline Hash current_hash_for(int thread) const {
-    return current_hash_for_[thread];
+    return current_hash_for_.count(thread) ? current_hash_for_[thread] : 0;
+  }
+
+  // Hashes the steps of thread as if another thread, as, took them, so that
+  // states that only differ by swapping symmetric threads hash the same.
+  // Reset hashes every thread as itself again.
+  inline void HashAs(int thread, int as) {
+    hashed_as_[thread] = as;
+  }
+  inline int hashed_as(int thread) const {
+    return hashed_as_[thread];
   }
 
+ protected:
+  virtual void IndexStep(int time);
+
  private:
   ThreadMap<Hash> current_hash_for_;
-  std::vector<Hash> hash_at_;  
+  SpillVector<Hash> hash_at_;
+  Hash combined_hash_;
+  int hashed_as_[kMaxThreads];
 };
 
 std::string ConvertHashToString(Hash hash);
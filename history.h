@@ -1,22 +1,56 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
+#include "spill_vector.h"
 #include "threadmap.h"
+#include "trace_file.h"
 #include "transition.h"
 
+// Histories store each field of a step in its own dense array. The arrays
+// are cleared but never shrunk between runs, and are reserved up to the
+// longest run seen so far when a new run starts, so that adding transitions
+// rarely reallocates. With spill_directory set, the arrays of long runs spill
+// to disk, see SpillBuffer.
 class History {
  public:
+  History() : longest_run_(0) {}
+
   virtual void AddTransition(int thread, const Transition& transition) {
-    thread_at_.push_back(thread);
-    transition_at_.push_back(transition);
     // FIXME: Guarantee that reading the previous value here is correct!
-    previous_value_at_.push_back(transition.Read());
+    AddStep(thread, transition, transition.Read());
   }
   virtual void Reset() {
+    longest_run_ = std::max(longest_run_, length());
     thread_at_.clear();
     transition_at_.clear();
     previous_value_at_.clear();
+    Reserve(longest_run_);
+  }
+  // Rolls the history back to its first length transitions, as if the later
+  // ones had never been added.
+  virtual void Truncate(int length) {
+    longest_run_ = std::max(longest_run_, this->length());
+    thread_at_.resize(length);
+    transition_at_.resize(length);
+    previous_value_at_.resize(length);
+  }
+
+  // Makes room for runs of the given length in every per-step array.
+  virtual void Reserve(int capacity) {
+    thread_at_.reserve(capacity);
+    transition_at_.reserve(capacity);
+    previous_value_at_.reserve(capacity);
+  }
+
+  // Adds a step that found previous_value in memory, such as one of another
+  // history, without indexing it.
+  void AddStep(int thread, const Transition& transition,
+      int64_t previous_value) {
+    thread_at_.push_back(thread);
+    transition_at_.push_back(transition);
+    previous_value_at_.push_back(previous_value);
   }
 
   inline const Transition& transition_at(int time) const {
@@ -32,35 +66,28 @@ class History {
     return thread_at_.size();
   }
 
-  virtual void Dump() const {
-    FILE* f = fopen("data.py", "w");
-    fprintf(f, "data = [");
+  // Writes the steps so far, with their annotations, to path for dumper.py.
+  virtual void Dump(const char* path = kTraceFile) const {
+    TraceWriter writer(path, length());
     for (int time = 0; time < length(); time++) {
-      if (time > 0) {
-        fprintf(f, ",\n");
-      }
-
       int thread = thread_at(time);
       const Transition& transition = transition_at(time);
 
-      if (transition.annotations()) {
-        for (std::string annotation : *transition.annotations()) {
-          fprintf(f, 
-              "{'thread': %d, 'type': 'annotation', 'description': '%s'},\n", 
-              thread, annotation.c_str());
+      if (transition.annotations() != kNoAnnotations) {
+        for (const std::string& annotation :
+            FormatAnnotations(transition.annotations())) {
+          writer.AddAnnotation(thread, annotation);
         }
       }
 
-      fprintf(f, "%s", 
-          transition.Dump(thread, time, previous_value_at(time)).c_str());
+      writer.AddTransition(thread, time, transition, previous_value_at(time));
     }
-    fprintf(f, "]\n");
-    fclose(f);
   }
 
  private:
-  std::vector<int> thread_at_;
-  std::vector<Transition> transition_at_;
-  std::vector<int64_t> previous_value_at_;
+  int longest_run_;
+  SpillVector<int> thread_at_;
+  SpillVector<Transition> transition_at_;
+  SpillVector<int64_t> previous_value_at_;
 };
 
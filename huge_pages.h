@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/mman.h>
+
+// The size of the transparent huge pages of x86-64 and of arm64 with 4 KB
+// pages.
+static const size_t kHugePageSize = size_t(2) << 20;
+
+// Asks the kernel to back the whole huge pages within [start, start +
+// length) with transparent huge pages as they are touched, which spares the
+// TLB on memory every run walks through. Returns false if the kernel has no
+// transparent huge pages, in which case the memory stays in normal pages.
+inline bool AdviseHugePages(void* start, size_t length) {
+#ifdef MADV_HUGEPAGE
+  uintptr_t begin = (reinterpret_cast<uintptr_t>(start) + kHugePageSize - 1) /
+      kHugePageSize * kHugePageSize;
+  uintptr_t end = (reinterpret_cast<uintptr_t>(start) + length) /
+      kHugePageSize * kHugePageSize;
+  if (begin >= end) {
+    return true;
+  }
+  return madvise(reinterpret_cast<void*>(begin), end - begin,
+      MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
@@ -1,107 +1,821 @@
 #include "interceptor.h"
 
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+#include <unistd.h>
 
+#include "config.h"
+#include "fingerprint_set.h"
 #include "hhbhistory.h"
+#include "memory_governor.h"
+#include "memory_hash.h"
+#include "schedule.h"
 #include "statistics.h"
+#include "timer.h"
 
 static int64_t& total_runs = RegisterStatistic<int64_t>("runs");
 static int64_t& total_transitions = RegisterStatistic<int64_t>("transitions");
 static int64_t& total_found = RegisterStatistic<int64_t>("found");
 static int64_t& total_distinct = RegisterStatistic<int64_t>("distinct");
+// Runs that the explorer moved away from before they finished.
+static int64_t& aborted_runs = RegisterStatistic<int64_t>("aborted-runs");
 static int& first_found = RegisterStatistic<int>("first_found", -1);
-static std::set<Hash> seen_hashes;
+// The time since startup and the transitions it took to find the first bug.
+static double& first_found_seconds =
+    RegisterStatistic<double>("first-found-seconds");
+static int64_t& first_found_transitions =
+    RegisterStatistic<int64_t>("first-found-transitions");
+static const auto start_time = std::chrono::steady_clock::now();
+static Histogram& run_lengths = RegisterStatistic<Histogram>("run-lengths");
+static int64_t& spinning_reads = RegisterStatistic<int64_t>("spinning-reads");
+static int64_t& total_deadlocks = RegisterStatistic<int64_t>("deadlocks");
+static int64_t& total_livelocks = RegisterStatistic<int64_t>("livelocks");
+static int64_t& cut_off_runs = RegisterStatistic<int64_t>("cut-off-runs");
+// Runs that stop_run_on_found ended at their bug.
+static int64_t& stopped_runs = RegisterStatistic<int64_t>("stopped-runs");
+static int64_t& reused_verdicts =
+    RegisterStatistic<int64_t>("finish-reused-verdicts");
+// Steps taken without switching back, see run_solo_tails.
+static int64_t& solo_steps = RegisterStatistic<int64_t>("solo-steps");
+static int64_t& bug_classes = RegisterStatistic<int64_t>("bug-classes");
+static int64_t& data_races = RegisterStatistic<int64_t>("data-races");
+static int64_t& freed_accesses =
+    RegisterStatistic<int64_t>("use-after-free-accesses");
+static int64_t& double_frees = RegisterStatistic<int64_t>("double-frees");
+// The microseconds finished runs took from their start, and with slow_runs
+// the part of them that went to happens-before bookkeeping and to finish_run_.
+// A few schedules, such as ones where backoff loops spin, can take a hundred
+// times the median and most of the time.
+static Histogram& run_micros = RegisterStatistic<Histogram>("run-micros");
+static Histogram& hb_micros = RegisterStatistic<Histogram>("hb-micros");
+static Histogram& finish_run_micros =
+    RegisterStatistic<Histogram>("finish-run-micros");
 
-void Interceptor::StartNewRun(HHBHistory* history) {
-  while (!runnable_.empty()) {
-    AdvanceThread(*runnable_.begin());
+struct SlowRun {
+  uint64_t cycles, hb_cycles, finish_cycles;
+  std::string schedule;
+
+  bool operator>(const SlowRun& other) const {
+    return cycles > other.cycles;
   }
+};
+
+// The slowest runs so far, as a heap with the fastest of them on top.
+static std::vector<SlowRun> slowest_runs;
 
-  assert(alive_threads_.empty());
+void Interceptor::StartNewRun(HHBHistory* history, int reuse_length) {
+  // A run abandoned before it finished is dropped where it stands rather
+  // than run to its end only to be thrown away: it is never finished, so
+  // neither the program's checks nor the statistics of finished runs see it.
+  // Its history is left as far as it got, which is as far as the path of the
+  // explorer goes.
+  if (!runnable_.empty()) {
+    aborted_runs++;
+    runnable_.clear();
+  }
+  reuse_length_ = 0;
+
+  // The threads of an abandoned run, and those left blocked by a deadlock,
+  // are dropped where they stand, as setup_run_ rebuilds the program state
+  // they refer to anyway.
+  for (int thread : alive_threads_) {
+    scheduler_.DiscardThread(thread);
+  }
+  alive_threads_.clear();
+  next_transitions_.clear();
+  enabled_.clear();
+  blocking_.clear();
+  recheck_.clear();
+  for (PendingCell& entry : pending_cells_) {
+    entry = PendingCell();
+  }
+  ranged_pending_.clear();
+  deadlocked_ = false;
+  cut_off_ = false;
+  stopped_ = false;
   num_created_threads_ = 0;
+  started_.clear();
+  tso_threads_.clear();
+  flushers_.clear();
   has_found_bug_ = false;
+  if (detect_races) {
+    race_detector_.Reset();
+  }
 
   history_ = history;
   // TODO: Clarify history ownership and Reset duty.
+  replayed_ = 0;
   if (history_ != nullptr) {
-    history_->Reset();
+    if (reuse_length > 0) {
+      history_->Truncate(reuse_length);
+      reuse_length_ = reuse_length;
+      for (int thread = 0; thread < kMaxThreads; thread++) {
+        replay_last_time_of_[thread] = -1;
+      }
+    } else {
+      history_->Reset();
+    }
   }
 
   total_runs++;
+  run_start_ = ReadCycleCounter();
+  hb_cycles_ = 0;
 
   setup_run_();
   SwitchToNext();
+  recheck_ = blocking_;
   ComputeRunnable();
 }
 
-int Interceptor::StartThread(const std::function<void()>& task) {
-  assert(num_created_threads_ < kMaxThreads);
+// Exits when the program starts more threads than the runtime was built for.
+static void CheckThreadCount(int num_threads) {
+  if (num_threads > kMaxThreads) {
+    fprintf(stderr, "the program starts more than %d threads; build with "
+        "make MAX_THREADS=N for more\n", kMaxThreads);
+    exit(1);
+  }
+}
+
+// Exits when a run takes more steps than clock vectors can count, a limit of
+// the runtime rather than a livelock of the program.
+static void CheckClockTime(int steps) {
+  if (steps >= kMaxClockTime) {
+    fprintf(stderr, "a run takes more than %d steps; build without "
+        "SHORT_CLOCKS=1, or cut runs off with --max-run-steps\n",
+        kMaxClockTime);
+    exit(1);
+  }
+}
 
-  int thread = num_created_threads_++;
+int Interceptor::StartThread(const std::function<void()>& task, bool tso,
+    int symmetry_group, int slot) {
+  int thread = slot;
+  if (slot < 0) {
+    CheckThreadCount(num_created_threads_ + 1 + tso);
+    thread = num_created_threads_++;
+  } else {
+    assert(!alive_threads_.count(slot) && !tso_threads_.count(slot));
+    started_.erase(slot);
+    if (history_ != nullptr) {
+      history_->HashAs(slot, slot);
+    }
+  }
 
-  scheduler_.AddThread(thread, [=]() {
-    task();
-    alive_threads_.erase(thread);
-    SwitchToNext();
-  });
+  tasks_[thread] = task;
+  scheduler_.AddThread(thread);
 
   alive_threads_.insert(thread);
+  spin_of_[thread].count = 0;
+  retries_of_[thread].count = 0;
+
+  symmetry_group_[thread] = symmetry_reduction ? symmetry_group : -1;
+  previous_symmetric_[thread] = -1;
+  for (int other = thread - 1;
+      symmetry_group_[thread] >= 0 && other >= 0; other--) {
+    if (symmetry_group_[other] == symmetry_group_[thread]) {
+      previous_symmetric_[thread] = other;
+      if (history_ != nullptr) {
+        history_->HashAs(thread, history_->hashed_as(other));
+      }
+      break;
+    }
+  }
+
+  if (tso) {
+    int flusher = num_created_threads_++;
+    tso_threads_.insert(thread);
+    flushers_.insert(flusher);
+    symmetry_group_[flusher] = -1;
+    flusher_of_[thread] = flusher;
+    owner_of_[flusher] = thread;
+    store_buffers_[thread].Reset();
+  }
 
   return thread;
 }
 
+void Interceptor::RunThread(void* p, int thread) {
+  Interceptor* interceptor = reinterpret_cast<Interceptor*>(p);
+  interceptor->tasks_[thread]();
+  // Stores can not outlive their thread, so that runs end with every store
+  // in memory.
+  if (interceptor->is_tso(thread)) {
+    interceptor->DrainStoreBuffer();
+  }
+  interceptor->alive_threads_.erase(thread);
+  interceptor->SwitchToNext();
+}
+
 void Interceptor::AdvanceThread(int thread) {
-  assert(alive_threads_.count(thread));
+  if (flushers_.count(thread)) {
+    Flush(thread);
+  } else {
+    BeginTransition(thread);
+    scheduler_.SwitchTo(thread);
+  }
+  ComputeRunnable();
+}
+
+void Interceptor::AdvanceThreads(const std::vector<int>& schedule) {
+  if (schedule.empty()) {
+    return;
+  }
+
+  schedule_ = &schedule;
+  next_in_schedule_ = 0;
+  if (FlushUntilScheduledThread()) {
+    int thread = schedule[next_in_schedule_++];
+    BeginTransition(thread);
+    scheduler_.SwitchTo(thread);
+  }
+  schedule_ = nullptr;
+  ComputeRunnable();
+}
+
+bool Interceptor::FlushUntilScheduledThread() {
+  while (next_in_schedule_ < schedule_->size() &&
+      flushers_.count((*schedule_)[next_in_schedule_])) {
+    Flush((*schedule_)[next_in_schedule_++]);
+  }
+  return next_in_schedule_ < schedule_->size();
+}
+
+void Interceptor::DrainStoreBuffer() {
+  StoreBuffer& buffer = store_buffers_[current_thread()];
+  if (!buffer.empty()) {
+    Transition drained(TransitionType::READ, buffer.address(),
+        sizeof(int32_t), 0, MemoryOrder::SEQ_CST);
+    drained.set_required(0);
+    ReachedTransition(drained);
+  }
+}
+
+Transition Interceptor::BufferedStore(const Transition& store) {
+  StoreBuffer& buffer = store_buffers_[current_thread()];
+  if (buffer.full()) {
+    Transition has_room(TransitionType::READ_GE, buffer.address(),
+        sizeof(int32_t), StoreBuffer::kCapacity, 0, MemoryOrder::SEQ_CST);
+    has_room.set_required(false);
+    ReachedTransition(has_room);
+  }
+  return store.Buffered(buffer.address());
+}
+
+void Interceptor::BufferStore(const Transition& store) {
+  int thread = current_thread();
+  StoreBuffer& buffer = store_buffers_[thread];
+  buffer.Push(store);
+  if (!next_transitions_.count(flusher_of_[thread])) {
+    SetNextTransition(flusher_of_[thread], store.Flushed());
+  }
+}
+
+void Interceptor::Flush(int flusher) {
+  BeginTransition(flusher);
+
+  int owner = owner_of_[flusher];
+  StoreBuffer& buffer = store_buffers_[owner];
+  ToggleMemoryHash(buffer.front().address(), buffer.front().length());
+  buffer.front().Write(buffer.front().stored_value());
+  ToggleMemoryHash(buffer.front().address(), buffer.front().length());
+  buffer.Pop();
+  write_epoch_++;
+  // The owner may wait for the buffer to drain or have room.
+  if (blocking_.count(owner)) {
+    recheck_.insert(owner);
+  }
+  if (!buffer.empty()) {
+    SetNextTransition(flusher, buffer.front().Flushed());
+  }
+}
+
+void Interceptor::WaitIfSpinning(Transition* read) {
+  const SpinState& spin = spin_of_[current_thread()];
+  if (spin_reads > 0 && spin.count >= spin_reads &&
+      read->address() == spin.address && read->length() == spin.length) {
+    read->set_required_other_than(spin.value);
+    spinning_reads++;
+  }
+}
+
+void Interceptor::NoteStep(const Transition& transition, int64_t value) {
+  SpinState& spin = spin_of_[current_thread()];
+  if (transition.type() != TransitionType::READ) {
+    spin.count = 0;
+  } else if (spin.count > 0 && transition.address() == spin.address &&
+      transition.length() == spin.length && value == spin.value) {
+    spin.count++;
+  } else {
+    spin = SpinState{transition.address(), transition.length(), value, 1};
+  }
+
+  if (retry_cutoff > 0) {
+    // Wide transitions have their values folded, so only their type tells.
+    RetryState& retries = retries_of_[current_thread()];
+    if (transition.is_wide() ? transition.can_write() :
+        transition.DoesWrite(value)) {
+      write_epoch_++;
+      retries.count = 0;
+    } else if (retries.write_epoch == write_epoch_) {
+      retries.count++;
+    } else {
+      retries = RetryState{write_epoch_, 1};
+    }
+  }
+}
+
+void Interceptor::CheckReplayedStep(int thread) {
+  if (history_ == nullptr || replayed_ >= reuse_length_) {
+    return;
+  }
+  const Transition& expected = history_->transition_at(replayed_);
+  if (history_->thread_at(replayed_) == thread &&
+      next_transitions_.count(thread) &&
+      next_transitions_[thread].SameStepAs(expected) &&
+      next_transitions_[thread].DetermineRunnable()) {
+    return;
+  }
+  fprintf(stderr, "replay diverged at step %d of run %lld: thread %d was to "
+      "take %s at %s", replayed_, (long long)total_runs, thread,
+      expected.Format(history_->previous_value_at(replayed_)).c_str(),
+      FormatLocation(expected.location()).c_str());
+  if (!next_transitions_.count(thread)) {
+    fprintf(stderr, ", but has no next step\n");
+  } else {
+    const Transition& next = next_transitions_[thread];
+    fprintf(stderr, ", but %s %s at %s\n",
+        next.DetermineRunnable() ? "takes" : "is blocked on",
+        next.Format(next.is_simple() ? next.Read() : 0).c_str(),
+        FormatLocation(next.location()).c_str());
+  }
+  fprintf(stderr, "runs of the program must only depend on their schedule; "
+      "does Setup reset all of its state?\n");
+  exit(1);
+}
+
+void Interceptor::BeginTransition(int thread) {
+  CheckReplayedStep(thread);
+  assert(alive_threads_.count(thread) || flushers_.count(thread));
   assert(next_transitions_.count(thread));
 
   // DANGER!! AddTransition assumes that it is called right before the
   // transition is executed and so SHOULD NOT BE MOVED.
   if (history_ != nullptr) {
-    history_->AddTransition(thread, next_transitions_[thread]);
+    if (replayed_ < reuse_length_) {
+      assert(history_->thread_at(replayed_) == thread);
+      replay_last_time_of_[thread] = replayed_++;
+    } else if (slow_runs > 0) {
+      uint64_t start = ReadCycleCounter();
+      history_->AddTransition(thread, next_transitions_[thread]);
+      hb_cycles_ += ReadCycleCounter() - start;
+    } else {
+      history_->AddTransition(thread, next_transitions_[thread]);
+    }
   }
+  started_.insert(thread);
 
+  uint32_t earlier_location;
+  if (detect_races && race_detector_.Check(thread, next_transitions_[thread],
+        &earlier_location)) {
+    ReportRace(earlier_location, next_transitions_[thread].location());
+  }
+
+  NoteWrite(next_transitions_[thread]);
   // The thread will call ReachedTransition before switching back to this
   // thread, so we must delete the old transition before switching to the
   // thread.
-  next_transitions_.erase(thread);
+  EraseNextTransition(thread);
 
   total_transitions++;
+}
 
-  scheduler_.SwitchTo(thread);
-  ComputeRunnable();
+ClockVector Interceptor::current_cv_for(int thread) const {
+  history_->CatchUp();
+  if (replayed_ < reuse_length_) {
+    int time = replay_last_time_of_[thread];
+    return time == -1 ? ClockVector() : history_->cv_at(time);
+  }
+  return history_->current_cv_for(thread);
+}
+
+// The distinct runs of this process, or of all processes forked after
+// ShareDistinct.
+static FingerprintSet* seen_hashes = nullptr;
+static SharedFingerprintSet* shared_seen_hashes = nullptr;
+
+// Folding the set into its sketch only makes the count an estimate. The
+// shared set takes all its memory from the start, and is left alone.
+static size_t DistinctSetBytes() {
+  return seen_hashes != nullptr ? seen_hashes->bytes() : 0;
+}
+
+static size_t ShedDistinctSet() {
+  return seen_hashes != nullptr ? seen_hashes->Fold() : 0;
+}
+
+static const bool distinct_set_governed = RegisterMemoryConsumer(
+    "distinct-set", kStatisticRank, DistinctSetBytes, ShedDistinctSet);
+
+void Interceptor::ShareDistinct() {
+  shared_seen_hashes = SharedFingerprintSet::Create(distinct_table_bytes);
+}
+
+void Interceptor::CountDistinct() {
+  Hash hash = history_->CombineCurrentHashes();
+  bool is_new;
+  if (shared_seen_hashes != nullptr) {
+    is_new = shared_seen_hashes->Insert(hash);
+    total_distinct = shared_seen_hashes->size();
+  } else {
+    if (seen_hashes == nullptr) {
+      seen_hashes = new FingerprintSet(distinct_table_bytes);
+    }
+    int64_t seen = seen_hashes->size();
+    seen_hashes->Insert(hash);
+    total_distinct += seen_hashes->size() - seen;
+    is_new = seen_hashes->size() > seen;
+  }
+  if (coverage_fd >= 0 && is_new) {
+    // Appended in a single write, so that forked explorers can share it.
+    if (write(coverage_fd, &hash, sizeof(hash)) != sizeof(hash)) {
+      perror("coverage");
+    }
+  }
+}
+
+// The runs of this process whose finish_run_ passed are marked in the set of
+// distinct runs. A run happens-before equivalent to one of them ends in the
+// same state, so its checks, such as a search for a linearization, would
+// pass again. The marks go with the table once it is folded, and processes
+// that share the set keep none.
+static bool IsVerifiedRun(Hash hash) {
+  return seen_hashes != nullptr && seen_hashes->Marked(hash);
+}
+
+void ForgetVerifiedRuns() {
+  if (seen_hashes != nullptr) {
+    seen_hashes->ClearMarks();
+  }
 }
 
 void Interceptor::FinishRun() {
-  finish_run_();
+  // The program's checks only apply once every thread is done.
+  bool first_deadlock = false;
+  uint64_t finish_start = 0, finish_cycles = 0;
+  // Whether to mark the run, under its hash, if it passes.
+  bool reuse = false;
+  Hash hash = 0;
+  if (deadlocked_) {
+    first_deadlock = ReportDeadlock();
+  } else if (cut_off_) {
+    first_deadlock = ReportCutOff();
+  } else if (stopped_) {
+    stopped_runs++;
+  } else {
+    // Lazy histories would have to catch up just for this.
+    reuse = !finish_every_run && !history_->lazy();
+    hash = reuse ? history_->CombineCurrentHashes() : 0;
+    if (reuse && IsVerifiedRun(hash)) {
+      reused_verdicts++;
+      reuse = false;
+    } else {
+      finish_start = ReadCycleCounter();
+      finish_run_();
+      finish_cycles = ReadCycleCounter() - finish_start;
+    }
+  }
 
   if (has_found_bug_) {
     if (total_found++ == 0) {
       history_->Dump();
       first_found = total_runs;
+      first_found_seconds = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start_time).count();
+      first_found_transitions = total_transitions;
+    } else if (first_deadlock) {
+      history_->Dump();
+    }
+    if (!bug_directory.empty() || !bug_corpus_file.empty()) {
+      DumpIfNewBugClass();
+    }
+  }
+  // Lazy histories only pay for hashing the run when coverage is written.
+  if (!history_->lazy() || coverage_fd >= 0) {
+    uint64_t start = ReadCycleCounter();
+    history_->CatchUp();
+    hb_cycles_ += ReadCycleCounter() - start;
+    CountDistinct();
+    // Marks the run that CountDistinct inserted.
+    if (reuse && !has_found_bug_ && seen_hashes != nullptr) {
+      seen_hashes->Mark(hash);
+    }
+  }
+  run_lengths.Add(history_->length());
+  RecordRunTime(finish_cycles);
+  MaybeStreamStatistics();
+}
+
+void Interceptor::RecordRunTime(uint64_t finish_cycles) {
+  uint64_t cycles = ReadCycleCounter() - run_start_;
+  double micros_per_cycle = 1e6 / CyclesPerSecond();
+  run_micros.Add(cycles * micros_per_cycle);
+  if (slow_runs <= 0) {
+    return;
+  }
+  hb_micros.Add(hb_cycles_ * micros_per_cycle);
+  finish_run_micros.Add(finish_cycles * micros_per_cycle);
+
+  if (static_cast<int>(slowest_runs.size()) == slow_runs) {
+    if (cycles <= slowest_runs.front().cycles) {
+      return;
     }
+    std::pop_heap(slowest_runs.begin(), slowest_runs.end(),
+        std::greater<SlowRun>());
+    slowest_runs.pop_back();
   }
-  if (seen_hashes.insert(history_->CombineCurrentHashes()).second) {
-    total_distinct++;
+  PackedSchedule schedule;
+  for (int time = 0; time < history_->length(); time++) {
+    schedule.Append(history_->thread_at(time));
   }
+  slowest_runs.push_back(SlowRun{cycles, hb_cycles_, finish_cycles,
+      schedule.ToString()});
+  std::push_heap(slowest_runs.begin(), slowest_runs.end(),
+      std::greater<SlowRun>());
 }
 
-void Interceptor::ComputeRunnable() {
-  runnable_.clear();
+void PrintSlowestRuns() {
+  std::vector<SlowRun> runs = slowest_runs;
+  std::sort(runs.begin(), runs.end(), std::greater<SlowRun>());
+  double millis_per_cycle = 1e3 / CyclesPerSecond();
+  for (const SlowRun& run : runs) {
+    fprintf(stderr, "slow run: %.3f ms, %.3f ms hb, %.3f ms finish_run: %s\n",
+        run.cycles * millis_per_cycle, run.hb_cycles * millis_per_cycle,
+        run.finish_cycles * millis_per_cycle, run.schedule.c_str());
+  }
+}
+
+void Interceptor::ReportRace(uint32_t earlier_location, uint32_t location) {
+  static std::set<std::pair<uint32_t, uint32_t>>* seen_pairs =
+      new std::set<std::pair<uint32_t, uint32_t>>();
+  has_found_bug_ = true;
+  data_races++;
+  if (seen_pairs->insert(std::make_pair(earlier_location, location)).second) {
+    fprintf(stderr, "data race in run %lld between %s and %s\n",
+        (long long)total_runs, FormatLocation(earlier_location).c_str(),
+        FormatLocation(location).c_str());
+  }
+}
+
+void Interceptor::ReportFreedMemory(const Transition* access, int freed_by,
+    int freed_after) {
+  static std::unordered_set<uint32_t>* seen_locations =
+      new std::unordered_set<uint32_t>();
+  static bool seen_double_free = false;
+  has_found_bug_ = true;
+  if (access == nullptr) {
+    double_frees++;
+    if (!seen_double_free) {
+      seen_double_free = true;
+      fprintf(stderr, "double free in run %lld by thread %d, of memory thread "
+          "%d freed after step %d\n", (long long)total_runs,
+          current_thread(), freed_by, freed_after);
+    }
+    return;
+  }
+  freed_accesses++;
+  if (seen_locations->insert(access->location()).second) {
+    fprintf(stderr, "use after free in run %lld by thread %d: %s at %s, of "
+        "memory thread %d freed after step %d\n", (long long)total_runs,
+        current_thread(), access->Format(access->Read()).c_str(),
+        FormatLocation(access->location()).c_str(), freed_by, freed_after);
+  }
+}
+
+int Interceptor::run_steps() const {
+  if (history_ == nullptr) {
+    return -1;
+  }
+  return replayed_ < reuse_length_ ? replayed_ : history_->length();
+}
+
+bool Interceptor::ReportDeadlock() {
+  bool spinning = false;
+  for (int thread : next_transitions_.keys()) {
+    spinning |= next_transitions_[thread].required_differs();
+  }
+  int64_t& count = spinning ? total_livelocks : total_deadlocks;
+  if (count++ > 0) {
+    return false;
+  }
+  fprintf(stderr, "%s in run %lld, with the threads blocked at:\n",
+      spinning ? "livelock" : "deadlock", (long long)total_runs);
+  for (int thread : next_transitions_.keys()) {
+    const Transition& transition = next_transitions_[thread];
+    fprintf(stderr, "  [% 2d]: %s\n", thread,
+        transition.Format(transition.Read()).c_str());
+  }
+  return true;
+}
+
+bool Interceptor::ReportCutOff() {
+  cut_off_runs++;
+  if (prune_cut_off_runs || total_livelocks++ > 0) {
+    return false;
+  }
+  fprintf(stderr, "livelock in run %lld, cut off after %d steps with the "
+      "threads at:\n", (long long)total_runs, run_steps());
   for (int thread : next_transitions_.keys()) {
+    const Transition& transition = next_transitions_[thread];
+    fprintf(stderr, "  [% 2d]: %s\n", thread,
+        transition.Format(transition.Read()).c_str());
+  }
+  return true;
+}
+
+static inline uint64_t MixHash(uint64_t hash, uint64_t value) {
+  uint64_t z = hash + 0x9e3779b97f4a7c15ULL * (value + 1);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+uint64_t Interceptor::BugClass() const {
+  const Transition* last_of[kMaxThreads] = {};
+  ThreadSet seen;
+  for (int thread : next_transitions_.keys()) {
+    last_of[thread] = &next_transitions_[thread];
+    seen.insert(thread);
+  }
+  // Walking back to the last step of every thread is usually short, as the
+  // threads that are done tend to have finished close to the end.
+  for (int time = history_->length() - 1;
+      time >= 0 && seen.size() < num_created_threads_; time--) {
+    int thread = history_->thread_at(time);
+    if (!seen.count(thread)) {
+      last_of[thread] = &history_->transition_at(time);
+      seen.insert(thread);
+    }
+  }
+
+  // Mixed in by thread, so that the order the threads finished in does not
+  // matter.
+  uint64_t hash = deadlocked_ + 2 * cut_off_ + 4 * stopped_;
+  for (int thread : seen) {
+    hash = MixHash(MixHash(MixHash(hash, thread),
+        static_cast<uint64_t>(last_of[thread]->type())),
+        last_of[thread]->location());
+  }
+  return hash;
+}
+
+uint64_t Interceptor::StateHash() const {
+  uint64_t hash = memory_state_hash;
+  for (int thread : alive_threads_) {
+    uint64_t state = MixHash(0, thread);
+    if (next_transitions_.count(thread)) {
+      const Transition& next = next_transitions_[thread];
+      state = MixHash(MixHash(MixHash(state,
+          static_cast<uint64_t>(next.type())), next.location()),
+          reinterpret_cast<uintptr_t>(next.address()));
+    }
+    if (is_tso(thread)) {
+      const StoreBuffer& buffer = store_buffers_[thread];
+      for (int i = 0; i < buffer.size(); i++) {
+        state = MixHash(MixHash(state,
+            reinterpret_cast<uintptr_t>(buffer.at(i).address())),
+            buffer.at(i).stored_value());
+      }
+    }
+    // Mixed in by thread, as the order of the threads is no part of it.
+    hash ^= state;
+  }
+  return MixHash(hash, 0);
+}
+
+void Interceptor::DumpIfNewBugClass() {
+  static std::unordered_set<uint64_t>* seen_classes =
+      new std::unordered_set<uint64_t>();
+  uint64_t bug_class = BugClass();
+  if (!seen_classes->insert(bug_class).second) {
+    return;
+  }
+  bug_classes++;
+  if (!bug_corpus_file.empty()) {
+    PackedSchedule schedule;
+    for (int time = 0; time < history_->length(); time++) {
+      schedule.Append(history_->thread_at(time));
+    }
+    AppendSchedule(bug_corpus_file, schedule);
+  }
+  if (bug_directory.empty()) {
+    return;
+  }
+  // Named by class, so that processes forked by the search that find the
+  // same class write the same file.
+  char name[32];
+  snprintf(name, sizeof(name), "/bug-%016llx.bin",
+      (unsigned long long)bug_class);
+  history_->Dump((bug_directory + name).c_str());
+}
+
+void Interceptor::UpdateRunnable() {
+  for (int thread : recheck_) {
     if (next_transitions_[thread].DetermineRunnable()) {
-      runnable_.insert(thread);
+      enabled_.insert(thread);
+    } else {
+      enabled_.erase(thread);
     }
   }
+  recheck_.clear();
+  runnable_ = enabled_;
+  if (symmetry_reduction) {
+    WithholdSymmetricThreads();
+  }
+}
+
+void Interceptor::ComputeRunnable() {
+  UpdateRunnable();
 
   if (alive_threads_.empty()) {
     FinishRun();
+  } else if (stopped_) {
+    // Left as a deadlocked run is, so that the search goes no further.
+    runnable_.clear();
+    FinishRun();
   } else if (runnable_.empty()) {
-    // TODO: Handle found deadlock gracefully. A deadlock is a difficult case
-    // as the tested program can not be reset to a normal state, so we have to
-    // stop. However, it would be useful to dump the violating trace.
-    assert(0);
-    exit(0);
+    // The run ends here, and the search carries on with the next one.
+    deadlocked_ = true;
+    has_found_bug_ = true;
+    FinishRun();
+  } else if (WithholdStarvedThreads()) {
+    // Left as a deadlocked run is, with no thread to run.
+    runnable_.clear();
+    cut_off_ = true;
+    has_found_bug_ |= !prune_cut_off_runs;
+    FinishRun();
+  }
+}
+
+bool Interceptor::WithholdStarvedThreads() {
+  if (max_run_steps > 0 && run_steps() >= max_run_steps) {
+    return true;
+  }
+  CheckClockTime(run_steps());
+  if (retry_cutoff <= 0) {
+    return false;
   }
+  ThreadSet starved;
+  for (int thread : runnable_) {
+    const RetryState& retries = retries_of_[thread];
+    if (!flushers_.count(thread) && retries.count >= retry_cutoff &&
+        retries.write_epoch == write_epoch_) {
+      starved.insert(thread);
+    }
+  }
+  if (starved == runnable_) {
+    return true;
+  }
+  runnable_ = runnable_ - starved;
+  return false;
+}
+
+void Interceptor::WithholdSymmetricThreads() {
+  ThreadSet withheld;
+  for (int thread : runnable_ - started_) {
+    int previous = previous_symmetric_[thread];
+    if (previous != -1 && alive_threads_.count(previous) &&
+        !started_.count(previous)) {
+      withheld.insert(thread);
+    }
+  }
+  // The previous threads are blocked where the withheld ones would be, so
+  // withholding them never makes a deadlock, but a program that is not quite
+  // symmetric should not be reported as deadlocked for it either.
+  if (withheld != runnable_) {
+    runnable_ = runnable_ - withheld;
+  }
+}
+
+bool Interceptor::ContinuesSolo() {
+  int thread = current_thread();
+  if (!run_solo_tails_ || schedule_ != nullptr || stopped_ ||
+      alive_threads_.size() != 1 || !alive_threads_.count(thread) ||
+      next_transitions_.size() != 1) {
+    return false;
+  }
+  // Whatever would end the run is left to ComputeRunnable, once back in the
+  // originating thread.
+  UpdateRunnable();
+  return runnable_.count(thread) && !WithholdStarvedThreads();
 }
 
 void Interceptor::SwitchToNext() {
@@ -109,6 +823,19 @@ void Interceptor::SwitchToNext() {
 
   if (!next_unknown.empty()) {
     scheduler_.SwitchTo(*next_unknown.begin());
+  } else if (ContinuesSolo()) {
+    // Returns to the thread, which takes the step right away.
+    BeginTransition(current_thread());
+    solo_steps++;
+  } else if (schedule_ != nullptr && FlushUntilScheduledThread()) {
+    // Skip the originating thread and run the next transition of the
+    // schedule right away. This may continue the current thread.
+    int thread = (*schedule_)[next_in_schedule_++];
+    CheckReplayedStep(thread);
+    assert(next_transitions_.count(thread) &&
+        next_transitions_[thread].DetermineRunnable());
+    BeginTransition(thread);
+    scheduler_.SwitchTo(thread);
   } else {
     scheduler_.SwitchTo(Scheduler::kOriginalThread);
   }
@@ -118,7 +845,104 @@ void Interceptor::ReachedTransition(const Transition& transition) {
   int thread = scheduler_.current_thread();
   assert(!next_transitions_.count(thread));
 
-  next_transitions_[thread] = transition;
+  SetNextTransition(thread, transition);
   SwitchToNext();
 }
 
+void Interceptor::SetNextTransition(int thread, const Transition& transition) {
+  next_transitions_[thread] = transition;
+  IndexPending(thread, transition, true);
+  if (transition.can_block()) {
+    blocking_.insert(thread);
+    recheck_.insert(thread);
+  } else {
+    enabled_.insert(thread);
+  }
+}
+
+void Interceptor::EraseNextTransition(int thread) {
+  IndexPending(thread, next_transitions_[thread], false);
+  next_transitions_.erase(thread);
+  enabled_.erase(thread);
+  blocking_.erase(thread);
+  recheck_.erase(thread);
+}
+
+int Interceptor::FindPendingSlot(uintptr_t cell) const {
+  int slot = (cell * 0x9e3779b97f4a7c15ULL >> 32) & (kPendingSlots - 1);
+  while (pending_cells_[slot].cell != 0 && pending_cells_[slot].cell != cell) {
+    slot = (slot + 1) & (kPendingSlots - 1);
+  }
+  return slot;
+}
+
+void Interceptor::IndexPending(int thread, const Transition& transition,
+    bool add) {
+  if (!transition.is_simple()) {
+    if (add) {
+      ranged_pending_.insert(thread);
+    } else {
+      ranged_pending_.erase(thread);
+    }
+    return;
+  }
+  uintptr_t begin = reinterpret_cast<uintptr_t>(transition.address());
+  uintptr_t first = begin / kCellSize + 1;
+  uintptr_t last = (begin + transition.length() - 1) / kCellSize + 1;
+  for (uintptr_t cell = first; cell <= last; cell++) {
+    int slot = FindPendingSlot(cell);
+    PendingCell& entry = pending_cells_[slot];
+    ThreadSet& threads = transition.can_write() ? entry.writers : entry.readers;
+    if (add) {
+      entry.cell = cell;
+      threads.insert(thread);
+      continue;
+    }
+    threads.erase(thread);
+    if (!entry.readers.empty() || !entry.writers.empty()) {
+      continue;
+    }
+    // Frees the slot, moving back the entries after it that would no longer
+    // be found past the gap.
+    int gap = slot;
+    for (int next = (gap + 1) & (kPendingSlots - 1);
+        pending_cells_[next].cell != 0;
+        next = (next + 1) & (kPendingSlots - 1)) {
+      int home = (pending_cells_[next].cell * 0x9e3779b97f4a7c15ULL >> 32) &
+          (kPendingSlots - 1);
+      if (((next - home) & (kPendingSlots - 1)) >=
+          ((next - gap) & (kPendingSlots - 1))) {
+        pending_cells_[gap] = pending_cells_[next];
+        gap = next;
+      }
+    }
+    pending_cells_[gap] = PendingCell();
+  }
+}
+
+ThreadSet Interceptor::PendingConflicts(const Transition& transition) const {
+  ThreadSet candidates = ranged_pending_;
+  if (!transition.is_simple()) {
+    candidates = next_transitions_.keys();
+  } else {
+    uintptr_t begin = reinterpret_cast<uintptr_t>(transition.address());
+    uintptr_t first = begin / kCellSize + 1;
+    uintptr_t last = (begin + transition.length() - 1) / kCellSize + 1;
+    for (uintptr_t cell = first; cell <= last; cell++) {
+      const PendingCell& entry = pending_cells_[FindPendingSlot(cell)];
+      candidates = candidates | entry.writers;
+      if (transition.can_write()) {
+        candidates = candidates | entry.readers;
+      }
+    }
+  }
+  // Sharing a cell is not quite overlapping.
+  ThreadSet conflicts;
+  for (int thread : candidates) {
+    if (next_transitions_[thread].ConflictsWith(transition)) {
+      conflicts.insert(thread);
+    }
+  }
+  return conflicts;
+}
+
@@ -1,34 +1,117 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 
+#include "clockvector.h"
+#include "race_detector.h"
 #include "scheduler.h"
+#include "store_buffer.h"
 #include "threadset.h"
 #include "threadmap.h"
 #include "transition.h"
 
 class HHBHistory;
 
+// The size of the index of next transitions, a power of two with room for
+// the two cells each thread's next transition may touch, and to spare.
+constexpr int PendingSlots(int slots = 1) {
+  return slots >= 8 * kMaxThreads ? slots : PendingSlots(2 * slots);
+}
+
 class Interceptor {
  public:
   Interceptor(const std::function<void()>& setup_run, 
       const std::function<void()>& finish_run) :
-    setup_run_(setup_run), finish_run_(finish_run) {}
+    setup_run_(setup_run), finish_run_(finish_run),
+    scheduler_(fiber_stack_size, preserve_fpu_state, huge_pages,
+        &Interceptor::RunThread, this),
+    pending_cells_(), write_epoch_(0), deadlocked_(false), cut_off_(false),
+    stopped_(false), run_solo_tails_(false), run_start_(0), hb_cycles_(0),
+    history_(nullptr),
+    reuse_length_(0), replayed_(0), schedule_(nullptr), next_in_schedule_(0) {}
 
-  int StartThread(const std::function<void()>& task);
+  // Threads started with tso set run under TSO: their stores go to a store
+  // buffer, and reach memory later in steps of a flusher thread that is
+  // started along with them. Flushers run no code of their own; advancing
+  // one runs the flush of the oldest buffered store.
+  //
+  // With symmetry_reduction set, threads of the same symmetry group, if it
+  // is 0 or more, are interchangeable. Of those yet to take a step, only the
+  // first is runnable, as a run in which another one goes first is that run
+  // with the two swapped. The history hashes them alike as well.
+  //
+  // With slot, the thread takes the place of the ended thread in it rather
+  // than a new one; TSO threads never do.
+  int StartThread(const std::function<void()>& task, bool tso = false,
+      int symmetry_group = -1, int slot = -1);
   void ReachedTransition(const Transition& transition);
 
+  inline bool is_tso(int thread) const {
+    return thread < kMaxThreads && tso_threads_.count(thread);
+  }
+  // Waits in a step of its own until the store buffer of the current TSO
+  // thread is flushed, as fences and atomic read-modify-writes do. Takes no
+  // step if it is empty already.
+  void DrainStoreBuffer();
+  // Turns a store of the current TSO thread into the BUFFERED_WRITE that
+  // buffers it, first waiting in a step of its own while the buffer is full.
+  Transition BufferedStore(const Transition& store);
+  // Buffers store, the BUFFERED_WRITE the current thread just ran.
+  void BufferStore(const Transition& store);
+  // The value load of the current TSO thread reads when memory holds value.
+  inline int64_t ForwardLoad(const Transition& load, int64_t value) const {
+    return store_buffers_[current_thread()].Forward(load.address(),
+        load.length(), value);
+  }
+
+  // With spin_reads set, a thread whose last spin_reads steps read the same
+  // value from the same location is taken to be spinning on it: its next
+  // read of the location waits until the value changes, instead of letting
+  // the search run the loop around again.
+  void WaitIfSpinning(Transition* read);
+  // Records the step the current thread just ran, and the value it read,
+  // counting the steps in a row that wrote nothing for retry_cutoff.
+  void NoteStep(const Transition& transition, int64_t value);
+
+  // Counts the run as a bug: access, of the current thread, touches memory
+  // that thread freed_by freed after step freed_after of the run, see
+  // PredictableAlloc::Free, or the current thread frees it again if access
+  // is null. Printed the first time for each location of an access, and
+  // for the first double free.
+  void ReportFreedMemory(const Transition* access, int freed_by,
+      int freed_after);
+  // The number of steps the run has taken so far.
+  int run_steps() const;
+
   // TODO: FoundBug can perhaps move into an annotation.
+  // With stop_run_on_found, a bug found while the run is going ends it once
+  // the current step is over.
   inline void FoundBug() {
     has_found_bug_ = true;
+    stopped_ |= stop_run_on_found && !finished();
   }
 
-  void StartNewRun(HHBHistory* history);
-  void AdvanceThread(int thread);  
-  // TODO: AdvanceThread switches back to the originating thread after every
-  // transition, which is not necessary if the originating thread can supply a
-  // series of threads to run in advance, or if the transitions to run can be
-  // determined in a callback.
+  // Abandons the previous run if it has not finished, without running the
+  // rest of it. If reuse_length is positive, the run is expected to replay
+  // the first reuse_length transitions of the previous run, and history
+  // keeps them instead of recomputing them.
+  void StartNewRun(HHBHistory* history, int reuse_length = 0);
+  void AdvanceThread(int thread);
+  // Runs the threads in schedule one transition each, in order. The program
+  // threads hand control directly to each other, so the originating thread
+  // only resumes once the whole schedule has run. Every thread in schedule
+  // must be runnable when its turn comes, as when replaying a known prefix.
+  void AdvanceThreads(const std::vector<int>& schedule);
+  // With run_solo_tails, once the thread that runs is the only one left with
+  // anything to do, it takes its steps one after another without switching
+  // back, until the run ends or another thread has a step to take; a single
+  // AdvanceThread then runs them all. The steps are still added to the
+  // history. Only for explorers with nothing to decide when one thread can
+  // run, and that do not look at each step as it runs.
+  inline void set_run_solo_tails(bool run_solo_tails) {
+    run_solo_tails_ = run_solo_tails;
+  }
 
   inline int current_thread() const {
     return scheduler_.current_thread();
@@ -41,38 +124,205 @@ class Interceptor {
   inline const ThreadMap<Transition>& next_transitions() const {
     return next_transitions_;
   }
+  // Marks the blocked threads that wait on what transition writes to be
+  // checked again, for writes that are not steps of their own.
+  inline void NoteWrite(const Transition& transition) {
+    if (!blocking_.empty() && transition.can_write()) {
+      recheck_ = recheck_ | (PendingConflicts(transition) & blocking_);
+    }
+  }
+  // The threads whose next transitions conflict with transition. Only those
+  // next transitions that touch the same cells, or access ranges, are
+  // checked.
+  ThreadSet PendingConflicts(const Transition& transition) const;
 
   inline const HHBHistory* history() const {
     return history_;
   }
 
+  // The clock vector of thread at the current point of the run, which lags
+  // behind history()->current_cv_for while a reused prefix is replayed.
+  ClockVector current_cv_for(int thread) const;
+
   inline bool has_found_bug() const {
     return has_found_bug_;
   }
 
+  // Whether the run ended, either with every thread done, with the alive
+  // ones all blocked, cut off by max_run_steps or retry_cutoff, or stopped
+  // at a bug by stop_run_on_found.
   inline bool finished() const {
-    return alive_threads_.empty();
+    return alive_threads_.empty() || deadlocked_ || cut_off_ || stopped_;
   }
 
+  // Whether the run ended with threads that can never run again. Such runs
+  // count as found bugs, but the program's own checks are not run on them.
+  inline bool deadlocked() const {
+    return deadlocked_;
+  }
+
+  // Tells bugs apart by where the finished run left each thread: the type
+  // and location of the last step it took, or of the transition it is
+  // blocked at. Runs that reach the same bug along other interleavings fall
+  // in the same class.
+  uint64_t BugClass() const;
+
+  // Tells states of the run apart by what they hold rather than by the
+  // steps that led there: the hash of memory, see memory_hash.h, with where
+  // each thread is, as the type, location and address of its next
+  // transition, and the stores in the buffers of TSO threads. Only
+  // meaningful with hash_memory_state. What threads keep in registers and
+  // in stack memory the pass does not intercept is not seen, so states that
+  // differ only there hash alike.
+  uint64_t StateHash() const;
+
+  // Makes the processes forked from here on count distinct runs in one set,
+  // so that a run is new only if no process has seen it, and the distinct
+  // statistic of each counts those of all.
+  static void ShareDistinct();
+
  private:
+  // Runs the task of thread, and then parks it until it is started again.
+  static void RunThread(void* interceptor, int thread);
+  void BeginTransition(int thread);
+  // While a reused prefix is replayed, exits unless thread can take the step
+  // the prefix holds next, reporting where the run diverged: a program whose
+  // runs depend on more than their schedule, such as on memory that Setup
+  // leaves as the previous run left it, would otherwise be explored along
+  // steps it no longer takes.
+  void CheckReplayedStep(int thread);
+  // Runs the step of flusher, which flushes the oldest store of its thread.
+  void Flush(int flusher);
+  // Runs the flushes that are next in the schedule of AdvanceThreads, and
+  // returns whether a program thread follows them.
+  bool FlushUntilScheduledThread();
   void SwitchToNext();
+  // Whether the current thread, which just reached its next transition, is
+  // to take it right away under run_solo_tails.
+  bool ContinuesSolo();
+  // Brings runnable_ up to date with the writes since it was last computed.
+  void UpdateRunnable();
   // FIXME: ComputeRunnable needs a better name to reflect that
   // it also checks for run end and deadlock.
   void ComputeRunnable();
+  // Removes the threads from runnable_ that wait for the previous thread of
+  // their symmetry group to take its first step.
+  void WithholdSymmetricThreads();
+  // Removes the threads from runnable_ that retry_cutoff starves, and returns
+  // whether the run is to be cut off: it reached max_run_steps, or only
+  // starved threads could run. Exits if the run outgrows kMaxClockTime.
+  bool WithholdStarvedThreads();
+  // Counts a cut-off run, as a livelock unless prune_cut_off_runs is set,
+  // and prints where its threads were the first time. Returns whether it is
+  // the first livelock.
+  bool ReportCutOff();
+  // Prints the blocked transitions of a deadlocked run, and counts it as a
+  // livelock if a thread is blocked spinning, see WaitIfSpinning. Returns
+  // whether it is the first of its kind.
+  bool ReportDeadlock();
+  // Counts the run as a bug, and prints the race of the step at location
+  // with the earlier one at earlier_location the first time the pair races.
+  void ReportRace(uint32_t earlier_location, uint32_t location);
+  // Dumps the trace of the run to bug_directory, and adds its schedule to
+  // the bug corpus, if its bug is the first of its class.
+  void DumpIfNewBugClass();
+  // Counts the run in the distinct statistic, and writes its hash to the
+  // coverage file, if it is new.
+  void CountDistinct();
   void FinishRun();
+  // Adds the time of the run that just finished to the histograms, and keeps
+  // its schedule if it is among the slow_runs slowest.
+  void RecordRunTime(uint64_t finish_cycles);
 
   std::function<void()> setup_run_, finish_run_;
 
   Scheduler scheduler_;
+  std::function<void()> tasks_[kMaxThreads];
   ThreadSet alive_threads_, runnable_;
   ThreadMap<Transition> next_transitions_;
+  // ComputeRunnable keeps the runnable next transitions in enabled_ from one
+  // step to the next. Those that can block are in blocking_, and only those
+  // in recheck_, which a write since may have woken or blocked, read memory
+  // again.
+  ThreadSet enabled_, blocking_, recheck_;
+
+  // The next transitions indexed by the kCellSize cells they access, with
+  // the threads whose next transitions read and write each. A linearly
+  // probed table, as there are at most two cells for each thread; a cell of
+  // 0 marks a free slot, so cells are stored one up. Next transitions of
+  // ranges, which may cover any number of cells, are kept apart.
+  struct PendingCell {
+    uintptr_t cell;
+    ThreadSet readers, writers;
+  };
+  static const int kPendingSlots = PendingSlots();
+  PendingCell pending_cells_[kPendingSlots];
+  ThreadSet ranged_pending_;
+  void SetNextTransition(int thread, const Transition& transition);
+  void EraseNextTransition(int thread);
+  // Adds thread to the cells transition accesses, or takes it out of them.
+  void IndexPending(int thread, const Transition& transition, bool add);
+  int FindPendingSlot(uintptr_t cell) const;
+
+  ThreadSet tso_threads_, flushers_;
+  int flusher_of_[kMaxThreads], owner_of_[kMaxThreads];
+  StoreBuffer store_buffers_[kMaxThreads];
+
+  // The reads a thread's latest steps repeated, see WaitIfSpinning.
+  struct SpinState {
+    int8_t* address;
+    int32_t length;
+    int64_t value;
+    int count;
+  };
+  SpinState spin_of_[kMaxThreads];
+
+  // The steps in a row each thread took that wrote nothing, counted since
+  // write_epoch, and the number of steps so far that wrote something, see
+  // retry_cutoff.
+  struct RetryState {
+    int64_t write_epoch;
+    int count;
+  };
+  RetryState retries_of_[kMaxThreads];
+  int64_t write_epoch_;
 
-  bool has_found_bug_;
+  // The threads that took a step this run, and the thread started before
+  // each one in its symmetry group, or -1.
+  ThreadSet started_;
+  int previous_symmetric_[kMaxThreads];
+  int symmetry_group_[kMaxThreads];
+
+  bool has_found_bug_, deadlocked_, cut_off_, stopped_;
+  bool run_solo_tails_;
+
+  // The cycle counter at the start of the run, and the cycles it has spent
+  // adding steps to the history so far, which are only counted with
+  // slow_runs.
+  uint64_t run_start_, hb_cycles_;
+
+  // Only used with detect_races.
+  RaceDetector race_detector_;
 
   // TODO: Consider if history really has a place in interceptor, and if so,
   // what subclass.
   HHBHistory* history_;
+  int reuse_length_, replayed_;
+  ThreadMap<int> replay_last_time_of_;
+
+  // The schedule being run by AdvanceThreads, if any, and the index of the
+  // next thread in it.
+  const std::vector<int>* schedule_;
+  size_t next_in_schedule_;
 
   int num_created_threads_;
 };
 
+// Prints the slow_runs slowest runs finished so far to stderr, slowest first,
+// with where their time went and their schedules, see PackedSchedule.
+void PrintSlowestRuns();
+
+// Forgets which runs passed the program's Finish, see FinishRun, for when
+// the program changes what its runs check, as between the workloads of
+// --workloads.
+void ForgetVerifiedRuns();
@@ -1,21 +1,41 @@
 #include "codex_interface.h"
 #include "program_interface.h"
 
-#include <memory>
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
+#include "annotation.h"
 #include "config.h"
 #include "hhbhistory.h"
 #include "interceptor.h"
+#include "location_profile.h"
+#include "memory_hash.h"
+#include "parallel.h"
 #include "predictable_alloc.h"
+#include "statistics.h"
 #include "threadmap.h"
 #include "transition.h"
 
+static int64_t& private_accesses =
+    RegisterStatistic<int64_t>("private-accesses");
+static int64_t& coalesced_accesses =
+    RegisterStatistic<int64_t>("coalesced-accesses");
+static int64_t& operation_step_accesses =
+    RegisterStatistic<int64_t>("operation-step-accesses");
+static int64_t& unscheduled_accesses =
+    RegisterStatistic<int64_t>("unscheduled-accesses");
+
 static PredictableAlloc* predictable_alloc = nullptr;
+uint64_t memory_state_hash = 0;
 
-static inline PredictableAlloc* GetPredictableAlloc() {
+PredictableAlloc* GetPredictableAlloc() {
   if (predictable_alloc == nullptr) {
     predictable_alloc = new PredictableAlloc();
   }
@@ -26,15 +46,142 @@ extern void Setup();
 extern void Finish();
 
 static Interceptor* interceptor = nullptr;
+static bool running_transparently = false;
+// While the program runs natively, see RunProgramNatively: the OS thread of
+// each of its threads, numbered as the interceptor would, the number of
+// them and of those still running, whether they may start running, whether
+// Found was called, the thread each OS thread runs, the atomic sections it
+// is in, and the result RequireResult asked its next access for.
+static bool running_natively = false;
+static std::thread os_threads[kMaxThreads];
+static std::atomic<int> num_os_threads;
+static std::atomic<int> live_os_threads;
+static std::atomic<bool> os_threads_released;
+static std::atomic<bool> found_natively;
+static thread_local int native_thread_id = Scheduler::kOriginalThread;
+static thread_local int native_section_depth = 0;
+static thread_local bool native_has_required = false;
+static thread_local int64_t native_required;
+// Atomic sections run one at a time, as the search runs them.
+static std::recursive_mutex native_sections;
+// The threads between EndInterleaving and BeginInterleaving.
+static ThreadSet native_threads;
+// How many atomic sections each thread is in, see BeginAtomicSection.
+static int atomic_section_depth[kMaxThreads];
+// The byte every atomic section starts by incrementing.
+static int8_t atomic_sections;
+// Threads that program threads start, and their ends, are steps on these:
+// how many of them took new slots this run, and how many threads started and
+// ended in each slot. Per slot, the generation of its thread, the count of
+// starts and ends that it waits for and that joining it waits for, and the
+// thread that spawned it. The slots of ended threads that a thread spawned
+// and joined are free for its next spawns.
+static int32_t spawned_threads;
+static int32_t thread_starts[kMaxThreads];
+static int32_t thread_ends[kMaxThreads];
+static int32_t generation[kMaxThreads];
+static int parent_of[kMaxThreads];
+static ThreadSet reusable_slots[kMaxThreads];
+
+// With operation_steps, the operation each thread is in, see
+// BeginOperationStep, or -1, and the accesses it took in it so far. One that
+// takes more is refined, as it may be spinning on what only another thread
+// would change.
+static const int kMaxOperationSteps = 4096;
+static const int64_t kMaxOperationStepAccesses = 1 << 16;
+static int current_operation[kMaxThreads];
+static int64_t operation_accesses[kMaxThreads];
+// Which operations are refined, in memory that the processes forked by the
+// search share, so that a refinement anywhere holds everywhere.
+struct RefinedOperationTable {
+  std::atomic<int64_t> count;
+  std::atomic<bool> refined[kMaxOperationSteps];
+};
+static RefinedOperationTable* refined_operations = nullptr;
+// The threads that accessed each aligned 8 bytes during the run, with the
+// operation each was in, or -1, and whether it wrote them.
+struct Touch {
+  int thread;
+  int operation;
+  bool wrote;
+};
+static std::unordered_map<uintptr_t, std::vector<Touch>> footprints;
+
+// Under scheduling_points that leave out atomic accesses, the locations made
+// scheduling points since, as RefinedOperationTable does for operations, and
+// the threads that made each atomic access or step to each aligned 8 bytes
+// during the run, with where, and whether it wrote them.
+static const uint32_t kMaxPromotedLocations = 1 << 16;
+struct PromotedLocationTable {
+  std::atomic<int64_t> count;
+  std::atomic<bool> promoted[kMaxPromotedLocations];
+};
+static PromotedLocationTable* promoted_locations = nullptr;
+struct PointTouch {
+  int thread;
+  uint32_t location;
+  bool scheduled;
+  bool wrote;
+};
+static std::unordered_map<uintptr_t, std::vector<PointTouch>> point_footprints;
+
+// With setup_once, the thread starts of the first Setup, repeated by later
+// runs in its stead.
+static bool in_first_setup = false;
+static bool first_setup_done = false;
+static std::vector<std::function<int()>> setup_thread_starts;
+
+static void SetupRun() {
+  GetPredictableAlloc()->ResetOffsetToBase();
+  native_threads.clear();
+  std::fill(atomic_section_depth, atomic_section_depth + kMaxThreads, 0);
+  spawned_threads = 0;
+  std::fill(thread_starts, thread_starts + kMaxThreads, 0);
+  std::fill(thread_ends, thread_ends + kMaxThreads, 0);
+  std::fill(generation, generation + kMaxThreads, 0);
+  std::fill(parent_of, parent_of + kMaxThreads, -1);
+  for (ThreadSet& slots : reusable_slots) {
+    slots.clear();
+  }
+  std::fill(current_operation, current_operation + kMaxThreads, -1);
+  footprints.clear();
+  point_footprints.clear();
+  if (!setup_once) {
+    Setup();
+  } else if (first_setup_done) {
+    for (const std::function<int()>& start : setup_thread_starts) {
+      start();
+    }
+  } else {
+    in_first_setup = true;
+    Setup();
+    in_first_setup = false;
+    GetPredictableAlloc()->StoreOffsetAsBase();
+    first_setup_done = true;
+  }
+  // Every run starts from the memory Setup leaves, whether it ran or not.
+  memory_state_hash = 0;
+}
 
 Interceptor* SetupInterfaceAndInterceptor() {
   assert(interceptor == nullptr);
 
+  if (huge_pages) {
+    GetPredictableAlloc()->UseHugePages();
+  }
   GetPredictableAlloc()->StoreOffsetAsBase();
-  interceptor = new Interceptor([]() { 
-    GetPredictableAlloc()->ResetOffsetToBase();
-    Setup();
-  }, Finish);
+  if (operation_steps) {
+    refined_operations = new (AllocateShared(sizeof(RefinedOperationTable)))
+        RefinedOperationTable();
+  }
+  if (RefinesSchedulingPoints()) {
+    promoted_locations = new (AllocateShared(sizeof(PromotedLocationTable)))
+        PromotedLocationTable();
+  }
+  interceptor = new Interceptor(&SetupRun, []() {
+    Finish();
+    GetPredictableAlloc()->RecordStatistics();
+  });
 
   return interceptor;
 }
@@ -42,15 +189,79 @@ Interceptor* SetupInterfaceAndInterceptor() {
 // Methods exposed to user code to interact with the runtime environment, such
 // as starting new threads or learning a current clockvector.
 
+// A started thread can reach anything its parent could through its task.
+static void ShareWithNewThread() {
+  int thread = interceptor->current_thread();
+  if (thread != Scheduler::kOriginalThread) {
+    GetPredictableAlloc()->ShareAllOwnedBy(thread);
+  }
+}
+
+static int SpawnThread(const std::function<void()>& task, bool tso,
+    int group);
+
+static int StartNatively(const std::function<void()>& task);
+
+// Starts a thread, and keeps the start for later runs if the first Setup
+// made it. Program threads spawn theirs in a step instead, see SpawnThread.
+static int Start(const std::function<void()>& task, bool tso, int group) {
+  if (running_natively) {
+    return StartNatively(task);
+  }
+  int thread = interceptor->current_thread();
+  if (thread != Scheduler::kOriginalThread && !running_transparently &&
+      !native_threads.count(thread)) {
+    return SpawnThread(task, tso, group);
+  }
+  std::function<int()> start = [=]() {
+    ShareWithNewThread();
+    return interceptor->StartThread(task, tso, group);
+  };
+  if (in_first_setup) {
+    setup_thread_starts.push_back(start);
+  }
+  return start();
+}
+
 int StartThread(const std::function<void()>& task) {
-  return interceptor->StartThread(task);
+  return Start(task, weak_atomics, -1);
 }
 
 int StartThread(const std::function<void(int)>& task, int arg) {
-  return interceptor->StartThread(std::bind(task, arg));
+  return Start(std::bind(task, arg), weak_atomics, -1);
+}
+
+int TSOStartThread(const std::function<void()>& task) {
+  return Start(task, true, -1);
+}
+
+int TSOStartThread(const std::function<void(int)>& task, int arg) {
+  return Start(std::bind(task, arg), true, -1);
+}
+
+int SymmetricStartThread(const std::function<void()>& task, int group) {
+  return Start(task, weak_atomics, group);
+}
+
+int SymmetricStartThread(const std::function<void(int)>& task, int arg,
+    int group) {
+  return Start(std::bind(task, arg), weak_atomics, group);
+}
+
+void TSOBarrier() {
+  if (running_natively) {
+    return;
+  }
+  if (interceptor != nullptr && !running_transparently &&
+      interceptor->is_tso(interceptor->current_thread())) {
+    interceptor->DrainStoreBuffer();
+  }
 }
 
 int ThreadId() {
+  if (running_natively) {
+    return native_thread_id;
+  }
   return interceptor->current_thread();
 }
 
@@ -58,11 +269,66 @@ void RequestYield(int) {
 }
 
 void Found() {
+  if (running_natively) {
+    found_natively = true;
+    return;
+  }
   interceptor->FoundBug();
 }
 
+bool RunningNatively() {
+  return running_natively;
+}
+
 ClockVector GetClockVector(int thread) {
-  return interceptor->history()->current_cv_for(thread);
+  if (running_natively) {
+    return ClockVector();
+  }
+  return interceptor->current_cv_for(thread);
+}
+
+void RegisterGlobal(void* address, size_t size) {
+  GetPredictableAlloc()->RegisterGlobal(address, size);
+}
+
+void RunTransparently(const std::function<void()>& function) {
+  if (running_natively) {
+    function();
+    return;
+  }
+  bool was_running_transparently = running_transparently;
+  int8_t was_intercepting = codex_intercepting;
+  running_transparently = true;
+  codex_intercepting = false;
+  function();
+  running_transparently = was_running_transparently;
+  codex_intercepting = was_intercepting;
+}
+
+void EndInterleaving() {
+  if (running_natively) {
+    return;
+  }
+  int thread = interceptor->current_thread();
+  if (thread == Scheduler::kOriginalThread || native_threads.count(thread)) {
+    return;
+  }
+  // Stores still buffered would otherwise land after the direct ones.
+  TSOBarrier();
+  native_threads.insert(thread);
+  codex_intercepting = false;
+}
+
+void BeginInterleaving() {
+  if (running_natively) {
+    return;
+  }
+  int thread = interceptor->current_thread();
+  if (thread == Scheduler::kOriginalThread || !native_threads.count(thread)) {
+    return;
+  }
+  native_threads.erase(thread);
+  codex_intercepting = true;
 }
 
 void Output(const char* format, ...) {
@@ -78,52 +344,444 @@ void Output(const char* format, ...) {
 // transitions, such as a required result or an annotation.
 
 struct NextTransitionInfo {
-  NextTransitionInfo() {}
+  NextTransitionInfo() : has_required(false) {}
 
   bool has_required;
   int64_t required;
-  std::vector<std::string> annotations;
+  // Cleared rather than replaced, to keep its buffer from run to run.
+  std::vector<Annotation> annotations;
 };
 
 static ThreadMap<NextTransitionInfo> next_transition_info;
 
 void RequireResult(int64_t result) {
+  if (running_natively) {
+    native_has_required = true;
+    native_required = result;
+    return;
+  }
   auto& info = next_transition_info[interceptor->current_thread()];
   info.has_required = true;
   info.required = result;
 }
 
-void Annotate(std::string annotation) {
+int InternAnnotation(const std::string& text) {
+  return InternAnnotationText(text);
+}
+
+void Annotate(int text) {
+  if (running_natively) {
+    return;
+  }
+  auto& info = next_transition_info[interceptor->current_thread()];
+  info.annotations.push_back(Annotation(text));
+}
+
+void Annotate(int text, int64_t value) {
+  if (running_natively) {
+    return;
+  }
   auto& info = next_transition_info[interceptor->current_thread()];
-  info.annotations.push_back(annotation);
+  info.annotations.push_back(Annotation(text, value));
+}
+
+void Annotate(const std::string& annotation) {
+  if (running_natively) {
+    return;
+  }
+  Annotate(InternAnnotationText(annotation));
 }
 
 // Handlers for intercepted memory accesses. All such accesses first get
 // intercepted below, and then get passed to the interceptor.
 
+// Allocations that only their owner can reach can not race, so accesses to
+// them are not transitions. Any other thread can only get at one through a
+// pointer that escaped unnoticed, which shares the allocation from then on.
+static bool IsPrivateAddress(int thread, int8_t* address) {
+  int owner = GetPredictableAlloc()->OwnerOf(address);
+  if (owner == thread) {
+    return true;
+  } else if (owner != PredictableAlloc::kShared) {
+    GetPredictableAlloc()->Share(address);
+  }
+  return false;
+}
+
+static bool IsPrivateAccess(int thread, const Transition& transition) {
+  if (transition.type() == TransitionType::MEMCPY &&
+      !IsPrivateAddress(thread, transition.source())) {
+    return false;
+  }
+  return IsPrivateAddress(thread, transition.address());
+}
+
+// When coalescing, a thread also runs on through non-atomic accesses that
+// conflict with no other thread's next transition, making them part of the
+// transition it was scheduled for. Assuming the tested program is data-race
+// free, only atomic accesses need to be interleaved; a race that is about to
+// happen still ends the step.
+//
+// Stores of TSO threads are never coalesced, as they have to go through the
+// store buffer in order.
+static bool IsCoalescedAccess(int thread, const Transition& transition) {
+  if (!coalesce_accesses || transition.is_atomic() ||
+      interceptor->is_tso(thread)) {
+    return false;
+  }
+  ThreadSet conflicts = interceptor->PendingConflicts(transition);
+  conflicts.erase(thread);
+  return conflicts.empty();
+}
+
+// Whether an access is a step under scheduling_points.
+static bool IsSchedulingPoint(int thread, const Transition& transition) {
+  TransitionType type = transition.type();
+  if (interceptor->is_tso(thread) || type == TransitionType::READ_GE ||
+      type == TransitionType::LOCK || type == TransitionType::UNLOCK ||
+      type == TransitionType::FREE) {
+    return true;
+  }
+  if (promoted_locations != nullptr && transition.is_atomic() &&
+      (transition.location() >= kMaxPromotedLocations ||
+       promoted_locations->promoted[transition.location()])) {
+    return true;
+  }
+  switch (scheduling_points) {
+  case SchedulingPoints::ATOMIC:
+    return transition.is_atomic();
+  case SchedulingPoints::SYNC:
+    return type == TransitionType::CAS || type == TransitionType::ATOMICRMW;
+  case SchedulingPoints::LOCATIONS:
+    return transition.location() < scheduling_locations.size() &&
+        scheduling_locations[transition.location()];
+  default:
+    return true;
+  }
+}
+
+static void PromoteLocation(uint32_t location) {
+  if (!promoted_locations->promoted[location].exchange(true)) {
+    promoted_locations->count++;
+  }
+}
+
+// Adds a step, or an atomic access that is no step, of a program thread to
+// the footprints of the run, under scheduling_points that leave out atomic
+// accesses. The search takes such an access as independent of every other,
+// so one that conflicts with an access of another thread, either way round,
+// is a race it would miss: its location is promoted to a scheduling point.
+static void NoteSchedulingAccess(int thread, const Transition& transition,
+    bool scheduled) {
+  if (promoted_locations == nullptr ||
+      (!scheduled && !transition.is_atomic())) {
+    return;
+  }
+  uint32_t location = transition.location();
+  AccessRange ranges[2];
+  int num_ranges = transition.AccessRanges(ranges);
+  for (int i = 0; i < num_ranges; i++) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(ranges[i].start);
+    for (uintptr_t granule = start / 8;
+        granule <= (start + std::max<int64_t>(ranges[i].length, 1) - 1) / 8;
+        granule++) {
+      bool seen = false;
+      std::vector<PointTouch>& touches = point_footprints[granule];
+      for (PointTouch& touch : touches) {
+        if (touch.thread == thread) {
+          if (touch.location == location && touch.scheduled == scheduled) {
+            touch.wrote |= ranges[i].write;
+            seen = true;
+          }
+        } else if (touch.wrote || ranges[i].write) {
+          if (!touch.scheduled) {
+            PromoteLocation(touch.location);
+          }
+          if (!scheduled) {
+            PromoteLocation(location);
+          }
+        }
+      }
+      if (!seen) {
+        touches.push_back(PointTouch{thread, location, scheduled,
+            ranges[i].write});
+      }
+    }
+  }
+}
+
+static void RefineOperation(int operation) {
+  if (operation >= 0 &&
+      !refined_operations->refined[operation].exchange(true)) {
+    refined_operations->count++;
+  }
+}
+
+// Adds an access of a program thread to the footprints of the run, and
+// returns whether it runs directly as part of the step of an operation, see
+// BeginOperationStep. An operation whose access conflicts with one of
+// another thread, either way round, is refined, as is one that does anything
+// that a step could have to wait for, from that access on.
+static bool NoteOperationAccess(int thread, const Transition& transition) {
+  int operation = current_operation[thread];
+  bool in_step = operation >= 0 && !refined_operations->refined[operation];
+  TransitionType type = transition.type();
+  if (in_step && (interceptor->is_tso(thread) ||
+      ++operation_accesses[thread] > kMaxOperationStepAccesses ||
+      (type != TransitionType::READ && type != TransitionType::WRITE &&
+       type != TransitionType::CAS && type != TransitionType::ATOMICRMW &&
+       type != TransitionType::MEMSET && type != TransitionType::MEMCPY))) {
+    RefineOperation(operation);
+    in_step = false;
+  }
+
+  AccessRange ranges[2];
+  int num_ranges = transition.AccessRanges(ranges);
+  for (int i = 0; i < num_ranges; i++) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(ranges[i].start);
+    for (uintptr_t granule = start / 8;
+        granule <= (start + std::max<int64_t>(ranges[i].length, 1) - 1) / 8;
+        granule++) {
+      bool seen = false;
+      std::vector<Touch>& touches = footprints[granule];
+      for (Touch& touch : touches) {
+        if (touch.thread == thread) {
+          if (touch.operation == operation) {
+            touch.wrote |= ranges[i].write;
+            seen = true;
+          }
+        } else if (touch.wrote || ranges[i].write) {
+          RefineOperation(touch.operation);
+          if (in_step) {
+            RefineOperation(operation);
+            in_step = false;
+          }
+        }
+      }
+      if (!seen) {
+        touches.push_back(Touch{thread, operation, ranges[i].write});
+      }
+    }
+  }
+  return in_step;
+}
+
+// Reports an access of a program thread to memory freed during the run. A
+// FREE itself only runs before the block is freed.
+static void CheckFreedAccess(const Transition& transition) {
+  AccessRange ranges[2];
+  int num_ranges = transition.AccessRanges(ranges);
+  for (int i = 0; i < num_ranges; i++) {
+    if (GetPredictableAlloc()->IsFreed(ranges[i].start, ranges[i].length)) {
+      int freed_by, freed_after;
+      GetPredictableAlloc()->FindFree(ranges[i].start, &freed_by,
+          &freed_after);
+      interceptor->ReportFreedMemory(&transition, freed_by, freed_after);
+      return;
+    }
+  }
+}
+
+// How Intercept reads and writes the memory of a transition: by switching on
+// its length, or, for the entry points of one width, as a T.
+struct AnyLength {
+  static int64_t Read(const Transition& transition) {
+    return transition.Read();
+  }
+  static void Write(const Transition& transition, int64_t value) {
+    transition.Write(value);
+  }
+};
+
+template <typename T>
+struct FixedLength {
+  static int64_t Read(const Transition& transition) {
+    return transition.ReadAs<T>();
+  }
+  static void Write(const Transition& transition, int64_t value) {
+    transition.WriteAs<T>(value);
+  }
+};
+
+// Accesses of native runs, which threads on other cores race with: loads
+// and stores are atomic, and writes that depend on what they read are
+// compare-and-swaps, retried until what they read is still there.
+template <typename T>
+static int64_t NativeLoad(const Transition& transition) {
+  return __atomic_load_n(reinterpret_cast<T*>(transition.address()),
+      __ATOMIC_SEQ_CST);
+}
+
+template <typename T>
+static bool NativeWrite(const Transition& transition, int64_t read,
+    int64_t value) {
+  T* address = reinterpret_cast<T*>(transition.address());
+  if (transition.type() == TransitionType::WRITE ||
+      transition.type() == TransitionType::UNLOCK) {
+    if (transition.order() == MemoryOrder::SEQ_CST) {
+      __atomic_store_n(address, static_cast<T>(value), __ATOMIC_SEQ_CST);
+    } else {
+      __atomic_store_n(address, static_cast<T>(value), __ATOMIC_RELEASE);
+    }
+    return true;
+  }
+  T expected = static_cast<T>(read);
+  return __atomic_compare_exchange_n(address, &expected,
+      static_cast<T>(value), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Runs transition of a native run. A transition that waits, for a required
+// result or a free lock, spins until it can run.
+static int64_t NativeIntercept(Transition transition) {
+  if (transition.is_ranged()) {
+    transition.WriteRange();
+    return 0;
+  } else if (transition.is_wide()) {
+    // The caller accesses the 16 bytes itself.
+    return 0;
+  }
+  if (native_has_required) {
+    transition.set_required(native_required);
+    native_has_required = false;
+  }
+  while (true) {
+    int64_t value;
+    switch (transition.length()) {
+      case 1:
+        value = NativeLoad<uint8_t>(transition);
+        break;
+      case 2:
+        value = NativeLoad<uint16_t>(transition);
+        break;
+      case 4:
+        value = NativeLoad<uint32_t>(transition);
+        break;
+      default:
+        value = NativeLoad<int64_t>(transition);
+        break;
+    }
+    if (!transition.DetermineRunnable(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    Result result = transition.DetermineResult(value);
+    if (!result.does_write) {
+      return result.returned_value;
+    }
+    bool written;
+    switch (transition.length()) {
+      case 1:
+        written = NativeWrite<uint8_t>(transition, value,
+            result.written_value);
+        break;
+      case 2:
+        written = NativeWrite<uint16_t>(transition, value,
+            result.written_value);
+        break;
+      case 4:
+        written = NativeWrite<uint32_t>(transition, value,
+            result.written_value);
+        break;
+      default:
+        written = NativeWrite<int64_t>(transition, value,
+            result.written_value);
+        break;
+    }
+    if (written) {
+      return result.returned_value;
+    }
+  }
+}
+
+// Kept out of line, so that LTO builds (see LTO in the Makefile) only inline
+// the fast paths of the entry points below into the instrumented code.
+template <typename Access = AnyLength>
+__attribute__((noinline))
 static int64_t Intercept(Transition transition) {
+  if (running_natively) {
+    return NativeIntercept(transition);
+  }
+  bool is_tso = false;
+  bool is_transition = false;
+  bool check_frees = false;
+
   // Intercepted code can have static initializaton code that that runs before
   // any of Codex. All such code runs transparently.
   if (interceptor != nullptr) {
     int thread = interceptor->current_thread();
+    bool native = running_transparently ||
+        (thread != Scheduler::kOriginalThread && native_threads.count(thread));
+    is_tso = interceptor->is_tso(thread) && !native;
 
     // Intercepted code can have setup code that we do not attempt to
     // interleave, and also run transparently.
-    if (thread != Scheduler::kOriginalThread) {
+    is_transition = thread != Scheduler::kOriginalThread && !native;
+    check_frees = detect_frees && is_transition;
+    if (is_transition) {
+      // Extra information has to end up on a transition.
+      auto& info = next_transition_info[thread];
+      bool in_operation_step = operation_steps &&
+          NoteOperationAccess(thread, transition);
+      if (info.has_required) {
+      } else if (in_operation_step) {
+        // Annotations carry over to the next step after it.
+        operation_step_accesses++;
+        is_transition = false;
+      } else if (!info.annotations.empty()) {
+      } else if (IsPrivateAccess(thread, transition)) {
+        private_accesses++;
+        is_transition = false;
+      } else if (IsCoalescedAccess(thread, transition)) {
+        coalesced_accesses++;
+        is_transition = false;
+      } else if (scheduling_points != SchedulingPoints::ALL &&
+          !IsSchedulingPoint(thread, transition)) {
+        unscheduled_accesses++;
+        is_transition = false;
+        NoteSchedulingAccess(thread, transition, false);
+      }
+      if (is_transition) {
+        NoteSchedulingAccess(thread, transition, true);
+      }
+    }
+    // Writes that are no step can still wake or block a waiting thread.
+    if (!is_transition) {
+      interceptor->NoteWrite(transition);
+    }
+
+    if (is_transition && is_tso) {
+      // Stores are buffered, and everything but loads waits for the stores
+      // before it to be flushed. Bulk copies and sets are not buffered, and
+      // with weak_atomics, neither are seq_cst stores. 16-byte accesses wait
+      // for the buffer, which does not hold them.
+      if (transition.is_wide()) {
+        interceptor->DrainStoreBuffer();
+      } else if (transition.type() == TransitionType::WRITE &&
+          !(weak_atomics && transition.order() == MemoryOrder::SEQ_CST)) {
+        transition = interceptor->BufferedStore(transition);
+      } else if (transition.type() != TransitionType::READ) {
+        interceptor->DrainStoreBuffer();
+      }
+    }
+
+    if (is_transition) {
       // Store extra information in the transition object that was passed
       // out-of-band through Annotate and RequireResult.
       auto& info = next_transition_info[thread];
       if (info.has_required) {
         transition.set_required(info.required);
         info.has_required = false;
+      } else if (transition.type() == TransitionType::READ &&
+          !transition.has_required()) {
+        interceptor->WaitIfSpinning(&transition);
       }
       if (!info.annotations.empty()) {
-        auto new_annotations = std::make_shared<std::vector<std::string>>();
-        std::swap(*new_annotations, info.annotations);
-        transition.set_annotations(new_annotations);
+        transition.set_annotations(InternAnnotations(info.annotations));
+        info.annotations.clear();
       }
 
       interceptor->ReachedTransition(transition);
+      ProfileTransition(transition);
 
       if (show_all_transitions) {
         fprintf(stderr, "% 3d [% 2d]: %s\n", 
@@ -134,64 +792,542 @@ static int64_t Intercept(Transition transition) {
     }
   }
 
-  // Execute the transition.
-  Result result = transition.DetermineResult(transition.Read());
+  // Execute the transition, which only now is ordered after the steps of
+  // the other threads that the search ran first.
+  if (check_frees) {
+    CheckFreedAccess(transition);
+  }
+  int64_t value = Access::Read(transition);
+  if (is_tso && transition.type() == TransitionType::READ) {
+    value = interceptor->ForwardLoad(transition, value);
+  }
+  if (is_transition) {
+    interceptor->NoteStep(transition, value);
+  }
+  if (transition.is_ranged()) {
+    ToggleMemoryHash(transition.address(), transition.range_length());
+    transition.WriteRange();
+    ToggleMemoryHash(transition.address(), transition.range_length());
+    return 0;
+  } else if (transition.type() == TransitionType::BUFFERED_WRITE) {
+    interceptor->BufferStore(transition);
+    return 0;
+  } else if (transition.is_wide()) {
+    return value;
+  }
+  Result result = transition.DetermineResult(value);
   if (result.does_write) {
-    transition.Write(result.written_value);
+    ToggleMemoryHash(transition.address(), transition.length());
+    Access::Write(transition, result.written_value);
+    ToggleMemoryHash(transition.address(), transition.length());
   }
   return result.returned_value;
 }
 
+// Native runs put nothing back between runs, and have no private
+// allocations, so writes are not noted, which would race on the bookkeeping
+// of the allocator.
+static inline void NoteWrite(const void* destination, int64_t length) {
+  if (!running_natively) {
+    GetPredictableAlloc()->NoteWrite(destination, length);
+  }
+}
+
+static inline void NoteStore(const void* destination, int64_t value) {
+  if (!running_natively) {
+    GetPredictableAlloc()->NoteStore(destination, value);
+  }
+}
+
 extern "C"
 int8_t* InterceptNew(int64_t size) {
-  return GetPredictableAlloc()->Alloc(size);
+  // The arena is not for threads that really run at once.
+  if (running_natively) {
+    return static_cast<int8_t*>(calloc(1, size));
+  }
+  // Allocations made outside of threads, such as during setup, are reachable
+  // by every thread.
+  int owner = PredictableAlloc::kShared;
+  if (interceptor != nullptr && !intercept_private_accesses &&
+      !running_transparently &&
+      interceptor->current_thread() != Scheduler::kOriginalThread) {
+    owner = interceptor->current_thread();
+  }
+  return GetPredictableAlloc()->Alloc(size, owner,
+      __builtin_return_address(0));
 }
 
 extern "C"
 void InterceptDelete(int8_t* ptr) {
+  // What is in the arena was allocated before, and is left there.
+  if (running_natively) {
+    if (!GetPredictableAlloc()->Contains(ptr)) {
+      free(ptr);
+    }
+    return;
+  }
+  if (interceptor == nullptr || running_transparently ||
+      interceptor->current_thread() == Scheduler::kOriginalThread) {
+    GetPredictableAlloc()->Free(ptr);
+    return;
+  }
+  // The free is a step of its own, so that the search orders the accesses
+  // of other threads to the block against it.
+  int64_t size = GetPredictableAlloc()->SizeOf(ptr);
+  if (detect_frees && size > 0) {
+    Intercept(Transition(TransitionType::FREE, ptr, 0, 0, size, 0,
+          MemoryOrder::NOT_ATOMIC));
+  }
+  int thread = interceptor->current_thread();
+  int step = interceptor->run_steps() - 1;
+  if (!GetPredictableAlloc()->Free(ptr, thread, step) && detect_frees) {
+    int freed_by, freed_after;
+    GetPredictableAlloc()->FindFree(ptr, &freed_by, &freed_after);
+    interceptor->ReportFreedMemory(nullptr, freed_by, freed_after);
+  }
 }
 
+// Outside of program threads, loads never get here, as the instrumentation
+// only calls InterceptLoad while codex_intercepting is set. Stores still have
+// to be noted, but skip building a transition.
 extern "C"
 void InterceptStore(int8_t* address, int64_t value, int32_t length, 
-    int32_t is_atomic, int8_t* file) {
-  Intercept(Transition(TransitionType::WRITE, address, length, value, file,
-        is_atomic));
+    int32_t ordering, int32_t location) {
+  NoteWrite(address, length);
+  NoteStore(address, value);
+  if (!codex_intercepting && !running_natively) {
+    // Only the low length bytes are stored, which on the little-endian
+    // targets Codex runs on come first.
+    ToggleMemoryHash(address, length);
+    memcpy(address, &value, length);
+    ToggleMemoryHash(address, length);
+    return;
+  }
+  Intercept(Transition(TransitionType::WRITE, address, length, value, location,
+        MemoryOrderFromLLVM(ordering)));
 }
 
 extern "C"
-int64_t InterceptLoad(int8_t* address, int32_t length, int32_t is_atomic,
-    int8_t* file) {
-  return Intercept(Transition(TransitionType::READ, address, length, file,
-        is_atomic));
+int64_t InterceptLoad(int8_t* address, int32_t length, int32_t ordering,
+    int32_t location) {
+  return Intercept(Transition(TransitionType::READ, address, length, location,
+        MemoryOrderFromLLVM(ordering)));
+}
+
+// Loads and stores of each width the pass gives an entry point of its own,
+// which take and return the value as a T.
+template <typename T>
+static T InterceptLoadAs(int8_t* address, int32_t ordering, int32_t location) {
+  return Intercept<FixedLength<T>>(Transition(TransitionType::READ, address,
+        sizeof(T), location, MemoryOrderFromLLVM(ordering)));
+}
+
+template <typename T>
+static void InterceptStoreAs(int8_t* address, T value, int32_t ordering,
+    int32_t location) {
+  NoteWrite(address, sizeof(T));
+  NoteStore(address, value);
+  if (!codex_intercepting && !running_natively) {
+    ToggleMemoryHash(address, sizeof(T));
+    *reinterpret_cast<T*>(address) = value;
+    ToggleMemoryHash(address, sizeof(T));
+    return;
+  }
+  Intercept<FixedLength<T>>(Transition(TransitionType::WRITE, address,
+        sizeof(T), value, location, MemoryOrderFromLLVM(ordering)));
+}
+
+extern "C"
+uint8_t InterceptLoad1(int8_t* address, int32_t ordering, int32_t location) {
+  return InterceptLoadAs<uint8_t>(address, ordering, location);
+}
+
+extern "C"
+uint16_t InterceptLoad2(int8_t* address, int32_t ordering, int32_t location) {
+  return InterceptLoadAs<uint16_t>(address, ordering, location);
+}
+
+extern "C"
+uint32_t InterceptLoad4(int8_t* address, int32_t ordering, int32_t location) {
+  return InterceptLoadAs<uint32_t>(address, ordering, location);
+}
+
+extern "C"
+uint64_t InterceptLoad8(int8_t* address, int32_t ordering, int32_t location) {
+  return InterceptLoadAs<uint64_t>(address, ordering, location);
+}
+
+extern "C"
+void InterceptStore1(int8_t* address, uint8_t value, int32_t ordering,
+    int32_t location) {
+  InterceptStoreAs<uint8_t>(address, value, ordering, location);
+}
+
+extern "C"
+void InterceptStore2(int8_t* address, uint16_t value, int32_t ordering,
+    int32_t location) {
+  InterceptStoreAs<uint16_t>(address, value, ordering, location);
+}
+
+extern "C"
+void InterceptStore4(int8_t* address, uint32_t value, int32_t ordering,
+    int32_t location) {
+  InterceptStoreAs<uint32_t>(address, value, ordering, location);
+}
+
+extern "C"
+void InterceptStore8(int8_t* address, uint64_t value, int32_t ordering,
+    int32_t location) {
+  InterceptStoreAs<uint64_t>(address, value, ordering, location);
 }
 
 extern "C"
 int64_t InterceptCmpXChg(int8_t* address, int64_t expected, 
-    int64_t replacement, int32_t length, int8_t* file) {
+    int64_t replacement, int32_t length, int32_t ordering, int32_t location) {
+  NoteWrite(address, length);
+  NoteStore(address, replacement);
   return Intercept(Transition(TransitionType::CAS, address, length, expected,
-        replacement, file, true));
+        replacement, location, MemoryOrderFromLLVM(ordering)));
 }
 
 extern "C"
 int64_t InterceptAtomicRMW(int8_t* address, int64_t value, int32_t type, 
-    int32_t length, int8_t* file) {
+    int32_t length, int32_t ordering, int32_t location) {
+  NoteWrite(address, length);
+  NoteStore(address, value);
   return Intercept(Transition(TransitionType::ATOMICRMW, address, length, type,
-        value, file, true));
+        value, location, MemoryOrderFromLLVM(ordering)));
+}
+
+// 16-byte accesses take a step whose transition carries their operands
+// folded, see Transition::FoldWide, and then run here on all 16 bytes.
+extern "C"
+unsigned __int128 InterceptLoad16(int8_t* address, int32_t ordering,
+    int32_t location) {
+  Intercept(Transition(TransitionType::READ, address, 16, location,
+        MemoryOrderFromLLVM(ordering)));
+  return *reinterpret_cast<unsigned __int128*>(address);
+}
+
+extern "C"
+void InterceptStore16(int8_t* address, unsigned __int128 value,
+    int32_t ordering, int32_t location) {
+  NoteWrite(address, 16);
+  NoteStore(address, static_cast<int64_t>(value));
+  NoteStore(address + 8,
+      static_cast<int64_t>(value >> 64));
+  Intercept(Transition(TransitionType::WRITE, address, 16,
+        Transition::FoldWide(value), location, MemoryOrderFromLLVM(ordering)));
+  unsigned __int128* wide = reinterpret_cast<unsigned __int128*>(address);
+  if (running_natively) {
+    unsigned __int128 old = *wide;
+    while (!__sync_bool_compare_and_swap(wide, old, value)) {
+      old = *wide;
+    }
+    return;
+  }
+  ToggleMemoryHash(address, 16);
+  *wide = value;
+  ToggleMemoryHash(address, 16);
+}
+
+extern "C"
+unsigned __int128 InterceptCmpXChg16(int8_t* address,
+    unsigned __int128 expected, unsigned __int128 replacement,
+    int32_t ordering, int32_t location) {
+  NoteWrite(address, 16);
+  NoteStore(address, static_cast<int64_t>(replacement));
+  NoteStore(address + 8,
+      static_cast<int64_t>(replacement >> 64));
+  Intercept(Transition(TransitionType::CAS, address, 16,
+        Transition::FoldWide(expected), Transition::FoldWide(replacement),
+        location, MemoryOrderFromLLVM(ordering)));
+  unsigned __int128* wide = reinterpret_cast<unsigned __int128*>(address);
+  if (running_natively) {
+    return __sync_val_compare_and_swap(wide, expected, replacement);
+  }
+  unsigned __int128 old = *wide;
+  if (old == expected) {
+    ToggleMemoryHash(address, 16);
+    *wide = replacement;
+    ToggleMemoryHash(address, 16);
+  }
+  return old;
 }
 
+// Bulk copies and sets are a single ranged transition each, rather than one
+// per byte or word.
 extern "C"
-void InterceptMemset(int8_t* dest, int8_t val, int32_t len, int32_t align,
-    bool is_volatile) {
-  memset(dest, val, len);
+void InterceptMemset(int8_t* dest, int64_t value, int64_t len,
+    int32_t location) {
+  NoteWrite(dest, len);
+  Intercept(Transition(TransitionType::MEMSET, dest, 0, value & 0xff, len,
+        location, MemoryOrder::NOT_ATOMIC));
 }
 
 extern "C"
-void InterceptMemcpy(int8_t* dest, int8_t* src, int32_t len, int32_t align,
-    bool is_volatile) {
-  memcpy(dest, src, len);
+void InterceptMemcpy(int8_t* dest, int8_t* src, int64_t len, int32_t location) {
+  NoteWrite(dest, len);
+  for (int64_t i = 0; i + 8 <= len; i += 8) {
+    int64_t word;
+    memcpy(&word, src + i, 8);
+    NoteStore(dest + i, word);
+  }
+  Intercept(Transition(TransitionType::MEMCPY, dest, 0,
+        reinterpret_cast<int64_t>(src), len, location,
+        MemoryOrder::NOT_ATOMIC));
 }
 
 extern "C"
 void InterceptFence() {
+  if (running_natively) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+  TSOBarrier();
+}
+
+// The low length bytes of value, as reads return them.
+static inline int64_t ZeroExtend(int64_t value, int32_t length) {
+  return length == 8 ? value : value & ((int64_t(1) << (8 * length)) - 1);
+}
+
+void WaitUntilEquals(const void* address, int32_t length, int64_t value) {
+  Transition wait(TransitionType::READ,
+      static_cast<int8_t*>(const_cast<void*>(address)), length, 0,
+      MemoryOrder::SEQ_CST);
+  wait.set_required(ZeroExtend(value, length));
+  Intercept(wait);
+}
+
+void WaitUntilAtLeast(const void* address, int32_t length, int64_t value) {
+  Transition wait(TransitionType::READ_GE,
+      static_cast<int8_t*>(const_cast<void*>(address)), length, value, 0,
+      MemoryOrder::SEQ_CST);
+  wait.set_required(1);
+  Intercept(wait);
+}
+
+void FutexWait(const void* address, int32_t length, int64_t expected) {
+  Transition wait(TransitionType::READ,
+      static_cast<int8_t*>(const_cast<void*>(address)), length, 0,
+      MemoryOrder::SEQ_CST);
+  wait.set_required_other_than(ZeroExtend(expected, length));
+  Intercept(wait);
+}
+
+void FutexWake(const void*) {
+}
+
+// A section is a step of its own that increments atomic_sections, so the
+// search orders sections of different threads, and then runs directly until
+// it ends, as after EndInterleaving.
+// Adds one to a counter of spawned_threads, thread_starts or thread_ends in
+// a step.
+static void CountInStep(int32_t* counter) {
+  Intercept(Transition(TransitionType::ATOMICRMW,
+        reinterpret_cast<int8_t*>(counter), sizeof(*counter), RMW_ADD, 1, 0,
+        MemoryOrder::SEQ_CST));
+}
+
+// The spawn counts a start of the slot, which the first step of the new
+// thread waits to see, so the thread runs after it in every order, and the
+// two never race. Spawns that take new slots count themselves in a step
+// before, as their order decides which slot each gets.
+static int SpawnThread(const std::function<void()>& task, bool tso,
+    int group) {
+  int parent = interceptor->current_thread();
+  int slot = -1;
+  if (!tso && !reusable_slots[parent].empty()) {
+    slot = *reusable_slots[parent].begin();
+    reusable_slots[parent].erase(slot);
+  } else {
+    CountInStep(&spawned_threads);
+  }
+  ShareWithNewThread();
+  int thread = interceptor->StartThread([=]() {
+    int self = interceptor->current_thread();
+    WaitUntilAtLeast(&thread_starts[self], sizeof(thread_starts[self]),
+        generation[self]);
+    task();
+    CountInStep(&thread_ends[self]);
+  }, tso, group, slot);
+  generation[thread]++;
+  parent_of[thread] = parent;
+  CountInStep(&thread_starts[thread]);
+  return thread;
+}
+
+void JoinThread(int thread) {
+  if (running_natively) {
+    if (thread >= 0 && thread < kMaxThreads &&
+        os_threads[thread].joinable()) {
+      os_threads[thread].join();
+    }
+    return;
+  }
+  if (interceptor == nullptr || running_transparently) {
+    return;
+  }
+  if (thread < 0 || thread >= kMaxThreads || parent_of[thread] == -1) {
+    fprintf(stderr, "JoinThread(%d): only threads that program threads "
+        "started can be joined\n", thread);
+    exit(1);
+  }
+  WaitUntilAtLeast(&thread_ends[thread], sizeof(thread_ends[thread]),
+      generation[thread]);
+  int self = interceptor->current_thread();
+  // A thread that runs directly does not wait, and may not have joined.
+  if (self == parent_of[thread] &&
+      thread_ends[thread] >= generation[thread] &&
+      !interceptor->is_tso(thread)) {
+    parent_of[thread] = -1;
+    reusable_slots[self].insert(thread);
+  }
+}
+
+// Threads of a native run get the numbers the interceptor would give them
+// on their first run, and those Setup starts all wait until it is over, so
+// that they start together.
+static int StartNatively(const std::function<void()>& task) {
+  int thread = num_os_threads++;
+  if (thread >= kMaxThreads) {
+    fprintf(stderr, "native runs can not start more than %d threads\n",
+        kMaxThreads);
+    exit(1);
+  }
+  live_os_threads++;
+  os_threads[thread] = std::thread([=]() {
+    native_thread_id = thread;
+    while (!os_threads_released.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    task();
+    live_os_threads--;
+  });
+  return thread;
+}
+
+bool RunProgramNatively() {
+  running_natively = true;
+  int8_t was_intercepting = codex_intercepting;
+  codex_intercepting = false;
+  num_os_threads = 0;
+  live_os_threads = 0;
+  os_threads_released = false;
+  found_natively = false;
+  Setup();
+  int setup_threads = num_os_threads;
+  os_threads_released.store(true, std::memory_order_release);
+  // The threads program threads start are theirs to join, and only once
+  // every thread is done are those they left unjoined.
+  for (int thread = 0; thread < setup_threads; thread++) {
+    os_threads[thread].join();
+  }
+  while (live_os_threads > 0) {
+    std::this_thread::yield();
+  }
+  for (int thread = setup_threads; thread < num_os_threads; thread++) {
+    if (os_threads[thread].joinable()) {
+      os_threads[thread].join();
+    }
+  }
+  Finish();
+  codex_intercepting = was_intercepting;
+  running_natively = false;
+  return found_natively;
+}
+
+void BeginAtomicSection() {
+  if (running_natively) {
+    native_sections.lock();
+    native_section_depth++;
+    return;
+  }
+  if (interceptor == nullptr || running_transparently) {
+    return;
+  }
+  int thread = interceptor->current_thread();
+  // Sections inside sections, or where the thread runs directly anyway, are
+  // part of what is around them.
+  if (thread == Scheduler::kOriginalThread ||
+      (atomic_section_depth[thread] == 0 && native_threads.count(thread)) ||
+      atomic_section_depth[thread]++ > 0) {
+    return;
+  }
+  Intercept(Transition(TransitionType::ATOMICRMW, &atomic_sections, 1,
+        RMW_ADD, 1, 0, MemoryOrder::SEQ_CST));
+  EndInterleaving();
+}
+
+void EndAtomicSection() {
+  if (running_natively) {
+    if (native_section_depth > 0) {
+      native_section_depth--;
+      native_sections.unlock();
+    }
+    return;
+  }
+  if (interceptor == nullptr || running_transparently) {
+    return;
+  }
+  int thread = interceptor->current_thread();
+  if (thread == Scheduler::kOriginalThread ||
+      atomic_section_depth[thread] == 0 ||
+      --atomic_section_depth[thread] > 0) {
+    return;
+  }
+  BeginInterleaving();
+}
+
+void BeginOperationStep(int operation) {
+  if (!operation_steps || running_natively || interceptor == nullptr ||
+      running_transparently) {
+    return;
+  }
+  int thread = interceptor->current_thread();
+  if (thread == Scheduler::kOriginalThread) {
+    return;
+  }
+  // Operations past the table always take steps.
+  current_operation[thread] = operation < kMaxOperationSteps ? operation : -1;
+  operation_accesses[thread] = 0;
+}
+
+void EndOperationStep() {
+  if (!operation_steps || running_natively || interceptor == nullptr ||
+      running_transparently) {
+    return;
+  }
+  int thread = interceptor->current_thread();
+  if (thread != Scheduler::kOriginalThread) {
+    current_operation[thread] = -1;
+  }
+}
+
+int64_t RefinedOperations() {
+  return refined_operations != nullptr ? refined_operations->count.load() : 0;
+}
+
+bool RefinesSchedulingPoints() {
+  return scheduling_points == SchedulingPoints::SYNC ||
+      scheduling_points == SchedulingPoints::LOCATIONS;
+}
+
+int64_t PromotedSchedulingPoints() {
+  return promoted_locations != nullptr ? promoted_locations->count.load() : 0;
+}
+
+void AcquireLock(void* lock) {
+  int8_t* byte = static_cast<int8_t*>(lock);
+  NoteWrite(byte, 1);
+  Intercept(Transition(TransitionType::LOCK, byte, 1, 0,
+        MemoryOrder::SEQ_CST));
+}
+
+void ReleaseLock(void* lock) {
+  int8_t* byte = static_cast<int8_t*>(lock);
+  NoteWrite(byte, 1);
+  Intercept(Transition(TransitionType::UNLOCK, byte, 1, 0,
+        MemoryOrder::SEQ_CST));
 }
 
@@ -0,0 +1,140 @@
+#include "introspection.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "statistics.h"
+
+enum IntrospectionCommand {
+  kNoRequest = 0,
+  kStatus,
+  kStop,
+};
+
+std::atomic<int> introspection_request(kNoRequest);
+
+static int64_t& introspection_requests =
+    RegisterStatistic<int64_t>("introspection-requests");
+
+static std::mutex mutex;
+static std::condition_variable answered_cv;
+static bool answered = false;
+static std::string answer;
+static std::string (*make_report)() = nullptr;
+static void (*stop_search)() = nullptr;
+
+static const auto kAnswerTimeout = std::chrono::seconds(5);
+
+void AnswerIntrospection() {
+  std::lock_guard<std::mutex> lock(mutex);
+  int command = introspection_request.exchange(kNoRequest);
+  if (command == kStatus) {
+    answer = make_report();
+  } else if (command == kStop) {
+    stop_search();
+    answer = "stopping\n";
+  } else {
+    return;
+  }
+  introspection_requests++;
+  answered = true;
+  answered_cv.notify_all();
+}
+
+static void WriteAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = write(fd, data.data() + written, data.size() - written);
+    if (result <= 0) {
+      return;
+    }
+    written += result;
+  }
+}
+
+// Reads the command of a connection, up to its first newline.
+static std::string ReadCommand(int fd) {
+  std::string command;
+  char c;
+  while (command.size() < 64 && read(fd, &c, 1) == 1 && c != '\n') {
+    command += c;
+  }
+  return command;
+}
+
+static void Serve(int listen_fd) {
+  while (true) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string command = ReadCommand(fd);
+    int request = command == "status" ? kStatus :
+        command == "stop" ? kStop : kNoRequest;
+    std::string reply;
+    if (request == kNoRequest) {
+      reply = "unknown command, expected status or stop\n";
+    } else {
+      std::unique_lock<std::mutex> lock(mutex);
+      answered = false;
+      introspection_request.store(request);
+      if (answered_cv.wait_for(lock, kAnswerTimeout,
+              []() { return answered; })) {
+        reply = answer;
+      } else {
+        introspection_request.store(kNoRequest);
+        reply = "busy\n";
+      }
+    }
+    WriteAll(fd, reply);
+    close(fd);
+  }
+}
+
+// Forked processes have no thread serving the socket, and leave requests
+// pending at the fork to their parent.
+static void ForgetRequestsAfterFork() {
+  introspection_request.store(kNoRequest);
+}
+
+void StartIntrospection(const std::string& path, std::string (*report)(),
+    void (*stop)()) {
+  make_report = report;
+  stop_search = stop;
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    fprintf(stderr, "introspection socket path too long: %s\n", path.c_str());
+    exit(1);
+  }
+  strcpy(address.sun_path, path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    exit(1);
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&address),
+          sizeof(address)) != 0 || listen(fd, 4) != 0) {
+    perror(path.c_str());
+    exit(1);
+  }
+  pthread_atfork(nullptr, nullptr, ForgetRequestsAfterFork);
+  std::thread(Serve, fd).detach();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// A running search can be asked about its progress at a Unix socket, so that
+// budgets can be moved between the searches of a cluster as they go. A thread
+// of its own accepts connections and reads a command from each, a line
+// holding "status" or "stop". The explorer answers at its next call of
+// ServeIntrospection, where its stacks are consistent, and the thread writes
+// the answer back, so the explorer only spends the time of making the report.
+// "stop" ends the search as if its budget ran out, which saves the frontier
+// with --save-frontier, to resume it elsewhere.
+//
+// Requests the explorer does not take up within a few seconds are answered
+// "busy", as happens while it waits for processes it forked, which do not
+// serve the socket.
+
+// Starts serving path, replacing whatever is there. report makes the answer
+// to status, and stop acts on stop.
+void StartIntrospection(const std::string& path, std::string (*report)(),
+    void (*stop)());
+
+extern std::atomic<int> introspection_request;
+void AnswerIntrospection();
+
+// Called wherever explorers check their budget, and cheap unless a request
+// is pending.
+inline void ServeIntrospection() {
+  if (introspection_request.load(std::memory_order_relaxed) != 0) {
+    AnswerIntrospection();
+  }
+}
@@ -1,13 +1,111 @@
 #include "helper.h"
 #include "linearizability.h"
 
+#include <city.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <functional>
-#include <string>
+#include <numeric>
+#include <random>
 #include <sstream>
+#include <string>
+#include <tuple>
 #include <vector>
 
-Linearizability::Linearizability(int num_threads) {
+#include "config.h"
+#include "memory_governor.h"
+#include "parallel.h"
+#include "statistics.h"
+#include "timer.h"
+
+static int64_t& total_checks =
+    RegisterStatistic<int64_t>("linearizability-checks");
+static int64_t& cached_verdicts =
+    RegisterStatistic<int64_t>("linearizability-cached-verdicts");
+static int64_t& key_histories =
+    RegisterStatistic<int64_t>("linearizability-key-histories");
+static int64_t& parallel_searches =
+    RegisterStatistic<int64_t>("linearizability-parallel-searches");
+static int64_t& stress_operations =
+    RegisterStatistic<int64_t>("linearizability-stress-operations");
+CODEX_TIMER(search_timer, "timer-linearizability");
+
+// With more than one worker, a search gets this many calls of Search in the
+// process itself, which settles most histories sooner than forking would,
+// before it starts over in parallel. Histories of more operations than fit
+// ParallelSearch are searched in the process either way.
+static const int64_t kSerialSearchBudget = 100000;
+static const int kMaxParallelSearchOperations = 4096;
+
+// What the workers of a parallel search share, in a MAP_SHARED mapping: the
+// next of the first operations to claim, whether a worker found a
+// linearization, and the one it found.
+struct ParallelSearch {
+  std::atomic<int> next;
+  std::atomic<bool> found;
+  int length;
+  int linearization[kMaxParallelSearchOperations];
+};
+
+static ParallelSearch* parallel_search;
+
+const int Linearizability::kNoKey;
+
+// The checkers alive in the process, whose verdicts the memory governor
+// sheds, and the bytes all their verdicts take. Checkers can be globals of
+// the tested program, constructed and destroyed in any order with this file.
+static std::set<Linearizability*>& Checkers() {
+  static std::set<Linearizability*>* checkers =
+      new std::set<Linearizability*>();
+  return *checkers;
+}
+static size_t total_verdicts_bytes = 0;
+static const size_t kMaxCachedVerdicts = 1 << 16;
+
+static size_t VerdictsBytes() {
+  return total_verdicts_bytes;
+}
+
+static size_t ShedVerdicts() {
+  size_t freed = total_verdicts_bytes;
+  for (Linearizability* checker : Checkers()) {
+    checker->ClearVerdicts();
+  }
+  return freed;
+}
+
+static const bool verdicts_governed = RegisterMemoryConsumer(
+    "linearizability-verdicts", kCacheRank, VerdictsBytes, ShedVerdicts);
+
+Linearizability::Linearizability(int num_threads) : keyed(true), online(false),
+    stressing(false), repeated(false), timestamped(false), search_budget(-1),
+    gave_up(false), cancelled(nullptr), verdicts_bytes(0) {
+  SetNumThreads(num_threads);
+  returned_annotation = InternAnnotation("-> ");
+  Checkers().insert(this);
+}
+
+Linearizability::~Linearizability() {
+  ClearVerdicts();
+  Checkers().erase(this);
+}
+
+void Linearizability::ClearVerdicts() {
+  std::unordered_map<std::vector<uint64_t>, bool, FingerprintHasher>().swap(
+      verdicts);
+  total_verdicts_bytes -= verdicts_bytes;
+  verdicts_bytes = 0;
+}
+
+void Linearizability::SetNumThreads(int num_threads) {
   threads.resize(num_threads);
+  index_of.resize(num_threads);
 }
 
 void Linearizability::RegisterModel(std::function<void()> setup, std::function<void()> cleanup) {
@@ -15,33 +113,283 @@ void Linearizability::RegisterModel(std::function<void()> setup, std::function<v
   cleanup_model = cleanup;
 }
 
+void Linearizability::RegisterModelHash(std::function<uint64_t()> hash) {
+  hash_model = hash;
+}
+
+void Linearizability::RegisterModelSnapshot(std::function<void*()> save, std::function<void(void*)> restore, std::function<void(void*)> release) {
+  save_model = save;
+  restore_model = restore;
+  release_model = release;
+}
+
 void Linearizability::RegisterImplementation(std::function<void()> setup, std::function<void()> cleanup) {
   setup_impl = setup;
   cleanup_impl = cleanup;
 }
 
-void Linearizability::AddStep(int thread, std::function<int()> function, std::string name) {
-  threads[thread].push_back(std::make_pair(function, name));
+void Linearizability::SetOnline(bool online) {
+  this->online = online;
+}
+
+void Linearizability::AddStep(int thread, std::function<int()> function, std::string name, int key) {
+  AddStep(thread, function, function, name, key);
+}
+
+void Linearizability::AddStep(int thread, std::function<int()> function, std::function<int()> model, std::string name, int key) {
+  PushStep(thread, Step{nullptr, nullptr, 0, function, model, name, key, 0});
+}
+
+void Linearizability::AddStep(int thread, int (*function)(int), int (*model)(int), int argument, std::string name, int key) {
+  PushStep(thread, Step{function, model, argument, nullptr, nullptr, name, key, 0});
+}
+
+void Linearizability::PushStep(int thread, Step step) {
+  keyed &= step.key != kNoKey;
+  step.starting_annotation = InternAnnotation("Starting " + step.name);
+  threads[thread].push_back(step);
+  index_of[thread].push_back(-1);
+}
+
+void Linearizability::RegisterOperation(std::string name, std::function<int(int)> function, int num_arguments, bool keyed, bool data_independent) {
+  RegisterOperation(name, function, function, num_arguments, keyed, data_independent);
+}
+
+void Linearizability::RegisterOperation(std::string name, std::function<int(int)> function, std::function<int(int)> model, int num_arguments, bool keyed, bool data_independent) {
+  operations.push_back(Operation{name, function, model, num_arguments, keyed, data_independent});
+}
+
+static void ExitWithBadWorkload(const std::string& workload) {
+  fprintf(stderr, "invalid workload %s\n", workload.c_str());
+  exit(1);
+}
+
+// Workloads are either random:<threads>x<steps>[:<seed>], for steps with
+// random operations and arguments, or the steps of each thread separated by
+// semicolons, with those of one thread separated by commas, as in
+// "push(1),pop;pop". Random workloads are printed in the second form, for
+// reduce.py and reruns.
+void Linearizability::AddWorkload(const std::string& workload) {
+  // (thread, operation, argument) for each step.
+  std::vector<std::tuple<int, int, int>> steps;
+  int num_threads = 0;
+  int random_threads, random_steps;
+  unsigned long long seed = 0;
+  if (sscanf(workload.c_str(), "random:%dx%d:%llu", &random_threads,
+        &random_steps, &seed) >= 2) {
+    std::mt19937_64 prng(seed);
+    num_threads = random_threads;
+    for (int thread = 0; thread < random_threads; thread++) {
+      for (int i = 0; i < random_steps; i++) {
+        int operation = std::uniform_int_distribution<int>(0, operations.size() - 1)(prng);
+        int num_arguments = operations[operation].num_arguments;
+        int argument = num_arguments > 0 ? std::uniform_int_distribution<int>(0, num_arguments - 1)(prng) : 0;
+        steps.push_back(std::make_tuple(thread, operation, argument));
+      }
+    }
+  } else {
+    std::stringstream threads_in(workload);
+    std::string thread_steps;
+    for (; std::getline(threads_in, thread_steps, ';'); num_threads++) {
+      std::stringstream steps_in(thread_steps);
+      std::string step;
+      while (std::getline(steps_in, step, ',')) {
+        std::string name = step.substr(0, step.find('('));
+        int argument = 0;
+        if (name.size() < step.size() && sscanf(step.c_str() + name.size(), "(%d)", &argument) != 1) {
+          ExitWithBadWorkload(workload);
+        }
+        int operation = 0;
+        while (operation < operations.size() && operations[operation].name != name) {
+          operation++;
+        }
+        if (operation == operations.size()) {
+          ExitWithBadWorkload(workload);
+        }
+        steps.push_back(std::make_tuple(num_threads, operation, argument));
+      }
+    }
+  }
+  if (num_threads <= 0 || num_threads > kMaxThreads) {
+    ExitWithBadWorkload(workload);
+  }
+
+  std::map<int, int> renamed_values;
+  for (std::tuple<int, int, int>& step : steps) {
+    if (operations[std::get<1>(step)].data_independent) {
+      int renamed = renamed_values.size();
+      std::get<2>(step) = renamed_values.emplace(std::get<2>(step), renamed).first->second;
+    }
+  }
+
+  SetNumThreads(num_threads);
+  for (const std::tuple<int, int, int>& step : steps) {
+    const Operation& operation = operations[std::get<1>(step)];
+    std::function<int(int)> function = operation.function;
+    std::function<int(int)> model = operation.model;
+    int argument = std::get<2>(step);
+    std::string name = operation.name;
+    if (operation.num_arguments > 0) {
+      name += "(" + std::to_string(argument) + ")";
+    }
+    int key = operation.keyed ? argument : kNoKey;
+    int (**function_pointer)(int) = function.target<int (*)(int)>();
+    int (**model_pointer)(int) = model.target<int (*)(int)>();
+    if (function_pointer != nullptr && model_pointer != nullptr) {
+      AddStep(std::get<0>(step), *function_pointer, *model_pointer, argument,
+          name, key);
+    } else {
+      AddStep(std::get<0>(step), [function, argument]() { return function(argument); },
+          [model, argument]() { return model(argument); }, name, key);
+    }
+  }
+
+  if (workload.compare(0, 7, "random:") == 0) {
+    std::string steps_of_threads;
+    for (int thread = 0; thread < num_threads; thread++) {
+      for (size_t i = 0; i < threads[thread].size(); i++) {
+        steps_of_threads += (i > 0 ? "," : "") + threads[thread][i].name;
+      }
+      steps_of_threads += thread + 1 < num_threads ? ";" : "";
+    }
+    fprintf(stderr, "workload %s is %s\n", workload.c_str(),
+        steps_of_threads.c_str());
+  }
+}
+
+// Makes each thread run its steps times over, as the steps of a longer
+// thread.
+void Linearizability::RepeatSteps(int times) {
+  for (int thread = 0; thread < threads.size(); thread++) {
+    std::vector<Step> steps = threads[thread];
+    for (int i = 1; i < times; i++) {
+      for (const Step& step : steps) {
+        PushStep(thread, step);
+      }
+    }
+  }
 }
 
 void Linearizability::Setup() {
+  if (!operations.empty() && (threads.empty() || workload != added_workload)) {
+    // Verdicts and hints only name steps by their index.
+    threads.clear();
+    index_of.clear();
+    keyed = true;
+    repeated = false;
+    ClearVerdicts();
+    previous_linearization.clear();
+    previous_linearization_of_key.clear();
+    AddWorkload(workload);
+    added_workload = workload;
+  }
+  stressing = RunningNatively();
+  timestamped = stressing;
+  if (stressing && !repeated) {
+    RepeatSteps(stress_repeat);
+    repeated = true;
+  }
+
   setup_impl();
 
   order.clear();
+  for (std::vector<int>& indices : index_of) {
+    std::fill(indices.begin(), indices.end(), -1);
+  }
+  completions = 0;
+  linearization.clear();
+  linearized.clear();
+  failed_states.clear();
+  violated = false;
+  if (stressing) {
+    stress_order.resize(threads.size());
+    for (int thread = 0; thread < threads.size(); thread++) {
+      stress_order[thread].clear();
+      stress_order[thread].reserve(threads[thread].size());
+    }
+  } else if (online) {
+    setup_model();
+    model_in_sync = true;
+  }
+}
+
+// Puts the operations of a native run in order by when they started, and
+// numbers their completions by when they returned.
+void Linearizability::MergeStressOrder() {
+  order.clear();
+  for (std::vector<Ordering>& operations_of_thread : stress_order) {
+    order.insert(order.end(), operations_of_thread.begin(),
+        operations_of_thread.end());
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [](const Ordering& a, const Ordering& b) {
+        return a.start_time < b.start_time;
+      });
+  std::vector<int> by_end(order.size());
+  std::iota(by_end.begin(), by_end.end(), 0);
+  std::stable_sort(by_end.begin(), by_end.end(), [this](int a, int b) {
+    return order[a].end_time < order[b].end_time;
+  });
+  for (int i = 0; i < by_end.size(); i++) {
+    order[by_end[i]].completion = i;
+  }
+  for (int i = 0; i < order.size(); i++) {
+    index_of[order[i].thread][order[i].function] = i;
+  }
+  completions = order.size();
+  stress_operations += order.size();
 }
 
 void Linearizability::Finish() {
   cleanup_impl();
+  if (stressing) {
+    MergeStressOrder();
+  }
 
-  linearization.clear();
+  bool linearizable;
+  if (online && !stressing) {
+    // The last completion already checked the whole run.
+    linearizable = !violated;
+    cleanup_model();
+  } else {
+    ComputePredecessors();
+    total_checks++;
+    // Native histories hardly ever repeat, and are too long to keep.
+    auto cached = verdicts.end();
+    if (!stressing) {
+      ComputeFingerprint();
+      cached = verdicts.find(fingerprint);
+    }
+    if (cached != verdicts.end()) {
+      cached_verdicts++;
+      linearizable = cached->second;
+    } else {
+      if (keyed) {
+        linearizable = CheckByKey();
+      } else {
+        setup_model();
+        model_in_sync = true;
+        linearizable = Check();
+        cleanup_model();
+      }
+      if (!stressing && verdicts.size() < kMaxCachedVerdicts) {
+        // The key and the node that holds it.
+        size_t bytes = fingerprint.size() * sizeof(uint64_t) +
+            sizeof(fingerprint) + 3 * sizeof(void*);
+        verdicts[fingerprint] = linearizable;
+        verdicts_bytes += bytes;
+        total_verdicts_bytes += bytes;
+      }
+    }
+  }
 
-  if (!Search()) {
+  if (!linearizable) {
     /*
     for (int i = 0; i < order.size(); i++) {
       if (order[i].finished) {
-        Output("%d: %s -> %d\n", order[i].thread, threads[order[i].thread][order[i].function].second.c_str(), order[i].result);
+        Output("%d: %s -> %d\n", order[i].thread, threads[order[i].thread][order[i].function].name.c_str(), order[i].result);
       } else {
-        Output("%d: %s start\n", order[i].thread, threads[order[i].thread][order[i].function].second.c_str());
+        Output("%d: %s start\n", order[i].thread, threads[order[i].thread][order[i].function].name.c_str());
       }
     }
     Output("\n");
@@ -51,8 +399,56 @@ void Linearizability::Finish() {
   }
 }
 
+bool Linearizability::CheckHistory(const std::vector<Ordering>& history,
+    bool timestamped) {
+  this->timestamped = timestamped;
+  order = history;
+  for (std::vector<int>& indices : index_of) {
+    std::fill(indices.begin(), indices.end(), -1);
+  }
+  completions = 0;
+  for (int i = 0; i < order.size(); i++) {
+    index_of[order[i].thread][order[i].function] = i;
+    completions += order[i].completion != -1;
+  }
+  linearization.clear();
+  previous_linearization.clear();
+  linearized.clear();
+  failed_states.clear();
+
+  ComputePredecessors();
+  setup_model();
+  model_in_sync = true;
+  bool linearizable = Check();
+  cleanup_model();
+  return linearizable;
+}
+
 void Linearizability::ThreadBody(int thread) {
-  for (int i = 0; i < threads[thread].size(); i++) {
+  if (stressing) {
+    std::vector<Ordering>& operations_of_thread = stress_order[thread];
+    for (int i = 0; i < threads[thread].size(); i++) {
+      Ordering o;
+      o.thread = thread;
+      o.actual_thread = ThreadId();
+      o.function = i;
+      o.executed = false;
+      o.completions_at_start = 0;
+      o.start_time = ReadFencedCycleCounter();
+      o.result = threads[thread][i].Run();
+      o.end_time = ReadFencedCycleCounter();
+      operations_of_thread.push_back(o);
+    }
+    return;
+  }
+
+  // Operations are numbered across threads for BeginOperationStep, the same
+  // in every run.
+  int first_operation = 0;
+  for (int t = 0; t < thread; t++) {
+    first_operation += threads[t].size();
+  }
+  for (int i = 0; i < threads[thread].size() && !violated; i++) {
     int start = order.size();
 
     order.push_back(Ordering());
@@ -61,47 +457,326 @@ void Linearizability::ThreadBody(int thread) {
     order[start].function = i;
     order[start].start_cv = GetClockVector(thread);
     order[start].executed = false;
-    {
-      std::stringstream ss;
-      ss << "Starting " << threads[thread][i].second.c_str();
-      Annotate(ss.str());
-    }
-    int ret = threads[thread][i].first();
-    {
-      std::stringstream ss;
-      ss << "-> " << ret;
-      Annotate(ss.str());
-    }
+    order[start].completion = -1;
+    order[start].completions_at_start = completions;
+    index_of[thread][i] = start;
+    Annotate(threads[thread][i].starting_annotation);
+    BeginOperationStep(first_operation + i);
+    int ret = threads[thread][i].Run();
+    EndOperationStep();
+    Annotate(returned_annotation, ret);
     order[start].end_cv = GetClockVector(thread);
     order[start].result = ret;
+    order[start].completion = completions++;
+
+    if (online) {
+      RunTransparently([&]() {
+        // A linearization that guessed the operation while it was pending
+        // may have guessed its result wrong.
+        for (int j = 0; j < linearization.size(); j++) {
+          if (linearization[j] == start) {
+            Truncate(j);
+            break;
+          }
+        }
+        ComputePredecessors();
+        violated = !Check();
+      });
+    }
   }
 }
 
-bool Linearizability::Verify() {
-  setup_model();
+void Linearizability::ComputePredecessors() {
+  int n = order.size();
+  words = (n + 63) / 64;
+  completed.assign(words, 0);
+  linearized.resize(words, 0);
+  predecessors.assign(n * words, 0);
+  for (int i = 0; i < n; i++) {
+    if (order[i].completion != -1) {
+      completed[i / 64] |= 1ULL << (i % 64);
+    }
 
-  bool success = true;
+    for (int j = 0; j < n; j++) {
+      if (i == j) {
+        continue;
+      }
+
+      bool precedes;
+      if (order[i].thread == order[j].thread) {
+        precedes = j < i;
+      } else if (order[j].completion == -1) {
+        precedes = false;
+      } else if (timestamped) {
+        precedes = order[j].end_time < order[i].start_time;
+      } else if (online && order[j].completion < order[i].completions_at_start) {
+        precedes = true;
+      } else if (order[i].completion == -1) {
+        precedes = order[j].end_cv[order[i].actual_thread] < order[i].start_cv[order[i].actual_thread];
+      } else {
+        bool i_after_j = order[i].end_cv[order[j].actual_thread] >= order[j].start_cv[order[j].actual_thread];
+        bool j_after_i = order[j].end_cv[order[i].actual_thread] >= order[i].start_cv[order[i].actual_thread];
+
+        //assert(i_after_j || j_after_i);
+
+        precedes = i_after_j && !j_after_i;
+      }
+      if (precedes) {
+        predecessors[i * words + j / 64] |= 1ULL << (j % 64);
+      }
+    }
+  }
+}
+
+void Linearizability::ComputeFingerprint() {
+  std::vector<int> canonical(order.size());
+  std::vector<int> canonical_order;
+  for (int thread = 0; thread < threads.size(); thread++) {
+    for (int function = 0; function < threads[thread].size(); function++) {
+      int i = index_of[thread][function];
+      if (i != -1) {
+        canonical[i] = canonical_order.size();
+        canonical_order.push_back(i);
+      }
+    }
+  }
+
+  fingerprint.clear();
+  for (int i : canonical_order) {
+    const Ordering& o = order[i];
+    fingerprint.push_back(static_cast<uint64_t>(o.thread) << 32 | o.function);
+    fingerprint.push_back(o.completion == -1 ? ~0ULL : static_cast<uint32_t>(o.result));
+    size_t begin = fingerprint.size();
+    fingerprint.resize(begin + words, 0);
+    for (int j = 0; j < order.size(); j++) {
+      if (predecessors[i * words + j / 64] & (1ULL << (j % 64))) {
+        fingerprint[begin + canonical[j] / 64] |= 1ULL << (canonical[j] % 64);
+      }
+    }
+  }
+}
+
+size_t Linearizability::FingerprintHasher::operator()(
+    const std::vector<uint64_t>& fingerprint) const {
+  return CityHash64(reinterpret_cast<const char*>(fingerprint.data()),
+      fingerprint.size() * sizeof(uint64_t));
+}
+
+void Linearizability::SyncModel() {
+  if (model_in_sync) {
+    return;
+  }
+  cleanup_model();
+  setup_model();
   for (int idx : linearization) {
     Ordering& o = order[idx];
-    if (threads[o.thread][o.function].first() != o.result) {
-      success = false;
+    threads[o.thread][o.function].RunModel();
+  }
+  model_in_sync = true;
+}
+
+// Returns the model to the state after linearization, right away from
+// snapshot if there is one, and otherwise on the next SyncModel.
+void Linearizability::UndoModel(void* snapshot) {
+  if (snapshot != nullptr) {
+    restore_model(snapshot);
+  } else {
+    model_in_sync = false;
+  }
+}
+
+void Linearizability::Truncate(int length) {
+  while (linearization.size() > length) {
+    int i = linearization.back();
+    linearization.pop_back();
+    order[i].executed = false;
+    linearized[i / 64] ^= 1ULL << (i % 64);
+  }
+  model_in_sync = false;
+}
+
+// Looks for a linearization of the completed operations, first by extending
+// the current one and then from scratch.
+bool Linearizability::Check() {
+  CODEX_TIMED_SCOPE(search_timer);
+  bool parallel = linearizability_workers > 1 && !online &&
+      order.size() <= kMaxParallelSearchOperations;
+  search_budget = parallel ? kSerialSearchBudget : -1;
+  gave_up = false;
+  bool found = Search();
+  if (!found && !gave_up && !linearization.empty()) {
+    Truncate(0);
+    found = Search();
+  }
+  search_budget = -1;
+  if (gave_up) {
+    gave_up = false;
+    Truncate(0);
+    found = SearchInParallel();
+  }
+  if (!found) {
+    return false;
+  }
+
+  previous_linearization.clear();
+  for (int i : linearization) {
+    previous_linearization.push_back(
+        std::make_pair(order[i].thread, order[i].function));
+  }
+  return true;
+}
+
+// Checks the operations of each key in turn, with order, index_of and the
+// search state standing for those of the key alone.
+bool Linearizability::CheckByKey() {
+  std::vector<Ordering> all;
+  all.swap(order);
+  std::map<int, std::vector<int>> of_key;
+  for (int i = 0; i < all.size(); i++) {
+    of_key[threads[all[i].thread][all[i].function].key].push_back(i);
+  }
+
+  bool linearizable = true;
+  for (const auto& key : of_key) {
+    order.clear();
+    for (std::vector<int>& indices : index_of) {
+      std::fill(indices.begin(), indices.end(), -1);
+    }
+    for (int i : key.second) {
+      index_of[all[i].thread][all[i].function] = order.size();
+      order.push_back(all[i]);
+    }
+    linearization.clear();
+    linearized.clear();
+    failed_states.clear();
+    ComputePredecessors();
+    key_histories++;
+
+    previous_linearization.swap(previous_linearization_of_key[key.first]);
+    setup_model();
+    model_in_sync = true;
+    linearizable = Check();
+    cleanup_model();
+    previous_linearization.swap(previous_linearization_of_key[key.first]);
+    if (!linearizable) {
       break;
     }
   }
 
-  cleanup_model();
+  order.swap(all);
+  for (int i = 0; i < order.size(); i++) {
+    index_of[order[i].thread][order[i].function] = i;
+  }
+  return linearizable;
+}
 
-  return success;
+// Splits the search by the first operation of the linearization over forked
+// workers, each with a copy of the model of its own. Workers claim first
+// operations in turn, and search on from each until one of them finds a
+// linearization, which stops the others.
+bool Linearizability::SearchInParallel() {
+  if (parallel_search == nullptr) {
+    parallel_search = static_cast<ParallelSearch*>(
+        AllocateShared(sizeof(ParallelSearch)));
+  }
+  parallel_search->next = 0;
+  parallel_search->found = false;
+  parallel_searches++;
+
+  // The operations that can come first, that of the previous run first.
+  std::vector<int> firsts;
+  int hint = previous_linearization.empty() ? -1 : index_of[
+      previous_linearization[0].first][previous_linearization[0].second];
+  for (int i = 0; i < order.size(); i++) {
+    bool first = true;
+    for (int word = 0; word < words; word++) {
+      first &= predecessors[i * words + word] == 0;
+    }
+    if (first) {
+      firsts.push_back(i);
+      if (i == hint) {
+        std::swap(firsts.front(), firsts.back());
+      }
+    }
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  std::vector<pid_t> workers;
+  for (int id = 0; id < linearizability_workers; id++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    } else if (pid == 0) {
+      SearchFrom(firsts);
+      fflush(stdout);
+      fflush(stderr);
+      _exit(0);
+    }
+    workers.push_back(pid);
+  }
+  for (pid_t pid : workers) {
+    waitpid(pid, nullptr, 0);
+  }
+
+  if (!parallel_search->found) {
+    return false;
+  }
+  for (int k = 0; k < parallel_search->length; k++) {
+    int i = parallel_search->linearization[k];
+    linearization.push_back(i);
+    order[i].executed = true;
+    linearized[i / 64] ^= 1ULL << (i % 64);
+  }
+  model_in_sync = false;
+  return true;
+}
+
+// The body of a worker of SearchInParallel.
+void Linearizability::SearchFrom(const std::vector<int>& firsts) {
+  cancelled = &parallel_search->found;
+  while (!parallel_search->found) {
+    int claimed = parallel_search->next.fetch_add(1);
+    if (claimed >= firsts.size()) {
+      return;
+    }
+    int i = firsts[claimed];
+    SyncModel();
+    Ordering& o = order[i];
+    int result = threads[o.thread][o.function].RunModel();
+    if (o.completion != -1 && result != o.result) {
+      model_in_sync = false;
+      continue;
+    }
+    linearization.push_back(i);
+    order[i].executed = true;
+    linearized[i / 64] ^= 1ULL << (i % 64);
+    if (Search()) {
+      if (!parallel_search->found.exchange(true)) {
+        parallel_search->length = linearization.size();
+        std::copy(linearization.begin(), linearization.end(),
+            parallel_search->linearization);
+      }
+      return;
+    }
+    Truncate(0);
+  }
 }
 
 bool Linearizability::Search() {
-  if (!Verify()) {
+  if (search_budget == 0 ||
+      (cancelled != nullptr && cancelled->load(std::memory_order_relaxed))) {
+    gave_up = true;
     return false;
   }
+  if (search_budget > 0) {
+    search_budget--;
+  }
 
   bool done = true;
-  for (int i = 0; i < order.size(); i++) {
-    if (!order[i].executed) {
+  for (int word = 0; word < words; word++) {
+    if (completed[word] & ~linearized[word]) {
       done = false;
       break;
     }
@@ -110,52 +785,85 @@ bool Linearizability::Search() {
     return true;
   }
 
-  for (int i = 0; i < order.size(); i++) {
-    if (order[i].executed) {
-      continue;
+  bool memoize = static_cast<bool>(hash_model);
+  std::pair<uint64_t, uint64_t> state;
+  if (memoize) {
+    SyncModel();
+    uint64_t linearized_key = words == 1 ? linearized[0] :
+        CityHash64(reinterpret_cast<const char*>(linearized.data()),
+            words * sizeof(uint64_t));
+    state = std::make_pair(linearized_key, hash_model());
+    if (failed_states.count(state)) {
+      return false;
     }
+  }
 
-    bool can = true;
-    for (int j = 0; j < order.size(); j++) {
-      if (i == j) {
-        continue;
-      }
-
-      if (order[j].executed) {
-        continue;
-      }
-
-      if (order[i].thread == order[j].thread) {
-        if (j < i) {
-          can = false;
-          break;
-        } else {
-          continue;
-        }
-      }
+  // Try the operation the previous run linearized here first.
+  int hint = -1;
+  if (linearization.size() < previous_linearization.size()) {
+    const std::pair<int, int>& previous =
+        previous_linearization[linearization.size()];
+    hint = index_of[previous.first][previous.second];
+  }
 
-      bool i_after_j = order[i].end_cv[order[j].actual_thread] >= order[j].start_cv[order[j].actual_thread];
-      bool j_after_i = order[j].end_cv[order[i].actual_thread] >= order[i].start_cv[order[i].actual_thread];
+  // Taken before the first candidate is applied, and restored after each.
+  void* snapshot = nullptr;
 
-      //assert(i_after_j || j_after_i);
+  for (int k = -1; k < static_cast<int>(order.size()); k++) {
+    int i = k == -1 ? hint : k;
+    if (i == -1 || (k != -1 && i == hint) || order[i].executed) {
+      continue;
+    }
 
-      if (i_after_j && !j_after_i) {
+    bool can = true;
+    for (int word = 0; word < words; word++) {
+      if (predecessors[i * words + word] & ~linearized[word]) {
         can = false;
         break;
       }
     }
 
     if (can) {
+      // Apply the operation to the model, which is then only back in sync
+      // with linearization if the operation stays in it. A pending operation
+      // can still return anything.
+      SyncModel();
+      if (save_model && snapshot == nullptr) {
+        snapshot = save_model();
+      }
+      Ordering& o = order[i];
+      int result = threads[o.thread][o.function].RunModel();
+      if (o.completion != -1 && result != o.result) {
+        UndoModel(snapshot);
+        continue;
+      }
+
       linearization.push_back(i);
       order[i].executed = true;
-      bool success = Search();
+      linearized[i / 64] ^= 1ULL << (i % 64);
+      if (Search()) {
+        if (snapshot != nullptr) {
+          release_model(snapshot);
+        }
+        return true;
+      }
+      linearized[i / 64] ^= 1ULL << (i % 64);
       order[i].executed = false;
       linearization.pop_back();
-      if (success) {
-        return true;
+      UndoModel(snapshot);
+      if (gave_up) {
+        break;
       }
     }
   }
 
+  if (snapshot != nullptr) {
+    release_model(snapshot);
+  }
+
+  // A search that gave up did not rule the state out.
+  if (memoize && !gave_up) {
+    failed_states.insert(state);
+  }
   return false;
 }
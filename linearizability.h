@@ -1,7 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "clockvector.h"
@@ -13,31 +19,220 @@ struct Ordering {
   int result;
   ClockVector start_cv;
   ClockVector end_cv;
+  // In place of the clock vectors when the program runs natively, the
+  // cycle counts at its invocation and response, see
+  // ReadFencedCycleCounter.
+  uint64_t start_time;
+  uint64_t end_time;
   bool executed;
+  // The operation's position among completed operations, or -1 while it is
+  // pending, and the number of operations completed when it started.
+  int completion;
+  int completions_at_start;
 
   Ordering() {}
 };
 
 class Linearizability {
  public:
+  // The key of steps that may depend on every other step, such as a size or
+  // an emptiness check.
+  static const int kNoKey = -1;
+
   Linearizability(int num_threads);
+  ~Linearizability();
 
+  // See reference_model.h for models that run uninstrumented.
   void RegisterModel(std::function<void()> setup, std::function<void()> cleanup);
+  // Optional. A hash of the model's state lets the search skip states it has
+  // already failed to complete a linearization from.
+  void RegisterModelHash(std::function<uint64_t()> hash);
+  // Optional. Snapshots of the model's state let the search return to a
+  // state it branched from, instead of replaying the model from scratch.
+  // save returns a snapshot, which stays valid until passed to release.
+  void RegisterModelSnapshot(std::function<void*()> save, std::function<void(void*)> restore, std::function<void(void*)> release);
   void RegisterImplementation(std::function<void()> setup, std::function<void()> cleanup);
+  // Optional. Checks the run every time an operation completes, running the
+  // model in between, and stops starting operations once no linearization
+  // exists. All steps then need a model function that keeps its state apart
+  // from the implementation's. Operations also follow those that completed
+  // before they started.
+  void SetOnline(bool online);
 
-  void AddStep(int thread, std::function<int()> function, std::string name);
+  // The model runs function itself, unless given a separate model function.
+  //
+  // Steps can be given a key, such as the key a step of a set or map
+  // operates on, if steps on different keys are independent: their results
+  // do not depend on each other, whatever the order. If every step of a run
+  // has a key, an offline check checks the steps of each key as a history of
+  // its own, from the initial model, which is as good as checking them
+  // together and takes a search per key instead of one over all steps.
+  void AddStep(int thread, std::function<int()> function, std::string name, int key = kNoKey);
+  void AddStep(int thread, std::function<int()> function, std::function<int()> model, std::string name, int key = kNoKey);
+  // A step given as plain functions of an argument, such as captureless
+  // lambdas, which the search calls directly rather than through
+  // std::function.
+  void AddStep(int thread, int (*function)(int), int (*model)(int), int argument, std::string name, int key = kNoKey);
+  // Instead of adding steps, a program can register the operations of the
+  // data structure by name, and leave the steps of each thread to the
+  // --workload flag, see workload in config.h. One binary can then check any
+  // number of workloads. The steps are added on the first Setup, which is
+  // where num_threads becomes known, and again on the first Setup after
+  // workload changes, as it does between the workloads of --workloads. Operations take an argument in
+  // [0, num_arguments), which is always 0 if num_arguments is 0. With
+  // keyed, the argument is the key of the operation's steps, see AddStep.
+  // Operations given as plain function pointers, as with +[](int argument)
+  // { ... }, make steps that are called directly.
+  //
+  // With data_independent, the argument is a payload the data structure
+  // only stores and hands back, such as the value of an enqueue, and never
+  // looks into. The arguments of such steps are renamed in the order they
+  // first appear in the workload, so that workloads that only differ in
+  // their payloads make the same runs, and so the same hashes, coverage
+  // and verdicts.
+  void RegisterOperation(std::string name, std::function<int(int)> function, int num_arguments = 0, bool keyed = false, bool data_independent = false);
+  void RegisterOperation(std::string name, std::function<int(int)> function, std::function<int(int)> model, int num_arguments = 0, bool keyed = false, bool data_independent = false);
+  inline int num_threads() const {
+    return threads.size();
+  }
   void Setup();
   void Finish();
+  // Drops the verdicts of earlier histories, as the memory governor does.
+  void ClearVerdicts();
+  // When the program runs natively, see RunningNatively, as with
+  // --explorer=stress, each thread runs its steps stress_repeat times over,
+  // timestamped rather than annotated, and Finish checks the history they
+  // make, in which an operation precedes those that started after it
+  // returned. Such runs are never checked online.
+  //
+  // With operation_steps, each step is an operation of BeginOperationStep,
+  // which takes no steps of the search of its own until it conflicts with
+  // another thread.
   void ThreadBody(int thread);
+  // Checks a history recorded elsewhere, as Finish checks a run, for
+  // benchmarks and offline use. Every operation of the history is one of
+  // the added steps, and the model is registered. With timestamped, the
+  // operations are ordered by their start_time and end_time, as those of
+  // native runs are, rather than by their clock vectors.
+  bool CheckHistory(const std::vector<Ordering>& history,
+      bool timestamped = false);
 
  private:
-  bool Verify();
+  void SetNumThreads(int num_threads);
+  void AddWorkload(const std::string& workload);
+  void RepeatSteps(int times);
+  void MergeStressOrder();
+  void ComputePredecessors();
+  void ComputeFingerprint();
+  void SyncModel();
+  void UndoModel(void* snapshot);
+  void Truncate(int length);
+  bool Check();
+  bool CheckByKey();
   bool Search();
+  bool SearchInParallel();
+  void SearchFrom(const std::vector<int>& firsts);
+
+  // A step, and its model, called through the function pointers with the
+  // argument if it has them, and through the std::functions otherwise.
+  struct Step {
+    int (*function)(int);
+    int (*model)(int);
+    int argument;
+    std::function<int()> function_object;
+    std::function<int()> model_object;
+    std::string name;
+    int key;
+    // The interned annotation marking its start.
+    int starting_annotation;
+
+    inline int Run() const {
+      return function != nullptr ? function(argument) : function_object();
+    }
+    inline int RunModel() const {
+      return model != nullptr ? model(argument) : model_object();
+    }
+  };
+
+  void PushStep(int thread, Step step);
 
-  std::vector<std::vector<std::pair<std::function<int()>, std::string>>> threads;
+  std::vector<std::vector<Step>> threads;
+  // The workload the steps were added from, if they were.
+  std::string added_workload;
+  // Whether every step added has a key.
+  bool keyed;
+  // The interned annotation of the result of a step.
+  int returned_annotation;
   std::function<void()> setup_model, cleanup_model, setup_impl, cleanup_impl;
+  std::function<uint64_t()> hash_model;
+  std::function<void*()> save_model;
+  std::function<void(void*)> restore_model, release_model;
+  bool online;
+
+  struct Operation {
+    std::string name;
+    std::function<int(int)> function;
+    std::function<int(int)> model;
+    int num_arguments;
+    bool keyed;
+    bool data_independent;
+  };
+  std::vector<Operation> operations;
 
   std::vector<Ordering> order;
+  // Whether the run is native, and the operations of each thread in it,
+  // which only that thread adds to until Finish merges them into order.
+  // Steps are repeated for native runs once.
+  bool stressing;
+  std::vector<std::vector<Ordering>> stress_order;
+  bool repeated;
+  // Whether order is ordered by timestamps, as in native runs.
+  bool timestamped;
+  // The index in order of each thread's operations.
+  std::vector<std::vector<int>> index_of;
+  int completions;
+  // A linearization of the completed operations and possibly some pending
+  // ones, which an online check extends, and the (thread, function) pairs of
+  // that of the previous run, which the next search tries first.
   std::vector<int> linearization;
+  std::vector<std::pair<int, int>> previous_linearization;
+  // The same for the history of each key, when checking by key.
+  std::map<int, std::vector<std::pair<int, int>>> previous_linearization_of_key;
+  bool violated;
+  // The model is kept at the state after linearization, and only replayed
+  // from scratch after a failed attempt left it elsewhere.
+  bool model_in_sync;
+  // Bitsets over order of words words each: the completed operations, the
+  // operations in linearization, and for each operation those that have to be
+  // linearized before it, as they precede it in its thread or in real time.
+  int words;
+  std::vector<uint64_t> completed;
+  std::vector<uint64_t> linearized;
+  std::vector<uint64_t> predecessors;
+  // Pairs of linearized and a model hash from which no linearization exists,
+  // with linearized itself for runs of at most 64 operations and a hash of
+  // it for longer ones, such as native runs. Completions only add
+  // constraints, so these stay valid for the rest of a run.
+  std::set<std::pair<uint64_t, uint64_t>> failed_states;
+  // The calls of Search left before it gives up, or -1 for no limit, and
+  // whether it gave up. The workers of a parallel search also give up once
+  // cancelled is set, as another worker found a linearization.
+  int64_t search_budget;
+  bool gave_up;
+  const std::atomic<bool>* cancelled;
+
+  struct FingerprintHasher {
+    size_t operator()(const std::vector<uint64_t>& fingerprint) const;
+  };
+
+  // The thread, function, result and predecessors of every operation, in
+  // the order of threads and their steps, which is all a verdict depends on.
+  // Runs that only differ in how operations interleave share it, and reuse
+  // the verdict of the first of them. The verdicts are a cache of the memory
+  // governor, which stops growing at kMaxCachedVerdicts, and verdicts_bytes
+  // is their estimated size.
+  std::vector<uint64_t> fingerprint;
+  std::unordered_map<std::vector<uint64_t>, bool, FingerprintHasher> verdicts;
+  size_t verdicts_bytes;
 };
 
@@ -1,73 +1,158 @@
-#include <llvm/Config/config.h>
-#include <llvm/Pass.h>
-#include <llvm/Support/raw_ostream.h>
-#include <llvm/Transforms/Utils/BasicBlockUtils.h>
-
-#include <llvm/Support/DebugLoc.h>
-//#include <llvm/Analysis/DebugInfo.h>
-
-#include <llvm/Support/CommandLine.h>
-
-#include <llvm/IR/Module.h>
-#include <llvm/IR/Type.h>
-#include <llvm/IR/Constant.h>
+// Replaces the memory accesses of a module with calls into the Codex runtime,
+// see interface.cc. Built as a plugin for the new pass manager, it runs as
+// the last module pass of clang's pipeline when loaded with
+//
+//   clang++ -fpass-plugin=pass.so ...
+//
+// and can also be run on its own with opt -load-pass-plugin=pass.so
+// -passes=intercept.
+
+#include <llvm/Analysis/CaptureTracking.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
-#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/PassPlugin.h>
+#include <llvm/Support/AtomicOrdering.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#if LLVM_VERSION_MAJOR >= 17
+#include <llvm/TargetParser/Triple.h>
+#else
+#include <llvm/ADT/Triple.h>
+#endif
 
 #include <cxxabi.h>
 
+#include <cstdlib>
+#include <fstream>
 #include <map>
+#include <set>
 #include <sstream>
+#include <string>
 #include <vector>
 
 using namespace llvm;
 
-namespace {
-  bool IsAtomic(AtomicOrdering o) {
-    return o == Monotonic || o == Acquire || o == Release || 
-        o == AcquireRelease || o == SequentiallyConsistent;
-  }
-
-  struct MemoryInterceptPass : public ModulePass {
-    static char ID;
-    MemoryInterceptPass() : ModulePass(ID) {
-      PassRegistry &Registry = *PassRegistry::getPassRegistry();
-      initializeDataLayoutPass(Registry);
-    }
-
-    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
-      AU.addRequired<DataLayout>();
-    }
-
-    int next;
+static cl::opt<bool> InterceptPrivate("intercept-private",
+    cl::desc("Also intercept accesses to memory private to a thread"));
+
+// Only intercepts the functions FILE selects, and runs the others natively,
+// as the runtime runs. Each line holds a pattern, which selects the functions
+// whose demangled name, without return type and parameters, starts with it,
+// or whose mangled name it is; a pattern starting with ! deselects them
+// instead, and later lines win over earlier ones. # starts a comment. The
+// members of std::atomic are always intercepted, so that each of their calls
+// stays one transition, and CODEX_INTERCEPT and CODEX_NATIVE, see
+// program_interface.h, override the file. As the pass runs after inlining,
+// inlined code goes with the function it was inlined into.
+static cl::opt<std::string> InterceptList("intercept-list",
+    cl::desc("Only intercept the functions the file lists"),
+    cl::value_desc("file"));
+
+// Makes the non-constant globals the module defines thread local, so that
+// every OS thread running the tested code has its own copy of them, laid out
+// in the TLS segment and reached from the thread pointer. Workers on threads
+// of one process can then run the same test side by side, the fibers of each
+// sharing its copy. Only the static initializer is in each copy; dynamic
+// initializers run once, for the main thread, so state that needs them must
+// be set up by Setup. A global the module only declares is left alone, so a
+// global shared between modules is best defined in the one that uses it; the
+// link fails on a thread local definition reached through a plain
+// declaration.
+static cl::opt<bool> RelocateGlobals("relocate-globals",
+    cl::desc("Give each OS thread its own copy of the module's globals"));
+
+// Fibers all run on one OS thread, so the thread_local globals of the tested
+// code get a copy for every thread id instead, see GiveFibersThreadLocals.
+// Ids run up to that of the original thread, kMaxThreads, which is at most
+// 126.
+static const int kFiberSlots = 127;
+
+// Library functions that the runtime replaces, and the replacements that
+// calls to them go to: allocation, and the threads and locks of pthreads and
+// of the C++ library, see pthread_interface.cc.
+static const std::pair<const char*, const char*> kReplacedFunctions[] = {
+  {"_Znwm", "InterceptNew"},
+  {"_ZdlPv", "InterceptDelete"},
+  {"pthread_create", "InterceptPthreadCreate"},
+  {"pthread_join", "InterceptPthreadJoin"},
+  {"pthread_detach", "InterceptPthreadDetach"},
+  {"pthread_self", "InterceptPthreadSelf"},
+  {"pthread_mutex_init", "InterceptPthreadMutexInit"},
+  {"pthread_mutex_destroy", "InterceptPthreadMutexDestroy"},
+  {"pthread_mutex_lock", "InterceptPthreadMutexLock"},
+  {"pthread_mutex_trylock", "InterceptPthreadMutexTrylock"},
+  {"pthread_mutex_unlock", "InterceptPthreadMutexUnlock"},
+  {"pthread_cond_init", "InterceptPthreadCondInit"},
+  {"pthread_cond_destroy", "InterceptPthreadCondDestroy"},
+  {"pthread_cond_wait", "InterceptPthreadCondWait"},
+  {"pthread_cond_timedwait", "InterceptPthreadCondTimedwait"},
+  {"pthread_cond_clockwait", "InterceptPthreadCondClockwait"},
+  {"pthread_cond_signal", "InterceptPthreadCondSignal"},
+  {"pthread_cond_broadcast", "InterceptPthreadCondBroadcast"},
+  {"_ZNSt6thread15_M_start_threadESt10unique_ptrINS_6_StateESt14default_"
+      "deleteIS1_EEPFvvE", "InterceptThreadStart"},
+  {"_ZNSt6thread4joinEv", "InterceptThreadJoin"},
+  {"_ZNSt6thread6detachEv", "InterceptThreadDetach"},
+  {"_ZNSt18condition_variableC1Ev", "InterceptCondVarInit"},
+  {"_ZNSt18condition_variableD1Ev", "InterceptCondVarDestroy"},
+  {"_ZNSt18condition_variable4waitERSt11unique_lockISt5mutexE",
+      "InterceptCondVarWait"},
+  {"_ZNSt18condition_variable10notify_oneEv", "InterceptCondVarNotifyOne"},
+  {"_ZNSt18condition_variable10notify_allEv", "InterceptCondVarNotifyAll"},
+};
 
+namespace {
+  struct MemoryInterceptPass : public PassInfoMixin<MemoryInterceptPass> {
     Module* M;
-    Type *UIntPtr, *Void, *Int8Ptr, *Int64, *Int32;
-
-    DataLayout* TD;
-
-    Constant *LoadFn, *StoreFn, *CmpXChgFn, *FenceFn, *AtomicRMWFn;
-
-    /*
-    std::string GetTypeName(Type* type) {
-      if (isa<PointerType>(type)) {
-        auto pointed = static_cast<SequentialType*>(type)->getElementType();
-        return GetTypeName(internal) + "*";
-      } else {
-        std::string s;
-        raw_string_ostream os(s);
-        type->print(os);
-        os.flush();
-        return s;
-      }
-    }
-    */
+    const DataLayout* TD;
+    // Pointers are passed to the runtime as int8_t*, which is the one
+    // opaque pointer type on current LLVM.
+    Type *Void, *Ptr, *Int128, *Int64, *Int32;
+
+    FunctionCallee LoadFn, StoreFn, CmpXChgFn, FenceFn, AtomicRMWFn;
+    FunctionCallee MemsetFn, MemcpyFn;
+    // 16-byte loads, stores and CASes, such as the double-width CAS of
+    // tagged pointers, pass their values as i128.
+    FunctionCallee Load16Fn, Store16Fn, CmpXChg16Fn;
+    // Loads and stores of 1, 2, 4 and 8 bytes, which pass their values as
+    // the integer of that width, and whose transitions the runtime reads and
+    // writes without switching on their length.
+    FunctionCallee SizedLoadFn[4], SizedStoreFn[4];
+    // The runtime's codex_intercepting, see scheduler.h.
+    Constant* InterceptingFlag;
+    // The runtime's codex_current_thread, see scheduler.h, the loads of it
+    // that GiveFibersThreadLocals adds, which are never intercepted, and the
+    // arrays that replace thread_local globals.
+    Constant* CurrentThread;
+    std::set<Instruction*> CurrentThreadLoads;
+    std::set<const GlobalVariable*> FiberSlots;
+
+    // The module's table of source locations, see Location in transition.h,
+    // which a constructor registers with CodexRegisterLocations. Accesses
+    // pass the base id it returns plus the index of their location.
+    FunctionCallee RegisterLocationsFn;
+    StructType* LocationTy;
+    GlobalVariable* LocationBase;
+    std::vector<Constant*> Locations;
+    std::map<const DILocation*, int> LocationIndex;
+    std::map<std::string, Constant*> Strings;
 
     static std::string Simplify(StringRef str) {
-      char const *mangled = str.str().c_str();
+      std::string mangled = str.str();
       int status;
-      char *demangled = abi::__cxa_demangle(mangled, 0, 0, &status);
+      char *demangled = abi::__cxa_demangle(mangled.c_str(), 0, 0, &status);
 
       std::stringstream ss;
       if (status == 0) {
@@ -95,215 +180,745 @@ namespace {
             }
           }
         }
+        free(demangled);
         return ss.str();
       } else {
-        return str;
+        return mangled;
       }
     }
 
-    static GlobalVariable *createPrivateGlobalForString(
-        Module* M, StringRef Str) {
-      Constant *StrConst = ConstantDataArray::getString(M->getContext(), 
-          Simplify(Str));
-      return new GlobalVariable(*M, StrConst->getType(), true,
-          GlobalValue::PrivateLinkage, StrConst, "");
+    int GetByteSize(Type* type) {
+      return TD->getTypeStoreSize(type).getFixedValue();
     }
 
-    int GetByteSize(Type* type) {
-      return TD->getTypeAllocSize(type);
+    // Orderings are passed to the runtime as LLVM numbers them, see
+    // MemoryOrderFromLLVM in transition.h.
+    static Constant* GetOrdering(IRBuilder<>& B, AtomicOrdering o) {
+      return B.getInt32(static_cast<int>(o));
     }
 
-    Value* CreateCastToInt64(Value* value, Instruction* insertBefore) {
-      if (isa<PointerType>(value->getType())) {
-        return CastInst::CreatePointerCast(value, Int64, "", insertBefore);
-      } else {
-        return CastInst::CreateZExtOrBitCast(value, Int64, "", insertBefore);
+    // Values travel as int64_t, or as the integer of their width for the
+    // entry points of one width, floating point ones by their bits.
+    Value* CreateCastToInt(IRBuilder<>& B, Value* value, Type* to) {
+      Type* type = value->getType();
+      if (type->isPointerTy()) {
+        return B.CreatePtrToInt(value, to);
+      } else if (!type->isIntegerTy()) {
+        value = B.CreateBitCast(value, B.getIntNTy(8 * GetByteSize(type)));
+      }
+      return B.CreateZExtOrBitCast(value, to);
+    }
+
+    Value* CreateCastToInt64(IRBuilder<>& B, Value* value) {
+      return CreateCastToInt(B, value, Int64);
+    }
+
+    Value* CreateCastToInt128(IRBuilder<>& B, Value* value) {
+      if (!value->getType()->isIntegerTy()) {
+        value = B.CreateBitCast(value, Int128);
+      }
+      return value;
+    }
+
+    Value* CreateCastFromInt128(IRBuilder<>& B, Value* value, Type* type) {
+      return type->isIntegerTy() ? value : B.CreateBitCast(value, type);
+    }
+
+    bool IsWide(Type* type) {
+      return GetByteSize(type) == 16;
+    }
+
+    // The index in SizedLoadFn and SizedStoreFn of the entry points for
+    // values of type, or -1 if there are none.
+    int GetSizedIndex(Type* type) {
+      switch (GetByteSize(type)) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return -1;
+      }
+    }
+
+    Value* CreateCastFromInt(IRBuilder<>& B, Value* value, Type* type) {
+      if (type->isPointerTy()) {
+        return B.CreateIntToPtr(value, type);
+      } else if (!type->isIntegerTy()) {
+        value = B.CreateTrunc(value, B.getIntNTy(8 * GetByteSize(type)));
+        return B.CreateBitCast(value, type);
+      }
+      return B.CreateTruncOrBitCast(value, type);
+    }
+
+    // Memory no other thread can access: stack slots whose address never
+    // escapes, constant globals, which are never written, and the copies of
+    // thread_local globals, unless their thread hands out their address. Accesses to it
+    // can not race, so they need not be scheduling points.
+    bool IsThreadPrivate(Value* pointer) {
+      const Value* object = getUnderlyingObject(pointer);
+      if (isa<AllocaInst>(object)) {
+#if LLVM_VERSION_MAJOR >= 20
+        return !PointerMayBeCaptured(object, true);
+#else
+        return !PointerMayBeCaptured(object, true, true);
+#endif
+      } else if (const GlobalVariable* global =
+          dyn_cast<GlobalVariable>(object)) {
+        return global->isConstant() || FiberSlots.count(global);
+      }
+      return false;
+    }
+
+    // Decided before rewriting the function, as the intercept calls that take
+    // the address of a slot would otherwise count as capturing it.
+    void FindPrivateAccesses(Function& F, std::set<Instruction*>& accesses) {
+      if (InterceptPrivate) {
+        return;
+      }
+      for (Instruction& I : instructions(F)) {
+        Value* pointer = nullptr;
+        if (LoadInst* IN = dyn_cast<LoadInst>(&I)) {
+          pointer = IN->getPointerOperand();
+        } else if (StoreInst* IN = dyn_cast<StoreInst>(&I)) {
+          pointer = IN->getPointerOperand();
+        } else if (AtomicCmpXchgInst* IN = dyn_cast<AtomicCmpXchgInst>(&I)) {
+          pointer = IN->getPointerOperand();
+        } else if (AtomicRMWInst* IN = dyn_cast<AtomicRMWInst>(&I)) {
+          pointer = IN->getPointerOperand();
+        } else if (MemSetInst* IN = dyn_cast<MemSetInst>(&I)) {
+          pointer = IN->getRawDest();
+        } else if (MemTransferInst* IN = dyn_cast<MemTransferInst>(&I)) {
+          if (IsThreadPrivate(IN->getRawSource())) {
+            pointer = IN->getRawDest();
+          }
+        }
+        if (pointer != nullptr && IsThreadPrivate(pointer)) {
+          accesses.insert(&I);
+        }
+      }
+    }
+
+    Constant* GetString(const std::string& str) {
+      Constant*& pointer = Strings[str];
+      if (pointer == nullptr) {
+        Constant* contents = ConstantDataArray::getString(M->getContext(),
+            str);
+        GlobalVariable* global = new GlobalVariable(*M, contents->getType(),
+            true, GlobalValue::PrivateLinkage, contents, "");
+        global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+        pointer = ConstantExpr::getPointerCast(global, Ptr);
+      }
+      return pointer;
+    }
+
+    // Returns the index of loc in the table, adding it and the locations it
+    // was inlined at as needed.
+    int AddLocation(const DILocation* loc) {
+      auto it = LocationIndex.find(loc);
+      if (it != LocationIndex.end()) {
+        return it->second;
+      }
+      int inlined_at = -1;
+      if (const DILocation* at = loc->getInlinedAt()) {
+        inlined_at = AddLocation(at);
+      }
+
+      std::string file = loc->getFilename().str();
+      if (!loc->getDirectory().empty() && !sys::path::is_absolute(file)) {
+        file = (loc->getDirectory() + "/" + file).str();
+      }
+      StringRef function;
+      if (const DISubprogram* subprogram = loc->getScope()->getSubprogram()) {
+        function = subprogram->getLinkageName();
+        if (function.empty()) {
+          function = subprogram->getName();
+        }
+      }
+
+      Locations.push_back(ConstantStruct::get(LocationTy, {
+          GetString(file), GetString(Simplify(function)),
+          ConstantInt::get(Int32, loc->getLine()),
+          ConstantInt::get(Int32, loc->getColumn()),
+          ConstantInt::get(Int32, inlined_at)}));
+      LocationIndex[loc] = Locations.size() - 1;
+      return Locations.size() - 1;
+    }
+
+    // The location id of instruction, see kMaxLocations in transition.h.
+    Value* GetLocation(Instruction* instruction, IRBuilder<>& B) {
+      const DILocation* loc = instruction->getDebugLoc().get();
+      if (loc == nullptr) {
+        return B.getInt32(0);
+      }
+      return B.CreateAdd(B.CreateLoad(Int32, LocationBase),
+          B.getInt32(AddLocation(loc)));
+    }
+
+    // Emits the table, and the constructor that registers it.
+    void RegisterLocations() {
+      if (Locations.empty()) {
+        LocationBase->eraseFromParent();
+        return;
+      }
+      ArrayType* tableTy = ArrayType::get(LocationTy, Locations.size());
+      GlobalVariable* table = new GlobalVariable(*M, tableTy, true,
+          GlobalValue::PrivateLinkage, ConstantArray::get(tableTy, Locations),
+          "codex.locations");
+      // Kept apart from the program's own data, which only needs the table
+      // once History::Dump writes a trace.
+      if (Triple(M->getTargetTriple()).isOSBinFormatELF()) {
+        table->setSection("codex_locations");
+      }
+
+      Function* ctor = Function::Create(FunctionType::get(Void, false),
+          GlobalValue::InternalLinkage, "codex.register_locations", M);
+      IRBuilder<> B(BasicBlock::Create(M->getContext(), "", ctor));
+      B.CreateStore(B.CreateCall(RegisterLocationsFn, {
+          B.CreatePointerCast(table, Ptr), B.getInt32(Locations.size())}),
+          LocationBase);
+      B.CreateRetVoid();
+      // First, as static initializers can already make accesses.
+      appendToGlobalCtors(*M, ctor, 0);
+    }
+
+    // Replaces I with a call to fn, and its uses with the call's result
+    // converted back to the type of I.
+    void ReplaceWithCall(Instruction& I, IRBuilder<>& B, FunctionCallee fn,
+        ArrayRef<Value*> args) {
+      CallInst* call = B.CreateCall(fn, args);
+      if (!I.getType()->isVoidTy()) {
+        I.replaceAllUsesWith(CreateCastFromInt(B, call, I.getType()));
       }
+      I.eraseFromParent();
     }
 
-    Instruction* CreateCastFromInt64(Value* value, Type* type) {
-      if (isa<PointerType>(type)) {
-        return CastInst::Create(Instruction::IntToPtr, value, type);
+    // Loads are by far the most common access, so they check
+    // codex_intercepting inline, and load directly outside of program
+    // threads, such as during Setup:
+    //
+    //   if (codex_intercepting) {
+    //     value = InterceptLoad(...);
+    //   } else {
+    //     value = *pointer;
+    //   }
+    void InterceptLoad(LoadInst* IN, IRBuilder<>& B) {
+      Value* intercepting = B.CreateICmpNE(
+          B.CreateLoad(B.getInt8Ty(), InterceptingFlag), B.getInt8(0));
+      Instruction *Then, *Else;
+      SplitBlockAndInsertIfThenElse(intercepting, IN, &Then, &Else);
+
+      IRBuilder<> T(Then);
+      Value* intercepted;
+      if (IsWide(IN->getType())) {
+        intercepted = CreateCastFromInt128(T, T.CreateCall(Load16Fn, {
+              T.CreatePointerCast(IN->getPointerOperand(), Ptr),
+              GetOrdering(T, IN->getOrdering()),
+              GetLocation(IN, T)}), IN->getType());
+      } else if (GetSizedIndex(IN->getType()) >= 0) {
+        int index = GetSizedIndex(IN->getType());
+        intercepted = CreateCastFromInt(T, T.CreateCall(SizedLoadFn[index], {
+              T.CreatePointerCast(IN->getPointerOperand(), Ptr),
+              GetOrdering(T, IN->getOrdering()),
+              GetLocation(IN, T)}), IN->getType());
       } else {
-        return CastInst::CreateTruncOrBitCast(value, type, "");
+        intercepted = CreateCastFromInt(T, T.CreateCall(LoadFn, {
+              T.CreatePointerCast(IN->getPointerOperand(), Ptr),
+              T.getInt32(GetByteSize(IN->getType())),
+              GetOrdering(T, IN->getOrdering()),
+              GetLocation(IN, T)}), IN->getType());
       }
+
+      BasicBlock* tail = IN->getParent();
+      IN->moveBefore(Else);
+      IRBuilder<> P(&tail->front());
+      P.SetCurrentDebugLocation(IN->getDebugLoc());
+      PHINode* value = P.CreatePHI(IN->getType(), 2);
+      IN->replaceAllUsesWith(value);
+      value->addIncoming(intercepted, Then->getParent());
+      value->addIncoming(IN, Else->getParent());
     }
 
-    Constant* GetTrace(Module* M, Instruction* instruction) {
-      DebugLoc loc = instruction->getDebugLoc();
-      //int result = -1;
-      bool first = true;
-      std::stringstream ss;
-      ss << "[";
-      // Fixme: crashes on ben
-      /*
-      while (!loc.isUnknown()) {
-        if (!first) {
-          ss << ", ";
-        } else {
-          first = false;
+    void Intercept(Instruction& I) {
+      IRBuilder<> B(&I);
+      if (LoadInst* IN = dyn_cast<LoadInst>(&I)) {
+        InterceptLoad(IN, B);
+      } else if (StoreInst* IN = dyn_cast<StoreInst>(&I)) {
+        if (IsWide(IN->getValueOperand()->getType())) {
+          ReplaceWithCall(I, B, Store16Fn, {
+              B.CreatePointerCast(IN->getPointerOperand(), Ptr),
+              CreateCastToInt128(B, IN->getValueOperand()),
+              GetOrdering(B, IN->getOrdering()),
+              GetLocation(&I, B)});
+          return;
+        }
+        Type* type = IN->getValueOperand()->getType();
+        int index = GetSizedIndex(type);
+        if (index >= 0) {
+          ReplaceWithCall(I, B, SizedStoreFn[index], {
+              B.CreatePointerCast(IN->getPointerOperand(), Ptr),
+              CreateCastToInt(B, IN->getValueOperand(),
+                  B.getIntNTy(8 * GetByteSize(type))),
+              GetOrdering(B, IN->getOrdering()),
+              GetLocation(&I, B)});
+          return;
+        }
+        ReplaceWithCall(I, B, StoreFn, {
+            B.CreatePointerCast(IN->getPointerOperand(), Ptr),
+            CreateCastToInt64(B, IN->getValueOperand()),
+            B.getInt32(GetByteSize(IN->getValueOperand()->getType())),
+            GetOrdering(B, IN->getOrdering()),
+            GetLocation(&I, B)});
+      } else if (AtomicCmpXchgInst* IN = dyn_cast<AtomicCmpXchgInst>(&I)) {
+        // The instruction yields the old value and whether it matched, which
+        // is rebuilt from the old value the runtime returns.
+        Value* compare = IN->getCompareOperand();
+        if (IsWide(compare->getType())) {
+          Value* expected = CreateCastToInt128(B, compare);
+          CallInst* call = B.CreateCall(CmpXChg16Fn, {
+              B.CreatePointerCast(IN->getPointerOperand(), Ptr),
+              expected,
+              CreateCastToInt128(B, IN->getNewValOperand()),
+              GetOrdering(B, IN->getSuccessOrdering()),
+              GetLocation(&I, B)});
+          Value* result = B.CreateInsertValue(UndefValue::get(IN->getType()),
+              CreateCastFromInt128(B, call, compare->getType()), 0);
+          result = B.CreateInsertValue(result, B.CreateICmpEQ(call, expected),
+              1);
+          I.replaceAllUsesWith(result);
+          I.eraseFromParent();
+          return;
         }
+        CallInst* call = B.CreateCall(CmpXChgFn, {
+            B.CreatePointerCast(IN->getPointerOperand(), Ptr),
+            CreateCastToInt64(B, compare),
+            CreateCastToInt64(B, IN->getNewValOperand()),
+            B.getInt32(GetByteSize(compare->getType())),
+            GetOrdering(B, IN->getSuccessOrdering()),
+            GetLocation(&I, B)});
+        Value* old = CreateCastFromInt(B, call, compare->getType());
+        Value* result = B.CreateInsertValue(UndefValue::get(IN->getType()),
+            old, 0);
+        result = B.CreateInsertValue(result,
+            B.CreateICmpEQ(call, CreateCastToInt64(B, compare)), 1);
+        I.replaceAllUsesWith(result);
+        I.eraseFromParent();
+      } else if (isa<FenceInst>(&I)) {
+        ReplaceWithCall(I, B, FenceFn, {});
+      } else if (AtomicRMWInst* IN = dyn_cast<AtomicRMWInst>(&I)) {
+        // The operation is passed as is, see AtomicRMWOperation in
+        // transition.h.
+        switch (IN->getOperation()) {
+          case AtomicRMWInst::Xchg:
+          case AtomicRMWInst::Add:
+          case AtomicRMWInst::Sub:
+          case AtomicRMWInst::And:
+          case AtomicRMWInst::Nand:
+          case AtomicRMWInst::Or:
+          case AtomicRMWInst::Xor:
+          case AtomicRMWInst::Max:
+          case AtomicRMWInst::Min:
+          case AtomicRMWInst::UMax:
+          case AtomicRMWInst::UMin:
+            break;
+          default:
+            report_fatal_error("Found an unsupported atomic RMW: " +
+                AtomicRMWInst::getOperationName(IN->getOperation()));
+        }
+        ReplaceWithCall(I, B, AtomicRMWFn, {
+            B.CreatePointerCast(IN->getPointerOperand(), Ptr),
+            CreateCastToInt64(B, IN->getValOperand()),
+            B.getInt32(IN->getOperation()),
+            B.getInt32(GetByteSize(IN->getValOperand()->getType())),
+            GetOrdering(B, IN->getOrdering()),
+            GetLocation(&I, B)});
+      } else if (MemSetInst* IN = dyn_cast<MemSetInst>(&I)) {
+        ReplaceWithCall(I, B, MemsetFn, {
+            B.CreatePointerCast(IN->getRawDest(), Ptr),
+            CreateCastToInt64(B, IN->getValue()),
+            CreateCastToInt64(B, IN->getLength()),
+            GetLocation(&I, B)});
+      } else if (MemTransferInst* IN = dyn_cast<MemTransferInst>(&I)) {
+        // Both memcpy and memmove, which the runtime treats alike.
+        ReplaceWithCall(I, B, MemcpyFn, {
+            B.CreatePointerCast(IN->getRawDest(), Ptr),
+            B.CreatePointerCast(IN->getRawSource(), Ptr),
+            CreateCastToInt64(B, IN->getLength()),
+            GetLocation(&I, B)});
+      }
+    }
 
-        ss << "{";
-        ss << "'function': \"" << Simplify(getDISubprogram(loc.getScope(M->getContext())).getLinkageName()) << "\", ";
-        ss << "'file': '" << DIScope(loc.getScope(M->getContext())).getFilename().str() << "', ";
-        ss << "'line': " << loc.getLine() << ", 'column': " << loc.getCol();
-        ss << "}";
+    // The patterns of -intercept-list, each with whether it selects.
+    std::vector<std::pair<std::string, bool>> Patterns;
+    // The functions annotated with CODEX_INTERCEPT or CODEX_NATIVE.
+    std::map<const Function*, bool> Annotated;
+
+    void ReadInterceptList() {
+      Patterns.clear();
+      if (InterceptList.empty()) {
+        return;
+      }
+      std::ifstream in(InterceptList);
+      if (!in) {
+        report_fatal_error(Twine("Cannot read the intercept list ") +
+            InterceptList);
+      }
+      std::string line;
+      while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        StringRef pattern = StringRef(line).trim();
+        bool selects = !pattern.consume_front("!");
+        pattern = pattern.ltrim();
+        if (!pattern.empty()) {
+          Patterns.emplace_back(pattern.str(), selects);
+        }
+      }
+    }
+
+    void ReadAnnotations() {
+      Annotated.clear();
+      GlobalVariable* annotations =
+          M->getGlobalVariable("llvm.global.annotations");
+      if (!annotations || !annotations->hasInitializer()) {
+        return;
+      }
+      auto* entries = dyn_cast<ConstantArray>(annotations->getInitializer());
+      if (!entries) {
+        return;
+      }
+      for (Value* entry : entries->operands()) {
+        auto* fields = dyn_cast<ConstantStruct>(entry);
+        if (!fields || fields->getNumOperands() < 2) {
+          continue;
+        }
+        auto* F =
+            dyn_cast<Function>(fields->getOperand(0)->stripPointerCasts());
+        auto* text = dyn_cast<GlobalVariable>(
+            fields->getOperand(1)->stripPointerCasts());
+        if (!F || !text || !text->hasInitializer()) {
+          continue;
+        }
+        auto* data = dyn_cast<ConstantDataSequential>(text->getInitializer());
+        if (!data || !data->isString()) {
+          continue;
+        }
+        StringRef annotation = data->getAsCString();
+        if (annotation == "codex_intercept") {
+          Annotated[F] = true;
+        } else if (annotation == "codex_native") {
+          Annotated[F] = false;
+        }
+      }
+    }
 
-        //result = loc.getLine();
-        loc = DebugLoc::getFromDILocation(loc.getInlinedAt(M->getContext()));
+    // The qualified name of a demangled function, e.g. ns::Class<int>::f for
+    // "int ns::Class<int>::f(int)".
+    static std::string QualifiedName(StringRef demangled) {
+      const StringRef anonymous = "(anonymous namespace)";
+      size_t start = 0;
+      int depth = 0;
+      for (size_t i = 0; i < demangled.size(); i++) {
+        if (demangled.substr(i).startswith(anonymous)) {
+          i += anonymous.size() - 1;
+        } else if (demangled[i] == '<') {
+          depth++;
+        } else if (demangled[i] == '>') {
+          depth--;
+        } else if (depth == 0 && demangled[i] == ' ') {
+          start = i + 1;
+        } else if (depth == 0 && demangled[i] == '(') {
+          return demangled.slice(start, i).str();
+        }
       }
-      */
-      ss << "]";
+      return demangled.substr(start).str();
+    }
 
-      GlobalVariable* name = createPrivateGlobalForString(M, ss.str());
-      return ConstantExpr::getPointerCast(name, Int8Ptr);
+    bool ShouldIntercept(const Function& F) {
+      auto annotated = Annotated.find(&F);
+      if (annotated != Annotated.end()) {
+        return annotated->second;
+      }
+      if (Patterns.empty()) {
+        return true;
+      }
+      std::string name = F.getName().str();
+      int status;
+      char* demangled = abi::__cxa_demangle(name.c_str(), 0, 0, &status);
+      std::string qualified = name;
+      if (status == 0) {
+        qualified = QualifiedName(demangled);
+        free(demangled);
+      }
+      for (const char* atomic : {"std::atomic", "std::__atomic",
+                                 "std::__1::atomic", "std::__1::__atomic"}) {
+        if (StringRef(qualified).startswith(atomic)) {
+          return true;
+        }
+      }
+      bool selected = false;
+      for (const auto& pattern : Patterns) {
+        if (name == pattern.first ||
+            StringRef(qualified).startswith(pattern.first)) {
+          selected = pattern.second;
+        }
+      }
+      return selected;
     }
 
-    virtual bool runOnModule(Module &module) {
-      M = &module;
-      UIntPtr = Type::getInt32PtrTy(M->getContext());
-      Type *Int32 = Type::getInt32Ty(M->getContext());
-      Void = Type::getVoidTy(M->getContext());
+    // See -relocate-globals. The runtime's globals, e.g. codex_intercepting,
+    // and the module's metadata stay shared.
+    void RelocateGlobalVariables() {
+      for (GlobalVariable& G : M->globals()) {
+        if (G.isDeclaration() || G.isConstant() || G.isThreadLocal() ||
+            G.hasSection() || G.getName().startswith("llvm.") ||
+            G.getName().startswith("codex")) {
+          continue;
+        }
+        G.setThreadLocalMode(GlobalValue::InitialExecTLSModel);
+      }
+    }
 
-      TD = &getAnalysis<DataLayout>();
+    static bool IsOnlyUsedByInstructions(const Value* value) {
+      for (const User* user : value->users()) {
+        const ConstantExpr* expr = dyn_cast<ConstantExpr>(user);
+        if (!isa<Instruction>(user) &&
+            (expr == nullptr || !IsOnlyUsedByInstructions(expr))) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Where an instruction computing the value of use goes.
+    static Instruction* InsertionPointFor(const Use& use) {
+      Instruction* user = cast<Instruction>(use.getUser());
+      if (PHINode* phi = dyn_cast<PHINode>(user)) {
+        return phi->getIncomingBlock(use)->getTerminator();
+      }
+      return user;
+    }
 
-      Int32 = Type::getInt32Ty(M->getContext());
-      Int64 = Type::getInt64Ty(M->getContext());
-      Int8Ptr = Type::getInt8PtrTy(M->getContext());
+    // Turns the constant expressions that use value into instructions, one
+    // before each of their users, so that only instructions use it.
+    static void ExpandConstantUsers(Value* value) {
+      std::vector<ConstantExpr*> exprs;
+      for (User* user : value->users()) {
+        if (ConstantExpr* expr = dyn_cast<ConstantExpr>(user)) {
+          exprs.push_back(expr);
+        }
+      }
+      for (ConstantExpr* expr : exprs) {
+        ExpandConstantUsers(expr);
+        std::vector<Use*> uses;
+        for (Use& use : expr->uses()) {
+          uses.push_back(&use);
+        }
+        for (Use* use : uses) {
+          Instruction* copy = expr->getAsInstruction();
+          copy->insertBefore(InsertionPointFor(*use));
+          use->set(copy);
+        }
+        expr->destroyConstant();
+      }
+    }
+
+    // Replaces each thread_local global the module defines with an array of
+    // kFiberSlots copies of it, indexed by codex_current_thread, which
+    // switches keep up to date, so that every program thread has its own.
+    // The copies all start out with the global's static initializer; dynamic
+    // initializers run once in each thread, as their guards are thread_local
+    // too. A global that other globals' initializers refer to, or that is
+    // aligned beyond its type, is left alone, and so is an exported one for
+    // the other modules that use it.
+    void GiveFibersThreadLocals() {
+      std::vector<GlobalVariable*> globals;
+      for (GlobalVariable& G : M->globals()) {
+        Type* type = G.getValueType();
+        G.removeDeadConstantUsers();
+        if (G.isThreadLocal() && !G.isDeclaration() && !G.hasSection() &&
+            IsOnlyUsedByInstructions(&G) &&
+            (!G.getAlign() || *G.getAlign() <= TD->getABITypeAlign(type))) {
+          globals.push_back(&G);
+        }
+      }
+      for (GlobalVariable* G : globals) {
+        ArrayType* array = ArrayType::get(G->getValueType(), kFiberSlots);
+        std::vector<Constant*> copies(kFiberSlots, G->getInitializer());
+        GlobalVariable* slots = new GlobalVariable(*M, array, false,
+            GlobalValue::InternalLinkage, ConstantArray::get(array, copies),
+            G->getName() + ".fiber_slots");
+        slots->setAlignment(G->getAlign());
+        FiberSlots.insert(slots);
+
+        ExpandConstantUsers(G);
+        std::vector<Use*> uses;
+        for (Use& use : G->uses()) {
+          uses.push_back(&use);
+        }
+        for (Use* use : uses) {
+          IRBuilder<> B(InsertionPointFor(*use));
+          LoadInst* thread = B.CreateLoad(Int32, CurrentThread);
+          CurrentThreadLoads.insert(thread);
+          Value* slot = B.CreateInBoundsGEP(array, slots,
+              {B.getInt64(0), B.CreateZExt(thread, Int64)});
+#if LLVM_VERSION_MAJOR >= 16
+          // Its argument has to be thread local, and the slot is not.
+          IntrinsicInst* call = dyn_cast<IntrinsicInst>(use->getUser());
+          if (call != nullptr &&
+              call->getIntrinsicID() == Intrinsic::threadlocal_address) {
+            call->replaceAllUsesWith(slot);
+            call->eraseFromParent();
+            continue;
+          }
+#endif
+          use->set(slot);
+        }
+        if (G->hasLocalLinkage()) {
+          G->eraseFromParent();
+        }
+      }
+    }
 
-      next = 1234;
+    static bool IsIntercepted(const Instruction& I) {
+      return isa<LoadInst>(I) || isa<StoreInst>(I) ||
+          isa<AtomicCmpXchgInst>(I) || isa<FenceInst>(I) ||
+          isa<AtomicRMWInst>(I) || isa<MemSetInst>(I) ||
+          isa<MemTransferInst>(I);
+    }
 
-      LoadFn = M->getOrInsertFunction("InterceptLoad", 
-          Int64, Int8Ptr, Int32, Int32, Int8Ptr, NULL);
-      StoreFn = M->getOrInsertFunction("InterceptStore", 
-          Void, Int8Ptr, Int64, Int32, Int32, Int8Ptr, NULL);
+    PreservedAnalyses run(Module &module, ModuleAnalysisManager&) {
+      M = &module;
+      TD = &M->getDataLayout();
+      LLVMContext& context = M->getContext();
+
+      Void = Type::getVoidTy(context);
+      Int32 = Type::getInt32Ty(context);
+      Int64 = Type::getInt64Ty(context);
+      Int128 = Type::getInt128Ty(context);
+#if LLVM_VERSION_MAJOR >= 15
+      Ptr = PointerType::getUnqual(context);
+#else
+      Ptr = Type::getInt8PtrTy(context);
+#endif
+
+      LoadFn = M->getOrInsertFunction("InterceptLoad",
+          Int64, Ptr, Int32, Int32, Int32);
+      StoreFn = M->getOrInsertFunction("InterceptStore",
+          Void, Ptr, Int64, Int32, Int32, Int32);
       CmpXChgFn = M->getOrInsertFunction("InterceptCmpXChg",
-          Int64, Int8Ptr, Int64, Int64, Int32, Int8Ptr, NULL);
+          Int64, Ptr, Int64, Int64, Int32, Int32, Int32);
       AtomicRMWFn = M->getOrInsertFunction("InterceptAtomicRMW",
-          Int64, Int8Ptr, Int64, Int32, Int32, Int8Ptr, NULL);
-      FenceFn = M->getOrInsertFunction("InterceptFence", Void, NULL);
-
-      for (Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
-        GlobalVariable* name = createPrivateGlobalForString(M, F->getName());
-        Constant* namePointer = ConstantExpr::getPointerCast(name, Int8Ptr);
-        for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
-          for (BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; ++BI) {
-            if (isa<LoadInst>(BI)) {
-              LoadInst& IN = static_cast<LoadInst&>(*BI);
-              std::vector<Value*> args(4);
-
-              args[0] = CastInst::CreateZExtOrBitCast(IN.getPointerOperand(), Int8Ptr,
-                  "", BI);
-              args[1] = ConstantInt::get(Int32, GetByteSize(IN.getType()));
-              args[2] = ConstantInt::get(Int32, IsAtomic(IN.getOrdering()));
-              args[3] = GetTrace(M, BI);
-              Instruction* callLoad = CallInst::Create(
-                  LoadFn,
-                  args, "");
-
-
-              BI->getParent()->getInstList().insert(BI, callLoad);
-              ReplaceInstWithInst(BI->getParent()->getInstList(), BI, CreateCastFromInt64(callLoad, BI->getType()));
-
-            } else if (isa<StoreInst>(BI)) {
-              StoreInst& IN = static_cast<StoreInst&>(*BI);
-              std::vector<Value*> args(5);
-
-              args[0] = CastInst::CreateZExtOrBitCast(IN.getPointerOperand(), Int8Ptr,
-                  "", BI);
-              args[1] = CreateCastToInt64(IN.getValueOperand(),
-                  BI);
-              args[2] = ConstantInt::get(Int32, GetByteSize(IN.getValueOperand()->getType()));
-              args[3] = ConstantInt::get(Int32, IsAtomic(IN.getOrdering()));
-              args[4] = GetTrace(M, BI);
-              Instruction* callStore = CallInst::Create(
-                  StoreFn,
-                  args, "");
-
-              ReplaceInstWithInst(BI->getParent()->getInstList(), BI, callStore);
-
-            } else if (isa<AtomicCmpXchgInst>(BI)) {
-              AtomicCmpXchgInst& IN = static_cast<AtomicCmpXchgInst&>(*BI);
-              std::vector<Value*> args(5);
-
-              args[0] = CastInst::CreateZExtOrBitCast(IN.getPointerOperand(), Int8Ptr,
-                  "", BI);
-              args[1] = CreateCastToInt64(IN.getCompareOperand(),
-                  BI);
-              args[2] = CreateCastToInt64(IN.getNewValOperand(),
-                  BI);
-              args[3] = ConstantInt::get(Int32, GetByteSize(IN.getCompareOperand()->getType()));
-              args[4] = GetTrace(M, BI);
-              Instruction* callCmpXChg = CallInst::Create(
-                  CmpXChgFn,
-                  args, "");
-
-              BI->getParent()->getInstList().insert(BI, callCmpXChg);
-              ReplaceInstWithInst(BI->getParent()->getInstList(), BI, CreateCastFromInt64(callCmpXChg, BI->getType()));
-            } else if (isa<FenceInst>(BI)) {
-              std::vector<Value*> args(0);
-
-              Instruction* callFence = CallInst::Create(
-                  FenceFn,
-                  args, "");
-
-              ReplaceInstWithInst(BI->getParent()->getInstList(), BI, callFence);
-
-            } else if (isa<AtomicRMWInst>(BI)) {
-              AtomicRMWInst& IN = static_cast<AtomicRMWInst&>(*BI);
-
-              switch (IN.getOperation()) {
-                case AtomicRMWInst::Xchg:
-                case AtomicRMWInst::Add:
-                case AtomicRMWInst::Sub:
-                  break;
-                default:
-                  errs() << "Found an unsupported atomic RMW...: " << IN.getOperation() << "\n";
-                  assert(0);
-              }
+          Int64, Ptr, Int64, Int32, Int32, Int32, Int32);
+      FenceFn = M->getOrInsertFunction("InterceptFence", Void);
+      Load16Fn = M->getOrInsertFunction("InterceptLoad16",
+          Int128, Ptr, Int32, Int32);
+      Store16Fn = M->getOrInsertFunction("InterceptStore16",
+          Void, Ptr, Int128, Int32, Int32);
+      CmpXChg16Fn = M->getOrInsertFunction("InterceptCmpXChg16",
+          Int128, Ptr, Int128, Int128, Int32, Int32);
+      for (int index = 0; index < 4; index++) {
+        std::string bytes = std::to_string(1 << index);
+        Type* sized = Type::getIntNTy(context, 8 << index);
+        SizedLoadFn[index] = M->getOrInsertFunction("InterceptLoad" + bytes,
+            sized, Ptr, Int32, Int32);
+        SizedStoreFn[index] = M->getOrInsertFunction("InterceptStore" + bytes,
+            Void, Ptr, sized, Int32, Int32);
+      }
+      MemsetFn = M->getOrInsertFunction("InterceptMemset",
+          Void, Ptr, Int64, Int64, Int32);
+      MemcpyFn = M->getOrInsertFunction("InterceptMemcpy",
+          Void, Ptr, Ptr, Int64, Int32);
+      InterceptingFlag = M->getOrInsertGlobal("codex_intercepting",
+          Type::getInt8Ty(context));
+      CurrentThread = M->getOrInsertGlobal("codex_current_thread", Int32);
+      CurrentThreadLoads.clear();
+      FiberSlots.clear();
+
+      RegisterLocationsFn = M->getOrInsertFunction("CodexRegisterLocations",
+          Int32, Ptr, Int32);
+      LocationTy = StructType::get(context, {Ptr, Ptr, Int32, Int32, Int32});
+      LocationBase = new GlobalVariable(*M, Int32, false,
+          GlobalValue::InternalLinkage, ConstantInt::get(Int32, 0),
+          "codex.location_base");
+      Locations.clear();
+      LocationIndex.clear();
+      Strings.clear();
+      ReadInterceptList();
+      ReadAnnotations();
+      // Before relocating, which makes globals thread local; the arrays of
+      // copies are then relocated like any other global.
+      GiveFibersThreadLocals();
+      if (RelocateGlobals) {
+        RelocateGlobalVariables();
+      }
 
-              std::vector<Value*> args(5);
-              args[0] = CastInst::CreateZExtOrBitCast(IN.getPointerOperand(), Int8Ptr, "", BI);
-              args[1] = CreateCastToInt64(IN.getValOperand(), BI);
-              args[2] = ConstantInt::get(Int32, IN.getOperation());
-              args[3] = ConstantInt::get(Int32, GetByteSize(IN.getValOperand()->getType()));
-              args[4] = GetTrace(M, BI);
-              Instruction* callCmpXChg = CallInst::Create(AtomicRMWFn, args, "");
-
-              BI->getParent()->getInstList().insert(BI, callCmpXChg);
-              ReplaceInstWithInst(BI->getParent()->getInstList(), BI, CreateCastFromInt64(callCmpXChg, BI->getType()));
-            } else if (isa<MemSetInst>(BI)) {
-              MemSetInst& IN = static_cast<MemSetInst&>(*BI);
-            } else if (isa<MemCpyInst>(BI) || isa<MemMoveInst>(BI)) {
-              MemCpyInst& IN = static_cast<MemCpyInst&>(*BI);
-            }
+      std::vector<Instruction*> accesses;
+      for (Function& F : *M) {
+        if (!ShouldIntercept(F)) {
+          continue;
+        }
+        std::set<Instruction*> private_accesses;
+        FindPrivateAccesses(F, private_accesses);
+        // Collected first, as intercepting an access replaces it.
+        accesses.clear();
+        for (Instruction& I : instructions(F)) {
+          if (IsIntercepted(I) && !private_accesses.count(&I) &&
+              !CurrentThreadLoads.count(&I)) {
+            accesses.push_back(&I);
           }
         }
+        for (Instruction* I : accesses) {
+          Intercept(*I);
+        }
       }
 
-      for (Module::iterator F = M->begin(), E = M->end(); F != E; ++F) {
-        if (!F->isDeclaration() && F->hasLinkOnceLinkage()) {
+      RegisterLocations();
+
+      for (Function& F : *M) {
+        if (!F.isDeclaration() && F.hasLinkOnceLinkage()) {
           // Make local copies of link-once functions so we don't end up
           // intercepting Codex code.
-          F->setName(F->getName() + "_copy_for_codex");
-        } else if (F->getName() == "_Znwm") {
-          F->setName("InterceptNew");
-        } else if (F->getName() == "_ZdlPv") {
-          F->setName("InterceptDelete");
-        } else if (F->getName() == "llvm.memcpy.p0i8.p0i8.i32") {
-          F->setName("InterceptMemcpy");
-        } else if (F->getName() == "llvm.memset.p0i8.i64") {
-          F->setName("InterceptMemset");
+          F.setName(F.getName() + "_copy_for_codex");
+          continue;
+        }
+        for (const auto& replaced : kReplacedFunctions) {
+          if (F.getName() == replaced.first) {
+            F.setName(replaced.second);
+            break;
+          }
         }
       }
 
-      return false;
+      return PreservedAnalyses::none();
+    }
+
+    // Runs even when optnone would skip it, as no access can go unseen.
+    static bool isRequired() {
+      return true;
     }
   };
 }
 
-char MemoryInterceptPass::ID = 0;
-static RegisterPass<MemoryInterceptPass> X("intercept", 
-    "Intercept memory accesses");
-
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "intercept", LLVM_VERSION_STRING,
+      [](PassBuilder& PB) {
+        PB.registerPipelineParsingCallback(
+            [](StringRef name, ModulePassManager& MPM,
+                ArrayRef<PassBuilder::PipelineElement>) {
+              if (name != "intercept") {
+                return false;
+              }
+              MPM.addPass(MemoryInterceptPass());
+              return true;
+            });
+        // Last, as the accesses the optimizer leaves are the ones the
+        // program makes.
+        PB.registerOptimizerLastEPCallback(
+#if LLVM_VERSION_MAJOR >= 20
+            [](ModulePassManager& MPM, OptimizationLevel, ThinOrFullLTOPhase) {
+#else
+            [](ModulePassManager& MPM, OptimizationLevel) {
+#endif
+              MPM.addPass(MemoryInterceptPass());
+            });
+      }};
+}
@@ -0,0 +1,160 @@
+#include "location_profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+#include "codex_interface.h"
+#include "config.h"
+#include "predictable_alloc.h"
+
+LocationCounts* location_profile;
+static uint32_t profiled_locations;
+AddressCounts* address_profile;
+
+static void* MapCounts(size_t size) {
+  void* counts = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (counts == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return counts;
+}
+
+void EnableLocationProfile() {
+  profiled_locations = std::min(CountLocations(), kMaxLocations);
+  location_profile = static_cast<LocationCounts*>(
+      MapCounts(profiled_locations * sizeof(LocationCounts)));
+}
+
+void WriteLocationProfile(const std::string& file) {
+  FILE* out = fopen(file.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "failed to open %s\n", file.c_str());
+    exit(1);
+  }
+  std::vector<uint32_t> locations;
+  for (uint32_t location = 0; location < profiled_locations; location++) {
+    const LocationCounts& counts = location_profile[location];
+    if (counts.transitions || counts.conflicts || counts.backtracks) {
+      locations.push_back(location);
+    }
+  }
+  std::stable_sort(locations.begin(), locations.end(),
+      [](uint32_t a, uint32_t b) {
+    return location_profile[a].transitions > location_profile[b].transitions;
+  });
+  fprintf(out, "%12s %12s %12s  location\n", "transitions", "conflicts",
+      "backtracks");
+  for (uint32_t location : locations) {
+    const LocationCounts& counts = location_profile[location];
+    fprintf(out, "%12lld %12lld %12lld  %s\n", (long long)counts.transitions,
+        (long long)counts.conflicts, (long long)counts.backtracks,
+        FormatLocation(location).c_str());
+  }
+  fclose(out);
+}
+
+void EnableAddressProfile() {
+  address_profile = static_cast<AddressCounts*>(
+      MapCounts(kProfiledAddresses * sizeof(AddressCounts)));
+  record_allocation_sites = true;
+}
+
+// Open addressing over all but the last entry, which takes the addresses
+// that find no free entry within a few probes.
+AddressCounts& AddressCountsOf(const int8_t* address) {
+  static const int kSlots = kProfiledAddresses - 1;
+  static const int kMaxProbes = 16;
+  uint64_t hash = reinterpret_cast<uint64_t>(address) * 0x9e3779b97f4a7c15ULL;
+  int slot = (hash >> 32) % kSlots;
+  for (int probe = 0; probe < kMaxProbes; probe++) {
+    AddressCounts& counts = address_profile[slot];
+    if (counts.address == address) {
+      return counts;
+    } else if (counts.address == nullptr) {
+      counts.address = address;
+      return counts;
+    }
+    slot = slot + 1 == kSlots ? 0 : slot + 1;
+  }
+  return address_profile[kSlots];
+}
+
+static std::string Demangle(const char* name) {
+  int status;
+  char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (demangled == nullptr) {
+    return name;
+  }
+  std::string result = demangled;
+  free(demangled);
+  return result;
+}
+
+// The symbol containing address, as an offset into it, or the address if
+// it has none that the dynamic linker knows of, as in executables linked
+// without -rdynamic.
+static std::string DescribeSymbol(const void* address) {
+  std::stringstream ss;
+  Dl_info info;
+  if (dladdr(address, &info) != 0 && info.dli_sname != nullptr) {
+    ss << Demangle(info.dli_sname) << "+" <<
+        (static_cast<const char*>(address) -
+         static_cast<const char*>(info.dli_saddr));
+  } else {
+    ss << address;
+  }
+  return ss.str();
+}
+
+static std::string DescribeAddress(const int8_t* address) {
+  std::stringstream ss;
+  const int8_t* start;
+  const void* site;
+  ss << static_cast<const void*>(address) << ", ";
+  if (GetPredictableAlloc()->FindSite(address, &start, &site)) {
+    ss << "byte " << address - start << " of a block allocated by ";
+    ss << (site != nullptr ? DescribeSymbol(site) : "the runtime");
+  } else {
+    ss << DescribeSymbol(address);
+  }
+  return ss.str();
+}
+
+void WriteAddressProfile(const std::string& file) {
+  FILE* out = fopen(file.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "failed to open %s\n", file.c_str());
+    exit(1);
+  }
+  std::vector<const AddressCounts*> addresses;
+  for (int slot = 0; slot < kProfiledAddresses - 1; slot++) {
+    if (address_profile[slot].address != nullptr) {
+      addresses.push_back(&address_profile[slot]);
+    }
+  }
+  std::stable_sort(addresses.begin(), addresses.end(),
+      [](const AddressCounts* a, const AddressCounts* b) {
+    return a->conflicts > b->conflicts;
+  });
+  fprintf(out, "%12s %12s  address\n", "conflicts", "backtracks");
+  for (const AddressCounts* counts : addresses) {
+    fprintf(out, "%12lld %12lld  %s\n", (long long)counts->conflicts,
+        (long long)counts->backtracks,
+        DescribeAddress(counts->address).c_str());
+  }
+  const AddressCounts& rest = address_profile[kProfiledAddresses - 1];
+  if (rest.conflicts || rest.backtracks) {
+    fprintf(out, "%12lld %12lld  other addresses\n",
+        (long long)rest.conflicts, (long long)rest.backtracks);
+  }
+  fclose(out);
+}
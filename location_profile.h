@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "transition.h"
+
+// Counts, per location id of the instrumentation, how much of the search the
+// accesses made there account for: the steps they took, the earlier steps
+// FindFirstConflicts found them to conflict with, and the races with them
+// that the explorers added backtrack points or wakeup sequences for. The
+// locations at the top are the ones worth leaving out with -intercept-list or
+// wrapping in an AtomicSection.
+struct LocationCounts {
+  int64_t transitions;
+  int64_t conflicts;
+  int64_t backtracks;
+};
+
+// Null unless profiling, and otherwise indexed by location id. The counts
+// live in a MAP_SHARED mapping, so that the processes forked for checkpoints
+// and parallel workers count into the same ones.
+extern LocationCounts* location_profile;
+
+// Starts counting, for the locations registered so far.
+void EnableLocationProfile();
+// Writes the counts of the locations that have any to file, most steps
+// first.
+void WriteLocationProfile(const std::string& file);
+
+// Counts, per address, the conflicts FindFirstConflicts found on the object
+// starting there and the races of steps accessing it that the explorers
+// added backtrack points for, in a table of kProfiledAddresses entries that
+// lives in a MAP_SHARED mapping like the counts per location. Allocations
+// land at the same addresses in every run, so the counts add up across runs.
+struct AddressCounts {
+  const int8_t* address;
+  int64_t conflicts;
+  int64_t backtracks;
+};
+static const int kProfiledAddresses = 1 << 16;
+
+// Null unless profiling, and otherwise the table, whose last entry collects
+// the counts of the addresses that do not fit.
+extern AddressCounts* address_profile;
+
+// Starts counting per address, and has PredictableAlloc record the sites of
+// allocations.
+void EnableAddressProfile();
+// Writes the counts of the addresses that have any to file, most conflicts
+// first, with the global or the block and allocation site holding each.
+void WriteAddressProfile(const std::string& file);
+AddressCounts& AddressCountsOf(const int8_t* address);
+
+inline void ProfileTransition(const Transition& transition) {
+  if (location_profile != nullptr) {
+    location_profile[transition.location()].transitions++;
+  }
+}
+
+inline void ProfileConflicts(const Transition& transition, int64_t count) {
+  if (location_profile != nullptr) {
+    location_profile[transition.location()].conflicts += count;
+  }
+}
+
+inline void ProfileAddressConflicts(const int8_t* address, int64_t count) {
+  if (address_profile != nullptr && count > 0) {
+    AddressCountsOf(address).conflicts += count;
+  }
+}
+
+inline void ProfileBacktrack(const Transition& transition) {
+  if (location_profile != nullptr) {
+    location_profile[transition.location()].backtracks++;
+  }
+  if (address_profile != nullptr) {
+    AddressCountsOf(transition.address()).backtracks++;
+  }
+}
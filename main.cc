@@ -1,53 +1,652 @@
+#include <cerrno>
 #include <cstdio>
-
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <map>
+#include <memory>
+#include <queue>
 #include <random>
+#include <set>
+#include <sstream>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "background_writer.h"
 #include "codex_interface.h"
+#include "conflict_coverage.h"
+#include "fingerprint_table.h"
+#include "frontier.h"
 #include "interceptor.h"
+#include "introspection.h"
 #include "hhbhistory.h"
+#include "location_profile.h"
+#include "memory_governor.h"
+#include "parallel.h"
 #include "pinner.h"
+#include "schedule.h"
+#include "spill_vector.h"
 #include "statistics.h"
+#include "timer.h"
 #include "trace_builder.h"
+#include "trace_file.h"
+#include "wakeup_tree.h"
 
 
 bool show_all_transitions = false;
 bool show_program_output = false;
 bool show_debug_output = false;
+bool intercept_private_accesses = false;
+bool coalesce_accesses = false;
+SchedulingPoints scheduling_points = SchedulingPoints::ALL;
+std::vector<bool> scheduling_locations;
+bool symmetry_reduction = false;
+bool reuse_freed_memory = false;
+bool record_allocation_sites = false;
+bool setup_once = false;
+bool weak_atomics = false;
+bool detect_races = false;
+bool detect_frees = false;
+bool hash_memory_state = false;
+bool operation_steps = false;
+int spin_reads = 0;
+int max_run_steps = 0;
+int retry_cutoff = 0;
+bool prune_cut_off_runs = false;
+bool stop_run_on_found = false;
+bool commuting_adds = false;
+size_t distinct_table_bytes = 256 << 20;
+bool finish_every_run = false;
+std::string bug_directory;
+std::string bug_corpus_file;
+int slow_runs = 0;
+std::string hb_graph_format;
+int coverage_fd = -1;
+std::string workload;
+size_t fiber_stack_size = 256 * 1024;
+bool preserve_fpu_state = false;
+bool huge_pages = false;
+int linearizability_workers = 1;
+int stress_repeat = 1;
+
+// The runtime the explorers drive. Nothing outside this file reaches it: the
+// pinner is handed the interceptor, and parallel workers are forked replicas.
+static Interceptor* interceptor;
+static TraceBuilder* trace_builder;
+static HHBHistory* history;
+
+static std::vector<ThreadSet> available, backtrack;
+static std::vector<int> begins;
+// Scratch space for FindFirstConflicts, consumed before exploring further.
+static std::vector<int> conflicts;
+
+// Checkpointing forks a process per explored child at nodes whose depth is at
+// least checkpoint_min_depth and a multiple of checkpoint_interval, so that
+// backtracking to such a node costs no replay. Disabled when the interval is 0.
+static int checkpoint_interval = 0;
+static int checkpoint_min_depth = 0;
+
+// Runs explore, the recursive exploration of a child of the current node,
+// from a checkpoint if the node qualifies. Children only hand back their
+// additions to the backtrack sets of this node and its ancestors.
+static int64_t& memory_skipped_checkpoints =
+    RegisterStatistic<int64_t>("memory-skipped-checkpoints");
+
+static void ExploreChild(const std::function<void()>& explore) {
+  int depth = history->length();
+  bool checkpoint = checkpoint_interval > 0 &&
+      depth >= checkpoint_min_depth && depth % checkpoint_interval == 0;
+  if (checkpoint && UnderMemoryPressure()) {
+    memory_skipped_checkpoints++;
+    checkpoint = false;
+  }
+  if (checkpoint) {
+    trace_builder->ExploreFromCheckpoint(explore, &backtrack);
+  } else {
+    explore();
+  }
+}
 
-Interceptor* interceptor;
-TraceBuilder* trace_builder;
-HHBHistory* history;
+// Exploration stops once any budget is exhausted; 0 means unlimited. With
+// stop_on_bug, finding a bug exhausts the budget as well, so every explorer
+// unwinds the way it does when time runs out.
+static double max_seconds = 0;
+static int64_t max_runs = 0;
+static int64_t max_transitions = 0;
+static bool stop_on_bug = false;
+// Reported as a statistic, so that whoever runs the search can tell one
+// that finished from one that was cut short.
+static bool& budget_exhausted = RegisterStatistic<bool>("out-of-budget");
+// With --operation-steps, or --scheduling-points that leave out atomic
+// accesses, the operations refined and locations promoted when the current
+// search started, see RunRefiningSteps.
+static int64_t refined_before_search = 0;
+// The bugs found before the current search, which stop_on_bug does not stop
+// for, see RunWorkloads.
+static int64_t found_before_search = 0;
+
+static bool RefinesSteps() {
+  return operation_steps || RefinesSchedulingPoints();
+}
 
-std::vector<ThreadSet> available, backtrack;
-std::vector<int> begins;
+static int64_t Refinements() {
+  return RefinedOperations() + PromotedSchedulingPoints();
+}
 
-ThreadSet FindConflicts(
-    ThreadMap<Transition> transitions, Transition transition) {
-  ThreadSet conflicts;
-  for (int thread : transitions.keys()) {
-    if (transitions[thread].ConflictsWith(transition)) {
-      conflicts.insert(thread);
-    }
+bool OutOfBudget() {
+  static const auto start = std::chrono::steady_clock::now();
+  static const int64_t& runs = GetStatistic<int64_t>("runs");
+  static const int64_t& transitions = GetStatistic<int64_t>("transitions");
+  static const int64_t& found = GetStatistic<int64_t>("found");
+
+  ServeIntrospection();
+  GovernMemory();
+  if (!budget_exhausted) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    budget_exhausted = (max_seconds > 0 && elapsed.count() >= max_seconds) ||
+        (max_runs > 0 && runs >= max_runs) ||
+        (max_transitions > 0 && transitions >= max_transitions) ||
+        (stop_on_bug && found > found_before_search) ||
+        (RefinesSteps() && Refinements() > refined_before_search);
   }
-  return conflicts;
+  return budget_exhausted;
+}
+
+// Range of preemption bounds that PBPOR, CBDPOR and CHESS iterate over, and
+// of delay bounds for the delay explorers. A negative maximum leaves the
+// range unbounded.
+static int min_preemptions = 0;
+static int max_preemptions = -1;
+// The bound being explored, for introspection.
+static int current_bound = -1;
+
+static inline bool InPreemptionRange(int preemptions) {
+  current_bound = preemptions;
+  return (max_preemptions < 0 || preemptions <= max_preemptions) &&
+      !OutOfBudget();
 }
 
 int64_t& dpor_leaves = RegisterStatistic<int64_t>("dpor-leaves");
 int64_t& dpor_deadends = RegisterStatistic<int64_t>("dpor-deadends");
 
-void DPORExplore(std::shared_ptr<TraceNode> node, ThreadSet sleepset) {
+// Set during parallel exploration, which also needs to name nodes across
+// workers by the hash of their path from the root.
+static WorkQueue* work_queue = nullptr;
+static std::vector<uint64_t> path_hashes(1, 0);
+
+// Seed of the random choices of explorers, see --seed.
+static uint64_t seed = 0;
+
+// Where exhaustive DPOR would never finish, it can add the backtrack point of
+// each race only with this probability, sampling the reduced tree instead.
+// Whether a point is added is decided by a hash of the path to its node, its
+// thread and seed, rather than drawn from a generator, so that the same seed
+// makes the same choices however the search is resumed or split between
+// workers.
+static double backtrack_probability = 1;
+static int64_t& skipped_backtracks =
+    RegisterStatistic<int64_t>("skipped-backtracks");
+
+static bool SampleBacktrack(int time, int thread) {
+  if (backtrack_probability >= 1 || backtrack[time].count(thread)) {
+    return true;
+  }
+  uint64_t hash = ExtendPathHash(path_hashes[time] ^ seed, thread);
+  if (hash < backtrack_probability * 18446744073709551616.0) {
+    return true;
+  }
+  skipped_backtracks++;
+  return false;
+}
+
+// Work that is left for later: backtrack points saved when the budget runs
+// out, or loaded with --resume. A resumed search claims work like a parallel
+// worker does, in claimed, to skip items that turn up more than once.
+static Frontier frontier;
+static std::string save_frontier_file;
+static bool resuming = false;
+// With --resume-share=I/K, a resumed DPOR search only explores the items of
+// the frontier whose index is I modulo K, so that K processes, on as many
+// machines, can split a frontier between them. Every item still counts as
+// claimed, so none of them explores another's share.
+static int resume_share = 0;
+static int resume_shares = 1;
+static std::set<uint64_t> claimed;
+// The threads DPOR has explored from each node on the current path, which the
+// frontier keeps so a resumed search does not explore them again. CB-DPOR
+// keeps them too, for EstimateProgress.
+static std::vector<ThreadSet> explored;
+
+// An estimate of how much of the tree DPOR or CB-DPOR has explored, in the
+// manner of Knuth's estimator: the branches a node has in its backtrack set
+// are taken to lead to subtrees of equal size, so the explored siblings of
+// each node on the current path count for that share of its parent's. The
+// estimate goes down again when DPOR adds branches to a node, and only
+// covers the current preemption bound of CB-DPOR. estimated-runs divides the
+// runs of the search so far by it. Parallel and resumed searches, which only
+// see part of the tree, leave both alone.
+static double& estimated_progress =
+    RegisterStatistic<double>("estimated-progress");
+static int64_t& estimated_runs = RegisterStatistic<int64_t>("estimated-runs");
+static int64_t search_leaves = 0;
+
+static void StartEstimatingProgress() {
+  estimated_progress = 0;
+  search_leaves = 0;
+}
+
+// Called at each leaf, with the frames of its ancestors on the stacks.
+static void EstimateProgress() {
+  if (work_queue != nullptr || resuming) {
+    return;
+  }
+  search_leaves++;
+  double share = 1;
+  double progress = 0;
+  for (size_t time = 0; time < backtrack.size(); time++) {
+    share /= std::max(1, backtrack[time].size());
+    progress += share * (explored[time] & backtrack[time]).size();
+  }
+  estimated_progress = std::min(1.0, progress + share);
+  estimated_runs = search_leaves / estimated_progress;
+}
+
+// Answers status requests of --introspect with the bound being explored, the
+// depth of the stacks of the search and the path at their top, and the
+// statistics, which include its estimate of the work left.
+static std::string IntrospectionReport() {
+  std::stringstream ss;
+  ss << "bound: " << current_bound << "\n";
+  ss << "available: " << available.size() << "\n";
+  ss << "backtrack: " << backtrack.size() << "\n";
+  if (trace_builder != nullptr && trace_builder->current() != nullptr) {
+    ss << "path: " << trace_builder->current()->CalculatePath() << "\n";
+  }
+  if (estimated_progress > 0) {
+    ss << "runs-left: " << estimated_runs - search_leaves << "\n";
+  }
+  ss << "statistics: " << DumpStatistics();
+  return ss.str();
+}
+
+static void StopOnIntrospection() {
+  budget_exhausted = true;
+}
+
+static bool ClaimDPORWork(int depth, int thread) {
+  if (work_queue != nullptr) {
+    return work_queue->Claim(path_hashes[depth], thread);
+  }
+  return claimed.insert(ExtendPathHash(path_hashes[depth], thread)).second;
+}
+
+// Hands the extension of the node at the end of path with thread to another
+// worker, or keeps it in the frontier if there is none.
+static void QueueDPORWork(const int8_t* path, const ThreadSet* available,
+    int length, int thread, ThreadSet sleepset) {
+  if (work_queue != nullptr &&
+      work_queue->Push(path, available, length, thread, sleepset)) {
+    return;
+  }
+  FrontierItem item;
+  item.path.assign(path, path + length);
+  item.available.assign(available, available + length + 1);
+  item.explored.assign(explored.begin(), explored.begin() + length + 1);
+  if (!claimed.empty()) {
+    for (int time = 0; time <= length; time++) {
+      for (int other : item.available[time]) {
+        if (claimed.count(ExtendPathHash(path_hashes[time], other))) {
+          item.explored[time].insert(other);
+        }
+      }
+    }
+  }
+  item.thread = thread;
+  item.sleepset = sleepset;
+  frontier.items.push_back(item);
+}
+
+// The stack of PBPOR or CB-DPOR, saved frame by frame as the search unwinds
+// once out of budget, see SaveBoundedFrame, and the one loaded on resume,
+// restored along its path while restoring_bounded_stack is set.
+static FrontierItem bounded_stack;
+static FrontierItem resumed_stack;
+static bool restoring_bounded_stack = false;
+
+// Saves the frame at the top of the stacks of PBPOR or CB-DPOR, as it
+// unwinds out of budget: its backtrack set, the threads done from it, and
+// the one it was exploring, or -1. Frames save from the deepest up, and the
+// deepest one sets the length of the path.
+static void SaveBoundedFrame(ThreadSet done, int unfinished) {
+  if (save_frontier_file.empty() || !OutOfBudget()) {
+    return;
+  }
+  size_t depth = backtrack.size() - 1;
+  size_t length = depth + (unfinished >= 0);
+  if (bounded_stack.path.size() < length) {
+    bounded_stack.path.resize(length);
+    bounded_stack.available.resize(length + 1);
+    bounded_stack.explored.resize(length + 1);
+  }
+  bounded_stack.available[depth] = backtrack[depth];
+  bounded_stack.explored[depth] = done;
+  if (unfinished >= 0) {
+    bounded_stack.path[depth] = unfinished;
+  }
+}
+
+// Restores the frame at the top of the stacks from the loaded stack, while
+// the search is on its path: adds its saved backtrack set, and returns the
+// threads done from it and the thread to explore first, or -1.
+static int RestoreBoundedFrame(ThreadSet* done) {
+  size_t depth = backtrack.size() - 1;
+  if (!restoring_bounded_stack || depth >= resumed_stack.available.size()) {
+    restoring_bounded_stack = false;
+    return -1;
+  }
+  backtrack[depth] = backtrack[depth] | resumed_stack.available[depth];
+  *done = resumed_stack.explored[depth];
+  if (depth == resumed_stack.path.size()) {
+    restoring_bounded_stack = false;
+    return -1;
+  }
+  return resumed_stack.path[depth];
+}
+
+// Takes the stack to restore from the loaded frontier.
+static void LoadBoundedStack() {
+  if (resuming && !frontier.items.empty()) {
+    resumed_stack = frontier.items.front();
+    restoring_bounded_stack = true;
+    frontier.items.clear();
+  }
+}
+
+// Bounded explorers save the bound they stopped at, with what they had left
+// of it: the stack in bounded_stack, or the children CHESS and delay
+// bounding put in the frontier as they unwound.
+static void SaveBoundedFrontier(const char* explorer, int preemptions) {
+  if (OutOfBudget() && !save_frontier_file.empty()) {
+    frontier.explorer = explorer;
+    frontier.preemptions = preemptions;
+    if (!bounded_stack.available.empty()) {
+      frontier.items.assign(1, bounded_stack);
+    }
+    SaveFrontier(save_frontier_file, frontier);
+  }
+  bounded_stack = FrontierItem();
+}
+
+static std::vector<int8_t> PathTo(const TraceNode* node) {
+  std::vector<int8_t> path;
+  for (auto n = node; n->parent(); n = n->parent()) {
+    path.push_back(n->last_thread());
+  }
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
+// Puts the child of node that thread steps to in the frontier, with the
+// bound left after the step, or -1 for a preemption CHESS defers.
+static void SaveBoundedChild(const TraceNode* node, int thread,
+    int remaining) {
+  FrontierItem item;
+  item.path = PathTo(node);
+  item.thread = thread;
+  item.remaining = remaining;
+  frontier.items.push_back(item);
+}
+
+static PackedSchedule PackPath(const std::vector<int8_t>& path) {
+  PackedSchedule schedule;
+  for (int8_t thread : path) {
+    schedule.Append(thread);
+  }
+  return schedule;
+}
+
+// Stateful DPOR and CB-DPOR (--stateful) do not explore a state twice. A
+// state is told by the hash of its happens-before history, as chess --prune
+// tells them, which for CB-DPOR includes the last thread, as it decides what
+// counts as a preemption. Each completed node keeps a summary of the steps
+// taken in its subtree, with the sleepset and preemptions left it was
+// explored with; on reaching the same state again with at least those
+// threads asleep and at most those preemptions left, the subtree is not
+// explored but its steps are checked for races with the current path
+// instead, adding the backtrack points exploring it would have added. A step
+// is checked as if it ran next from here, so it races with at least what it
+// raced with in the subtree, and CAS and read-modify-writes count as writes,
+// as the values they would see are not those in memory now. Steps are kept
+// once per thread and accesses, so a summary is as big as the accesses of
+// its subtree rather than the subtree itself. Searches that only see part of
+// the tree, and symmetric and checkpointed ones, which do not see the steps
+// of a state as a whole, are left stateless.
+static bool stateful = false;
+static int64_t stateful_max_states = 1000000;
+
+typedef std::tuple<int, int, int8_t*, int64_t, int8_t*, int64_t> SummaryKey;
+
+struct StateSummary {
+  ThreadSet sleepset;
+  int remaining;
+  std::vector<std::pair<int, Transition>> steps;
+};
+
+struct SummaryFrame {
+  std::vector<std::pair<int, Transition>> steps;
+  std::set<SummaryKey> keys;
+};
+
+static std::unordered_map<Hash, StateSummary> visited_states;
+static std::vector<SummaryFrame> summary_frames;
+static int64_t& stateful_states = RegisterStatistic<int64_t>("stateful-states");
+static int64_t& stateful_pruned = RegisterStatistic<int64_t>("stateful-pruned");
+
+static bool IsStateful() {
+  return stateful && work_queue == nullptr && !resuming &&
+    !symmetry_reduction && checkpoint_interval == 0;
+}
+
+// The key that stateful search and chess --prune tell states apart by: the
+// happens-before hashes of the history, or with --state-key=memory what the
+// state holds, see Interceptor::StateHash, so that runs that reach the same
+// memory by steps that do not commute still meet. With_last adds the thread
+// that took the last step, for searches that count preemptions.
+static Hash StateKey(bool with_last) {
+  if (!hash_memory_state) {
+    return with_last ? history->CombineCurrentHashesWithLast() :
+        history->CombineCurrentHashes();
+  }
+  Hash key = interceptor->StateHash();
+  if (with_last && history->length() > 0) {
+    key ^= (history->thread_at(history->length() - 1) + 1) *
+        0x9e3779b97f4a7c15ULL;
+  }
+  return key;
+}
+
+static void AddToSummary(SummaryFrame* frame, int thread,
+    const Transition& transition) {
+  SummaryKey key(thread, static_cast<int>(transition.type()),
+      transition.address(), transition.range_length(), nullptr, 0);
+  if (!transition.is_simple()) {
+    AccessRange ranges[2] = {};
+    transition.AccessRanges(ranges);
+    key = SummaryKey(thread, static_cast<int>(transition.type()),
+        ranges[0].start, ranges[0].length, ranges[1].start, ranges[1].length);
+  }
+  if (frame->keys.insert(key).second) {
+    frame->steps.emplace_back(thread, transition);
+  }
+}
+
+// Adds the backtrack points of the summary of the state at the current node
+// and returns true if it has been explored with a subset of sleepset asleep
+// and at least remaining preemptions left. CB-DPOR backtracks all available
+// threads at a race.
+static bool PruneVisitedState(Hash state, ThreadSet sleepset, int remaining,
+    bool backtrack_available) {
+  auto it = visited_states.find(state);
+  if (it == visited_states.end() ||
+      !(it->second.sleepset - sleepset).empty() ||
+      it->second.remaining < remaining) {
+    return false;
+  }
+  for (const auto& step : it->second.steps) {
+    int thread = step.first;
+    conflicts.clear();
+    history->FindFirstConflicts(thread, step.second, &conflicts, true);
+    for (int time : conflicts) {
+      ProfileBacktrack(step.second);
+      if (backtrack_available) {
+        backtrack[time] = available[time];
+      } else if (available[time].count(thread)) {
+        backtrack[time].insert(thread);
+      } else {
+        backtrack[time] = backtrack[time] | available[time];
+      }
+    }
+    AddToSummary(&summary_frames.back(), thread, step.second);
+  }
+  stateful_pruned++;
+  return true;
+}
+
+// Keeps the summary of the node whose frame is on top, unless its subtree
+// was cut short, and adds its steps to those of its parent.
+static void FinishSummary(Hash state, ThreadSet sleepset, int remaining) {
+  SummaryFrame& frame = summary_frames.back();
+  if (!OutOfBudget() &&
+      static_cast<int64_t>(visited_states.size()) < stateful_max_states) {
+    StateSummary& summary = visited_states[state];
+    summary.sleepset = sleepset;
+    summary.remaining = remaining;
+    summary.steps = frame.steps;
+    stateful_states = visited_states.size();
+  }
+  if (summary_frames.size() > 1) {
+    SummaryFrame& parent = summary_frames[summary_frames.size() - 2];
+    for (const auto& step : frame.steps) {
+      AddToSummary(&parent, step.first, step.second);
+    }
+  }
+  summary_frames.pop_back();
+}
+
+// The shape of the trees the DPOR explorers walk: at each node they finish,
+// by its depth, how many threads were available, how many of those ended up
+// in the backtrack set, and how many runnable threads were asleep.
+static DepthHistogram& available_by_depth =
+    RegisterStatistic<DepthHistogram>("available-by-depth");
+static DepthHistogram& backtrack_by_depth =
+    RegisterStatistic<DepthHistogram>("backtrack-by-depth");
+static DepthHistogram& asleep_by_depth =
+    RegisterStatistic<DepthHistogram>("asleep-by-depth");
+
+// Records the node whose available and backtrack sets are the last ones.
+static void RecordNodeShape(const TraceNode* node) {
+  int depth = available.size() - 1;
+  available_by_depth.Add(depth, available.back().size());
+  backtrack_by_depth.Add(depth, backtrack.back().size());
+  asleep_by_depth.Add(depth,
+      node->runnable().size() - available.back().size());
+}
+
+void DPORExplore(const TraceNode* node, ThreadSet sleepset);
+
+void DPORExtend(const TraceNode* node, int thread,
+    ThreadSet sleepset) {
+  const Transition& transition = node->next_transitions()[thread];
+
+  trace_builder->MoveTo(node);
+  conflicts.clear();
+  history->FindFirstConflicts(thread, transition, &conflicts);
+  // Reads never conflict with reads, so traces differing only in their order
+  // are one already. Races between writes are reversed even when nothing reads
+  // either write, as HBHistory orders each write after the last one to its
+  // location, and that order can hide the races of later steps until it is
+  // reversed: skipping such races, or deferring them until a read observes
+  // the later write, misses reads-from functions. The reads-from explorer
+  // goes by a happens-before without those edges, see RunReadsFrom.
+  for (int time : conflicts) {
+    if (transition.DetermineRunnable(history->previous_value_at(time)) &&
+        SampleBacktrack(time, thread)) {
+      ProfileBacktrack(transition);
+      if (available[time].count(thread)) {
+        backtrack[time].insert(thread);
+      } else {
+        backtrack[time] = backtrack[time] | available[time];
+      }
+    }
+  }
+
+  ThreadSet new_sleepset = 
+    sleepset - node->FindConflicts(thread);
+
+  path_hashes.push_back(ExtendPathHash(path_hashes.back(), thread));
+  ExploreChild([&]() {
+    DPORExplore(trace_builder->Extend(thread), new_sleepset);
+  });
+  path_hashes.pop_back();
+}
+
+// Hands all but the first thread of todo to idle workers. Donated threads
+// count as explored here, in the order they would have been explored.
+static void DonateDPORWork(const TraceNode* node, int depth,
+    ThreadSet todo, ThreadSet& sleepset, ThreadSet& done) {
+  std::vector<int8_t> path = PathTo(node);
+
+  for (auto it = todo.upper_bound(*todo.begin()); it != todo.end(); ++it) {
+    int thread = *it;
+    if (!work_queue->Claim(path_hashes[depth], thread)) {
+      // Someone else is exploring it already.
+    } else if (!work_queue->Push(path.data(), available.data(), path.size(),
+          thread, sleepset)) {
+      // The queue is full; we claimed the thread, so explore it ourselves.
+      DPORExtend(node, thread, sleepset);
+    }
+    sleepset.insert(thread);
+    done.insert(thread);
+  }
+}
+
+void DPORExplore(const TraceNode* node, ThreadSet sleepset) {
   if (node->is_leaf()) {
     dpor_leaves++;
+    EstimateProgress();
     return;
   }
 
+  Hash state = 0;
+  if (IsStateful()) {
+    trace_builder->MoveTo(node);
+    state = StateKey(false);
+    if (PruneVisitedState(state, sleepset, 0, false)) {
+      EstimateProgress();
+      return;
+    }
+  }
+
   available.push_back(node->runnable() - sleepset);
   if (available.back().empty()) {
     available.pop_back();
     dpor_deadends++;
+    EstimateProgress();
     return;
   }
 
@@ -57,49 +656,484 @@ void DPORExplore(std::shared_ptr<TraceNode> node, ThreadSet sleepset) {
   } else {
     backtrack.back().insert(*available.back().begin());
   }
+  explored.push_back(ThreadSet());
+  ThreadSet explored_sleepset = sleepset;
+  if (IsStateful()) {
+    summary_frames.emplace_back();
+  }
+
+  int depth = history->length();
 
   ThreadSet done;
-  while (true) {
+  while (!OutOfBudget()) {
     ThreadSet todo = backtrack.back() - done;
     if (todo.empty()) {
       break;
     }
+    explored[depth] = done;
 
     int thread = *todo.begin();
-    Transition transition = node->next_transitions()[thread];
 
-    trace_builder->MoveTo(node);
-    for (int time : history->FindFirstConflicts(thread, transition)) {
-      if (transition.DetermineRunnable(history->previous_value_at(time))) {
-        if (available[time].count(thread)) {
-          backtrack[time].insert(thread);
-        } else {
-          backtrack[time] = backtrack[time] | available[time];
-        }
+    if (work_queue != nullptr || resuming) {
+      if (work_queue != nullptr && todo.size() > 1 &&
+          work_queue->has_idle_workers()) {
+        DonateDPORWork(node, depth, todo, sleepset, done);
+      }
+      if (!ClaimDPORWork(depth, thread)) {
+        sleepset.insert(thread);
+        done.insert(thread);
+        continue;
       }
     }
 
-    ThreadSet new_sleepset = 
-      sleepset - FindConflicts(node->next_transitions(), transition);
-
-    DPORExplore(trace_builder->Extend(thread), new_sleepset);
+    if (IsStateful()) {
+      AddToSummary(&summary_frames.back(), thread,
+          node->next_transitions()[thread]);
+    }
+    DPORExtend(node, thread, sleepset);
     sleepset.insert(thread);
     done.insert(thread);
   }
 
+  if (OutOfBudget()) {
+    // Save what is left in the order it would have been explored in.
+    std::vector<int8_t> path = PathTo(node);
+    for (int thread : backtrack.back() - done) {
+      QueueDPORWork(path.data(), available.data(), path.size(), thread,
+          sleepset);
+      sleepset.insert(thread);
+    }
+  }
+
+  if (IsStateful()) {
+    FinishSummary(state, explored_sleepset, 0);
+  }
+  RecordNodeShape(node);
   available.pop_back();
   backtrack.pop_back();
+  explored.pop_back();
+}
+
+static void ExploreDPORWorkItem(const WorkItem& item);
+
+// Explores the items of the frontier until it is empty or the budget runs out.
+static void ExploreDPORFrontier() {
+  WorkItem* item = new WorkItem();
+  while (!frontier.items.empty() && !OutOfBudget()) {
+    const FrontierItem& next = frontier.items.front();
+    item->length = next.path.size();
+    item->thread = next.thread;
+    item->sleepset = next.sleepset;
+    std::copy(next.path.begin(), next.path.end(), item->path);
+    std::copy(next.available.begin(), next.available.end(), item->available);
+    frontier.items.pop_front();
+
+    ExploreDPORWorkItem(*item);
+  }
+  delete item;
 }
 
 void RunDPOR() {
   trace_builder = new TraceBuilder(interceptor, history);
-  DPORExplore(trace_builder->root(), ThreadSet());
+  if (resuming) {
+    // Everything that is either queued or explored counts as claimed.
+    for (const FrontierItem& item : frontier.items) {
+      uint64_t hash = 0;
+      for (int time = 0; time <= static_cast<int>(item.path.size()); time++) {
+        for (int thread : item.explored[time]) {
+          claimed.insert(ExtendPathHash(hash, thread));
+        }
+        if (time < static_cast<int>(item.path.size())) {
+          hash = ExtendPathHash(hash, item.path[time]);
+        }
+      }
+      claimed.insert(ExtendPathHash(hash, item.thread));
+    }
+    if (resume_shares > 1) {
+      std::deque<FrontierItem> share;
+      for (size_t i = resume_share; i < frontier.items.size();
+          i += resume_shares) {
+        share.push_back(frontier.items[i]);
+      }
+      frontier.items.swap(share);
+    }
+    ExploreDPORFrontier();
+  } else {
+    StartEstimatingProgress();
+    DPORExplore(trace_builder->root(), ThreadSet());
+  }
+  DumpStatisticsToStderr();
+
+  if (OutOfBudget() && !save_frontier_file.empty()) {
+    frontier.explorer = "dpor";
+    SaveFrontier(save_frontier_file, frontier);
+  }
+}
+
+int64_t& parallel_items = RegisterStatistic<int64_t>("parallel-items");
+int64_t& parallel_requeued = RegisterStatistic<int64_t>("parallel-requeued");
+
+// Replays the prefix of item and explores it. Backtrack points that DPOR
+// finds inside the prefix belong to other workers, so they are put back on the
+// queue, or in the frontier, instead of being explored here.
+static void ExploreDPORWorkItem(const WorkItem& item) {
+  parallel_items++;
+
+  auto node = trace_builder->root();
+  trace_builder->MoveTo(node);
+
+  // The frames of the prefix are frozen: they only collect backtrack points.
+  // A donated item also freezes the frame of its last node.
+  int frozen = item.length + (item.thread != -1);
+  auto thread_at = [&](int time) {
+    return time < item.length ? item.path[time] : item.thread;
+  };
+
+  std::vector<ThreadSet> runnable;
+  available.clear();
+  backtrack.clear();
+  explored.clear();
+  path_hashes.resize(1);
+  for (int time = 0; time < frozen; time++) {
+    runnable.push_back(node->runnable());
+    available.push_back(item.available[time]);
+    backtrack.push_back(ThreadSet::Singleton(thread_at(time)));
+    explored.push_back(ThreadSet());
+    if (time < item.length) {
+      path_hashes.push_back(ExtendPathHash(path_hashes.back(), thread_at(time)));
+      node = trace_builder->Extend(thread_at(time));
+    }
+  }
+
+  if (item.thread == -1) {
+    DPORExplore(node, item.sleepset);
+  } else {
+    DPORExtend(node, item.thread, item.sleepset);
+  }
+
+  for (int time = 0; time < frozen; time++) {
+    ThreadSet extra = backtrack[time] - ThreadSet::Singleton(thread_at(time));
+    // The sleep set the owner entered this node with is still safe to use.
+    // Without concurrent workers, so are the siblings claimed so far, as each
+    // of them was claimed, and got its sleep set, before this one.
+    ThreadSet sleepset = runnable[time] - available[time];
+    if (work_queue == nullptr) {
+      sleepset.insert(thread_at(time));
+      for (int other : available[time]) {
+        if (claimed.count(ExtendPathHash(path_hashes[time], other))) {
+          sleepset.insert(other);
+        }
+      }
+    }
+    for (int thread : extra) {
+      if (ClaimDPORWork(time, thread)) {
+        QueueDPORWork(item.path, item.available, time, thread,
+            sleepset - ThreadSet::Singleton(thread));
+        parallel_requeued++;
+      }
+      if (work_queue == nullptr) {
+        sleepset.insert(thread);
+      }
+    }
+  }
+}
+
+static void ParallelDPORWorker(int id) {
+  DetachStatistics();
+  trace_builder = new TraceBuilder(interceptor, history);
+
+  WorkItem* item = new WorkItem();
+  while (work_queue->Pop(item)) {
+    // Out of budget, a worker still drains the queue so that the others can
+    // tell when the search is over.
+    if (!OutOfBudget()) {
+      ExploreDPORWorkItem(*item);
+      // Work that did not fit in the queue.
+      ExploreDPORFrontier();
+    }
+  }
+  delete item;
+
+  fprintf(stderr, "worker %d: ", id);
+  DumpStatisticsToStderr();
+}
+
+void RunParallelDPOR(int num_workers) {
+  work_queue = WorkQueue::Create(num_workers);
+  Interceptor::ShareDistinct();
+  ThreadSet root_available;
+  work_queue->Push(nullptr, &root_available, 0, -1, ThreadSet());
+  RunWorkers(num_workers, &ParallelDPORWorker);
+}
+
+int64_t& odpor_leaves = RegisterStatistic<int64_t>("odpor-leaves");
+int64_t& odpor_deadends = RegisterStatistic<int64_t>("odpor-deadends");
+
+// Optimal DPOR keeps, for every node on the current path, the node, its sleep
+// set and its wakeup tree. The trees live in a deque, which keeps them in
+// place while deeper nodes are pushed.
+static std::vector<const TraceNode*> odpor_nodes;
+static std::vector<ThreadSet> odpor_sleepsets;
+static std::deque<WakeupTree> wakeup_trees;
+// The races along the current path, as pairs of the times of their events.
+static std::vector<std::pair<int, int>> odpor_races;
+// With the reads-from explorer, the reads-from history that each maximal run
+// is copied to, whose happens-before and races it reverses instead.
+static HBHistory* reads_from_history = nullptr;
+
+// Records the races of transition, the next step of thread, with the events
+// of the history that it conflicts with directly, not through another event.
+static void ODPORNoteRaces(int thread, const Transition& transition) {
+  int depth = history->length();
+  conflicts.clear();
+  history->FindFirstConflicts(thread, transition, &conflicts);
+  for (int time : conflicts) {
+    if (!transition.DetermineRunnable(history->previous_value_at(time))) {
+      continue;
+    }
+    bool direct = true;
+    for (int other : conflicts) {
+      if (other != time && history->time_happens_before_time(time, other)) {
+        direct = false;
+        break;
+      }
+    }
+    if (direct) {
+      odpor_races.push_back(std::make_pair(time, depth));
+    }
+  }
+}
+
+// Reverses the races of the maximal run in the history: for a race of events
+// e and e', the events after e that do not happen after it, followed by e', go
+// into the wakeup tree of the node before e, unless a thread that can start
+// them there is asleep.
+static void ODPORReverseRaces() {
+  const HBHistory* hb = history;
+  if (reads_from_history != nullptr) {
+    // The races follow from the whole run, as which stores are observed
+    // does.
+    reads_from_history->CopySteps(*history);
+    reads_from_history->CatchUp();
+    hb = reads_from_history;
+    for (const std::pair<int, int>& race : reads_from_history->races()) {
+      if (history->transition_at(race.second).DetermineRunnable(
+            history->previous_value_at(race.first))) {
+        odpor_races.push_back(race);
+      }
+    }
+  }
+  std::vector<WakeupEvent> v;
+  for (const std::pair<int, int>& race : odpor_races) {
+    int time = race.first;
+    v.clear();
+    for (int later = time + 1; later < history->length(); later++) {
+      if (!hb->time_happens_before_time(time, later)) {
+        v.push_back(WakeupEvent{history->thread_at(later),
+            history->transition_at(later)});
+      }
+    }
+    v.push_back(WakeupEvent{history->thread_at(race.second),
+        history->transition_at(race.second)});
+
+    const TraceNode* before = odpor_nodes[time];
+    ThreadSet initials = WakeupTree::WeakInitials(v, before->runnable(),
+        before->next_transitions());
+    if ((initials & odpor_sleepsets[time]).empty()) {
+      ProfileBacktrack(v.back().transition);
+      wakeup_trees[time].Insert(v);
+    }
+  }
+  if (reads_from_history != nullptr) {
+    odpor_races.clear();
+  }
+}
+
+// Explores the sequences of wakeup from node, and a single arbitrary one if
+// it is empty.
+void ODPORExplore(const TraceNode* node, ThreadSet sleepset,
+    WakeupTree wakeup) {
+  if (node->is_leaf()) {
+    odpor_leaves++;
+    ODPORReverseRaces();
+    return;
+  }
+
+  if (wakeup.empty()) {
+    ThreadSet available = node->runnable() - sleepset;
+    if (available.empty()) {
+      // Blocked threads: the run is maximal all the same.
+      odpor_deadends++;
+      ODPORReverseRaces();
+      return;
+    }
+    int thread = node->parent() && available.count(node->last_thread()) ?
+        node->last_thread() : *available.begin();
+    wakeup.Start(WakeupEvent{thread, node->next_transitions()[thread]});
+  }
+
+  int depth = history->length();
+  odpor_nodes.push_back(node);
+  odpor_sleepsets.push_back(sleepset);
+  wakeup_trees.push_back(std::move(wakeup));
+
+  while (!wakeup_trees[depth].empty() && !OutOfBudget()) {
+    int thread = wakeup_trees[depth].first_thread();
+    WakeupTree subtree = wakeup_trees[depth].TakeFirst();
+    // Sequences are built from steps that could be taken, so this only
+    // skips steps that a required result turned out to block.
+    if (!node->runnable().count(thread) ||
+        odpor_sleepsets[depth].count(thread)) {
+      continue;
+    }
+
+    const Transition& transition = node->next_transitions()[thread];
+    trace_builder->MoveTo(node);
+    int races = odpor_races.size();
+    if (reads_from_history == nullptr) {
+      ODPORNoteRaces(thread, transition);
+    }
+
+    ThreadSet new_sleepset = odpor_sleepsets[depth] -
+        node->FindConflicts(thread);
+    ODPORExplore(trace_builder->Extend(thread), new_sleepset,
+        std::move(subtree));
+    odpor_races.resize(races);
+    odpor_sleepsets[depth].insert(thread);
+  }
+
+  odpor_nodes.pop_back();
+  odpor_sleepsets.pop_back();
+  wakeup_trees.pop_back();
+}
+
+void RunODPOR() {
+  trace_builder = new TraceBuilder(interceptor, history);
+  ODPORExplore(trace_builder->root(), ThreadSet(), WakeupTree());
   DumpStatisticsToStderr();
 }
 
+// Optimal DPOR over reads-from equivalence: runs that only differ in the
+// order of stores no step observes are one trace, as in Aronis et al.,
+// "Optimal Dynamic Partial Order Reduction with Observers", TACAS 2018. The
+// races of each maximal run are those of its reads-from history, see
+// HBHistory::set_reads_from. Sleep sets and wakeup trees still go by
+// conflicting transitions, which keeps more threads awake and more
+// sequences apart than needed, but misses none.
+void RunReadsFrom() {
+  reads_from_history = new HBHistory();
+  reads_from_history->set_reads_from(true);
+  RunODPOR();
+}
+
 int64_t& bpor_leaves = RegisterStatistic<int64_t>("bpor-leaves");
 int64_t& bpor_deadends = RegisterStatistic<int64_t>("bpor-deadends");
 
+// The races of the steps that bounded explorers took so far: the earlier
+// times whose steps conflict with the step and would let it run where they
+// ran, keyed by the hash of the path to the step. Each bound explores the
+// nodes of the bounds before it again, and the races of a step are the same
+// every time, so they are only searched for once. Nodes do not outlive their
+// frame of the TraceBuilder, so they are kept here rather than in them.
+//
+// The table is open-addressed, with kRaceCacheSlots slots that point into
+// one array of the times of all of them, and both are allocated in full on
+// the first insert. The last bound adds none, and the table stops growing
+// once half its slots or all of its times are taken.
+struct RaceCacheSlot {
+  uint64_t key; // 0 for an empty slot
+  uint32_t start;
+  uint32_t count;
+};
+static const size_t kRaceCacheSlots = 1 << 16;
+static const size_t kRaceCacheTimes = 1 << 20;
+static std::vector<RaceCacheSlot> race_cache;
+static std::vector<int> race_cache_times;
+static size_t race_cache_size = 0;
+static int64_t& race_cache_hits =
+    RegisterStatistic<int64_t>("race-cache-hits");
+
+static size_t RaceCacheBytes() {
+  return race_cache.capacity() * sizeof(RaceCacheSlot) +
+      race_cache_times.capacity() * sizeof(int);
+}
+
+static size_t ClearRaceCache() {
+  size_t freed = RaceCacheBytes();
+  std::vector<RaceCacheSlot>().swap(race_cache);
+  std::vector<int>().swap(race_cache_times);
+  race_cache_size = 0;
+  return freed;
+}
+
+static const bool race_cache_governed = RegisterMemoryConsumer(
+    "race-cache", kCacheRank, RaceCacheBytes, ClearRaceCache);
+
+// The slot of key, or the empty slot where it would go, or nullptr if the
+// table is not allocated.
+static RaceCacheSlot* FindRaceCacheSlot(uint64_t key) {
+  if (race_cache.empty()) {
+    return nullptr;
+  }
+  size_t slot = key & (kRaceCacheSlots - 1);
+  while (race_cache[slot].key != 0 && race_cache[slot].key != key) {
+    slot = (slot + 1) & (kRaceCacheSlots - 1);
+  }
+  return &race_cache[slot];
+}
+
+static void CacheRaces(uint64_t key, const std::vector<int>& races) {
+  if (race_cache.empty()) {
+    race_cache.resize(kRaceCacheSlots);
+    race_cache_times.reserve(kRaceCacheTimes);
+  }
+  if (2 * (race_cache_size + 1) > kRaceCacheSlots ||
+      race_cache_times.size() + races.size() > kRaceCacheTimes) {
+    return;
+  }
+  RaceCacheSlot* slot = FindRaceCacheSlot(key);
+  if (slot->key == 0) {
+    race_cache_size++;
+  }
+  slot->key = key;
+  slot->start = race_cache_times.size();
+  slot->count = races.size();
+  race_cache_times.insert(race_cache_times.end(), races.begin(), races.end());
+}
+
+// The races of the step of thread at node, which the history has to be at.
+// Consumed before exploring further. Profiles and coverage count what
+// FindFirstConflicts finds, so they always search.
+static const std::vector<int>& FindRaces(const TraceNode* node, int thread,
+    const Transition& transition) {
+  static std::vector<int> races;
+  bool cached = location_profile == nullptr && address_profile == nullptr &&
+      conflict_coverage == nullptr;
+  // Zero marks an empty slot.
+  uint64_t key = ExtendPathHash(node->path_hash(), thread) | 1;
+  if (cached) {
+    const RaceCacheSlot* slot = FindRaceCacheSlot(key);
+    if (slot != nullptr && slot->key != 0) {
+      race_cache_hits++;
+      races.assign(race_cache_times.begin() + slot->start,
+          race_cache_times.begin() + slot->start + slot->count);
+      return races;
+    }
+  }
+  conflicts.clear();
+  history->FindFirstConflicts(thread, transition, &conflicts);
+  races.clear();
+  for (int time : conflicts) {
+    if (transition.DetermineRunnable(history->previous_value_at(time))) {
+      races.push_back(time);
+    }
+  }
+  if (cached && (max_preemptions < 0 || current_bound < max_preemptions)) {
+    CacheRaces(key, races);
+  }
+  return races;
+}
+
 void PBPORBacktrack(int time, int thread) {
   if (available[time].count(thread)) {
     backtrack[time].insert(thread);
@@ -108,8 +1142,13 @@ void PBPORBacktrack(int time, int thread) {
   }
 }
 
+static bool IsPreemption(const TraceNode* node, int thread) {
+  return node->parent() && thread != node->last_thread() &&
+      node->runnable().count(node->last_thread());
+}
+
 void PBPORExplore(
-    std::shared_ptr<TraceNode> node, ThreadSet sleepset, int remaining) {
+    const TraceNode* node, ThreadSet sleepset, int remaining) {
   if (node->is_leaf()) {
     bpor_leaves++;
     return;
@@ -130,32 +1169,39 @@ void PBPORExplore(
   }
 
   ThreadSet done;
-  while (true) {
+  int first = RestoreBoundedFrame(&done);
+  // The preemptions among the threads done go to sleep, as they did.
+  for (int thread : done) {
+    if (remaining && IsPreemption(node, thread)) {
+      sleepset.insert(thread);
+    }
+  }
+  int unfinished = -1;
+  while (!OutOfBudget()) {
     ThreadSet todo = backtrack.back() - done;
     if (todo.empty()) {
       break;
     }
 
-    int thread = *todo.begin();
-    Transition transition = node->next_transitions()[thread];
+    int thread = first >= 0 ? first : *todo.begin();
+    first = -1;
+    const Transition& transition = node->next_transitions()[thread];
 
-    bool is_a_preemption = node->parent() && thread != node->last_thread() &&
-      node->runnable().count(node->last_thread());
+    bool is_a_preemption = IsPreemption(node, thread);
     if (is_a_preemption && !remaining) {
       done.insert(thread);
       continue;
     }
 
     trace_builder->MoveTo(node);
-    for (int time : history->FindFirstConflicts(thread, transition)) {
-      if (transition.DetermineRunnable(history->previous_value_at(time))) {
-        PBPORBacktrack(time, thread);
-        PBPORBacktrack(begins[time], thread);
-      }
+    for (int time : FindRaces(node, thread, transition)) {
+      ProfileBacktrack(transition);
+      PBPORBacktrack(time, thread);
+      PBPORBacktrack(begins[time], thread);
     }
 
     ThreadSet new_sleepset = 
-      sleepset - FindConflicts(node->next_transitions(), transition);
+      sleepset - node->FindConflicts(thread);
 
     if (!node->parent() || node->last_thread() != thread) {
       begins.push_back(history->length());
@@ -163,10 +1209,18 @@ void PBPORExplore(
       begins.push_back(begins.back());
     }
 
-    PBPORExplore(trace_builder->Extend(thread), new_sleepset,
-        remaining - is_a_preemption);
+    ExploreChild([&]() {
+      PBPORExplore(trace_builder->Extend(thread), new_sleepset,
+          remaining - is_a_preemption);
+    });
+    // The restored stack ends at the first leaf.
+    restoring_bounded_stack = false;
 
     begins.pop_back();
+    if (OutOfBudget()) {
+      unfinished = thread;
+      break;
+    }
 
     if (is_a_preemption) {
       sleepset.insert(thread);
@@ -174,69 +1228,223 @@ void PBPORExplore(
     done.insert(thread);
   }
 
+  SaveBoundedFrame(done, unfinished);
+  RecordNodeShape(node);
   available.pop_back();
   backtrack.pop_back();
 }
 
 void RunPBPOR() {
   trace_builder = new TraceBuilder(interceptor, history);
-  for (int preemptions = 0;; preemptions++) {
+  int preemptions = min_preemptions;
+  if (resuming) {
+    preemptions = std::max(preemptions, frontier.preemptions);
+  }
+  LoadBoundedStack();
+  for (; InPreemptionRange(preemptions); preemptions++) {
     PBPORExplore(trace_builder->root(), ThreadSet(), preemptions);
     DumpStatisticsToStderr();
+    if (OutOfBudget()) {
+      break;
+    }
   }
+  SaveBoundedFrontier("pbpor", preemptions);
 }
 
 
-int64_t& cbdpor_leaves = RegisterStatistic<int64_t>("cbdpor-leaves");
-int64_t& cbdpor_deadends = RegisterStatistic<int64_t>("cbdpor-deadends");
+// With delay-dpor, CB-DPOR bounds delays instead of preemptions: the
+// baseline schedule runs the last thread for as long as it can, and then the
+// next runnable thread after it, round-robin, and each runnable thread that a
+// step skips in that order is a delay. Tests written for a deterministic
+// scheduler usually need far fewer delays than preemptions to go wrong.
+static bool bound_delays = false;
 
-void CBDPORExplore(
-    std::shared_ptr<TraceNode> node, ThreadSet sleepset, int remaining) {
-  if (node->is_leaf()) {
-    cbdpor_leaves++;
-    return;
+// The delays of extending node with thread.
+static int Delays(const TraceNode* node, int thread) {
+  int first = node->parent() ? node->last_thread() : 0;
+  int delays = 0;
+  for (int i = 0; i < kMaxThreads; i++) {
+    int other = (first + i) % kMaxThreads;
+    if (other == thread) {
+      break;
+    }
+    delays += node->runnable().count(other);
   }
+  return delays;
+}
 
-  available.push_back(node->runnable() - sleepset);
-  if (available.back().empty()) {
-    available.pop_back();
-    cbdpor_deadends++;
+// With source-bpor, CB-DPOR backtracks as bounded POR does: a race adds a
+// single thread that can start its reversal, rather than every thread
+// available before it, along with the step at the start of the racing block,
+// whose preemption may be the one that fits the bound. Past a switch that is
+// no preemption, one thread is explored rather than all of them. Coverage is
+// the same as CB-DPOR's at every bound, from far fewer runs once the bound
+// is 2 or more.
+static bool source_backtracking = false;
+
+// The weak initials of the events after time that do not happen after it,
+// followed by the next step of thread, which conflicts with the event at time
+// at the steps of conflicts: the threads whose first such event happens after
+// no other, and thread if none of them happens before its step. As happening
+// before is transitive and the program order part of it, only the first
+// event of each thread needs comparing.
+static ThreadSet SourceInitials(int time, int thread,
+    const std::vector<int>& conflicts) {
+  int first[kMaxThreads];
+  std::fill(first, first + kMaxThreads, -1);
+  for (int later = time + 1; later < history->length(); later++) {
+    int other = history->thread_at(later);
+    if (first[other] < 0 && !history->time_happens_before_time(time, later)) {
+      first[other] = later;
+    }
+  }
+  // The step of thread also happens after the events it conflicts with.
+  bool follows_conflict = false;
+  for (int conflict : conflicts) {
+    if (conflict > time &&
+        !history->time_happens_before_time(time, conflict)) {
+      follows_conflict = true;
+    }
+  }
+
+  ThreadSet initials;
+  for (int other = 0; other < kMaxThreads; other++) {
+    bool initial = first[other] >= 0 ||
+        (other == thread && !follows_conflict);
+    for (int before = 0; before < kMaxThreads && initial; before++) {
+      if (before == other || first[before] < 0) {
+        continue;
+      }
+      if (first[other] >= 0) {
+        initial = first[before] > first[other] ||
+            !history->time_happens_before_time(first[before], first[other]);
+      } else {
+        initial = !history->time_happens_before_thread(first[before], other);
+      }
+    }
+    if (initial) {
+      initials.insert(other);
+    }
+  }
+  return initials;
+}
+
+// Adds to the backtrack set before time a thread that can start the reversal
+// of its race with the next step of thread, unless one is there already.
+static void SourceBacktrack(int time, int thread) {
+  ThreadSet initials = SourceInitials(time, thread, conflicts);
+  if (!(initials & backtrack[time]).empty()) {
+    return;
+  }
+  ThreadSet candidates = initials & available[time];
+  if (candidates.count(thread)) {
+    backtrack[time].insert(thread);
+  } else if (!candidates.empty()) {
+    backtrack[time].insert(*candidates.begin());
+  } else {
+    backtrack[time] = backtrack[time] | available[time];
+  }
+}
+
+int64_t& cbdpor_leaves = RegisterStatistic<int64_t>("cbdpor-leaves");
+int64_t& cbdpor_deadends = RegisterStatistic<int64_t>("cbdpor-deadends");
+
+// The delays or preemptions of extending node with thread.
+static int CBDPORCost(const TraceNode* node, int thread) {
+  return bound_delays ? Delays(node, thread) : IsPreemption(node, thread);
+}
+
+void CBDPORExplore(
+    const TraceNode* node, ThreadSet sleepset, int remaining) {
+  if (node->is_leaf()) {
+    cbdpor_leaves++;
+    EstimateProgress();
+    return;
+  }
+
+  Hash state = 0;
+  if (IsStateful()) {
+    trace_builder->MoveTo(node);
+    state = StateKey(true);
+    if (PruneVisitedState(state, sleepset, remaining, true)) {
+      EstimateProgress();
+      return;
+    }
+  }
+
+  available.push_back(node->runnable() - sleepset);
+  if (available.back().empty()) {
+    available.pop_back();
+    cbdpor_deadends++;
+    EstimateProgress();
     return;
   }
 
   backtrack.push_back(ThreadSet());
   if (node->parent() && available.back().count(node->last_thread())) {
     backtrack.back().insert(node->last_thread());
+  } else if (source_backtracking) {
+    backtrack.back().insert(*available.back().begin());
   } else {
     backtrack.back() = available.back();
   }
+  explored.push_back(ThreadSet());
+  ThreadSet explored_sleepset = sleepset;
+  if (IsStateful()) {
+    summary_frames.emplace_back();
+  }
 
   ThreadSet done;
-  while (true) {
+  int first = RestoreBoundedFrame(&done);
+  // The threads done within the bound were explored as they were then.
+  for (int thread : done) {
+    int cost = CBDPORCost(node, thread);
+    if (cost > remaining) {
+      continue;
+    }
+    if (IsStateful()) {
+      AddToSummary(&summary_frames.back(), thread,
+          node->next_transitions()[thread]);
+    }
+    if (cost > 0) {
+      sleepset.insert(thread);
+    }
+  }
+  int unfinished = -1;
+  while (!OutOfBudget()) {
     ThreadSet todo = backtrack.back() - done;
     if (todo.empty()) {
       break;
     }
+    explored.back() = done;
 
-    int thread = *todo.begin();
-    Transition transition = node->next_transitions()[thread];
+    int thread = first >= 0 ? first : *todo.begin();
+    first = -1;
+    const Transition& transition = node->next_transitions()[thread];
 
-    bool is_a_preemption = node->parent() && thread != node->last_thread() &&
-      node->runnable().count(node->last_thread());
-    if (is_a_preemption && !remaining) {
+    int cost = CBDPORCost(node, thread);
+    if (cost > remaining) {
       done.insert(thread);
       continue;
     }
 
+    if (IsStateful()) {
+      AddToSummary(&summary_frames.back(), thread, transition);
+    }
+
     trace_builder->MoveTo(node);
-    for (int time : history->FindFirstConflicts(thread, transition)) {
-      if (transition.DetermineRunnable(history->previous_value_at(time))) {
+    for (int time : FindRaces(node, thread, transition)) {
+      ProfileBacktrack(transition);
+      if (source_backtracking) {
+        SourceBacktrack(time, thread);
+        PBPORBacktrack(begins[time], thread);
+      } else {
         backtrack[time] = available[time];
       }
     }
 
     ThreadSet new_sleepset = 
-      sleepset - FindConflicts(node->next_transitions(), transition);
+      sleepset - node->FindConflicts(thread);
 
     if (!node->parent() || node->last_thread() != thread) {
       begins.push_back(history->length());
@@ -244,36 +1452,73 @@ void CBDPORExplore(
       begins.push_back(begins.back());
     }
 
-    CBDPORExplore(trace_builder->Extend(thread), new_sleepset,
-        remaining - is_a_preemption);
+    ExploreChild([&]() {
+      CBDPORExplore(trace_builder->Extend(thread), new_sleepset,
+          remaining - cost);
+    });
+    restoring_bounded_stack = false;
 
     begins.pop_back();
+    if (OutOfBudget()) {
+      unfinished = thread;
+      break;
+    }
 
-    if (is_a_preemption) {
+    if (cost > 0) {
       sleepset.insert(thread);
     }
     done.insert(thread);
   }
 
+  SaveBoundedFrame(done, unfinished);
+  if (IsStateful()) {
+    FinishSummary(state, explored_sleepset, remaining);
+  }
+  RecordNodeShape(node);
   available.pop_back();
   backtrack.pop_back();
+  explored.pop_back();
 }
 
 void RunCBDPOR() {
   trace_builder = new TraceBuilder(interceptor, history);
-  for (int preemptions = 0;; preemptions++) {
+  int preemptions = min_preemptions;
+  if (resuming) {
+    preemptions = std::max(preemptions, frontier.preemptions);
+  }
+  LoadBoundedStack();
+  for (; InPreemptionRange(preemptions); preemptions++) {
+    StartEstimatingProgress();
     CBDPORExplore(trace_builder->root(), ThreadSet(), preemptions);
     DumpStatisticsToStderr();
+    if (OutOfBudget()) {
+      break;
+    }
   }
+  SaveBoundedFrontier(bound_delays ? "delay-dpor" :
+      source_backtracking ? "source-bpor" : "cbdpor", preemptions);
+}
+
+void RunDelayDPOR() {
+  bound_delays = true;
+  RunCBDPOR();
 }
 
-void BruteForceExplore(std::shared_ptr<TraceNode> node) {
+void RunSourceBPOR() {
+  source_backtracking = true;
+  RunCBDPOR();
+}
+
+void BruteForceExplore(const TraceNode* node) {
   if (node->is_leaf()) {
     trace_builder->MoveTo(node);
     return;
   }
 
   for (int thread : node->runnable()) {
+    if (OutOfBudget()) {
+      return;
+    }
     trace_builder->MoveTo(node);
     BruteForceExplore(trace_builder->Extend(thread));
   }
@@ -285,136 +1530,964 @@ void RunBruteForce() {
   DumpStatisticsToStderr();
 }
 
-static std::map<Hash, int> seen;
+static FingerprintTable* seen;
+static size_t seen_table_bytes = 64 << 20;
+
+static size_t PruneTableBytes() {
+  return seen != nullptr ? seen->bytes() : 0;
+}
+
+static size_t ShedPruneTable() {
+  return seen != nullptr ? seen->Clear() : 0;
+}
+
+static const bool prune_table_governed = RegisterMemoryConsumer(
+    "prune-table", kPruningRank, PruneTableBytes, ShedPruneTable);
 static bool prune_using_hash_table = false;
-static bool only_preempt_on_atomic = false;
 
-void CHESSExplore(std::shared_ptr<TraceNode> node, int remaining) {
+// The preemptions CHESS pruned for exceeding the bound, as the path to the
+// node followed by the thread that would have preempted there. Every trace
+// with one more preemption takes exactly one of them as its first preemption
+// beyond the bound, so the next bound only explores below these instead of
+// starting over from the root.
+static std::vector<PackedSchedule> chess_deferred;
+static int64_t& chess_deferred_preemptions =
+    RegisterStatistic<int64_t>("chess-deferred-preemptions");
+
+// Moves to the node at the end of path, replaying only the part that differs
+// from the current path.
+static const TraceNode* ReplayPath(const int8_t* path, int length) {
+  const TraceNode* node = trace_builder->current();
+  std::vector<int8_t> current = PathTo(node);
+  int common = 0;
+  while (common < length && common < static_cast<int>(current.size()) &&
+      current[common] == path[common]) {
+    common++;
+  }
+  while (node->depth() > common) {
+    node = node->parent();
+  }
+  trace_builder->MoveTo(node);
+  for (int time = common; time < length; time++) {
+    node = trace_builder->Extend(path[time]);
+  }
+  return node;
+}
+
+// Puts the children of node from that of thread on, which CHESS has yet to
+// explore, in the frontier, as CHESSExplore would explore or defer them.
+static void SaveCHESSChildren(const TraceNode* node, int thread,
+    int remaining) {
+  if (save_frontier_file.empty()) {
+    return;
+  }
+  for (int other : node->runnable()) {
+    if (other >= thread) {
+      bool is_a_preemption = IsPreemption(node, other);
+      SaveBoundedChild(node, other, is_a_preemption && !remaining ? -1 :
+          remaining - is_a_preemption);
+    }
+  }
+}
+
+// Explores the children that a search saved in the frontier with explore, in
+// order, and puts those it has no budget left for back. Preemptions CHESS
+// deferred go to chess_deferred.
+static void ExploreBoundedChildren(
+    void (*explore)(const TraceNode* node, int remaining)) {
+  std::deque<FrontierItem> items;
+  items.swap(frontier.items);
+  while (!items.empty() && !OutOfBudget()) {
+    const FrontierItem& item = items.front();
+    if (item.remaining < 0) {
+      chess_deferred.push_back(PackPath(item.path));
+      chess_deferred.back().Append(item.thread);
+    } else {
+      ReplayPath(item.path.data(), item.path.size());
+      explore(trace_builder->Extend(item.thread), item.remaining);
+    }
+    items.pop_front();
+  }
+  if (!save_frontier_file.empty()) {
+    frontier.items.insert(frontier.items.end(), items.begin(), items.end());
+  }
+}
+
+// Puts the preemptions CHESS deferred to the next bound in the frontier,
+// ahead of the children saved since, as they were found first.
+static void SaveCHESSDeferred() {
+  if (!OutOfBudget() || save_frontier_file.empty()) {
+    return;
+  }
+  std::vector<int8_t> path;
+  for (auto it = chess_deferred.rbegin(); it != chess_deferred.rend(); ++it) {
+    it->Unpack(&path);
+    FrontierItem item;
+    item.thread = path.back();
+    item.path.assign(path.begin(), path.end() - 1);
+    item.remaining = -1;
+    frontier.items.push_front(item);
+  }
+}
+
+void CHESSExplore(const TraceNode* node, int remaining) {
   if (node->is_leaf()) {
     return;
   }
 
   if (prune_using_hash_table) {
     // Prune traces already seen.
-    Hash hash = history->CombineCurrentHashesWithLast();
-    auto it = seen.insert(std::make_pair(hash, remaining));
-    if (!it.second) {
-      if (it.first->second >= remaining) {
-        return;
-      } else {
-        it.first->second = remaining;
-      }
+    if (!seen->Visit(StateKey(true), remaining)) {
+      return;
     }
   }
 
   // Extend this node
   for (int thread : node->runnable()) {
-    bool is_a_preemption = node->parent() && thread != node->last_thread() &&
-      node->runnable().count(node->last_thread());
+    if (OutOfBudget()) {
+      SaveCHESSChildren(node, thread, remaining);
+      return;
+    }
+
+    bool is_a_preemption = IsPreemption(node, thread);
 
     if (is_a_preemption && !remaining) {
+      chess_deferred.push_back(PackPath(PathTo(node)));
+      chess_deferred.back().Append(thread);
+      chess_deferred_preemptions++;
       continue;
     }
 
-    if (only_preempt_on_atomic) {
-      if (is_a_preemption && 
-          node->next_transitions()[node->last_thread()].is_atomic()) {
-        continue;
+    trace_builder->MoveTo(node);
+    CHESSExplore(trace_builder->Extend(thread), remaining - is_a_preemption);
+  }
+}
+
+void RunCHESS() {
+  if (prune_using_hash_table && seen == nullptr) {
+    seen = FingerprintTable::Create(seen_table_bytes);
+  }
+  trace_builder = new TraceBuilder(interceptor, history);
+  // Left over from an earlier phase of hybrid, which stopped at its bound.
+  chess_deferred.clear();
+  int preemptions = min_preemptions;
+  if (resuming) {
+    preemptions = std::max(preemptions, frontier.preemptions);
+  }
+  int first = preemptions;
+  for (; InPreemptionRange(preemptions); preemptions++) {
+    if (preemptions == first && resuming) {
+      // What was left of the bound, then the preemptions deferred from it.
+      ExploreBoundedChildren(CHESSExplore);
+    } else if (preemptions == first) {
+      CHESSExplore(trace_builder->root(), preemptions);
+    } else {
+      // Items are in depth-first order, so consecutive ones share most of
+      // their paths, which ReplayPath then does not run again.
+      std::vector<PackedSchedule> items;
+      items.swap(chess_deferred);
+      std::vector<int8_t> path;
+      size_t i = 0;
+      for (; i < items.size() && !OutOfBudget(); i++) {
+        items[i].Unpack(&path);
+        ReplayPath(path.data(), path.size() - 1);
+        CHESSExplore(trace_builder->Extend(path.back()), 0);
+      }
+      for (; i < items.size() && !save_frontier_file.empty(); i++) {
+        items[i].Unpack(&path);
+        FrontierItem item;
+        item.thread = path.back();
+        item.path.assign(path.begin(), path.end() - 1);
+        frontier.items.push_back(item);
       }
     }
+    DumpStatisticsToStderr();
+    if (OutOfBudget()) {
+      break;
+    }
+  }
+  SaveCHESSDeferred();
+  SaveBoundedFrontier("chess", preemptions);
+}
+
+// Explores every trace of at most remaining delays, see bound_delays, in the
+// manner of CHESSExplore: the bound grows by one from the root each time,
+// and --prune skips states already visited with as many delays left.
+void DelayExplore(const TraceNode* node, int remaining) {
+  if (node->is_leaf()) {
+    return;
+  }
 
+  if (prune_using_hash_table) {
+    if (!seen->Visit(StateKey(true), remaining)) {
+      return;
+    }
+  }
+
+  for (int thread : node->runnable()) {
+    if (OutOfBudget()) {
+      // What is left of the node goes in the frontier.
+      for (int other : node->runnable()) {
+        int delays = Delays(node, other);
+        if (other >= thread && delays <= remaining &&
+            !save_frontier_file.empty()) {
+          SaveBoundedChild(node, other, remaining - delays);
+        }
+      }
+      return;
+    }
+    int delays = Delays(node, thread);
+    if (delays > remaining) {
+      continue;
+    }
     trace_builder->MoveTo(node);
-    CHESSExplore(trace_builder->Extend(thread), remaining - is_a_preemption);
+    DelayExplore(trace_builder->Extend(thread), remaining - delays);
   }
 }
 
-void RunCHESS() {
+void RunDelay() {
+  if (prune_using_hash_table && seen == nullptr) {
+    seen = FingerprintTable::Create(seen_table_bytes);
+  }
   trace_builder = new TraceBuilder(interceptor, history);
-  for (int preemptions = 0;; preemptions++) {
-    CHESSExplore(trace_builder->root(), preemptions);
+  int delays = min_preemptions;
+  if (resuming) {
+    delays = std::max(delays, frontier.preemptions);
+  }
+  int first = delays;
+  for (; InPreemptionRange(delays); delays++) {
+    if (delays == first && resuming) {
+      ExploreBoundedChildren(DelayExplore);
+    } else {
+      DelayExplore(trace_builder->root(), delays);
+    }
     DumpStatisticsToStderr();
+    if (OutOfBudget()) {
+      break;
+    }
+  }
+  SaveBoundedFrontier("delay", delays);
+}
+
+// Best-first search keeps the children it has yet to explore in a priority
+// queue, and always extends the most promising one, jumping to it with
+// ReplayPath. Children are scored from their parent, by the heuristics of
+// --heuristics in order of precedence, lower first:
+//   preemptions: the preemptions along the path to the child;
+//   conflicts: 0 if the step conflicts with a step of the run so far, 1 if
+//     not, to reverse races first;
+//   novelty: how often the parent's HHB hash was expanded before;
+//   unblocking: 0 if the step conflicts with the next step of a blocked
+//     thread, which may be waiting on a RequireResult it could satisfy.
+// Ties go to the deeper child, so that runs get finished, and then to the
+// lower thread. Nothing is pruned: given the budget, the whole tree is
+// explored, as by brute-force.
+enum BestFirstHeuristic { kPreemptions, kConflicts, kNovelty, kUnblocking };
+static const int kMaxHeuristics = 4;
+static std::vector<BestFirstHeuristic> heuristics;
+// The most children the queue held at once.
+static int64_t& best_first_frontier =
+    RegisterStatistic<int64_t>("best-first-frontier");
+
+struct BestFirstItem {
+  int score[kMaxHeuristics];
+  int preemptions;
+  int64_t order;
+  // The path to the child is the path to its parent, which the children of
+  // a node share, and thread.
+  std::shared_ptr<const PackedSchedule> parent_path;
+  int8_t thread;
+
+  // Whether this item comes after o.
+  bool operator<(const BestFirstItem& o) const {
+    for (size_t i = 0; i < heuristics.size(); i++) {
+      if (score[i] != o.score[i]) {
+        return score[i] > o.score[i];
+      }
+    }
+    if (parent_path->size() != o.parent_path->size()) {
+      return parent_path->size() < o.parent_path->size();
+    }
+    return order > o.order;
+  }
+};
+
+static void ParseHeuristics(const std::string& names) {
+  std::stringstream in(names);
+  std::string name;
+  while (std::getline(in, name, ',')) {
+    if (name == "preemptions") {
+      heuristics.push_back(kPreemptions);
+    } else if (name == "conflicts") {
+      heuristics.push_back(kConflicts);
+    } else if (name == "novelty") {
+      heuristics.push_back(kNovelty);
+    } else if (name == "unblocking") {
+      heuristics.push_back(kUnblocking);
+    } else {
+      fprintf(stderr, "unknown heuristic %s\n", name.c_str());
+      exit(1);
+    }
+  }
+  if (heuristics.size() > kMaxHeuristics) {
+    fprintf(stderr, "at most %d heuristics can be combined\n", kMaxHeuristics);
+    exit(1);
+  }
+}
+
+// Queues the children of node, which the trace builder has to be at.
+static void BestFirstQueueChildren(const TraceNode* node, int preemptions,
+    std::priority_queue<BestFirstItem>* queue) {
+  static std::unordered_map<Hash, int> expansions;
+  static int64_t order = 0;
+  if (node->is_leaf()) {
+    return;
+  }
+
+  auto path = std::make_shared<const PackedSchedule>(PackPath(PathTo(node)));
+  int visits = 0;
+  if (std::find(heuristics.begin(), heuristics.end(), kNovelty) !=
+      heuristics.end()) {
+    visits = expansions[history->CombineCurrentHashesWithLast()]++;
+  }
+  const ThreadMap<Transition>& transitions = node->next_transitions();
+  ThreadSet blocked = transitions.keys() - node->runnable();
+
+  for (int thread : node->runnable()) {
+    const Transition& transition = transitions[thread];
+    bool is_a_preemption = node->parent() && thread != node->last_thread() &&
+      node->runnable().count(node->last_thread());
+
+    BestFirstItem item;
+    for (size_t i = 0; i < heuristics.size(); i++) {
+      switch (heuristics[i]) {
+        case kPreemptions:
+          item.score[i] = preemptions + is_a_preemption;
+          break;
+        case kConflicts:
+          conflicts.clear();
+          history->FindFirstConflicts(thread, transition, &conflicts);
+          item.score[i] = conflicts.empty();
+          break;
+        case kNovelty:
+          item.score[i] = visits;
+          break;
+        case kUnblocking:
+          item.score[i] = 1;
+          for (int other : blocked) {
+            if (transitions[other].ConflictsWith(transition)) {
+              item.score[i] = 0;
+              break;
+            }
+          }
+          break;
+      }
+    }
+    item.preemptions = preemptions + is_a_preemption;
+    item.order = order++;
+    item.parent_path = path;
+    item.thread = thread;
+    queue->push(std::move(item));
   }
 }
 
+void RunBestFirst() {
+  trace_builder = new TraceBuilder(interceptor, history);
+  std::priority_queue<BestFirstItem> queue;
+  BestFirstQueueChildren(trace_builder->root(), 0, &queue);
+  std::vector<int8_t> path;
+  while (!queue.empty() && !OutOfBudget()) {
+    BestFirstItem item = queue.top();
+    queue.pop();
+    item.parent_path->Unpack(&path);
+    path.push_back(item.thread);
+    const TraceNode* node = ReplayPath(path.data(), path.size());
+    BestFirstQueueChildren(node, item.preemptions, &queue);
+    best_first_frontier = std::max<int64_t>(best_first_frontier,
+        queue.size());
+  }
+  DumpStatisticsToStderr();
+}
+
 void RunSingle() {
+  interceptor->set_run_solo_tails(true);
   interceptor->StartNewRun(history);
   while (!interceptor->finished()) {
     interceptor->AdvanceThread(*interceptor->runnable().begin());
   }
+  interceptor->set_run_solo_tails(false);
   DumpStatisticsToStderr();
 }
 
+// Runs the program once along the schedule of a dumped trace, so that the bug
+// it shows can be looked into without searching for it again. Should the
+// program take a different turn, the run is finished like RunSingle's.
+void RunReplay(const std::string& trace_file) {
+  std::vector<int> schedule;
+  LoadTraceSchedule(trace_file, &schedule);
+
+  interceptor->StartNewRun(history);
+  for (int thread : schedule) {
+    if (interceptor->finished() || !interceptor->runnable().count(thread)) {
+      fprintf(stderr, "replay diverged from %s at step %d of %zu\n",
+          trace_file.c_str(), history->length(), schedule.size());
+      break;
+    }
+    interceptor->AdvanceThread(thread);
+  }
+  while (!interceptor->finished()) {
+    interceptor->AdvanceThread(*interceptor->runnable().begin());
+  }
+  DumpStatisticsToStderr();
+}
+
+static int64_t& minimize_runs = RegisterStatistic<int64_t>("minimize-runs");
+
+// Runs the program once, giving each step to the next thread of schedule that
+// is runnable. Once the schedule runs out, the last thread keeps running while
+// it can, and the lowest runnable thread takes over when it can not. Returns
+// whether the run found a bug of the class bug_class, or any bug if it is
+// zero, and the actual schedule of the run in executed.
+static bool RunGuided(const std::vector<int>& schedule, uint64_t bug_class,
+    std::vector<int>* executed) {
+  interceptor->StartNewRun(history);
+  auto next = schedule.begin();
+  int last = -1;
+  while (!interceptor->finished()) {
+    ThreadSet runnable = interceptor->runnable();
+    while (next != schedule.end() && !runnable.count(*next)) {
+      ++next;
+    }
+    if (next != schedule.end()) {
+      last = *next++;
+    } else if (!runnable.count(last)) {
+      last = *runnable.begin();
+    }
+    interceptor->AdvanceThread(last);
+  }
+
+  executed->clear();
+  for (int time = 0; time < history->length(); time++) {
+    executed->push_back(history->thread_at(time));
+  }
+  return interceptor->has_found_bug() &&
+      (bug_class == 0 || interceptor->BugClass() == bug_class);
+}
+
+static int ContextSwitches(const std::vector<int>& schedule) {
+  int switches = 0;
+  for (size_t i = 1; i < schedule.size(); i++) {
+    switches += schedule[i] != schedule[i - 1];
+  }
+  return switches;
+}
+
+// Whether a is a simpler schedule than b: one with fewer context switches, or
+// as many and fewer steps.
+static bool SimplerSchedule(const std::vector<int>& a,
+    const std::vector<int>& b) {
+  int a_switches = ContextSwitches(a), b_switches = ContextSwitches(b);
+  return a_switches < b_switches ||
+      (a_switches == b_switches && a.size() < b.size());
+}
+
+static bool RunMinimizing(const std::vector<int>& schedule,
+    uint64_t bug_class, std::vector<int>* executed) {
+  minimize_runs++;
+  return RunGuided(schedule, bug_class, executed);
+}
+
+static int64_t& corpus_runs = RegisterStatistic<int64_t>("corpus-runs");
+static int64_t& corpus_found = RegisterStatistic<int64_t>("corpus-found");
+
+// Replays the schedules of the bug corpus as RunGuided does, so that a
+// program changed since they were recorded still gets close to them, before
+// the search proper starts. Bugs they find count like those of the search.
+static void ReplayBugCorpus() {
+  std::vector<PackedSchedule> corpus;
+  LoadSchedules(bug_corpus_file, &corpus);
+  std::vector<int8_t> path;
+  std::vector<int> schedule, executed;
+  for (const PackedSchedule& packed : corpus) {
+    if (OutOfBudget()) {
+      break;
+    }
+    packed.Unpack(&path);
+    schedule.assign(path.begin(), path.end());
+    corpus_runs++;
+    corpus_found += RunGuided(schedule, 0, &executed);
+  }
+  if (corpus_found > 0) {
+    fprintf(stderr, "%lld of the %zu schedules of %s found bugs\n",
+        (long long)corpus_found, corpus.size(), bug_corpus_file.c_str());
+  }
+}
+
+// Simplifies the schedule of the dumped trace of a bug by delta debugging,
+// and dumps the simplest schedule found that still finds a bug, of the same
+// class if same_class is set, over the trace. Candidates leave out runs of
+// consecutive blocks of steps of one thread, which defers those steps to the
+// next block of the thread, from halves of the blocks down to single blocks.
+void MinimizeFoundTrace(const std::string& trace_file, bool same_class) {
+  std::vector<int> best, executed;
+  LoadTraceSchedule(trace_file, &best);
+  if (!RunMinimizing(best, 0, &executed)) {
+    fprintf(stderr, "the trace in %s no longer finds a bug\n",
+        trace_file.c_str());
+    return;
+  }
+  uint64_t bug_class = same_class ? interceptor->BugClass() : 0;
+  int original_switches = ContextSwitches(executed);
+  size_t original_length = executed.size();
+  best = executed;
+
+  std::vector<int> candidate;
+  for (size_t chunk = best.size(); chunk >= 1;) {
+    std::vector<size_t> block_starts;
+    for (size_t i = 0; i < best.size(); i++) {
+      if (i == 0 || best[i] != best[i - 1]) {
+        block_starts.push_back(i);
+      }
+    }
+    block_starts.push_back(best.size());
+    size_t num_blocks = block_starts.size() - 1;
+    chunk = std::min(chunk, std::max<size_t>(num_blocks / 2, 1));
+
+    bool simplified = false;
+    for (size_t first = 0; first < num_blocks && !simplified; first += chunk) {
+      size_t last = std::min(first + chunk, num_blocks);
+      candidate.assign(best.begin(), best.begin() + block_starts[first]);
+      candidate.insert(candidate.end(), best.begin() + block_starts[last],
+          best.end());
+      if (RunMinimizing(candidate, bug_class, &executed) &&
+          SimplerSchedule(executed, best)) {
+        best = executed;
+        simplified = true;
+      }
+    }
+    if (!simplified) {
+      if (chunk == 1) {
+        break;
+      }
+      chunk /= 2;
+    }
+  }
+
+  RunMinimizing(best, bug_class, &executed);
+  history->Dump(trace_file.c_str());
+  if (!bug_corpus_file.empty()) {
+    PackedSchedule schedule;
+    for (int thread : best) {
+      schedule.Append(thread);
+    }
+    AppendSchedule(bug_corpus_file, schedule);
+  }
+  fprintf(stderr, "minimized %s from %d context switches and %zu "
+      "steps to %d and %zu\n", trace_file.c_str(), original_switches, original_length,
+      ContextSwitches(best), best.size());
+}
+
+// Minimizes the trace of each class of bugs in bug_directory, keeping each
+// in its class. Classes that turn up while minimizing are dumped, but left
+// as they are.
+void MinimizeBugClasses() {
+  FlushBackgroundWrites();
+  std::vector<std::string> trace_files;
+  if (DIR* dir = opendir(bug_directory.c_str())) {
+    while (dirent* entry = readdir(dir)) {
+      if (strncmp(entry->d_name, "bug-", 4) == 0) {
+        trace_files.push_back(bug_directory + "/" + entry->d_name);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(trace_files.begin(), trace_files.end());
+  for (const std::string& trace_file : trace_files) {
+    MinimizeFoundTrace(trace_file, true);
+  }
+}
+
 static std::mt19937_64 prng(0);
+
+// Random runs each draw from prng seeded by their index and --seed, rather
+// than from one sequence continued across runs, so that any run is repeated
+// on its own by its index, as --pct-run does, and parallel workers that take
+// indices from a shared counter make the same runs however they are split.
+static uint64_t SplitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static void SeedRun(int64_t index) {
+  prng.seed(SplitMix64(seed ^ SplitMix64(index)));
+}
+
+static int pct_changes = 10;
 static int& max_program_length = RegisterStatistic("max-program-length", -1);
 
-static int HighestPriorityThread(ThreadMap<int> priority, ThreadSet runnable) {
-  int best_thread = -1, best_priority = -1;
-  for (int thread : runnable) {
-    if (priority[thread] > best_priority) { 
-      best_thread = thread;
-      best_priority = priority[thread];
+// PCT's thread priorities, with the threads also kept in order of decreasing
+// priority. The highest priority runnable thread is then the first runnable
+// one in that order, which is nearly always one of the first few.
+class PCTPriorities {
+ public:
+  // Gives the threads the priorities num_changes and up in a random order,
+  // above the priorities that changes lower threads to.
+  void Shuffle(int num_changes) {
+    for (int i = 0; i < kMaxThreads; i++) {
+      priority_[i] = num_changes + i;
     }
+    for (int i = 0; i < kMaxThreads; i++) {
+      std::swap(priority_[i],
+          priority_[std::uniform_int_distribution<int>(0, i)(prng)]);
+    }
+    Order(num_changes);
   }
-  return best_thread;
-}
 
-void PCTOnce(int num_changes, int max_program_length) {
-  ThreadMap<int> priority;
-  for (int i = 0; i < kMaxThreads; i++) {
-    priority[i] = num_changes + i;
+  // Gives the threads the priorities of an earlier Shuffle.
+  void Set(const int* priority, int num_changes) {
+    std::copy(priority, priority + kMaxThreads, priority_);
+    Order(num_changes);
   }
-  for (int i = 0; i < kMaxThreads; i++) {
-    std::swap(priority[i], 
-        priority[std::uniform_int_distribution<int>(0, i)(prng)]);
+
+  inline const int* priorities() const {
+    return priority_;
+  }
+
+  inline int Highest(ThreadSet runnable) const {
+    for (int i = 0; i < kMaxThreads; i++) {
+      if (runnable.count(order_[i])) {
+        return order_[i];
+      }
+    }
+    return -1;
   }
 
+  // Sets the priority of thread and moves it to its place in the order.
+  void Change(int thread, int priority) {
+    int i = 0;
+    while (order_[i] != thread) {
+      i++;
+    }
+    priority_[thread] = priority;
+    for (; i + 1 < kMaxThreads && priority_[order_[i + 1]] > priority; i++) {
+      order_[i] = order_[i + 1];
+    }
+    for (; i > 0 && priority_[order_[i - 1]] < priority; i--) {
+      order_[i] = order_[i - 1];
+    }
+    order_[i] = thread;
+  }
+
+ private:
+  void Order(int num_changes) {
+    for (int thread = 0; thread < kMaxThreads; thread++) {
+      order_[kMaxThreads - 1 - (priority_[thread] - num_changes)] = thread;
+    }
+  }
+
+  int priority_[kMaxThreads];
+  int order_[kMaxThreads];
+};
+
+// The initial priorities and the change points, as pairs of depth and
+// priority, of a PCT run.
+struct PCTSample {
+  int priority[kMaxThreads];
   std::vector<std::pair<int, int>> changes;
-  for (int i = 0; i < num_changes; i++) {
-    changes.push_back(std::make_pair(
-        std::uniform_int_distribution<int>(0, max_program_length)(prng), i));
+};
+
+// With conflict coverage, PCT keeps the samples of up to kPCTCorpusSize runs
+// that covered new conflicts, and half of its runs take one of them and move
+// one of its change points, as a fuzzer mutates the inputs that reached new
+// coverage. Those runs depend on the corpus as well as on their index, and
+// only repeat in the search that made them.
+static const size_t kPCTCorpusSize = 64;
+static std::vector<PCTSample> pct_corpus;
+
+void PCTOnce(int num_changes, int max_program_length) {
+  PCTPriorities priorities;
+  PCTSample sample;
+  if (!pct_corpus.empty() && std::bernoulli_distribution(0.5)(prng)) {
+    sample = pct_corpus[std::uniform_int_distribution<size_t>(
+        0, pct_corpus.size() - 1)(prng)];
+    if (!sample.changes.empty()) {
+      sample.changes[std::uniform_int_distribution<size_t>(
+          0, sample.changes.size() - 1)(prng)].first =
+        std::uniform_int_distribution<int>(0, max_program_length)(prng);
+    }
+    priorities.Set(sample.priority, num_changes);
+  } else {
+    priorities.Shuffle(num_changes);
+    std::copy(priorities.priorities(), priorities.priorities() + kMaxThreads,
+        sample.priority);
+    for (int i = 0; i < num_changes; i++) {
+      sample.changes.push_back(std::make_pair(
+          std::uniform_int_distribution<int>(0, max_program_length)(prng), i));
+    }
   }
+  std::vector<std::pair<int, int>> changes = sample.changes;
   std::sort(changes.begin(), changes.end());
 
   auto change = changes.begin();
+  int64_t covered = NewConflictCoverage();
 
+  // Coverage looks at every step.
+  interceptor->set_run_solo_tails(conflict_coverage == nullptr);
   interceptor->StartNewRun(history);
   while (!interceptor->finished()) {
-    while (change != changes.end() && change->first == history->length()) {
-      int thread = HighestPriorityThread(priority, interceptor->runnable());
-      priority[thread] = change->second;
+    ThreadSet runnable = interceptor->runnable();
+    // A solo tail can take several steps at once, past change points that
+    // then apply at the first step after it.
+    while (change != changes.end() && change->first <= history->length()) {
+      priorities.Change(priorities.Highest(runnable), change->second);
       change++;
     }
-    int thread = HighestPriorityThread(priority, interceptor->runnable());
+    int thread = priorities.Highest(runnable);
+    if (conflict_coverage != nullptr) {
+      // Only for the coverage, which FindFirstConflicts sets.
+      history->CatchUp();
+      conflicts.clear();
+      history->FindFirstConflicts(thread,
+          interceptor->next_transitions()[thread], &conflicts);
+    }
     interceptor->AdvanceThread(thread);
   }
+  interceptor->set_run_solo_tails(false);
+
+  if (NewConflictCoverage() > covered) {
+    if (pct_corpus.size() < kPCTCorpusSize) {
+      pct_corpus.push_back(sample);
+    } else {
+      pct_corpus[std::uniform_int_distribution<size_t>(
+          0, kPCTCorpusSize - 1)(prng)] = sample;
+    }
+  }
+}
+
+// The number of PCT runs after which a bug of depth num_changes + 1 has been
+// found with 99% probability.
+static double PCTRequiredRuns(int num_threads, int max_program_length,
+    int num_changes) {
+  double p = 1.0 / num_threads / pow(max_program_length, num_changes);
+  if (p < 1e-10) {
+    return 1e10;
+  }
+  return log(0.01) / log(1 - p);
+}
+
+// PCT sweeps the bug depth, as the number of change points from 0 up to
+// pct_changes, dealing each run to the depth with the fewest runs that has
+// not yet had the runs that find a bug of it with 99% probability. Shallow
+// depths need few runs and finish first, so shallow bugs are found early,
+// and the rest of the budget goes to the deeper ones. Returns -1 once every
+// depth is done.
+template<class RunsWith>
+static int NextPCTChanges(const RunsWith& runs_with, int num_threads,
+    int max_program_length) {
+  int next = -1;
+  for (int changes = 0; changes <= pct_changes; changes++) {
+    int64_t runs = runs_with(changes);
+    if (runs <= PCTRequiredRuns(num_threads, max_program_length, changes) &&
+        (next == -1 || runs < runs_with(next))) {
+      next = changes;
+    }
+  }
+  return next;
+}
+
+static const int kMaxPCTChanges = 32;
+// The most change points a run had so far.
+static int& pct_depth = RegisterStatistic<int>("pct-depth", -1);
+
+// Runs the PCT run of index, which depends on nothing else but its number of
+// changes and the program length it drew change points from, and tells how
+// to repeat it if it finds a bug.
+static void PCTRun(int64_t index, int num_changes, int max_program_length) {
+  SeedRun(index);
+  PCTOnce(num_changes, max_program_length);
+  if (interceptor->has_found_bug()) {
+    fprintf(stderr, "pct run %lld found a bug, --pct-run=%lld:%d:%d repeats "
+        "it\n", static_cast<long long>(index), static_cast<long long>(index),
+        num_changes, max_program_length);
+  }
 }
 
+// The run of --pct-run, as index:changes:length, or empty.
+static std::string pct_run;
+
 void RunPCT() {
+  if (!pct_run.empty()) {
+    long long index;
+    int num_changes, length;
+    if (sscanf(pct_run.c_str(), "%lld:%d:%d", &index, &num_changes,
+            &length) != 3) {
+      fprintf(stderr, "invalid --pct-run %s\n", pct_run.c_str());
+      exit(1);
+    }
+    PCTRun(index, num_changes, length);
+    DumpStatisticsToStderr();
+    return;
+  }
+
   interceptor->StartNewRun(history);
   int num_threads = interceptor->next_transitions().size();
-  int num_changes = 10;
+  int64_t runs_with[kMaxPCTChanges + 1] = {};
 
   max_program_length = 0;
 
-  for (int i = 1; ; i++) {
-    PCTOnce(num_changes, max_program_length);
+  for (int i = 1; !OutOfBudget(); i++) {
+    int num_changes = NextPCTChanges(
+        [&](int changes) { return runs_with[changes]; }, num_threads,
+        max_program_length);
+    if (num_changes < 0) {
+      break;
+    }
+    PCTRun(i, num_changes, max_program_length);
+    runs_with[num_changes]++;
+    pct_depth = std::max(pct_depth, num_changes);
 
     max_program_length = std::max(max_program_length, history->length());
 
-    double p = 1.0 / num_threads / pow(max_program_length, num_changes);
+    if (i % 1000 == 0) {
+      DumpStatisticsToStderr();
+    }
+  }
+  DumpStatisticsToStderr();
+}
+
+// What parallel PCT workers share, so that they agree on when the search is
+// done, and take the indices of their runs in turn. Each worker keeps its own
+// statistics.
+struct PCTProgress {
+  std::atomic<int> max_program_length;
+  std::atomic<int64_t> next_index;
+  std::atomic<int64_t> runs;
+  std::atomic<int64_t> runs_with[kMaxPCTChanges + 1];
+  std::atomic<int64_t> found;
+};
 
-    double required_runs;
-    if (p < 1e-10) {
-      required_runs = 1e10;
-    } else {
-      required_runs = log(0.01) / log(1 - p);
+static PCTProgress* pct_progress = nullptr;
+
+int64_t& pct_runs = RegisterStatistic<int64_t>("pct-runs");
+int64_t& pct_found = RegisterStatistic<int64_t>("pct-found");
+
+static void ParallelPCTWorker(int id) {
+  DetachStatistics();
+
+  interceptor->StartNewRun(history);
+  int num_threads = interceptor->next_transitions().size();
+
+  max_program_length = 0;
+
+  while (!OutOfBudget()) {
+    int shared_length =
+        pct_progress->max_program_length.load(std::memory_order_relaxed);
+    // Counted as it starts, so that workers spread over the depths.
+    int num_changes = NextPCTChanges([](int changes) {
+          return pct_progress->runs_with[changes].load(
+              std::memory_order_relaxed);
+        }, num_threads, shared_length);
+    if (num_changes < 0) {
+      break;
     }
+    pct_progress->runs_with[num_changes]++;
+    pct_depth = std::max(pct_depth, num_changes);
+    PCTRun(++pct_progress->next_index, num_changes, shared_length);
 
-    if (i > required_runs) {
+    while (history->length() > shared_length &&
+        !pct_progress->max_program_length.compare_exchange_weak(
+          shared_length, history->length())) {}
+    max_program_length = std::max(max_program_length, history->length());
+
+    if (interceptor->has_found_bug()) {
+      pct_progress->found++;
+    }
+    pct_progress->runs++;
+  }
+
+  fprintf(stderr, "worker %d: ", id);
+  DumpStatisticsToStderr();
+}
+
+void RunParallelPCT(int num_workers) {
+  pct_progress =
+      reinterpret_cast<PCTProgress*>(AllocateShared(sizeof(PCTProgress)));
+  Interceptor::ShareDistinct();
+  RunWorkers(num_workers, &ParallelPCTWorker);
+
+  max_program_length = pct_progress->max_program_length;
+  pct_runs = pct_progress->runs;
+  pct_found = pct_progress->found;
+  DumpStatisticsToStderr();
+}
+
+// Random walks go from the root to a leaf, each step taken by a thread
+// picked uniformly among those that can take it. The product of the choices
+// along a walk is an unbiased estimate of the leaves of the tree, as Knuth
+// estimated the size of backtracking searches, so the mean of a few minutes
+// of walks tells whether exploring the tree is feasible. With
+// --walk-sleep-sets the tree is the one brute force explores with sleep
+// sets, taking threads in order: a child is not entered by the threads its
+// earlier siblings took unless their steps conflict with its own, and walks
+// that find every thread asleep end there. Estimates are kept as logarithms,
+// as those of deep trees overflow doubles.
+static bool walk_sleep_sets = false;
+static double& walk_leaves_log10 =
+    RegisterStatistic<double>("walk-estimated-leaves-log10");
+static int64_t& walk_deadends = RegisterStatistic<int64_t>("walk-deadends");
+
+// Walks to a leaf from the root, and returns the log10 of its estimate.
+static double RandomWalk() {
+  const TraceNode* node = trace_builder->root();
+  trace_builder->MoveTo(node);
+  ThreadSet sleepset;
+  double log10_leaves = 0;
+  while (!node->is_leaf()) {
+    ThreadSet choices = node->runnable() - sleepset;
+    if (choices.empty()) {
+      walk_deadends++;
       break;
     }
+    std::vector<int> threads;
+    for (int choice : choices) {
+      threads.push_back(choice);
+    }
+    int thread = threads[std::uniform_int_distribution<size_t>(
+        0, threads.size() - 1)(prng)];
+    log10_leaves += log10(threads.size());
+    if (walk_sleep_sets) {
+      for (int earlier : threads) {
+        if (earlier == thread) {
+          break;
+        }
+        sleepset.insert(earlier);
+      }
+      sleepset = sleepset - node->FindConflicts(thread);
+    }
+    node = trace_builder->Extend(thread);
+  }
+  return log10_leaves;
+}
 
-    if (i % 1000 == 0) {
+void RunRandomWalk() {
+  trace_builder = new TraceBuilder(interceptor, history);
+  // The log10 of the largest estimate, and the sum of the others over it.
+  double max_log10 = 0;
+  double sum = 0;
+  for (int64_t walks = 1; !OutOfBudget(); walks++) {
+    SeedRun(walks);
+    double log10_leaves = RandomWalk();
+    if (walks == 1 || log10_leaves > max_log10) {
+      sum = sum * pow(10, max_log10 - log10_leaves) + 1;
+      max_log10 = log10_leaves;
+    } else {
+      sum += pow(10, log10_leaves - max_log10);
+    }
+    walk_leaves_log10 = max_log10 + log10(sum / walks);
+
+    if (walks % 1000 == 0) {
       DumpStatisticsToStderr();
     }
   }
@@ -441,15 +2514,19 @@ void DumpChoice(const Choice& choice) {
   fprintf(stderr, "\n");
 }
 
+// Explores with ever higher costs, until a cost no longer cuts anything off.
 void RunPinner() {
   PinnerState* root = GetUnusedState();
   for (int cost = 0;; cost++) {
-    CreateInitialState(root);
+    CreateInitialState(interceptor, root);
     cost_histogram_count.clear();
-    Explore(root, cost);
+    bool cost_bound_reached = Explore(interceptor, root, cost);
     DumpStatisticsToStderr();
+    if (OutOfBudget()) {
+      break;
+    }
     DumpHistogram();
-    int total_not_exceeding_cost;
+    int total_not_exceeding_cost = 0;
     for (auto it : cost_histogram_count) {
       int actual_cost = 0;
       for (auto value : it.first) {
@@ -460,12 +2537,16 @@ void RunPinner() {
       }
     }
     fprintf(stderr, "Total runs not exceeding cost: %d\n", total_not_exceeding_cost);
+    if (!cost_bound_reached) {
+      break;
+    }
   }
+  ReturnUnusedState(root);
 }
 
 void RunPinnerInteractive() {
   PinnerState* state = GetUnusedState();
-  CreateInitialState(state);
+  CreateInitialState(interceptor, state);
   while (true) {
     printf("Cost: %d\n", state->cost);
     state->history.Dump();
@@ -473,7 +2554,8 @@ void RunPinnerInteractive() {
 
     cost_histogram_count.clear();
 
-    auto choices = GenerateChoices(state, 10);
+    std::vector<Choice> choices;
+    GenerateChoices(state, 10, &choices);
 
     DumpHistogram();
 
@@ -489,29 +2571,951 @@ void RunPinnerInteractive() {
     DumpChoice(choice);
 
     PinnerState* tmp = GetUnusedState();
-    Pin(tmp, choice, state);
+    if (!Pin(interceptor, tmp, choice, state)) {
+      fprintf(stderr, "Choice is impossible\n");
+      ReturnUnusedState(tmp);
+      continue;
+    }
     std::swap(state, tmp);
     ReturnUnusedState(tmp);
   }
 }
 
+int64_t& stress_runs = RegisterStatistic<int64_t>("stress-runs");
+int64_t& stress_found = RegisterStatistic<int64_t>("stress-found");
+
+// Runs the program natively, see RunProgramNatively, over and over, for
+// interleavings of workloads far larger than a search covers, as real
+// hardware makes them. Native runs leave no trace, so bugs are only counted
+// and reported, and --max-runs counts native runs.
+void RunStress() {
+  while (!OutOfBudget() && (max_runs == 0 || stress_runs < max_runs)) {
+    stress_runs++;
+    if (RunProgramNatively()) {
+      if (stress_found++ == 0) {
+        fprintf(stderr, "stress run %lld found a bug\n",
+            (long long)stress_runs);
+      }
+      if (stop_on_bug) {
+        break;
+      }
+    }
+    if (stress_runs % 1000 == 0) {
+      DumpStatisticsToStderr();
+    }
+  }
+  DumpStatisticsToStderr();
+}
+
+// Flags are given as --name=value, or as --name for booleans. A flag can also
+// be set from the environment as CODEX_NAME=value, with the name upper-cased
+// and dashes replaced by underscores. The command line takes precedence.
+struct Flag {
+  const char* name;
+  const char* help;
+};
+
+static const Flag kFlags[] = {
+  {"explorer", "single, brute-force, chess, pbpor, cbdpor (default), delay, "
+      "delay-dpor, source-bpor, dpor, odpor, reads-from, parallel-dpor, "
+      "pct, parallel-pct, random-walk, best-first, pinner, "
+      "pinner-interactive, stress, hybrid or auto"},
+  {"auto-explorers", "comma-separated explorers that auto probes before "
+      "giving the rest of the budget to the best (default cbdpor,pct,chess)"},
+  {"probe-runs", "runs auto gives each explorer it probes (default 1000)"},
+  {"phases", "comma-separated explorers that hybrid runs in turn, each as "
+      "name[:limit], the limit being the last preemption bound of a bounded "
+      "explorer and the number of runs of any other (e.g. cbdpor:2,pct)"},
+  {"heuristics", "comma-separated heuristics of best-first, in order of "
+      "precedence: preemptions, conflicts, novelty and unblocking (default "
+      "preemptions,conflicts)"},
+  {"min-preemptions", "first preemption bound of pbpor, cbdpor, "
+      "source-bpor and chess, and first delay bound of delay and delay-dpor"},
+  {"max-preemptions", "last preemption bound of pbpor, cbdpor, "
+      "source-bpor and chess, and last delay bound of delay and delay-dpor"},
+  {"pct-changes", "most priority changes per pct run, swept from 0 up "
+      "(default 10, at most 32)"},
+  {"seed", "seed of the pct and random-walk random number generator, "
+      "which each run combines with its index (default 0)"},
+  {"pct-run", "index:changes:length of a single pct run to repeat, as "
+      "printed by the run that found a bug"},
+  {"backtrack-probability", "probability that dpor and parallel-dpor add "
+      "the backtrack point of a race, chosen by --seed (default 1)"},
+  {"walk-sleep-sets", "have random-walk walk and estimate the tree that "
+      "sleep sets leave"},
+  {"workers", "number of parallel-dpor and parallel-pct workers (default 8)"},
+  {"pin-workers", "pin each worker to a CPU of its own, spread over the NUMA "
+      "nodes, and share work within a node first"},
+  {"linearizability-workers", "number of processes searching for a "
+      "linearization of a long history at once (default 1)"},
+  {"stress-repeat", "with --explorer=stress, times over each thread of a "
+      "linearizability check runs its steps (default 1)"},
+  {"prune", "prune chess using a table of visited states"},
+  {"stateful", "prune dpor and cbdpor at states they have explored before"},
+  {"stateful-max-states", "most states --stateful keeps (default 1000000)"},
+  {"prune-table-mb", "memory for the chess table in megabytes (default 64)"},
+  {"only-preempt-on-atomic", "the same as --scheduling-points=atomic"},
+  {"checkpoint-interval", "fork checkpoints at depths that are a multiple "
+      "of this (default 0, disabled)"},
+  {"checkpoint-min-depth", "fork no checkpoints above this depth"},
+  {"checkpoint-pageout", "have checkpoints waiting for their child page out "
+      "the memory that differs from the child's, to compressed swap if it "
+      "is on zram"},
+  {"max-seconds", "stop exploring after this many seconds"},
+  {"max-runs", "stop exploring after this many runs"},
+  {"max-transitions", "stop exploring after this many transitions"},
+  {"stop-on-bug", "stop exploring once a bug is found"},
+  {"save-frontier", "file to save the unexplored frontier to when a budget "
+      "runs out"},
+  {"resume", "frontier file to continue a search from"},
+  {"resume-share", "I/K: only explore every Kth item of the dpor frontier, "
+      "starting at the Ith, as one of K processes splitting it"},
+  {"minimize", "simplify the dumped traces of the bugs found, with fewer "
+      "context switches and steps"},
+  {"bug-dir", "directory to dump the first trace of each class of bugs to"},
+  {"bug-corpus", "file of the schedules of earlier bugs to replay before "
+      "exploring, which the first run of each class of bugs and each "
+      "minimized trace is added to"},
+  {"coverage-file", "file to append the hash of each distinct trace to; "
+      "single, pct and parallel-pct only count distinct traces with it"},
+  {"workloads", "check each workload of this file, one per line, in turn "
+      "in one process, with --max-runs for each and --max-seconds for all"},
+  {"workload", "steps of a linearizability check that registers its "
+      "operations, as op(arg),op;op with threads separated by semicolons, "
+      "or random:<threads>x<steps>[:<seed>] (default random:3x3)"},
+  {"replay", "trace file to run the schedule of once, as dumped when a bug "
+      "is found; the other flags should match those of the dumping run"},
+  {"profile-locations", "file to write the steps, conflicts and backtrack "
+      "points of the accesses at each source location to, most steps first"},
+  {"profile-addresses", "file to write the conflicts and backtrack points of "
+      "the accesses to each address to, with the global or allocation site "
+      "holding it, most conflicts first"},
+  {"conflict-coverage", "set a bit per ordered pair of source locations of "
+      "conflicting steps, count the new ones in the conflict-coverage "
+      "statistic, and have pct mutate the runs that set some"},
+  {"coverage-map", "file to load the conflict coverage bits from, if it "
+      "exists, and to save them to; implies --conflict-coverage"},
+  {"show-transitions", "print every transition"},
+  {"show-program-output", "print the output of the tested program"},
+  {"show-debug-output", "print debug output"},
+  {"intercept-private", "explore accesses to heap allocations only one "
+      "thread can reach as transitions"},
+  {"coalesce", "only interleave atomic and racing accesses, assuming the "
+      "program is data-race free"},
+  {"scheduling-points", "the accesses threads can be switched out before, "
+      "for every explorer: all (default), atomic, sync for locks, CAS and "
+      "read-modify-writes, or a comma-separated list of location ids and "
+      "file:line locations; the others run as part of the step before them, "
+      "missing the bugs that need a switch there, except for atomic "
+      "accesses found to race, which become scheduling points as the search "
+      "starts over"},
+  {"symmetry", "explore only one order in which threads of the same "
+      "symmetry group take their first step, and hash states up to "
+      "permutations of them"},
+  {"reuse-freed", "recycle freed memory within a run, last freed first, "
+      "per power-of-two size"},
+  {"setup-once", "only run Setup before the first run, and start later "
+      "runs from the memory it left; the program must register every global "
+      "its runs write"},
+  {"weak-atomics", "run every thread with a store buffer, as the program "
+      "compiled for x86-TSO would: only seq_cst stores and read-modify-writes "
+      "wait for the stores before them"},
+  {"detect-races", "report plain accesses of different threads to the same "
+      "address, one a write, that no atomic accesses order as bugs"},
+  {"detect-frees", "report accesses to memory freed during the run, and "
+      "frees of it, as bugs"},
+  {"operation-steps", "run each operation of a linearizability harness as "
+      "part of the step before it until a run finds it to conflict with "
+      "another thread, and then search again with its accesses as steps, so "
+      "that only conflicting operations are interleaved; not with the hybrid "
+      "and auto explorers or --replay"},
+  {"state-key", "what --stateful and chess --prune tell states apart by: "
+      "hb, the happens-before history (default), or memory, the contents of "
+      "intercepted memory and where each thread is, which merges more states "
+      "but misses what threads keep in registers and on their stacks"},
+  {"spin-reads", "block a thread that read the same value from a location "
+      "this many times in a row until the value changes (default 0, off)"},
+  {"max-run-steps", "cut off runs after this many steps, as livelocks "
+      "(default 0, off)"},
+  {"retry-cutoff", "give a thread no further steps once it took this many "
+      "steps in a row that wrote nothing while no other thread wrote, and "
+      "cut off the run once no other thread can run (default 0, off)"},
+  {"prune-cut-off", "drop runs cut off by --max-run-steps or "
+      "--retry-cutoff instead of counting them as livelocks"},
+  {"stop-run-on-found", "end a run as soon as its program finds a bug, and "
+      "explore nothing below it"},
+  {"commuting-adds", "never reorder atomic adds and subtracts of the same "
+      "location among themselves; only sound if the program ignores the "
+      "values they return"},
+  {"stack-kb", "stack size of each program thread in KB (default 256)"},
+  {"preserve-fpu", "keep the floating point control state of program "
+      "threads apart"},
+  {"huge-pages", "back the arena and the stacks of program threads with "
+      "transparent huge pages where the kernel has them"},
+  {"distinct-table-mb", "memory for counting distinct traces exactly, "
+      "beyond which they are estimated (default 256)"},
+  {"finish-every-run", "run the program's Finish after every run, rather "
+      "than passing runs happens-before equivalent to one it passed"},
+  {"perf-counters", "also count instructions, cache misses and branch "
+      "misses in the timers of TIMERS=1 builds"},
+  {"stats-fd", "file descriptor to stream statistics to as JSON lines"},
+  {"stats-interval", "seconds between streamed statistics (default 1)"},
+  {"hb-graph", "bin or dot, to write the happens-before graph of each "
+      "dumped trace next to it"},
+  {"slow-runs", "number of slowest runs to print the schedules of at exit, "
+      "also timing their happens-before bookkeeping and program checks"},
+  {"introspect", "unix socket to answer status, and stop, requests of the "
+      "running search at, one per connection"},
+  {"spill-dir", "directory to spill the histories of long runs to, keeping "
+      "only a window of each of their arrays in memory"},
+  {"spill-window-mb", "memory each spilled history array keeps of its "
+      "latest elements (default 64)"},
+  {"writer-queue-mb", "memory for trace dumps and statistics waiting to be "
+      "written in the background (default 64)"},
+  {"memory-budget-mb", "resident memory above which the search sheds "
+      "caches, exact distinct counts, pruning tables and checkpoints"},
+  {"fork-server", "read jobs from stdin, each a line of flags, and run each "
+      "in a process forked after startup, printing its exit status"},
+};
+
+static int flag_argc;
+static char** flag_argv;
+
+static void PrintUsageAndExit(const char* program) {
+  fprintf(stderr, "usage: %s [--flag[=value]]...\n", program);
+  for (const Flag& flag : kFlags) {
+    fprintf(stderr, "  --%-24s %s\n", flag.name, flag.help);
+  }
+  exit(1);
+}
+
+static void ParseFlags(int argc, char** argv) {
+  flag_argc = argc;
+  flag_argv = argv;
+
+  for (int i = 1; i < argc; i++) {
+    bool known = false;
+    if (strncmp(argv[i], "--", 2) == 0) {
+      const char* name = argv[i] + 2;
+      size_t length = strcspn(name, "=");
+      for (const Flag& flag : kFlags) {
+        if (strlen(flag.name) == length &&
+            strncmp(flag.name, name, length) == 0) {
+          known = true;
+        }
+      }
+    }
+    if (!known) {
+      fprintf(stderr, "unknown flag %s\n", argv[i]);
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+}
+
+// Returns the value of flag name, "1" for a boolean flag without a value, or
+// nullptr if the flag is not set.
+static const char* GetFlag(const char* name) {
+  size_t length = strlen(name);
+  const char* value = nullptr;
+  for (int i = 1; i < flag_argc; i++) {
+    const char* arg = flag_argv[i] + 2;
+    if (strncmp(arg, name, length) == 0) {
+      if (arg[length] == '=') {
+        value = arg + length + 1;
+      } else if (arg[length] == '\0') {
+        value = "1";
+      }
+    }
+  }
+  if (value != nullptr) {
+    return value;
+  }
+
+  std::string variable = "CODEX_";
+  for (const char* c = name; *c; c++) {
+    variable += *c == '-' ? '_' : toupper(*c);
+  }
+  return getenv(variable.c_str());
+}
+
+static std::string GetFlag(const char* name, const char* default_value) {
+  const char* value = GetFlag(name);
+  return value ? value : default_value;
+}
+
+template<class T>
+static T GetFlag(const char* name, T default_value) {
+  const char* value = GetFlag(name);
+  if (value == nullptr) {
+    return default_value;
+  }
+  char* end;
+  double parsed = strtod(value, &end);
+  if (*value == '\0' || *end != '\0') {
+    fprintf(stderr, "invalid value %s for --%s\n", value, name);
+    PrintUsageAndExit(flag_argv[0]);
+  }
+  return static_cast<T>(parsed);
+}
+
+// Serves --fork-server: starting a test binary loads and relocates it and runs
+// the static constructors of the program and its libraries, which costs more
+// than short searches do, so drivers starting many of them, as fuzz.py and
+// distribute.py do, can instead start one and write it a job per search. Each
+// job is a line of flags separated by spaces, run in a child forked from the
+// server, which then returns here to run main with them as if started with
+// them. The server waits for it and writes its exit status, or 128 plus the
+// signal that killed it, as a line to stdout, and exits at the end of stdin.
+// Jobs run one at a time; drivers wanting more start more servers.
+static void ServeForks(char* program) {
+  char* line = nullptr;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, stdin) > 0) {
+    std::vector<std::string> job;
+    std::istringstream words(line);
+    for (std::string word; words >> word;) {
+      job.push_back(word);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if (pid == 0) {
+      // The environment would make the child a server as well.
+      unsetenv("CODEX_FORK_SERVER");
+      static std::vector<std::string> arguments;
+      static std::vector<char*> argv;
+      arguments = job;
+      argv.push_back(program);
+      for (std::string& word : arguments) {
+        argv.push_back(&word[0]);
+      }
+      argv.push_back(nullptr);
+      free(line);
+      ParseFlags(argv.size() - 1, argv.data());
+      return;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    printf("%d\n", WIFEXITED(status) ? WEXITSTATUS(status) :
+        128 + WTERMSIG(status));
+    fflush(stdout);
+  }
+  free(line);
+  exit(0);
+}
+
+// An explorer as --explorer and the phases of hybrid name it. All of them
+// share the runtime above, stop on OutOfBudget, dump their statistics and
+// save their frontiers themselves, so running one after another only needs
+// the bounds and the budget adjusted in between.
+struct Explorer {
+  const char* name;
+  void (*run)();
+  // Random and single runs only count steps, and so leave happens-before to
+  // whatever asks for it.
+  bool lazy_history;
+  // Iterates over the preemption bounds from min- to max-preemptions.
+  bool bounded;
+};
+
+static const Explorer kExplorers[] = {
+  {"single", RunSingle, true, false},
+  {"brute-force", RunBruteForce, false, false},
+  {"chess", RunCHESS, false, true},
+  {"pbpor", RunPBPOR, false, true},
+  {"cbdpor", RunCBDPOR, false, true},
+  {"delay", RunDelay, false, true},
+  {"delay-dpor", RunDelayDPOR, false, true},
+  {"source-bpor", RunSourceBPOR, false, true},
+  {"dpor", RunDPOR, false, false},
+  {"odpor", RunODPOR, false, false},
+  {"reads-from", RunReadsFrom, false, false},
+  {"parallel-dpor", []() { RunParallelDPOR(GetFlag("workers", 8)); },
+    false, false},
+  {"random-walk", RunRandomWalk, false, false},
+  {"pct", RunPCT, true, false},
+  {"parallel-pct", []() { RunParallelPCT(GetFlag("workers", 8)); },
+    true, false},
+  {"best-first", []() {
+      ParseHeuristics(GetFlag("heuristics", "preemptions,conflicts"));
+      RunBestFirst();
+    }, false, false},
+  {"pinner", RunPinner, false, false},
+  {"pinner-interactive", RunPinnerInteractive, false, false},
+  {"stress", RunStress, true, false},
+};
+
+static const Explorer* FindExplorer(const std::string& name) {
+  for (const Explorer& explorer : kExplorers) {
+    if (name == explorer.name) {
+      return &explorer;
+    }
+  }
+  return nullptr;
+}
+
+int64_t& hybrid_phases = RegisterStatistic<int64_t>("hybrid-phases");
+int64_t& hybrid_handed_states =
+    RegisterStatistic<int64_t>("hybrid-handed-states");
+
+// Hands what the phases so far have visited to the phase of next. Summaries
+// of stateful CB-DPOR become entries of the table of chess --prune, which
+// hashes states the same way: a state CB-DPOR has explored with no thread
+// asleep and some preemptions left needs no exploring by chess with at most
+// as many left. Summaries only carry over to a phase of the explorer that
+// made them, as DPOR and CB-DPOR hash and bound states differently.
+static void HandOverVisitedStates(const Explorer* previous,
+    const Explorer* next) {
+  if (previous == nullptr || previous == next) {
+    return;
+  }
+  if (std::string(previous->name) == "cbdpor" &&
+      std::string(next->name) == "chess" && prune_using_hash_table) {
+    if (seen == nullptr) {
+      seen = FingerprintTable::Create(seen_table_bytes);
+    }
+    for (const auto& state : visited_states) {
+      if (state.second.sleepset.empty()) {
+        seen->Visit(state.first, state.second.remaining);
+        hybrid_handed_states++;
+      }
+    }
+  }
+  visited_states.clear();
+}
+
+// --explorer=hybrid runs the explorers of --phases, a comma-separated list
+// of name[:limit], one after another in one budget. The limit of a bounded
+// explorer is the last preemption bound it explores, and the next bounded
+// phase starts at the bound after it; that of any other is the number of runs
+// it gets. A phase without a limit gets what is left of the budget. So
+// cbdpor:2,pct explores every trace of up to two preemptions and samples
+// the rest with PCT, and cbdpor:1,chess carries on from there with CHESS,
+// its --prune table filled with the states CB-DPOR explored.
+static void RunHybrid(const std::string& phases) {
+  std::vector<std::pair<const Explorer*, int64_t>> plan;
+  std::stringstream in(phases);
+  std::string phase;
+  while (std::getline(in, phase, ',')) {
+    size_t colon = phase.find(':');
+    const Explorer* explorer = FindExplorer(phase.substr(0, colon));
+    int64_t limit = -1;
+    if (colon != std::string::npos) {
+      char* end;
+      limit = strtoll(phase.c_str() + colon + 1, &end, 10);
+      if (*end != '\0' || limit < 0) {
+        explorer = nullptr;
+      }
+    }
+    if (explorer == nullptr || std::string(explorer->name) == "pinner" ||
+        std::string(explorer->name) == "pinner-interactive") {
+      fprintf(stderr, "invalid hybrid phase %s\n", phase.c_str());
+      exit(1);
+    }
+    plan.emplace_back(explorer, limit);
+  }
+  if (plan.empty()) {
+    fprintf(stderr, "--explorer=hybrid needs --phases\n");
+    exit(1);
+  }
+
+  const int64_t& runs = GetStatistic<int64_t>("runs");
+  int last_preemptions = max_preemptions;
+  int64_t total_runs = max_runs;
+  const Explorer* previous = nullptr;
+  for (const auto& step : plan) {
+    const Explorer* explorer = step.first;
+    if (OutOfBudget()) {
+      break;
+    }
+    if (explorer->bounded && last_preemptions >= 0 &&
+        min_preemptions > last_preemptions) {
+      continue;
+    }
+    max_preemptions = last_preemptions;
+    max_runs = total_runs;
+    if (explorer->bounded && step.second >= 0) {
+      max_preemptions = last_preemptions < 0 ? step.second :
+          std::min<int>(step.second, last_preemptions);
+    } else if (step.second >= 0) {
+      max_runs = runs + step.second;
+      if (total_runs > 0) {
+        max_runs = std::min(max_runs, total_runs);
+      }
+    }
+
+    HandOverVisitedStates(previous, explorer);
+    delete trace_builder;
+    trace_builder = nullptr;
+    hybrid_phases++;
+    fprintf(stderr, "hybrid phase %s\n", explorer->name);
+    history->set_lazy(explorer->lazy_history);
+    explorer->run();
+    previous = explorer;
+
+    if (explorer->bounded) {
+      if (max_preemptions < 0) {
+        break;
+      }
+      min_preemptions = std::max(min_preemptions, max_preemptions + 1);
+    }
+    // The limit of the phase is not that of the search.
+    max_runs = total_runs;
+    budget_exhausted = false;
+  }
+  max_preemptions = last_preemptions;
+  max_runs = total_runs;
+}
+
+int64_t& refining_restarts = RegisterStatistic<int64_t>("refining-restarts");
+int64_t& refined_operations = RegisterStatistic<int64_t>("refined-operations");
+int64_t& promoted_scheduling_points =
+    RegisterStatistic<int64_t>("promoted-scheduling-points");
+
+// --operation-steps runs explorer with the operations between
+// BeginOperationStep and EndOperationStep as parts of the steps before them,
+// so that it only interleaves the operations that conflict. A run that finds
+// an operation to conflict refines it, and stops the search, which has
+// treated the operation as independent of the others so far; it starts over
+// with the operation as steps, until a search refines none. Scheduling
+// points that leave out atomic accesses are refined the same way, by
+// promoting the locations of those found to race, see
+// PromotedSchedulingPoints.
+static void RunRefiningSteps(const Explorer* explorer) {
+  while (true) {
+    refined_before_search = Refinements();
+    explorer->run();
+    refined_operations = RefinedOperations();
+    promoted_scheduling_points = PromotedSchedulingPoints();
+    if (Refinements() == refined_before_search) {
+      break;
+    }
+    refining_restarts++;
+    fprintf(stderr, "%lld operations refined, %lld scheduling points "
+        "promoted, restarting\n", (long long)refined_operations,
+        (long long)promoted_scheduling_points);
+    delete trace_builder;
+    trace_builder = nullptr;
+    visited_states.clear();
+    ClearRaceCache();
+    if (seen != nullptr) {
+      seen->Clear();
+    }
+    budget_exhausted = false;
+  }
+}
+
+int64_t& batch_workloads = RegisterStatistic<int64_t>("batch-workloads");
+int64_t& batch_failing = RegisterStatistic<int64_t>("batch-failing");
+
+// --workloads checks each workload of file in turn with explorer, in this
+// process, as enumerate.py does with a process each: the interceptor, the
+// fibers of its threads, the arena and the history are set up once, and each
+// workload only pays for its search. The searches share --max-seconds, and
+// --max-runs is for each. Lines starting with # are skipped.
+static void RunWorkloads(const std::string& file, const Explorer* explorer) {
+  std::ifstream in(file);
+  if (!in) {
+    perror(file.c_str());
+    exit(1);
+  }
+  const int64_t& runs = GetStatistic<int64_t>("runs");
+  const int64_t& found = GetStatistic<int64_t>("found");
+  int64_t runs_per_workload = max_runs;
+  std::vector<std::string> failing;
+  std::string line;
+  while (std::getline(in, line) && !OutOfBudget()) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    workload = line;
+    delete trace_builder;
+    trace_builder = nullptr;
+    visited_states.clear();
+    ClearRaceCache();
+    if (seen != nullptr) {
+      seen->Clear();
+    }
+    ForgetVerifiedRuns();
+    int64_t runs_before = runs;
+    found_before_search = found;
+    max_runs = runs_per_workload > 0 ? runs + runs_per_workload : 0;
+    batch_workloads++;
+
+    explorer->run();
+
+    bool fails = found > found_before_search;
+    if (fails) {
+      batch_failing++;
+      failing.push_back(workload);
+    }
+    printf("%-48s %s, %lld runs%s\n", workload.c_str(),
+        fails ? "fails" : "passes", (long long)(runs - runs_before),
+        budget_exhausted && !fails ? ", out of budget" : "");
+    fflush(stdout);
+    // The budget of the workload is not that of the batch.
+    found_before_search = found;
+    max_runs = 0;
+    budget_exhausted = false;
+  }
+  max_runs = runs_per_workload;
+  found_before_search = 0;
+  printf("%lld workloads, %zu failing\n", (long long)batch_workloads,
+      failing.size());
+  for (const std::string& failed : failing) {
+    printf("--workload='%s'\n", failed.c_str());
+  }
+}
+
+// --explorer=auto probes each explorer of --auto-explorers for --probe-runs
+// runs, in a forked process so that each starts from the same state, and
+// then gives the rest of the budget to the one that did best: one whose
+// probe found a bug, else one whose estimate of its runs, see
+// estimated-runs, fits in what is left of the budget, as it will finish,
+// else the one that found the most distinct traces per second.
+static const Explorer* probed_explorer;
+static int64_t probe_runs = 1000;
+
+static void ProbeExplorer(int id) {
+  save_frontier_file.clear();
+  int64_t limit = GetStatistic<int64_t>("runs") + probe_runs;
+  max_runs = max_runs > 0 ? std::min(max_runs, limit) : limit;
+  // Lazy histories do not count distinct traces.
+  history->set_lazy(false);
+  probed_explorer->run();
+}
+
+static void RunAuto(const std::string& explorers) {
+  const int64_t& runs = GetStatistic<int64_t>("runs");
+  const int64_t& distinct = GetStatistic<int64_t>("distinct");
+  const int64_t& found = GetStatistic<int64_t>("found");
+  const auto start = std::chrono::steady_clock::now();
+
+  const Explorer* best = nullptr;
+  double best_rate = -1;
+  bool best_finishes = false;
+  std::stringstream in(explorers);
+  std::string name;
+  while (std::getline(in, name, ',') && !OutOfBudget()) {
+    probed_explorer = FindExplorer(name);
+    if (probed_explorer == nullptr || name == "pinner" ||
+        name == "pinner-interactive" || name.compare(0, 9, "parallel-") == 0) {
+      fprintf(stderr, "invalid auto explorer %s\n", name.c_str());
+      exit(1);
+    }
+    int64_t runs_before = runs, distinct_before = distinct;
+    int64_t found_before = found;
+    estimated_runs = 0;
+    auto probe_start = std::chrono::steady_clock::now();
+    RunWorkers(1, ProbeExplorer);
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - probe_start).count();
+    double rate = (distinct - distinct_before) / std::max(seconds, 1e-9);
+    double runs_per_second = (runs - runs_before) / std::max(seconds, 1e-9);
+
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    bool finishes = estimated_runs > 0 &&
+        (max_runs <= 0 || estimated_runs <= max_runs - runs) &&
+        (max_seconds <= 0 ||
+         estimated_runs / runs_per_second <= max_seconds - elapsed);
+    fprintf(stderr, "auto probe %s: %.0f runs/s, %.0f distinct/s, "
+        "%lld estimated runs%s\n", name.c_str(), runs_per_second, rate,
+        (long long)estimated_runs, found > found_before ? ", found" : "");
+
+    if (found > found_before) {
+      best = probed_explorer;
+      break;
+    }
+    if (best == nullptr || (finishes && !best_finishes) ||
+        (finishes == best_finishes && rate > best_rate)) {
+      best = probed_explorer;
+      best_rate = rate;
+      best_finishes = finishes;
+    }
+  }
+  if (best == nullptr || OutOfBudget()) {
+    return;
+  }
+
+  fprintf(stderr, "auto picks %s\n", best->name);
+  estimated_runs = 0;
+  history->set_lazy(best->lazy_history);
+  best->run();
+}
+
+// Sets scheduling_points from --scheduling-points. Listed locations are ids,
+// or file:line, which stands for every location registered at that line of
+// a file whose path ends in file. Returns false if one matches nothing.
+static bool ParseSchedulingPoints(const std::string& points) {
+  if (points == "all" || points == "atomic" || points == "sync") {
+    scheduling_points = points == "all" ? SchedulingPoints::ALL :
+        points == "atomic" ? SchedulingPoints::ATOMIC : SchedulingPoints::SYNC;
+    return true;
+  }
+  scheduling_points = SchedulingPoints::LOCATIONS;
+  uint32_t count = CountLocations();
+  scheduling_locations.assign(count, false);
+  std::stringstream in(points);
+  std::string point;
+  while (std::getline(in, point, ',')) {
+    size_t colon = point.rfind(':');
+    char* end;
+    bool matched = false;
+    if (colon == std::string::npos) {
+      uint32_t location = strtoul(point.c_str(), &end, 10);
+      matched = *end == '\0' && location > 0 && location < count;
+      if (matched) {
+        scheduling_locations[location] = true;
+      }
+    } else {
+      std::string file = point.substr(0, colon);
+      int line = strtol(point.c_str() + colon + 1, &end, 10);
+      for (uint32_t location = 1; location < count && *end == '\0';
+          location++) {
+        uint32_t inlined_at;
+        const Location& l = FindLocation(location, &inlined_at);
+        std::string path = l.file;
+        if (l.line == line && path.size() >= file.size() &&
+            path.compare(path.size() - file.size(), file.size(), file) == 0) {
+          scheduling_locations[location] = true;
+          matched = true;
+        }
+      }
+    }
+    if (!matched) {
+      return false;
+    }
+  }
+  return true;
+}
+
 int main(int argc, char** argv) {
-  //show_all_transitions = true;
-  //show_debug_output = true;
-  //show_program_output = true;
+  ParseFlags(argc, argv);
+  if (GetFlag("fork-server", false)) {
+    ServeForks(argv[0]);
+  }
+
+  show_all_transitions = GetFlag("show-transitions", false);
+  show_program_output = GetFlag("show-program-output", false);
+  show_debug_output = GetFlag("show-debug-output", false);
+  intercept_private_accesses = GetFlag("intercept-private", false);
+  coalesce_accesses = GetFlag("coalesce", false);
+  symmetry_reduction = GetFlag("symmetry", false);
+  reuse_freed_memory = GetFlag("reuse-freed", false);
+  setup_once = GetFlag("setup-once", false);
+  weak_atomics = GetFlag("weak-atomics", false);
+  detect_races = GetFlag("detect-races", false);
+  detect_frees = GetFlag("detect-frees", false);
+  std::string state_key = GetFlag("state-key", "hb");
+  if (state_key != "hb" && state_key != "memory") {
+    fprintf(stderr, "--state-key must be hb or memory\n");
+    return 1;
+  }
+  hash_memory_state = state_key == "memory";
+  operation_steps = GetFlag("operation-steps", false);
+  spin_reads = GetFlag("spin-reads", spin_reads);
+  max_run_steps = GetFlag("max-run-steps", max_run_steps);
+  retry_cutoff = GetFlag("retry-cutoff", retry_cutoff);
+  prune_cut_off_runs = GetFlag("prune-cut-off", prune_cut_off_runs);
+  stop_run_on_found = GetFlag("stop-run-on-found", stop_run_on_found);
+  commuting_adds = GetFlag("commuting-adds", commuting_adds);
+  workload = GetFlag("workload", "random:3x3");
+  std::string coverage_file = GetFlag("coverage-file", "");
+  if (!coverage_file.empty()) {
+    coverage_fd = open(coverage_file.c_str(),
+        O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (coverage_fd < 0) {
+      fprintf(stderr, "failed to open %s\n", coverage_file.c_str());
+      exit(1);
+    }
+  }
+  bug_directory = GetFlag("bug-dir", "");
+  bug_corpus_file = GetFlag("bug-corpus", "");
+  if (!bug_directory.empty() && mkdir(bug_directory.c_str(), 0777) != 0 &&
+      errno != EEXIST) {
+    fprintf(stderr, "failed to create %s\n", bug_directory.c_str());
+    exit(1);
+  }
+  distinct_table_bytes =
+      GetFlag<size_t>("distinct-table-mb", distinct_table_bytes >> 20) << 20;
+  finish_every_run = GetFlag("finish-every-run", finish_every_run);
+  fiber_stack_size = GetFlag<size_t>("stack-kb", fiber_stack_size >> 10) << 10;
+  preserve_fpu_state = GetFlag("preserve-fpu", false);
+  huge_pages = GetFlag("huge-pages", false);
+  linearizability_workers = GetFlag("linearizability-workers", 1);
+  stress_repeat = GetFlag("stress-repeat", stress_repeat);
+  pin_workers = GetFlag("pin-workers", false);
+  spill_directory = GetFlag("spill-dir", "");
+  spill_window_bytes =
+      GetFlag<size_t>("spill-window-mb", spill_window_bytes >> 20) << 20;
+
+  min_preemptions = GetFlag("min-preemptions", min_preemptions);
+  max_preemptions = GetFlag("max-preemptions", max_preemptions);
+  pct_changes = std::min(GetFlag("pct-changes", pct_changes), kMaxPCTChanges);
+  seed = GetFlag<uint64_t>("seed", seed);
+  pct_run = GetFlag("pct-run", "");
+  walk_sleep_sets = GetFlag("walk-sleep-sets", walk_sleep_sets);
+  backtrack_probability = GetFlag("backtrack-probability",
+      backtrack_probability);
+  prune_using_hash_table = GetFlag("prune", prune_using_hash_table);
+  stateful = GetFlag("stateful", stateful);
+  stateful_max_states = GetFlag("stateful-max-states", stateful_max_states);
+  seen_table_bytes = GetFlag<size_t>("prune-table-mb", seen_table_bytes >> 20)
+      << 20;
+  if (GetFlag("only-preempt-on-atomic", false)) {
+    scheduling_points = SchedulingPoints::ATOMIC;
+  }
+  std::string points = GetFlag("scheduling-points", "");
+  if (!points.empty() && !ParseSchedulingPoints(points)) {
+    fprintf(stderr, "invalid --scheduling-points %s\n", points.c_str());
+    exit(1);
+  }
+  checkpoint_interval = GetFlag("checkpoint-interval", checkpoint_interval);
+  checkpoint_min_depth = GetFlag("checkpoint-min-depth", checkpoint_min_depth);
+  page_out_checkpoints = GetFlag("checkpoint-pageout", page_out_checkpoints);
+  memory_budget_bytes =
+      GetFlag<size_t>("memory-budget-mb", memory_budget_bytes >> 20) << 20;
+  if (checkpoint_interval > 0) {
+    Interceptor::ShareDistinct();
+  }
+  max_seconds = GetFlag("max-seconds", max_seconds);
+  max_runs = GetFlag("max-runs", max_runs);
+  max_transitions = GetFlag("max-transitions", max_transitions);
+  stop_on_bug = GetFlag("stop-on-bug", stop_on_bug);
+
+  save_frontier_file = GetFlag("save-frontier", "");
+  std::string profile_file = GetFlag("profile-locations", "");
+  if (!profile_file.empty()) {
+    EnableLocationProfile();
+  }
+  std::string address_profile_file = GetFlag("profile-addresses", "");
+  if (!address_profile_file.empty()) {
+    EnableAddressProfile();
+  }
+  std::string coverage_map_file = GetFlag("coverage-map", "");
+  if (GetFlag("conflict-coverage", false) || !coverage_map_file.empty()) {
+    EnableConflictCoverage(coverage_map_file);
+  }
+
+  if (GetFlag("perf-counters", false)) {
+#ifdef CODEX_TIMERS
+    EnablePerfCounters();
+#else
+    fprintf(stderr, "--perf-counters needs a build with TIMERS=1\n");
+    exit(1);
+#endif
+  }
+
+  slow_runs = GetFlag("slow-runs", slow_runs);
+  hb_graph_format = GetFlag("hb-graph", "");
+  if (!hb_graph_format.empty() && hb_graph_format != "bin" &&
+      hb_graph_format != "dot") {
+    fprintf(stderr, "invalid --hb-graph %s\n", hb_graph_format.c_str());
+    exit(1);
+  }
+  int stats_fd = GetFlag("stats-fd", -1);
+  background_queue_bytes = GetFlag<size_t>("writer-queue-mb",
+      background_queue_bytes >> 20) << 20;
+  if (stats_fd >= 0) {
+    StreamStatisticsTo(stats_fd, GetFlag("stats-interval", 1.0));
+  }
+  std::string introspect = GetFlag("introspect", "");
+  if (!introspect.empty()) {
+    StartIntrospection(introspect, IntrospectionReport, StopOnIntrospection);
+  }
+
+  std::string explorer = GetFlag("explorer", "cbdpor");
+  std::string resume_file = GetFlag("resume", "");
+  if (!resume_file.empty()) {
+    LoadFrontier(resume_file, &frontier);
+    explorer = frontier.explorer;
+    resuming = true;
+    std::string share = GetFlag("resume-share", "");
+    if (!share.empty() && (sscanf(share.c_str(), "%d/%d", &resume_share,
+            &resume_shares) != 2 || resume_shares < 1 || resume_share < 0 ||
+          resume_share >= resume_shares)) {
+      fprintf(stderr, "invalid --resume-share %s\n", share.c_str());
+      exit(1);
+    }
+  }
+
+  std::string replay_file = GetFlag("replay", "");
+  if (operation_steps && (explorer == "hybrid" || explorer == "auto" ||
+        !replay_file.empty())) {
+    fprintf(stderr, "--operation-steps does not go with --explorer=%s or "
+        "--replay\n", explorer.c_str());
+    exit(1);
+  }
+  // Only a search that can start over can refine its scheduling points.
+  if (RefinesSchedulingPoints() && (explorer == "hybrid" ||
+        explorer == "auto" || !replay_file.empty())) {
+    fprintf(stderr, "--scheduling-points=%s does not go with --explorer=%s "
+        "or --replay\n", points.c_str(), explorer.c_str());
+    exit(1);
+  }
+  std::string workloads_file = GetFlag("workloads", "");
+  if (!workloads_file.empty() && (explorer == "hybrid" ||
+        explorer == "auto" || explorer == "stress" ||
+        explorer.compare(0, 6, "pinner") == 0 || !replay_file.empty() ||
+        resuming || setup_once || RefinesSteps())) {
+    fprintf(stderr, "--workloads does not go with --explorer=%s, --replay, "
+        "--resume, --setup-once, --operation-steps or sync or location "
+        "--scheduling-points\n", explorer.c_str());
+    exit(1);
+  }
 
   interceptor = SetupInterfaceAndInterceptor();
   history = new HHBHistory();
 
-  //RunSingle();
-  //RunBruteForce();
-  //RunCHESS();
-  //RunPBPOR();
-  //RunPCT();
-  //RunPinner();
-  //RunDPOR();
-  RunCBDPOR();
+  if (!bug_corpus_file.empty()) {
+    ReplayBugCorpus();
+  }
 
-  //RunPinnerInteractive();
-}
+  if (!replay_file.empty()) {
+    RunReplay(replay_file);
+  } else if (explorer == "hybrid") {
+    RunHybrid(GetFlag("phases", ""));
+  } else if (explorer == "auto") {
+    probe_runs = GetFlag("probe-runs", probe_runs);
+    RunAuto(GetFlag("auto-explorers", "cbdpor,pct,chess"));
+  } else if (const Explorer* run = FindExplorer(explorer)) {
+    history->set_lazy(run->lazy_history);
+    if (!workloads_file.empty()) {
+      RunWorkloads(workloads_file, run);
+    } else if (RefinesSteps()) {
+      RunRefiningSteps(run);
+    } else {
+      run->run();
+    }
+  } else {
+    fprintf(stderr, "unknown explorer %s\n", explorer.c_str());
+    PrintUsageAndExit(argv[0]);
+  }
+  history->set_lazy(false);
+  PrintSlowestRuns();
+  if (!profile_file.empty()) {
+    WriteLocationProfile(profile_file);
+  }
+  if (!address_profile_file.empty()) {
+    WriteAddressProfile(address_profile_file);
+  }
+  if (!coverage_map_file.empty()) {
+    SaveConflictCoverage(coverage_map_file);
+  }
 
+  if (GetFlag("minimize", false) && GetStatistic<int64_t>("found") > 0) {
+    if (bug_directory.empty()) {
+      MinimizeFoundTrace(kTraceFile, false);
+    } else {
+      MinimizeBugClasses();
+    }
+  }
+}
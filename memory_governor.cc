@@ -0,0 +1,106 @@
+#include "memory_governor.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "parallel.h"
+#include "statistics.h"
+
+size_t memory_budget_bytes = 0;
+
+static int64_t& memory_resident_bytes =
+    RegisterStatistic<int64_t>("memory-resident-bytes");
+static int64_t& memory_over_budget =
+    RegisterStatistic<int64_t>("memory-over-budget");
+
+static const auto kCheckInterval = std::chrono::milliseconds(200);
+
+struct MemoryConsumer {
+  MemoryConsumerRank rank;
+  size_t (*usage)();
+  size_t (*shed)();
+  int64_t* bytes;
+  int64_t* sheds;
+};
+
+static std::vector<MemoryConsumer>& Consumers() {
+  static std::vector<MemoryConsumer> consumers;
+  return consumers;
+}
+
+static std::atomic<bool>* pressure = nullptr;
+
+bool RegisterMemoryConsumer(const char* name, MemoryConsumerRank rank,
+    size_t (*usage)(), size_t (*shed)()) {
+  std::string prefix = std::string("memory-") + name;
+  std::vector<MemoryConsumer>& consumers = Consumers();
+  MemoryConsumer consumer = {rank, usage, shed,
+      &RegisterStatistic<int64_t>(prefix + "-bytes"),
+      &RegisterStatistic<int64_t>(prefix + "-sheds")};
+  // Static initialization registers them in no particular order.
+  auto position = consumers.begin();
+  while (position != consumers.end() && position->rank <= rank) {
+    ++position;
+  }
+  consumers.insert(position, consumer);
+  return true;
+}
+
+// The resident set of this process, from the second field of statm, in pages.
+static int64_t ResidentBytes() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm == nullptr) {
+    return 0;
+  }
+  long long size, resident;
+  int fields = fscanf(statm, "%lld %lld", &size, &resident);
+  fclose(statm);
+  return fields == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+void GovernMemory() {
+  static auto next_check = std::chrono::steady_clock::now();
+  if (memory_budget_bytes == 0) {
+    return;
+  }
+  if (pressure == nullptr) {
+    pressure = new (AllocateShared(sizeof(std::atomic<bool>)))
+        std::atomic<bool>(false);
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now < next_check) {
+    return;
+  }
+  next_check = now + kCheckInterval;
+
+  memory_resident_bytes = ResidentBytes();
+  for (MemoryConsumer& consumer : Consumers()) {
+    *consumer.bytes = consumer.usage();
+  }
+  bool over = memory_resident_bytes > static_cast<int64_t>(memory_budget_bytes);
+  pressure->store(over, std::memory_order_relaxed);
+  if (!over) {
+    return;
+  }
+  memory_over_budget++;
+
+  // One consumer per check, as the next one sees what this freed.
+  for (MemoryConsumer& consumer : Consumers()) {
+    if (*consumer.bytes > 0) {
+      *consumer.bytes -= consumer.shed();
+      (*consumer.sheds)++;
+      return;
+    }
+  }
+}
+
+bool UnderMemoryPressure() {
+  return pressure != nullptr && pressure->load(std::memory_order_relaxed);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+// One memory budget for the whole search, for hosts where it shares RAM with
+// others: rather than growing until it is killed, the search gives back the
+// memory of caches and sets it can do without, and slows down instead. The
+// governor compares the resident memory of the process with the budget where
+// explorers check theirs, a few times a second, and while over it asks one
+// consumer after another to shed what it holds, from the cheapest to lose to
+// the dearest. Each consumer reports its bytes and sheds as
+// memory-<name>-bytes and memory-<name>-sheds.
+//
+// Checkpoints (see TraceBuilder::ExploreFromCheckpoint) are separate
+// processes, which the governor of the searching one cannot shed. Under
+// pressure it forks no new ones, and has those waiting for their children
+// page out their memory at once, as with --checkpoint-pageout.
+extern size_t memory_budget_bytes; // 0 for none
+
+// Registers a consumer during static initialization, as statistics are, and
+// returns true. usage returns the bytes it holds, and shed gives back what it
+// can and returns the bytes freed. Consumers of lower rank are shed first.
+enum MemoryConsumerRank {
+  kCacheRank, // costs rebuilding what was cached
+  kStatisticRank, // costs the exactness of statistics
+  kPruningRank, // costs exploring again what would have been pruned
+};
+bool RegisterMemoryConsumer(const char* name, MemoryConsumerRank rank,
+    size_t (*usage)(), size_t (*shed)());
+
+// Called wherever explorers check their budget, and cheap between checks.
+void GovernMemory();
+
+// Whether the last check found the search over budget. Shared with the
+// processes forked for checkpoints, so they see the pressure of their
+// descendants.
+bool UnderMemoryPressure();
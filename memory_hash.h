@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include "config.h"
+
+// A Zobrist hash of the memory of the tested program: the xor, over the
+// aligned 8-byte words written since the run's Setup, of a hash of each
+// word's address and contents then, and of its address and contents now.
+// Every write toggles the words it touches out before it and back in after,
+// which takes constant time for an access and time linear in the length for
+// a bulk copy or set, so runs that leave memory alike hash alike, whatever
+// steps took them there. Only kept with hash_memory_state, for
+// Interceptor::StateHash.
+//
+// Blocks that reuse_freed_memory hands out again are zeroed without a write,
+// so runs that reuse them can hash apart although memory is alike; they are
+// never hashed alike when it is not.
+extern uint64_t memory_state_hash;
+
+inline void ToggleMemoryHash(const void* address, int64_t length) {
+  if (!hash_memory_state || length <= 0) {
+    return;
+  }
+  uintptr_t word = reinterpret_cast<uintptr_t>(address) & ~uintptr_t(7);
+  uintptr_t last = (reinterpret_cast<uintptr_t>(address) + length - 1) &
+      ~uintptr_t(7);
+  for (; word <= last; word += 8) {
+    uint64_t z = word * 0x9e3779b97f4a7c15ULL ^
+        *reinterpret_cast<const uint64_t*>(word);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    memory_state_hash ^= z ^ (z >> 31);
+  }
+}
@@ -0,0 +1,271 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "background_writer.h"
+
+bool pin_workers = false;
+
+void* AllocateShared(size_t size) {
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return memory;
+}
+
+// The CPUs of each NUMA node that this process may run on, nodes without
+// any left out, or all of them as one node where that is unknown.
+static const std::vector<std::vector<int>>& NodeCPUs() {
+  static std::vector<std::vector<int>>* nodes = nullptr;
+  if (nodes != nullptr) {
+    return *nodes;
+  }
+  nodes = new std::vector<std::vector<int>>();
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    CPU_ZERO(&allowed);
+  }
+  for (int node = 0; pin_workers; node++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+        node);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+      break;
+    }
+    // A list of ranges, such as 0-7,16-23.
+    std::vector<int> cpus;
+    int first, last;
+    while (fscanf(file, "%d", &first) == 1) {
+      last = first;
+      if (fscanf(file, "-%d", &last) != 1) {
+        last = first;
+      }
+      for (int cpu = first; cpu <= last; cpu++) {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+          cpus.push_back(cpu);
+        }
+      }
+      if (fgetc(file) != ',') {
+        break;
+      }
+    }
+    fclose(file);
+    if (!cpus.empty() && nodes->size() < kMaxNodes) {
+      nodes->push_back(cpus);
+    }
+  }
+  if (nodes->empty() && pin_workers) {
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty()) {
+      nodes->push_back(cpus);
+    }
+  }
+#endif
+  return *nodes;
+}
+
+static int worker_node = 0;
+
+int CountWorkerNodes() {
+  return std::max<int>(NodeCPUs().size(), 1);
+}
+
+int WorkerNode() {
+  return worker_node;
+}
+
+// Workers go to the nodes in turn, and to the CPUs of each in turn.
+static void PlaceWorker(int id) {
+  const std::vector<std::vector<int>>& nodes = NodeCPUs();
+  if (nodes.empty()) {
+    return;
+  }
+  worker_node = id % nodes.size();
+  const std::vector<int>& cpus = nodes[worker_node];
+#ifdef __linux__
+  cpu_set_t cpu;
+  CPU_ZERO(&cpu);
+  CPU_SET(cpus[id / nodes.size() % cpus.size()], &cpu);
+  if (sched_setaffinity(0, sizeof(cpu), &cpu) != 0) {
+    perror("sched_setaffinity");
+  }
+#endif
+}
+
+WorkQueue* WorkQueue::Create(int num_workers) {
+  // Anonymous mappings are zero-filled, which is a valid initial state for the
+  // claim table.
+  WorkQueue* queue =
+      reinterpret_cast<WorkQueue*>(AllocateShared(sizeof(WorkQueue)));
+  queue->num_workers_ = num_workers;
+  queue->num_rings_ = CountWorkerNodes();
+  for (int i = 0; i < queue->num_rings_; i++) {
+    Ring& ring = queue->rings_[i];
+    ring.lock = 0;
+    ring.begin = i * kWorkQueueSize / queue->num_rings_;
+    ring.capacity = (i + 1) * kWorkQueueSize / queue->num_rings_ - ring.begin;
+    ring.head = 0;
+    ring.size = 0;
+  }
+  queue->idle_workers_ = 0;
+  queue->size_ = 0;
+  queue->finished_ = false;
+  return queue;
+}
+
+void WorkQueue::Lock(Ring* ring) {
+  int expected = 0;
+  while (!ring->lock.compare_exchange_weak(expected, 1,
+        std::memory_order_acquire)) {
+    expected = 0;
+    sched_yield();
+  }
+}
+
+void WorkQueue::Unlock(Ring* ring) {
+  ring->lock.store(0, std::memory_order_release);
+}
+
+bool WorkQueue::Push(const int8_t* path, const ThreadSet* available,
+    int length, int thread, ThreadSet sleepset) {
+  if (length > kMaxPrefixLength) {
+    return false;
+  }
+
+  Ring* ring = &rings_[WorkerNode() % num_rings_];
+  Lock(ring);
+  if (ring->size == ring->capacity) {
+    Unlock(ring);
+    return false;
+  }
+  WorkItem& item =
+      items_[ring->begin + (ring->head + ring->size) % ring->capacity];
+  item.length = length;
+  item.thread = thread;
+  item.sleepset = sleepset;
+  memcpy(item.path, path, length);
+  memcpy(item.available, available, (length + 1) * sizeof(ThreadSet));
+  ring->size++;
+  size_++;
+  Unlock(ring);
+  return true;
+}
+
+bool WorkQueue::PopFrom(Ring* ring, WorkItem* item, bool idle) {
+  // Empty rings are passed over without taking their locks.
+  if (ring->size.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  Lock(ring);
+  if (ring->size == 0) {
+    Unlock(ring);
+    return false;
+  }
+  const WorkItem& head = items_[ring->begin + ring->head];
+  item->length = head.length;
+  item->thread = head.thread;
+  item->sleepset = head.sleepset;
+  memcpy(item->path, head.path, head.length);
+  memcpy(item->available, head.available,
+      (head.length + 1) * sizeof(ThreadSet));
+  ring->head = (ring->head + 1) % ring->capacity;
+  ring->size--;
+  if (idle) {
+    idle_workers_--;
+  }
+  size_--;
+  Unlock(ring);
+  return true;
+}
+
+bool WorkQueue::Pop(WorkItem* item) {
+  bool idle = false;
+  int node = WorkerNode() % num_rings_;
+  while (true) {
+    // The other nodes in turn, which on two sockets is the other one.
+    for (int i = 0; i < num_rings_; i++) {
+      if (PopFrom(&rings_[(node + i) % num_rings_], item, idle)) {
+        return true;
+      }
+    }
+
+    if (!idle) {
+      idle = true;
+      idle_workers_++;
+    }
+    // Only busy workers can produce new items.
+    if (idle_workers_ == num_workers_ && size_ == 0) {
+      finished_ = true;
+    }
+    if (finished_) {
+      return false;
+    }
+    usleep(50);
+  }
+}
+
+bool WorkQueue::Claim(uint64_t node_hash, int thread) {
+  // Zero marks an empty slot.
+  uint64_t key = ExtendPathHash(node_hash, thread) | 1;
+  const uint64_t mask = (1 << kLogClaimTableSize) - 1;
+
+  uint64_t slot = key & mask;
+  for (int probe = 0; probe < 64; probe++) {
+    uint64_t expected = 0;
+    if (claims_[slot].compare_exchange_strong(expected, key)) {
+      return true;
+    } else if (expected == key) {
+      return false;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return true;
+}
+
+void RunWorkers(int num_workers, void (*worker)(int)) {
+  fflush(stdout);
+  fflush(stderr);
+
+  for (int id = 0; id < num_workers; id++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    } else if (pid == 0) {
+      if (pin_workers) {
+        PlaceWorker(id);
+      }
+      worker(id);
+      FlushBackgroundWrites();
+      fflush(stdout);
+      fflush(stderr);
+      _exit(0);
+    }
+  }
+
+  for (int id = 0; id < num_workers; id++) {
+    int status;
+    wait(&status);
+  }
+}
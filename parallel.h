@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "threadset.h"
+
+// Work sharing between forked explorer processes. Every worker owns a full
+// replica of the runtime (interceptor, history, fibers, program state), so the
+// only things exchanged are schedule prefixes: a WorkItem names a TraceNode by
+// the path of threads leading to it.
+
+static const int kMaxPrefixLength = 4096;
+static const int kWorkQueueSize = 64;
+static const int kLogClaimTableSize = 20;
+static const int kMaxNodes = 8;
+
+// With pin_workers, RunWorkers pins each worker to a CPU of its own, spreading
+// them evenly over the NUMA nodes, before it touches any memory. The pages a
+// worker copies on write, of its arena, history and stacks, then come from
+// its own node. The work queue keeps the items of each node apart, and
+// workers take those of their own node first, so that prefixes mostly stay
+// on the socket whose caches hold them. Linux only; elsewhere, and on
+// machines with one node, the queue has a single ring.
+extern bool pin_workers;
+
+struct WorkItem {
+  int length;
+  // Thread to extend the node with, or -1 to explore the whole node.
+  int thread;
+  ThreadSet sleepset;
+  int8_t path[kMaxPrefixLength];
+  // The DPOR available sets of the handing-out worker along the prefix,
+  // including the node itself.
+  ThreadSet available[kMaxPrefixLength + 1];
+};
+
+// WorkQueue lives in a MAP_SHARED mapping created before forking the workers,
+// and is only accessed through atomics and a spinlock per node.
+class WorkQueue {
+ public:
+  static WorkQueue* Create(int num_workers);
+
+  // Queues the item on the node of the calling worker. Returns false if its
+  // ring is full or the prefix is too long, in which case the caller must
+  // explore the item itself.
+  bool Push(const int8_t* path, const ThreadSet* available, int length,
+      int thread, ThreadSet sleepset);
+
+  // Blocks until an item is available, from the node of the calling worker
+  // if it has any and from the nearest other node otherwise, or every worker
+  // is idle, in which case the search is complete and Pop returns false.
+  bool Pop(WorkItem* item);
+
+  // Claims the pair (node hash, thread) for exploration. Returns false if some
+  // worker already claimed it. A full table claims everything, which only
+  // costs duplicate work.
+  bool Claim(uint64_t node_hash, int thread);
+
+  inline bool has_idle_workers() const {
+    return idle_workers_.load(std::memory_order_relaxed) > 0 &&
+        size_.load(std::memory_order_relaxed) == 0;
+  }
+
+ private:
+  // The items queued by the workers of a node, in a slice of items_, behind
+  // a lock on a cache line of its own.
+  struct alignas(64) Ring {
+    std::atomic<int> lock;
+    int begin;
+    int capacity;
+    int head;
+    std::atomic<int> size;
+  };
+
+  void Lock(Ring* ring);
+  void Unlock(Ring* ring);
+  bool PopFrom(Ring* ring, WorkItem* item, bool idle);
+
+  int num_workers_;
+  int num_rings_;
+  Ring rings_[kMaxNodes];
+  std::atomic<int> idle_workers_;
+  // Of all rings. A worker taking an item stops counting as idle before the
+  // item stops counting here, so that idle workers and an empty queue
+  // together always mean the search is over.
+  std::atomic<int> size_;
+  std::atomic<bool> finished_;
+  WorkItem items_[kWorkQueueSize];
+  std::atomic<uint64_t> claims_[1 << kLogClaimTableSize];
+};
+
+// Hash of the path to a child of the node with hash parent.
+inline uint64_t ExtendPathHash(uint64_t parent, int thread) {
+  uint64_t z = parent + 0x9e3779b97f4a7c15ULL * (thread + 1);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Allocates size zero-filled bytes in a MAP_SHARED mapping, which processes
+// forked afterwards share.
+void* AllocateShared(size_t size);
+
+// Forks num_workers processes that each call worker(id) and waits for them.
+void RunWorkers(int num_workers, void (*worker)(int));
+
+// The number of NUMA nodes workers are placed on, 1 without pin_workers, and
+// the node of the calling worker, 0 outside of workers.
+int CountWorkerNodes();
+int WorkerNode();
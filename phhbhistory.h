@@ -7,27 +7,43 @@
 class PHHBHistory : public HHBHistory {
  public:
   virtual void AddTransition(int thread, const Transition& transition) {
-    first_conflicts_at_.push_back(FindFirstConflicts(thread, transition));
-    previous_time_of_thread_at_.push_back(current_cv_for(thread)[thread]);
+    FindFirstConflicts(thread, transition, &first_conflicts_);
+    first_conflicts_end_at_.push_back(first_conflicts_.size());
     HHBHistory::AddTransition(thread, transition);
   }
 
   virtual void Reset() {
     HHBHistory::Reset();
-    first_conflicts_at_.clear();
-    previous_time_of_thread_at_.clear();
+    first_conflicts_.clear();
+    first_conflicts_end_at_.clear();
   }
 
-  inline const std::vector<int>& first_conflicts_at(int time) const {
-    return first_conflicts_at_[time];
+  virtual void Truncate(int length) {
+    HHBHistory::Truncate(length);
+    first_conflicts_end_at_.resize(length);
+    first_conflicts_.resize(length > 0 ? first_conflicts_end_at_.back() : 0);
   }
 
-  inline int previous_time_of_thread_at(int time) const {
-    return previous_time_of_thread_at_[time];
+  virtual void Reserve(int capacity) {
+    HHBHistory::Reserve(capacity);
+    first_conflicts_end_at_.reserve(capacity);
+  }
+
+  // The first conflicts of the step at time, in increasing order, as a
+  // range into the shared buffer that stays valid until the next change to
+  // the history.
+  inline const int* first_conflicts_begin(int time) const {
+    return first_conflicts_.data() +
+        (time > 0 ? first_conflicts_end_at_[time - 1] : 0);
+  }
+
+  inline const int* first_conflicts_end(int time) const {
+    return first_conflicts_.data() + first_conflicts_end_at_[time];
   }
 
  private:
-  std::vector<std::vector<int>> first_conflicts_at_;
-  std::vector<int> previous_time_of_thread_at_;
+  // The first conflicts of all steps, back to back, and where those of each
+  // step end.
+  std::vector<int> first_conflicts_;
+  std::vector<int> first_conflicts_end_at_;
 };
-
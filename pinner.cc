@@ -1,21 +1,31 @@
 #include "pinner.h"
 
+#include <algorithm>
+#include <iterator>
 #include <vector>
 
 #include <cstdio>
 #include <climits>
 
 #include "interceptor.h"
+#include "memory_governor.h"
 #include "phhbhistory.h"
 #include "statistics.h"
 #include "transition.h"
 
-// NOTE: pinner is broken
+extern bool OutOfBudget();
 
-extern Interceptor* interceptor;
+static int64_t& pinner_states = RegisterStatistic<int64_t>("pinner-states");
+
+// Explore only keeps the states along its current path alive, so this bound
+// rarely matters, but a deep first path should not pin its memory forever.
+static const int kMaxCachedPinnerStates = 64;
 
 static std::vector<PinnerState*> state_cache;
 
+// Set whenever max_cost keeps a choice from being generated or explored.
+static bool cost_bound_reached;
+
 PinnerState* GetUnusedState() {
   if (state_cache.empty()) {
     return new PinnerState();
@@ -27,9 +37,35 @@ PinnerState* GetUnusedState() {
 }
 
 void ReturnUnusedState(PinnerState* state) {
-  state_cache.push_back(state);
+  if (state_cache.size() < kMaxCachedPinnerStates) {
+    state_cache.push_back(state);
+  } else {
+    delete state;
+  }
+}
+
+static size_t PinnerCacheBytes() {
+  size_t bytes = 0;
+  for (PinnerState* state : state_cache) {
+    bytes += sizeof(PinnerState) +
+        (state->first_seen.capacity() + state->last_considered.capacity()) *
+        sizeof(int);
+  }
+  return bytes;
+}
+
+static size_t ShedPinnerCache() {
+  size_t bytes = PinnerCacheBytes();
+  for (PinnerState* state : state_cache) {
+    delete state;
+  }
+  std::vector<PinnerState*>().swap(state_cache);
+  return bytes;
 }
 
+static const bool pinner_cache_governed = RegisterMemoryConsumer(
+    "pinner-cache", kCacheRank, PinnerCacheBytes, ShedPinnerCache);
+
 void PrepareStateForNewRun(PinnerState* state) {
   state->first_seen.clear();
   state->last_considered.clear();
@@ -40,15 +76,14 @@ void PrepareStateForNewRun(PinnerState* state) {
   state->thread_cost.clear();
 }
 
-static void Push(PinnerState* state, int first_seen, int last_considered, bool fixed,
-    bool is_a_pin) {
+static void Push(PinnerState* state, int time, int first_seen,
+    int last_considered, bool fixed, bool is_a_pin) {
   state->first_seen.push_back(first_seen);
   state->last_considered.push_back(last_considered);
   state->fixed.push_back(fixed);
   state->is_a_pin.push_back(is_a_pin);
 
   if (fixed) {
-    int time = state->history.length() - 1;
     int thread = state->history.thread_at(time);
 
     if (!state->last_pin.count(thread)) {
@@ -63,7 +98,8 @@ static void Push(PinnerState* state, int first_seen, int last_considered, bool f
   }
 }
 
-int GetFirstRunnableThreadByParentFirstSeen(PinnerState* state) {
+int GetFirstRunnableThreadByParentFirstSeen(Interceptor* interceptor,
+    PinnerState* state) {
   int best_thread = -1;
   int best_parent_first_seen = INT_MAX;
   for (int thread : interceptor->runnable()) {
@@ -77,7 +113,7 @@ int GetFirstRunnableThreadByParentFirstSeen(PinnerState* state) {
   return best_thread;
 }
 
-void CreateInitialState(PinnerState* state) {
+void CreateInitialState(Interceptor* interceptor, PinnerState* state) {
   state->depth = 0;
   PrepareStateForNewRun(state);
   interceptor->StartNewRun(&state->history);
@@ -89,32 +125,57 @@ void CreateInitialState(PinnerState* state) {
       thread = *interceptor->runnable().begin();
     }
     interceptor->AdvanceThread(thread);
-    Push(state, state->depth, -1, false, false);
+    Push(state, state->history.length() - 1, state->depth, -1, false, false);
   }
 }
 
-void Pin(PinnerState* state, const Choice& choice, const PinnerState* old) {
-  int thread = old->history.thread_at(choice.time);
+// Whether the step at time happens after any step in c, which holds 999 for
+// threads without one.
+static bool HappensAfterChoice(const PHHBHistory& history, int time,
+    const ClockVector& c) {
+  for (int thread = 0; thread < kMaxThreads; thread++) {
+    if (c[thread] != 999 && history.cv_at(time, thread) >= c[thread]) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  state->depth = old->depth + 1;
-  PrepareStateForNewRun(state);
-  interceptor->StartNewRun(&state->history);
+// The old state's steps that stay in front of the pin, and what Pin needs
+// of them. They are copied out first, as state may be old itself.
+struct KeptStep {
+  int time;
+  int first_seen;
+  int last_considered;
+  bool fixed;
+  bool is_a_pin;
+};
+
+static std::vector<KeptStep> kept_steps;
+static std::vector<int> kept_schedule;
+
+bool Pin(Interceptor* interceptor, PinnerState* state, const Choice& choice,
+    const PinnerState* old) {
+  int thread = old->history.thread_at(choice.time);
+  int depth = old->depth + 1;
 
   ThreadMap<int> special_last_considered;
 
+  kept_steps.clear();
+  kept_schedule.clear();
   for (int time = 0; time < old->history.length(); time++) {
     int thread = old->history.thread_at(time);
 
-    if (!old->history.cv_at(time).happens_after_any(choice.c)) {
-      interceptor->AdvanceThread(thread);
-
-      if (time < choice.time) {
-        Push(state, old->first_seen[time], old->depth,
-            old->fixed[time], old->is_a_pin[time]);
-      } else {
-        Push(state, old->first_seen[time], old->last_considered[time],
-            old->fixed[time], old->is_a_pin[time]);
-      }
+    if (!HappensAfterChoice(old->history, time, choice.c)) {
+      KeptStep step;
+      step.time = time;
+      step.first_seen = old->first_seen[time];
+      step.last_considered =
+          time < choice.time ? old->depth : old->last_considered[time];
+      step.fixed = old->fixed[time];
+      step.is_a_pin = old->is_a_pin[time];
+      kept_steps.push_back(step);
+      kept_schedule.push_back(thread);
     } else {
       if (!special_last_considered.count(thread)) {
         special_last_considered[thread] = old->last_considered[time];
@@ -122,10 +183,37 @@ void Pin(PinnerState* state, const Choice& choice, const PinnerState* old) {
     }
   }
 
+  // Pinning in place keeps the history of the steps in front of the first
+  // one that moves.
+  int reuse_length = 0;
+  if (state == old) {
+    while (reuse_length < kept_steps.size() &&
+        kept_steps[reuse_length].time == reuse_length) {
+      reuse_length++;
+    }
+  }
+
+  state->depth = depth;
+  PrepareStateForNewRun(state);
+  interceptor->StartNewRun(&state->history, reuse_length);
+  interceptor->AdvanceThreads(kept_schedule);
+  for (int time = 0; time < kept_steps.size(); time++) {
+    const KeptStep& step = kept_steps[time];
+    Push(state, time, step.first_seen, step.last_considered, step.fixed,
+        step.is_a_pin);
+  }
+
+  // The thread of the pin can depend on a moved step to have a next step at
+  // all, as a flush does on the store it flushes.
+  if (!interceptor->runnable().count(thread)) {
+    return false;
+  }
+
   int pin_point = state->history.length();
   interceptor->AdvanceThread(thread);
   assert(special_last_considered.count(thread));
-  Push(state, state->depth, special_last_considered[thread], true, true);
+  Push(state, pin_point, state->depth, special_last_considered[thread], true,
+      true);
   special_last_considered.erase(thread);
   for (int i = 0; i < pin_point; i++) {
     if (state->history.time_happens_before_time(i, pin_point)) {
@@ -134,26 +222,30 @@ void Pin(PinnerState* state, const Choice& choice, const PinnerState* old) {
   }
 
   while (!interceptor->finished()) {
-    //thread = GetFirstRunnableThreadByParentFirstSeen(state);
+    //thread = GetFirstRunnableThreadByParentFirstSeen(interceptor, state);
     if (!interceptor->runnable().count(thread)) {
       thread = *interceptor->runnable().begin();
     }
     interceptor->AdvanceThread(thread);
 
+    int time = state->history.length() - 1;
     if (special_last_considered.count(thread)) {
-      Push(state, state->depth, special_last_considered[thread], false, false);
+      Push(state, time, state->depth, special_last_considered[thread], false,
+          false);
       special_last_considered.erase(thread);
     } else {
-      Push(state, state->depth, -1, false, false);
+      Push(state, time, state->depth, -1, false, false);
     }
   }
+  return true;
 }
 
-int64_t& pinner_states = RegisterStatistic<int64_t>("pinner-states");
+// Walks the first conflicts of a step from last to first.
+typedef std::reverse_iterator<const int*> ConflictIterator;
 
-void ConsiderPin(PinnerState* state, 
-    std::vector<int>::const_reverse_iterator index, 
-    std::vector<int>::const_reverse_iterator end,
+void ConsiderPin(PinnerState* state,
+    ConflictIterator index,
+    ConflictIterator end,
     const ClockVector& b,
     bool b_nonempty,
     ClockVector& c,
@@ -161,7 +253,7 @@ void ConsiderPin(PinnerState* state,
     int64_t value,
     int pin_time,
     int max_cost,
-    std::vector<ClockVector>& cs) {
+    std::vector<Choice>* choices) {
 
   // Ensure that the last transition, which is the first one we pick, has not
   // been considered before.
@@ -185,11 +277,13 @@ void ConsiderPin(PinnerState* state,
     int pin_thread = state->history.thread_at(pin_time);
     if (state->last_pin.count(pin_thread)) {
       int previous_pin = state->last_pin[pin_thread];
-      if (state->history.cv_at(*index)[pin_thread] >= previous_pin) {
+      if (state->history.cv_at(*index, pin_thread) >= previous_pin) {
         can_put_in_b = false;
+        cost_bound_reached = true;
       }
     } else {
       can_put_in_b = false;
+      cost_bound_reached = true;
     }
   }
 
@@ -202,7 +296,7 @@ void ConsiderPin(PinnerState* state,
       new_b.Maximize(state->history.cv_at(*index));
       ConsiderPin(state, next_index, end, new_b, true, c, c_nonempty,
           state->history.previous_value_at(*index), pin_time, max_cost,
-          cs);
+          choices);
     } 
     
     int index_thread = state->history.thread_at(*index);
@@ -212,17 +306,18 @@ void ConsiderPin(PinnerState* state,
       c[index_thread] = *index;
       ConsiderPin(state, next_index, end, b, b_nonempty, c, true,
           state->history.previous_value_at(*index), pin_time, max_cost,
-          cs);
+          choices);
       c[index_thread] = old_value;
     }
   } else if (can_put_in_b && c_nonempty) {
-    cs.push_back(c);
+    choices->push_back(Choice(pin_time, c));
   }
 }
 
 
-std::vector<Choice> GenerateChoices(PinnerState* state, int max_cost) {
-  std::vector<Choice> choices;
+void GenerateChoices(PinnerState* state, int max_cost,
+    std::vector<Choice>* choices) {
+  choices->clear();
   for (int time = 0; time < state->history.length(); time++) {
     int thread = state->history.thread_at(time);
 
@@ -241,42 +336,26 @@ std::vector<Choice> GenerateChoices(PinnerState* state, int max_cost) {
           state->history.previous_time_of_thread_at(time));
     }
     if (already_nonfree && state->cost == max_cost) {
+      cost_bound_reached = true;
       continue;
     }
 
-    std::vector<int> conflicts = state->history.first_conflicts_at(time);
-    std::vector<ClockVector> cs;
     ClockVector helper_c(999);
-    ConsiderPin(state, conflicts.rbegin(), conflicts.rend(), 
+    ConsiderPin(state,
+        ConflictIterator(state->history.first_conflicts_end(time)),
+        ConflictIterator(state->history.first_conflicts_begin(time)),
         ClockVector(-1), false, helper_c, false,
-        state->history.previous_value_at(time), time, max_cost, cs);
-
-    for (ClockVector c : cs) {
-      choices.push_back(Choice(time, c));
-    }
+        state->history.previous_value_at(time), time, max_cost, choices);
   }
-
-  return choices;
 }
 
 std::map<std::vector<int>, int> cost_histogram_count;
 
-void Explore(PinnerState* state, int max_cost) {
+// Counts state towards the statistics, and returns whether it is within
+// max_cost.
+static bool VisitState(PinnerState* state, int max_cost) {
   pinner_states++;
 
-  /*
-  int num_threads_with_cost_over_2 = 0;
-  for (int thread = 0; thread < kMaxThreads; thread++) {
-    if (state->thread_cost[thread] >= 2) {
-      num_threads_with_cost_over_2++;
-    }
-  }
-
-  if (num_threads_with_cost_over_2 >= 2) {
-    return;
-  }
-  */
-
   std::vector<int> cost_histogram;
   for (int thread = 0; thread < kMaxThreads; thread++) {
     cost_histogram.push_back(state->thread_cost[thread]);
@@ -286,19 +365,74 @@ void Explore(PinnerState* state, int max_cost) {
 
   // Heuristic assumes only pins cost things, not every pinned transition.
   // (in Push: change fixed to is_a_pin to get working heuristic)
-  // assert(state->cost <= max_cost);
   if (state->cost > max_cost) {
-    return;
+    cost_bound_reached = true;
+    return false;
   }
+  return true;
+}
 
-  auto choices = GenerateChoices(state, max_cost);
-  std::reverse(choices.begin(), choices.end());
-  for (Choice choice : choices) {
-    int thread = state->history.thread_at(choice.time);
-    PinnerState* new_state = GetUnusedState();
-    Pin(new_state, choice, state);
-    Explore(new_state, max_cost);
-    ReturnUnusedState(new_state);
+// A state on the path of Explore, with the choices still to be pinned from
+// it, last first. Frames are kept between uses so that their choices keep
+// their buffers.
+struct PinnerFrame {
+  PinnerState* state;
+  std::vector<Choice> choices;
+};
+
+static std::vector<PinnerFrame> frames;
+
+bool Explore(Interceptor* interceptor, PinnerState* root, int max_cost) {
+  cost_bound_reached = false;
+  if (!VisitState(root, max_cost)) {
+    return cost_bound_reached;
   }
-}
 
+  int depth = 0;
+  frames.resize(std::max<size_t>(frames.size(), 1));
+  frames[0].state = root;
+  GenerateChoices(root, max_cost, &frames[0].choices);
+
+  while (depth >= 0) {
+    if (OutOfBudget()) {
+      for (; depth > 0; depth--) {
+        ReturnUnusedState(frames[depth].state);
+      }
+      break;
+    }
+    PinnerFrame& frame = frames[depth];
+    if (frame.choices.empty()) {
+      if (depth > 0) {
+        ReturnUnusedState(frame.state);
+      }
+      depth--;
+      continue;
+    }
+
+    Choice choice = frame.choices.back();
+    frame.choices.pop_back();
+    // The last choice of a non-root state no longer needs the state itself,
+    // and pins it in place.
+    PinnerState* new_state;
+    if (frame.choices.empty() && depth > 0) {
+      new_state = frame.state;
+      depth--;
+    } else {
+      new_state = GetUnusedState();
+    }
+    if (!Pin(interceptor, new_state, choice, frame.state) ||
+        !VisitState(new_state, max_cost)) {
+      ReturnUnusedState(new_state);
+      continue;
+    }
+
+    depth++;
+    if (depth == frames.size()) {
+      frames.emplace_back();
+    }
+    frames[depth].state = new_state;
+    GenerateChoices(new_state, max_cost, &frames[depth].choices);
+  }
+
+  return cost_bound_reached;
+}
@@ -2,6 +2,8 @@
 
 #include "phhbhistory.h"
 
+class Interceptor;
+
 struct PinnerState {
   PHHBHistory history;
   std::vector<int> first_seen;
@@ -23,8 +25,17 @@ struct Choice {
 PinnerState* GetUnusedState();
 void ReturnUnusedState(PinnerState* state);
 
-void CreateInitialState(PinnerState* state);
-void Pin(PinnerState* state, const Choice& c, const PinnerState* old);
-std::vector<Choice> GenerateChoices(PinnerState* state, int max_cost);
-void Explore(PinnerState* state, int max_cost);
+// The pinner drives runs through the interceptor it is given, rather than a
+// global one, so that it only touches the runtime its caller owns.
+void CreateInitialState(Interceptor* interceptor, PinnerState* state);
+// Returns false if the choice turns out to be impossible, in which case
+// state is left unusable.
+bool Pin(Interceptor* interceptor, PinnerState* state, const Choice& c,
+    const PinnerState* old);
+void GenerateChoices(PinnerState* state, int max_cost,
+    std::vector<Choice>* choices);
+// Explores every state reachable from root within max_cost, depth first.
+// Returns whether max_cost cut off any choice, so that a higher cost could
+// reach more states. Stops early once the budget of main.cc runs out.
+bool Explore(Interceptor* interceptor, PinnerState* root, int max_cost);
 
@@ -0,0 +1,171 @@
+#include "predictable_alloc.h"
+
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include "huge_pages.h"
+#include "statistics.h"
+
+static int64_t& arena_high_water =
+    RegisterStatistic<int64_t>("arena-high-water");
+static int64_t& allocations = RegisterStatistic<int64_t>("allocations");
+static Histogram& allocation_sizes =
+    RegisterStatistic<Histogram>("allocation-sizes");
+static Histogram& run_arena_bytes =
+    RegisterStatistic<Histogram>("run-arena-bytes");
+static Histogram& run_unfreed_bytes =
+    RegisterStatistic<Histogram>("run-unfreed-bytes");
+static int64_t& restored_pages = RegisterStatistic<int64_t>("restored-pages");
+static int64_t& reused_allocations =
+    RegisterStatistic<int64_t>("reused-allocations");
+
+// Only address space is reserved up front; the kernel backs pages as they
+// are committed and touched.
+static const int64_t kArenaReservation = int64_t(16) << 30;
+static const int64_t kArenaCommitChunk = int64_t(1) << 20;
+
+const int64_t PredictableAlloc::kPageSize;
+const int64_t PredictableAlloc::kMinPooledSize;
+const int64_t PredictableAlloc::kMaxPooledSize;
+
+PredictableAlloc::PredictableAlloc() {
+  void* memory = mmap(nullptr, kArenaReservation, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  buffer_ = base_ = offset_ = committed_ = reinterpret_cast<int8_t*>(memory);
+  commit_chunk_ = kArenaCommitChunk;
+  any_freed_ = false;
+}
+
+PredictableAlloc::~PredictableAlloc() {
+  munmap(buffer_, kArenaReservation);
+}
+
+void PredictableAlloc::Commit() {
+  if (offset_ > buffer_ + kArenaReservation) {
+    fprintf(stderr, "out of arena space, %lld MB are reserved\n",
+        static_cast<long long>(kArenaReservation >> 20));
+    exit(1);
+  }
+  // Chunks are aligned, so that huge pages are committed whole.
+  uintptr_t end = (reinterpret_cast<uintptr_t>(offset_) + commit_chunk_ - 1) /
+      commit_chunk_ * commit_chunk_;
+  int64_t length = std::min<int64_t>(reinterpret_cast<int8_t*>(end) -
+      committed_, buffer_ + kArenaReservation - committed_);
+  if (mprotect(committed_, length, PROT_READ | PROT_WRITE) != 0) {
+    perror("mprotect");
+    exit(1);
+  }
+  committed_ += length;
+}
+
+void PredictableAlloc::UseHugePages() {
+  if (AdviseHugePages(buffer_, kArenaReservation)) {
+    commit_chunk_ = kHugePageSize;
+  }
+}
+
+int8_t* PredictableAlloc::Reuse(int size_class, int owner) {
+  std::vector<int>& free_list = free_lists_[size_class];
+  Allocation& allocation = allocations_[free_list.back()];
+  free_list.pop_back();
+  allocation.owner = owner;
+  allocation.freed = false;
+  if (detect_frees) {
+    MarkFreed(allocation, false);
+  }
+  memset(allocation.start, 0, allocation.size);
+  reused_allocations++;
+  return allocation.start;
+}
+
+void PredictableAlloc::StoreOffsetAsBase() {
+  base_ = offset_;
+  allocations_.clear();
+  for (std::vector<int>& free_list : free_lists_) {
+    free_list.clear();
+  }
+  for (SavedRegion& region : saved_) {
+    if (region.start == buffer_) {
+      region.size = base_ - buffer_;
+    }
+    region.contents.assign(region.start, region.start + region.size);
+    region.dirty.assign(
+        (region.size + 64 * kPageSize - 1) / (64 * kPageSize), 0);
+  }
+  RegisterGlobal(buffer_, base_ - buffer_);
+}
+
+void PredictableAlloc::RecordStatistics() {
+  arena_high_water = std::max<int64_t>(arena_high_water, offset_ - base_);
+  run_arena_bytes.Add(offset_ - base_);
+
+  for (int bucket = 0; bucket < Histogram::kBuckets; bucket++) {
+    allocations += run_allocation_sizes_.counts[bucket];
+    allocation_sizes.counts[bucket] += run_allocation_sizes_.counts[bucket];
+  }
+  run_allocation_sizes_ = Histogram();
+
+  // Memory a run leaves allocated is either still reachable from the data
+  // structure, or leaked by it.
+  int64_t unfreed = 0;
+  for (const Allocation& allocation : allocations_) {
+    if (!allocation.freed) {
+      unfreed += allocation.size;
+    }
+  }
+  run_unfreed_bytes.Add(unfreed);
+}
+
+void PredictableAlloc::ResetOffsetToBase() {
+  if (any_freed_) {
+    size_t end = std::min<size_t>((offset_ - buffer_) / 8,
+        freed_granules_.size());
+    size_t begin = std::min<size_t>((base_ - buffer_) / 8, end);
+    std::fill(freed_granules_.begin() + begin, freed_granules_.begin() + end,
+        0);
+    any_freed_ = false;
+  }
+  offset_ = base_;
+  allocations_.clear();
+  run_allocation_sizes_ = Histogram();
+  for (std::vector<int>& free_list : free_lists_) {
+    free_list.clear();
+  }
+
+  for (SavedRegion& region : saved_) {
+    for (size_t word = 0; word < region.dirty.size(); word++) {
+      while (region.dirty[word] != 0) {
+        int64_t page = word * 64 + __builtin_ctzll(region.dirty[word]);
+        region.dirty[word] &= region.dirty[word] - 1;
+        int64_t start = page * kPageSize;
+        int64_t length = std::min(kPageSize, region.size - start);
+        memcpy(region.start + start, region.contents.data() + start, length);
+        restored_pages++;
+      }
+    }
+  }
+}
+
+void PredictableAlloc::RegisterGlobal(void* address, int64_t size) {
+  int8_t* start = reinterpret_cast<int8_t*>(address);
+  if (size <= 0) {
+    return;
+  }
+  for (const SavedRegion& region : saved_) {
+    if (region.start == start) {
+      return;
+    }
+  }
+
+  saved_.emplace_back();
+  SavedRegion& region = saved_.back();
+  region.start = start;
+  region.size = size;
+  region.contents.assign(start, start + size);
+  region.dirty.resize((size + 64 * kPageSize - 1) / (64 * kPageSize));
+}
@@ -1,37 +1,353 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "config.h"
+#include "statistics.h"
+
+// Memory for the tested program, bump-allocated from one mmap-ed reservation
+// so that allocations land at the same addresses in every run. Pages are
+// committed in chunks as the offset grows past them.
+//
+// Everything allocated before StoreOffsetAsBase, along with any memory passed
+// to RegisterGlobal, is saved and put back by ResetOffsetToBase, so every run
+// starts from the same state. Only pages written since the last reset are
+// copied back; writes are noted through NoteWrite by the store interceptors,
+// so writes from code that is not intercepted go unnoticed.
+//
+// With reuse_freed_memory, allocations made during a run are rounded up to a
+// power of two, and freed ones are handed out again last-in first-out per
+// size, the way a real allocator would recycle them.
+//
+// With detect_frees, the blocks freed during a run are marked in a shadow
+// byte per 8 bytes of the arena, until they are handed out again, so that
+// checking an access for use after free is an array lookup.
+//
+// With record_allocation_sites, the call site of the latest allocation at
+// each address is kept across runs, for reports such as those of
+// --profile-addresses.
+//
+// The allocations of each run are counted, by size, and RecordStatistics
+// adds them up into statistics once the run is over, along with how much
+// of the arena the run used and how much of that it never freed.
 class PredictableAlloc {
  public:
-  PredictableAlloc() {
-    buffer_ = base_ = offset_ = new int8_t[1024 * 1024 * 64];
-  }
+  // Owner of allocations that more than one thread can reach.
+  static const int kShared = -1;
 
-  ~PredictableAlloc() {
-    delete buffer_;
-  }
+  PredictableAlloc();
+  ~PredictableAlloc();
 
-  int8_t* Alloc(int64_t size) {
+  int8_t* Alloc(int64_t size, int owner = kShared,
+      const void* site = nullptr) {
     size += (8 - (size % 8)) % 8;
+    run_allocation_sizes_.Add(size);
+    if (reuse_freed_memory && size <= kMaxPooledSize) {
+      int size_class = SizeClass(size);
+      if (!free_lists_[size_class].empty()) {
+        int8_t* block = Reuse(size_class, owner);
+        NoteSite(block, size, site);
+        return block;
+      }
+      size = kMinPooledSize << size_class;
+    }
 
     int8_t* slab = offset_;
     offset_ += size;
+    if (offset_ > committed_) {
+      Commit();
+    }
 
     memset(slab, 0, size);
+    if (slab >= base_) {
+      allocations_.push_back(Allocation(slab, size, owner));
+    }
+    NoteSite(slab, size, site);
     return slab;
   }
 
-  void StoreOffsetAsBase() {
-    base_ = offset_;
+  // Finds the block containing address among those recorded with
+  // record_allocation_sites, and the site it was allocated from. Returns
+  // false if there is none.
+  bool FindSite(const void* address, const int8_t** start,
+      const void** site) const {
+    const int8_t* byte = reinterpret_cast<const int8_t*>(address);
+    auto it = sites_.upper_bound(byte);
+    if (it == sites_.begin()) {
+      return false;
+    }
+    --it;
+    if (byte >= it->first + it->second.size) {
+      return false;
+    }
+    *start = it->first;
+    *site = it->second.site;
+    return true;
+  }
+
+  // Makes the allocation starting at pointer available to later allocations
+  // of its size class. Anything else, including memory allocated before
+  // StoreOffsetAsBase, is never reused. The free is recorded as by thread
+  // after step of the run. Returns false if the allocation was freed
+  // already.
+  bool Free(const void* pointer, int thread = kShared, int step = -1) {
+    Allocation* allocation = Find(pointer);
+    if (allocation == nullptr || allocation->start != pointer) {
+      return true;
+    } else if (allocation->freed) {
+      return false;
+    }
+    allocation->freed = true;
+    allocation->freed_by = thread;
+    allocation->freed_after = step;
+    if (detect_frees) {
+      MarkFreed(*allocation, true);
+    }
+    if (!reuse_freed_memory || allocation->size > kMaxPooledSize ||
+        allocation->size != kMinPooledSize << SizeClass(allocation->size)) {
+      return true;
+    }
+    free_lists_[SizeClass(allocation->size)].push_back(
+        allocation - allocations_.data());
+    return true;
+  }
+
+  // The size of the allocation of the run starting at pointer, or 0 if there
+  // is none, or it is freed.
+  inline int64_t SizeOf(const void* pointer) const {
+    const Allocation* allocation = Find(pointer);
+    if (allocation == nullptr || allocation->start != pointer ||
+        allocation->freed) {
+      return 0;
+    }
+    return allocation->size;
+  }
+
+  // Whether any of the length bytes at address are in a block freed during
+  // the run that has not been handed out again. Only valid with
+  // detect_frees.
+  inline bool IsFreed(const void* address, int64_t length) const {
+    const int8_t* byte = reinterpret_cast<const int8_t*>(address);
+    if (!any_freed_ || byte < base_ || byte >= offset_ || length <= 0) {
+      return false;
+    }
+    uint64_t first = (byte - buffer_) / 8;
+    uint64_t last = std::min<uint64_t>((byte + length - 1 - buffer_) / 8,
+        freed_granules_.size() - 1);
+    for (uint64_t granule = first; granule <= last; granule++) {
+      if (freed_granules_[granule]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether address is in the arena, allocated or not.
+  inline bool Contains(const void* address) const {
+    const int8_t* byte = reinterpret_cast<const int8_t*>(address);
+    return byte >= buffer_ && byte < committed_;
   }
 
-  void ResetOffsetToBase() {
-    offset_ = base_;
+  // The thread that freed the allocation containing address, and the step
+  // of the run it freed it after, as passed to Free.
+  void FindFree(const void* address, int* thread, int* step) const {
+    const Allocation* allocation = Find(address);
+    *thread = allocation ? allocation->freed_by : kShared;
+    *step = allocation ? allocation->freed_after : -1;
+  }
+
+  // Ends the allocations that outlive runs, and saves their contents along
+  // with those of every global, so that later resets return to this state.
+  // Called again after a run's setup, it makes that setup outlive runs too.
+  void StoreOffsetAsBase();
+
+  // Counts the allocations of the run so far into the statistics, and the
+  // memory they take into arena-high-water.
+  void RecordStatistics();
+
+  // Backs the arena with transparent huge pages from now on, committing it in
+  // whole huge pages, where the kernel has them.
+  void UseHugePages();
+
+  // Drops the allocations of the run that just ended, and restores the pages
+  // of saved memory that it wrote.
+  void ResetOffsetToBase();
+
+  // Saves size bytes at address, such as a global of the tested program, to
+  // be restored by every later ResetOffsetToBase. Memory that is already
+  // saved is left alone.
+  void RegisterGlobal(void* address, int64_t size);
+
+  // Records that length bytes at destination are about to be written.
+  inline void NoteWrite(const void* destination, int64_t length) {
+    const int8_t* byte = reinterpret_cast<const int8_t*>(destination);
+    for (SavedRegion& region : saved_) {
+      uint64_t first = byte - region.start;
+      if (first < static_cast<uint64_t>(region.size)) {
+        uint64_t last = std::min<uint64_t>(first + length, region.size) - 1;
+        for (uint64_t page = first / kPageSize; page <= last / kPageSize;
+            page++) {
+          region.dirty[page / 64] |= 1ULL << (page % 64);
+        }
+      }
+    }
+  }
+
+  // Returns the thread that owns the allocation containing address, or
+  // kShared if it is shared or not allocated since StoreOffsetAsBase.
+  inline int OwnerOf(const void* address) const {
+    const Allocation* allocation = Find(address);
+    return allocation ? allocation->owner : kShared;
+  }
+
+  // Marks the allocation containing address as shared, along with every
+  // private allocation that its contents point into, transitively: once a
+  // thread can reach the allocation, it can follow those pointers as well.
+  void Share(const void* address) {
+    std::vector<Allocation*> todo;
+    Allocation* first = Find(address);
+    if (first != nullptr && first->owner != kShared) {
+      first->owner = kShared;
+      todo.push_back(first);
+    }
+
+    while (!todo.empty()) {
+      Allocation* allocation = todo.back();
+      todo.pop_back();
+
+      const int64_t* words = reinterpret_cast<const int64_t*>(allocation->start);
+      for (int64_t i = 0; i < allocation->size / 8; i++) {
+        Allocation* target = Find(reinterpret_cast<const void*>(words[i]));
+        if (target != nullptr && target->owner != kShared) {
+          target->owner = kShared;
+          todo.push_back(target);
+        }
+      }
+    }
+  }
+
+  // Records that value is about to be written to destination. If value points
+  // into a private allocation, it escapes unless destination belongs to the
+  // same owner; such a pointer is found again by Share if that changes.
+  inline void NoteStore(const void* destination, int64_t value) {
+    const void* pointer = reinterpret_cast<const void*>(value);
+    if (pointer < base_ || pointer >= offset_) {
+      return;
+    }
+    int owner = OwnerOf(pointer);
+    if (owner != kShared && OwnerOf(destination) != owner) {
+      Share(pointer);
+    }
+  }
+
+  // Shares all allocations owned by thread, which for example a new thread
+  // can reach through the arguments it is started with.
+  void ShareAllOwnedBy(int thread) {
+    for (Allocation& allocation : allocations_) {
+      if (allocation.owner == thread) {
+        Share(allocation.start);
+      }
+    }
   }
 
  private:
-  int8_t *buffer_, *base_, *offset_;
-};
+  static const int64_t kPageSize = 4096;
+  static const int64_t kMinPooledSize = 8;
+  static const int kNumSizeClasses = 18;
+  static const int64_t kMaxPooledSize =
+      kMinPooledSize << (kNumSizeClasses - 1);
+
+  struct Allocation {
+    Allocation(int8_t* start, int64_t size, int owner) :
+      start(start), size(size), owner(owner), freed(false),
+      freed_by(kShared), freed_after(-1) {}
+
+    int8_t* start;
+    int64_t size;
+    int owner;
+    bool freed;
+    int freed_by, freed_after;
+  };
+
+  // Sets or clears the shadow bytes of allocation.
+  inline void MarkFreed(const Allocation& allocation, bool freed) {
+    freed_granules_.resize((committed_ - buffer_) / 8);
+    memset(freed_granules_.data() + (allocation.start - buffer_) / 8, freed,
+        allocation.size / 8);
+    any_freed_ |= freed;
+  }
 
+  // The smallest class whose blocks hold size bytes, for sizes up to
+  // kMaxPooledSize.
+  static inline int SizeClass(int64_t size) {
+    return size <= kMinPooledSize ? 0 : 64 - __builtin_clzll(size - 1) - 3;
+  }
+
+  // Hands out the most recently freed block of size_class to owner.
+  int8_t* Reuse(int size_class, int owner);
+
+  struct Site {
+    int64_t size;
+    const void* site;
+  };
+
+  inline void NoteSite(const int8_t* start, int64_t size, const void* site) {
+    if (record_allocation_sites) {
+      sites_[start] = Site{size, site};
+    }
+  }
+
+  // Allocations are made in order of address, so a binary search finds them.
+  inline Allocation* Find(const void* address) const {
+    const int8_t* byte = reinterpret_cast<const int8_t*>(address);
+    if (byte < base_ || byte >= offset_) {
+      return nullptr;
+    }
+    auto it = std::upper_bound(allocations_.begin(), allocations_.end(), byte,
+        [](const int8_t* byte, const Allocation& allocation) {
+          return byte < allocation.start;
+        });
+    if (it == allocations_.begin()) {
+      return nullptr;
+    }
+    --it;
+    if (byte >= it->start + it->size) {
+      return nullptr;
+    }
+    return const_cast<Allocation*>(&*it);
+  }
+
+  // A copy of memory to restore, and which of its pages have been written
+  // since it was last restored.
+  struct SavedRegion {
+    int8_t* start;
+    int64_t size;
+    std::vector<int8_t> contents;
+    std::vector<uint64_t> dirty;
+  };
+
+  // Makes the pages up to offset_ accessible, or exits if that would overrun
+  // the reservation.
+  void Commit();
+
+  int8_t *buffer_, *base_, *offset_, *committed_;
+  int64_t commit_chunk_;
+  std::vector<Allocation> allocations_;
+  std::vector<SavedRegion> saved_;
+  // A byte per 8 bytes of committed arena, set while they are freed, and
+  // whether any were set since the last reset.
+  std::vector<uint8_t> freed_granules_;
+  bool any_freed_;
+  // Indices into allocations_ of the freed blocks of each size class.
+  std::vector<int> free_lists_[kNumSizeClasses];
+  // The latest allocation at each address, with record_allocation_sites.
+  std::map<const int8_t*, Site> sites_;
+  // The sizes of the run's allocations, reused ones included.
+  Histogram run_allocation_sizes_;
+};
@@ -1,21 +1,115 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <string>
 
 #include "clockvector.h"
 
+// Threads can be started from Setup, or by program threads, which spawn
+// them in a step that everything the new thread does happens after. A thread
+// that its spawner joins leaves its slot to the spawner's next threads, so
+// programs that spawn and join helpers over and over stay within the
+// MAX_THREADS the runtime was built for.
 extern int StartThread(const std::function<void()>& function);
 extern int StartThread(const std::function<void(int)>& function, int arg);
+// Threads started with TSOStartThread run under TSO, as on x86: their stores
+// only reach memory some time later, in order, and a TSOBarrier, a fence or
+// an atomic read-modify-write waits until all of them have.
+extern int TSOStartThread(const std::function<void()>& function);
+extern int TSOStartThread(const std::function<void(int)>& function, int arg);
+extern void TSOBarrier();
+// Threads started with SymmetricStartThread in the same group, a number of
+// the program's choosing, are declared interchangeable: swapping any two of
+// them throughout a run gives a run that is the same for the purposes of the
+// test. With --symmetry, runs that only differ by such a swap are explored
+// once. Threads whose arguments decide what they access are not symmetric.
+extern int SymmetricStartThread(const std::function<void()>& function,
+    int group);
+extern int SymmetricStartThread(const std::function<void(int)>& function,
+    int arg, int group);
 extern int ThreadId();
+// Waits, in a step that happens after the end of the thread, for a thread
+// that a program thread started to return.
+extern void JoinThread(int thread);
 
 extern void RequestYield(int);
 
 extern void Found();
+// Whether the program runs natively, see RunProgramNatively, where its threads
+// are OS threads that really run at once, and annotations, clock vectors and
+// the steps of the search are gone.
+extern bool RunningNatively();
 
 extern ClockVector GetClockVector(int thread);
+// Saves size bytes at address, typically a global of the tested program, and
+// puts them back before every later run's Setup, so that state Setup does not
+// reinitialize starts out the same in every run.
+extern void RegisterGlobal(void* address, size_t size);
+// Runs function in the current thread with all its accesses running
+// transparently, as during setup. Only fit for state that no other thread
+// touches, such as a checker's own bookkeeping.
+extern void RunTransparently(const std::function<void()>& function);
+// Threads start out interleaved. After EndInterleaving, the accesses of the
+// current thread run directly, without being scheduled, until it calls
+// BeginInterleaving, so a warmup such as filling a structure before the
+// threads contend takes no steps. No other thread runs in between, so the
+// thread must not wait for one there.
+extern void EndInterleaving();
+extern void BeginInterleaving();
+// The accesses of the current thread between BeginAtomicSection and
+// EndAtomicSection, which nest, run directly as part of a single step, see
+// AtomicSection in helper.h. Sections of different threads are ordered by
+// the search like steps that conflict, but what a section touches is not
+// otherwise seen, so it may only be touched inside sections, as with the
+// bookkeeping of a test harness. No other thread runs during a section, so
+// it must not wait for one.
+extern void BeginAtomicSection();
+extern void EndAtomicSection();
+// With operation_steps, the accesses of the current thread between
+// BeginOperationStep and EndOperationStep, such as an operation of a
+// linearizability harness, see Linearizability::ThreadBody, run directly as
+// part of the step before them, while no access of another thread in the run
+// conflicts with them. Once one does, the operation, which has to be
+// numbered the same in every run, is refined: its accesses are steps from
+// then on, in this run and in every later one. Operations that wait, or run
+// under TSO, are refined as they start to.
+extern void BeginOperationStep(int operation);
+extern void EndOperationStep();
+// Mark a function definition to have its accesses intercepted, or to run
+// natively, whatever the intercept list says; see INTERCEPT_LIST in the
+// Makefile. Native code runs as the runtime does, unseen by the explorer, so
+// it may only touch what no other thread touches while it runs.
+#define CODEX_INTERCEPT __attribute__((annotate("codex_intercept")))
+#define CODEX_NATIVE __attribute__((annotate("codex_native")))
 extern void Output(const char* format, ...);
 
 extern void RequireResult(int64_t result);
-extern void Annotate(std::string annotation);
+// Wait, as a single read step, until the length bytes at address,
+// zero-extended, equal value, or are at least the non-negative value. A
+// waiting thread is not runnable, so a spin-wait written with these takes one
+// step instead of a read per turn of the loop; see the std::atomic overloads in helper.h.
+// Outside program threads, they do not wait.
+extern void WaitUntilEquals(const void* address, int32_t length,
+    int64_t value);
+extern void WaitUntilAtLeast(const void* address, int32_t length,
+    int64_t value);
+// Futex-style waits: FutexWait returns once the bytes at address no longer
+// hold expected. As any step that changes them wakes the waiters, wakeups
+// are never lost or spurious, and FutexWake, kept for code written against
+// real futexes, does nothing.
+extern void FutexWait(const void* address, int32_t length, int64_t expected);
+extern void FutexWake(const void* address);
+// Acquires the lock at lock, a byte that is 0 while it is free, in a single
+// step that waits until it is free, and releases it, see TransitionType::LOCK.
+// Blocking acquires are cheaper to explore this way than as a CAS loop.
+extern void AcquireLock(void* lock);
+extern void ReleaseLock(void* lock);
+// Annotations are interned, so frequent ones are best interned once and
+// passed by id, optionally with a value that is printed after the text.
+extern int InternAnnotation(const std::string& text);
+extern void Annotate(int text);
+extern void Annotate(int text, int64_t value);
+extern void Annotate(const std::string& annotation);
 
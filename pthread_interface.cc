@@ -0,0 +1,219 @@
+// The threads, mutexes and condition variables of pthreads and of the C++
+// standard library, mapped onto Codex threads and steps, so that code written
+// against them runs unmodified. The pass points calls to the library
+// functions here, see kReplacedFunctions in llvm_mod/pass.cc; std::mutex and
+// the timed waits of std::condition_variable are inline and call pthreads.
+//
+// A program still provides Setup and Finish, and runs what would be its main
+// in a thread that Setup starts, so that the threads it creates can be
+// joined.
+//
+// Threads are identified by their slot plus one, as an id of 0 means no
+// thread to std::thread. A mutex is the byte it starts with, taken with LOCK
+// steps, so recursive and error-checking mutexes are plain ones here. A
+// condition variable is a counter in the four bytes it starts with, which
+// signals add to and waits wait to change, so every signal wakes every waiter,
+// as a spurious wakeup may. Timed waits time out at once.
+#include <pthread.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "config.h"
+#include "program_interface.h"
+#include "transition.h"
+
+extern "C" int64_t InterceptLoad(int8_t* address, int32_t length,
+    int32_t ordering, int32_t location);
+extern "C" void InterceptStore(int8_t* address, int64_t value, int32_t length,
+    int32_t ordering, int32_t location);
+extern "C" int64_t InterceptCmpXChg(int8_t* address, int64_t expected,
+    int64_t replacement, int32_t length, int32_t ordering, int32_t location);
+extern "C" int64_t InterceptAtomicRMW(int8_t* address, int64_t value,
+    int32_t type, int32_t length, int32_t ordering, int32_t location);
+
+// llvm::AtomicOrdering::SequentiallyConsistent, as the intercepted accesses
+// take their orders.
+static const int32_t kSeqCst = 7;
+
+// What the start routine of each thread returned, for pthread_join.
+static void* thread_results[kMaxThreads];
+
+static int8_t* BytesOf(const void* object) {
+  return static_cast<int8_t*>(const_cast<void*>(object));
+}
+
+static void CondWait(void* cond, void* mutex) {
+  int64_t seen = InterceptLoad(BytesOf(cond), sizeof(int32_t), kSeqCst, 0);
+  ReleaseLock(mutex);
+  FutexWait(cond, sizeof(int32_t), seen);
+  AcquireLock(mutex);
+}
+
+static void CondSignal(void* cond) {
+  InterceptAtomicRMW(BytesOf(cond), 1, RMW_ADD, sizeof(int32_t), kSeqCst, 0);
+}
+
+extern "C"
+int InterceptPthreadCreate(pthread_t* thread, const pthread_attr_t*,
+    void* (*start)(void*), void* arg) {
+  *thread = StartThread([=]() {
+    thread_results[ThreadId()] = start(arg);
+  }) + 1;
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadJoin(pthread_t thread, void** result) {
+  JoinThread(thread - 1);
+  if (result != nullptr) {
+    *result = thread_results[thread - 1];
+  }
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadDetach(pthread_t) {
+  return 0;
+}
+
+extern "C"
+pthread_t InterceptPthreadSelf() {
+  return ThreadId() + 1;
+}
+
+extern "C"
+int InterceptPthreadMutexInit(pthread_mutex_t* mutex,
+    const pthread_mutexattr_t*) {
+  InterceptStore(BytesOf(mutex), 0, 1, kSeqCst, 0);
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadMutexDestroy(pthread_mutex_t*) {
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadMutexLock(pthread_mutex_t* mutex) {
+  AcquireLock(mutex);
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadMutexTrylock(pthread_mutex_t* mutex) {
+  return InterceptCmpXChg(BytesOf(mutex), 0, 1, 1, kSeqCst, 0) == 0 ?
+      0 : EBUSY;
+}
+
+extern "C"
+int InterceptPthreadMutexUnlock(pthread_mutex_t* mutex) {
+  ReleaseLock(mutex);
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadCondInit(pthread_cond_t* cond, const pthread_condattr_t*) {
+  InterceptStore(BytesOf(cond), 0, sizeof(int32_t), kSeqCst, 0);
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadCondDestroy(pthread_cond_t*) {
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadCondWait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+  CondWait(cond, mutex);
+  return 0;
+}
+
+static int TimedOut(pthread_mutex_t* mutex) {
+  ReleaseLock(mutex);
+  AcquireLock(mutex);
+  return ETIMEDOUT;
+}
+
+extern "C"
+int InterceptPthreadCondTimedwait(pthread_cond_t*, pthread_mutex_t* mutex,
+    const struct timespec*) {
+  return TimedOut(mutex);
+}
+
+extern "C"
+int InterceptPthreadCondClockwait(pthread_cond_t*, pthread_mutex_t* mutex,
+    clockid_t, const struct timespec*) {
+  return TimedOut(mutex);
+}
+
+extern "C"
+int InterceptPthreadCondSignal(pthread_cond_t* cond) {
+  CondSignal(cond);
+  return 0;
+}
+
+extern "C"
+int InterceptPthreadCondBroadcast(pthread_cond_t* cond) {
+  CondSignal(cond);
+  return 0;
+}
+
+// The id of a std::thread is all there is of it.
+static_assert(sizeof(std::thread) == sizeof(std::thread::native_handle_type),
+    "std::thread is more than its id");
+
+static std::thread::native_handle_type& HandleOf(std::thread* thread) {
+  return *reinterpret_cast<std::thread::native_handle_type*>(thread);
+}
+
+// std::thread::_M_start_thread, which takes the state that it runs, and
+// owns it from then on, by value, which is by reference in the ABI.
+extern "C"
+void InterceptThreadStart(std::thread* thread,
+    std::unique_ptr<std::thread::_State>* state, void (*)()) {
+  std::shared_ptr<std::thread::_State> run(state->release());
+  HandleOf(thread) = StartThread([=]() {
+    run->_M_run();
+  }) + 1;
+}
+
+extern "C"
+void InterceptThreadJoin(std::thread* thread) {
+  JoinThread(HandleOf(thread) - 1);
+  HandleOf(thread) = 0;
+}
+
+extern "C"
+void InterceptThreadDetach(std::thread* thread) {
+  HandleOf(thread) = 0;
+}
+
+extern "C"
+void InterceptCondVarInit(std::condition_variable* cond) {
+  InterceptStore(BytesOf(cond), 0, sizeof(int32_t), kSeqCst, 0);
+}
+
+extern "C"
+void InterceptCondVarDestroy(std::condition_variable*) {
+}
+
+extern "C"
+void InterceptCondVarWait(std::condition_variable* cond,
+    std::unique_lock<std::mutex>* lock) {
+  CondWait(cond, lock->mutex()->native_handle());
+}
+
+extern "C"
+void InterceptCondVarNotifyOne(std::condition_variable* cond) {
+  CondSignal(cond);
+}
+
+extern "C"
+void InterceptCondVarNotifyAll(std::condition_variable* cond) {
+  CondSignal(cond);
+}
@@ -0,0 +1,96 @@
+#include "race_detector.h"
+
+RaceDetector::RaceDetector() {
+  Reset();
+}
+
+void RaceDetector::Reset() {
+  for (ClockVector& cv : cv_) {
+    cv.Reset(0);
+  }
+  shadows_.Reset();
+  sync_vars_.Reset();
+}
+
+bool RaceDetector::Check(int thread, const Transition& transition,
+    uint32_t* earlier_location) {
+  if (thread >= kMaxThreads || !transition.is_simple()) {
+    return false;
+  }
+  ClockVector& cv = cv_[thread];
+  cv[thread]++;
+  intptr_t address = reinterpret_cast<intptr_t>(transition.address());
+
+  if (transition.is_atomic() || transition.type() == TransitionType::CAS ||
+      transition.type() == TransitionType::ATOMICRMW) {
+    SyncVar& sync = sync_vars_[address];
+    cv.Maximize(sync.released);
+    if (transition.can_write()) {
+      sync.released.Maximize(cv);
+    }
+    return false;
+  }
+
+  Shadow& shadow = shadows_[address];
+  if (transition.can_write()) {
+    return CheckWrite(thread, shadow, transition.location(),
+        earlier_location);
+  }
+  return CheckRead(thread, shadow, transition.location(), earlier_location);
+}
+
+bool RaceDetector::CheckRead(int thread, Shadow& shadow, uint32_t location,
+    uint32_t* earlier_location) {
+  const ClockVector& cv = cv_[thread];
+  bool race = !HappensBefore(shadow.write, thread);
+  if (race) {
+    *earlier_location = shadow.write.location;
+  }
+
+  if (shadow.shared_reads) {
+    shadow.reads[thread] = cv[thread];
+    shadow.read_locations[thread] = location;
+  } else if (shadow.read.thread == thread ||
+      HappensBefore(shadow.read, thread)) {
+    shadow.read = Epoch{thread, cv[thread], location};
+  } else {
+    // Reads of two threads that are not ordered: keep both.
+    shadow.shared_reads = true;
+    shadow.reads.Reset(0);
+    shadow.reads[shadow.read.thread] = shadow.read.clock;
+    shadow.read_locations[shadow.read.thread] = shadow.read.location;
+    shadow.reads[thread] = cv[thread];
+    shadow.read_locations[thread] = location;
+  }
+  return race;
+}
+
+bool RaceDetector::CheckWrite(int thread, Shadow& shadow, uint32_t location,
+    uint32_t* earlier_location) {
+  const ClockVector& cv = cv_[thread];
+  bool race = false;
+  if (!HappensBefore(shadow.write, thread)) {
+    race = true;
+    *earlier_location = shadow.write.location;
+  } else if (!shadow.shared_reads) {
+    if (!HappensBefore(shadow.read, thread)) {
+      race = true;
+      *earlier_location = shadow.read.location;
+    }
+  } else {
+    for (int other = 0; other < kMaxThreads; other++) {
+      if (shadow.reads[other] > cv[other]) {
+        race = true;
+        *earlier_location = shadow.read_locations[other];
+        break;
+      }
+    }
+  }
+
+  // Later accesses that the write happens before also follow the reads it
+  // was checked against.
+  shadow.write = Epoch{thread, cv[thread], location};
+  shadow.read.thread = -1;
+  shadow.shared_reads = false;
+  return race;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include "clockvector.h"
+#include "config.h"
+#include "hashtable.h"
+#include "transition.h"
+
+// Finds data races among the steps of a run, as FastTrack does: two plain
+// accesses to the same address, one of them a write, that are not ordered by
+// the happens-before of C11, which only atomic accesses add to. This is not
+// the happens-before of HBHistory, which orders every pair of conflicting
+// steps the way the run ran them.
+//
+// Each thread has a clock vector, and each atomic address the clock vector
+// of the releases to it. An atomic write releases, and an atomic read
+// acquires, whatever their order: fences are not steps, so relaxed accesses
+// synchronize too, and races only ordered by relaxed accesses and fences go
+// unreported rather than the other way around.
+//
+// Each plain address keeps the epoch, the thread and its clock, of its last
+// write and of its last read, and only keeps a read per thread once reads of
+// different threads are not ordered with each other, so the usual access is
+// a constant number of comparisons.
+//
+// Only steps are checked, so accesses that are not explored as transitions,
+// private or coalesced ones, and the stores and flushes of TSO threads, are
+// not, nor are ranged transitions. Mixed-size accesses to the same bytes are
+// only compared when they start at the same address.
+class RaceDetector {
+ public:
+  RaceDetector();
+
+  void Reset();
+
+  // Checks transition, the next step of thread, against the earlier steps of
+  // the run, and records it. Returns whether it races with one of them, and
+  // sets earlier_location to the location of that one.
+  bool Check(int thread, const Transition& transition,
+      uint32_t* earlier_location);
+
+ private:
+  struct Epoch {
+    int thread;
+    int clock;
+    uint32_t location;
+  };
+
+  struct Shadow {
+    Epoch write, read;
+    // Whether reads holds the latest read of each thread instead of read.
+    bool shared_reads;
+    ClockVector reads;
+    uint32_t read_locations[kMaxThreads];
+
+    void Reset() {
+      write.thread = -1;
+      read.thread = -1;
+      shared_reads = false;
+    }
+  };
+
+  struct SyncVar {
+    ClockVector released;
+
+    void Reset() {
+      released.Reset(0);
+    }
+  };
+
+  inline bool HappensBefore(const Epoch& epoch, int thread) const {
+    return epoch.thread == -1 || epoch.clock <= cv_[thread][epoch.thread];
+  }
+  bool CheckRead(int thread, Shadow& shadow, uint32_t location,
+      uint32_t* earlier_location);
+  bool CheckWrite(int thread, Shadow& shadow, uint32_t location,
+      uint32_t* earlier_location);
+
+  ClockVector cv_[kMaxThreads];
+  HashTable<Shadow> shadows_;
+  HashTable<SyncVar> sync_vars_;
+};
@@ -0,0 +1,81 @@
+import argparse, ast, os, re, subprocess
+
+# Reduces a failing workload of a workload case, see make_workload_case in
+# generator.py, to a 1-minimal one: removing any single thread or step of it
+# makes the search within the budget find no bug. Threads go first, as each
+# one removed shrinks the search the most, then single steps, until neither
+# finds anything more to remove. Random workloads, as fuzz.py finds, are
+# first expanded into their steps, which the case prints. The reduced
+# workload is printed as a --workload flag and as an entry of the bugs of
+# generator.py. Flags of the searches follow a --.
+#
+#   python reduce.py obj/cases/cds_msqueue_workload \
+#       --workload='random:3x3:1234' -- --explorer=pct --max-runs=100000
+
+parser = argparse.ArgumentParser()
+parser.add_argument('binary')
+parser.add_argument('--workload', required=True)
+parser.add_argument('--run-seconds', type=float, default=60)
+parser.add_argument('flags', nargs='*', default=['--explorer=cbdpor'],
+                    help='flags of each search (default --explorer=cbdpor)')
+args = parser.parse_args()
+
+binary = os.path.abspath(args.binary)
+
+def run(workload, flags):
+    command = [binary, '--workload=' + workload] + flags
+    process = subprocess.run(command, stdout=subprocess.DEVNULL,
+                             stderr=subprocess.PIPE, universal_newlines=True)
+    return process
+
+def parse(workload):
+    return [thread.split(',') if thread else [] for thread in
+            workload.split(';')]
+
+def format_workload(threads):
+    return ';'.join(','.join(steps) for steps in threads)
+
+def fails(threads):
+    process = run(format_workload(threads),
+                  ['--max-seconds=%g' % args.run_seconds] + args.flags)
+    lines = [l for l in process.stderr.splitlines() if l.startswith('{')]
+    statistics = ast.literal_eval(lines[-1]) if lines else {}
+    found = statistics.get('found', 0) > 0 or process.returncode != 0
+    print('%-48s %s' % (format_workload(threads), 'fails' if found else 'passes'))
+    return found
+
+workload = args.workload
+if workload.startswith('random:'):
+    process = run(workload, ['--explorer=single'])
+    match = re.search(r'^workload \S+ is (.*)$', process.stderr, re.MULTILINE)
+    if not match:
+        raise SystemExit('%s did not print the steps of %s' % (binary, workload))
+    workload = match.group(1)
+
+threads = parse(workload)
+if not fails(threads):
+    raise SystemExit('%s does not fail within the budget' % workload)
+
+reduced = True
+while reduced:
+    reduced = False
+    for thread in reversed(range(len(threads))):
+        if len(threads) > 1:
+            candidate = threads[:thread] + threads[thread + 1:]
+            if fails(candidate):
+                threads = candidate
+                reduced = True
+    for thread in range(len(threads)):
+        for step in reversed(range(len(threads[thread]))):
+            candidate = [list(steps) for steps in threads]
+            del candidate[thread][step]
+            if fails(candidate):
+                threads = candidate
+                reduced = True
+
+data_structure = os.path.basename(binary)
+if data_structure.endswith('_workload'):
+    data_structure = data_structure[:-len('_workload')]
+print('--workload=\'%s\'' % format_workload(threads))
+print('(%r, %r),' % (data_structure,
+    [[step.split('(')[0] for step in steps] for steps in threads]))
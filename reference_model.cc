@@ -0,0 +1,118 @@
+#include "reference_model.h"
+
+#include <city.h>
+
+#include <vector>
+
+#include "linearizability.h"
+
+ReferenceModel::~ReferenceModel() {}
+
+void ReferenceModel::Register(Linearizability& linearizability) {
+  linearizability.RegisterModel([this]() { Clear(); }, [this]() { Clear(); });
+  linearizability.RegisterModelHash([this]() { return Hash(); });
+  linearizability.RegisterModelSnapshot([this]() { return Save(); },
+      [this](void* snapshot) { Restore(snapshot); },
+      [this](void* snapshot) { Release(snapshot); });
+}
+
+template <typename Container>
+static uint64_t HashContents(const Container& container) {
+  std::vector<int> contents(container.begin(), container.end());
+  return CityHash64(reinterpret_cast<const char*>(contents.data()),
+                    contents.size() * sizeof(int));
+}
+
+QueueModel::QueueModel() {}
+
+QueueModel::~QueueModel() {}
+
+void QueueModel::enqueue(int value) {
+  items.push_back(value);
+}
+
+bool QueueModel::dequeue(int& value) {
+  if (items.empty()) {
+    return false;
+  }
+  value = items.front();
+  items.pop_front();
+  return true;
+}
+
+bool QueueModel::empty() const {
+  return items.empty();
+}
+
+void QueueModel::Clear() {
+  items.clear();
+}
+
+uint64_t QueueModel::Hash() const {
+  return HashContents(items);
+}
+
+void* QueueModel::Save() const {
+  return new std::deque<int>(items);
+}
+
+void QueueModel::Restore(void* snapshot) {
+  items = *static_cast<std::deque<int>*>(snapshot);
+}
+
+void QueueModel::Release(void* snapshot) {
+  delete static_cast<std::deque<int>*>(snapshot);
+}
+
+void StackModel::push(int value) {
+  items.push_back(value);
+}
+
+bool StackModel::pop(int& value) {
+  if (items.empty()) {
+    return false;
+  }
+  value = items.back();
+  items.pop_back();
+  return true;
+}
+
+SetModel::SetModel() {}
+
+SetModel::~SetModel() {}
+
+bool SetModel::insert(int key) {
+  return keys.insert(key).second;
+}
+
+bool SetModel::erase(int key) {
+  return keys.erase(key) > 0;
+}
+
+bool SetModel::find(int key) const {
+  return keys.count(key) > 0;
+}
+
+bool SetModel::empty() const {
+  return keys.empty();
+}
+
+void SetModel::Clear() {
+  keys.clear();
+}
+
+uint64_t SetModel::Hash() const {
+  return HashContents(keys);
+}
+
+void* SetModel::Save() const {
+  return new std::set<int>(keys);
+}
+
+void SetModel::Restore(void* snapshot) {
+  keys = *static_cast<std::set<int>*>(snapshot);
+}
+
+void SetModel::Release(void* snapshot) {
+  delete static_cast<std::set<int>*>(snapshot);
+}
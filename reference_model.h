@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <set>
+
+class Linearizability;
+
+// Sequential models of the usual data structures over plain STL containers,
+// for Linearizability to check implementations against. They are part of the
+// runtime, so unlike a model built from the tested code itself, they run
+// without going through the intercept pass, which matters as running the
+// model is the inner loop of the search. Their operations mirror those of
+// the cds containers, so a step's model is its own code with the structure
+// swapped for the model. Everything touching the containers, constructors
+// included, is defined out of line, so that none of it is compiled into the
+// tested code.
+class ReferenceModel {
+ public:
+  virtual ~ReferenceModel();
+
+  // Registers the model with linearizability, along with its hash and
+  // snapshots.
+  void Register(Linearizability& linearizability);
+
+ protected:
+  virtual void Clear() = 0;
+  virtual uint64_t Hash() const = 0;
+  virtual void* Save() const = 0;
+  virtual void Restore(void* snapshot) = 0;
+  virtual void Release(void* snapshot) = 0;
+};
+
+class QueueModel : public ReferenceModel {
+ public:
+  QueueModel();
+  ~QueueModel() override;
+
+  void enqueue(int value);
+  bool dequeue(int& value);
+  bool empty() const;
+
+ protected:
+  void Clear() override;
+  uint64_t Hash() const override;
+  void* Save() const override;
+  void Restore(void* snapshot) override;
+  void Release(void* snapshot) override;
+
+  std::deque<int> items;
+};
+
+// A stack is a queue that pops at the end it pushes to.
+class StackModel : public QueueModel {
+ public:
+  void push(int value);
+  bool pop(int& value);
+};
+
+class SetModel : public ReferenceModel {
+ public:
+  SetModel();
+  ~SetModel() override;
+
+  bool insert(int key);
+  bool erase(int key);
+  bool find(int key) const;
+  bool empty() const;
+
+ protected:
+  void Clear() override;
+  uint64_t Hash() const override;
+  void* Save() const override;
+  void Restore(void* snapshot) override;
+  void Release(void* snapshot) override;
+
+  std::set<int> keys;
+};
@@ -0,0 +1,156 @@
+#include "schedule.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static void AppendVarint(std::string* bytes, uint32_t value) {
+  while (value >= 0x80) {
+    bytes->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  bytes->push_back(static_cast<char>(value));
+}
+
+static uint32_t ReadVarint(const std::string& bytes, size_t* position) {
+  uint32_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t byte = bytes[(*position)++];
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return value;
+    }
+  }
+}
+
+// ReadVarint for bytes read from a file, which returns false rather than read
+// past their end.
+static bool ReadVarintChecked(const std::string& bytes, size_t* position,
+    uint32_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 32 && *position < bytes.size(); shift += 7) {
+    uint8_t byte = bytes[(*position)++];
+    *value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PackedSchedule::Append(int thread) {
+  size_++;
+  if (thread == last_thread_) {
+    last_count_++;
+    return;
+  }
+  if (last_count_ > 0) {
+    AppendVarint(&bytes_, last_thread_);
+    AppendVarint(&bytes_, last_count_);
+  }
+  last_thread_ = thread;
+  last_count_ = 1;
+}
+
+void PackedSchedule::Unpack(std::vector<int8_t>* path) const {
+  path->clear();
+  path->reserve(size_);
+  size_t position = 0;
+  while (position < bytes_.size()) {
+    int thread = ReadVarint(bytes_, &position);
+    uint32_t count = ReadVarint(bytes_, &position);
+    path->insert(path->end(), count, thread);
+  }
+  path->insert(path->end(), last_count_, last_thread_);
+}
+
+std::string PackedSchedule::ToString() const {
+  std::vector<int8_t> path;
+  Unpack(&path);
+  std::stringstream ss;
+  for (size_t i = 0; i < path.size();) {
+    size_t end = i;
+    while (end < path.size() && path[end] == path[i]) {
+      end++;
+    }
+    ss << (i > 0 ? " " : "") << static_cast<int>(path[i]);
+    if (end - i > 1) {
+      ss << "x" << end - i;
+    }
+    i = end;
+  }
+  return ss.str();
+}
+
+std::string PackedSchedule::Bytes() const {
+  std::string bytes = bytes_;
+  if (last_count_ > 0) {
+    AppendVarint(&bytes, last_thread_);
+    AppendVarint(&bytes, last_count_);
+  }
+  return bytes;
+}
+
+bool PackedSchedule::FromBytes(const std::string& bytes) {
+  *this = PackedSchedule();
+  size_t position = 0;
+  while (position < bytes.size()) {
+    uint32_t thread, count;
+    if (!ReadVarintChecked(bytes, &position, &thread) ||
+        !ReadVarintChecked(bytes, &position, &count) || thread > 127) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      Append(thread);
+    }
+  }
+  return true;
+}
+
+void LoadSchedules(const std::string& file,
+    std::vector<PackedSchedule>* schedules) {
+  std::ifstream in(file, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+      std::istreambuf_iterator<char>());
+  size_t position = 0;
+  while (position < data.size()) {
+    uint32_t length;
+    PackedSchedule schedule;
+    if (!ReadVarintChecked(data, &position, &length) ||
+        length > data.size() - position ||
+        !schedule.FromBytes(data.substr(position, length))) {
+      fprintf(stderr, "failed to parse schedules in %s\n", file.c_str());
+      exit(1);
+    }
+    position += length;
+    schedules->push_back(schedule);
+  }
+}
+
+void AppendSchedule(const std::string& file, const PackedSchedule& schedule) {
+  std::string bytes = schedule.Bytes();
+  std::vector<PackedSchedule> schedules;
+  LoadSchedules(file, &schedules);
+  for (const PackedSchedule& other : schedules) {
+    if (other.Bytes() == bytes) {
+      return;
+    }
+  }
+
+  std::string record;
+  AppendVarint(&record, bytes.size());
+  record += bytes;
+  int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+  if (fd < 0 || write(fd, record.data(), record.size()) !=
+      static_cast<ssize_t>(record.size())) {
+    perror(file.c_str());
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A schedule, the thread of each step of a run from the start, packed for
+// explorers that keep many of them around. Runs of steps by one thread are
+// stored as a varint of the thread and a varint of the run's length, so a
+// typical schedule of a few hundred steps but a few dozen context switches
+// takes a few dozen bytes, and short ones fit in the string without a heap
+// allocation. The last run is kept unpacked, so Append is constant time.
+class PackedSchedule {
+ public:
+  PackedSchedule() : size_(0), last_thread_(-1), last_count_(0) {}
+
+  void Append(int thread);
+
+  inline size_t size() const {
+    return size_;
+  }
+
+  void Unpack(std::vector<int8_t>* path) const;
+
+  // E.g. "0x3 1 2x2" for 0 0 0 1 2 2, for messages.
+  std::string ToString() const;
+
+  // The packed runs, the last one included, and the schedule they pack, or
+  // false if bytes do not pack one.
+  std::string Bytes() const;
+  bool FromBytes(const std::string& bytes);
+
+ private:
+  std::string bytes_;
+  uint32_t size_;
+  int last_thread_;
+  uint32_t last_count_;
+};
+
+// Files of schedules, each a varint of its length in bytes and its Bytes, as
+// the bug corpus is kept in. A missing file holds none; one that does not
+// parse exits the process.
+void LoadSchedules(const std::string& file,
+    std::vector<PackedSchedule>* schedules);
+// Appends schedule to file unless it holds it already, in a single write, so
+// that forked explorers can share the file.
+void AppendSchedule(const std::string& file, const PackedSchedule& schedule);
@@ -1,22 +1,78 @@
 #include "scheduler.h"
 
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
-#include <atomic>
-#include <functional>
-#include <map>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-Scheduler::Scheduler() : current_thread_(kOriginalThread) {
-  contexts_[kOriginalThread] = &original_context_;
+#include "huge_pages.h"
+#include "statistics.h"
+#include "timer.h"
 
+int8_t codex_intercepting = 0;
+int32_t codex_current_thread = Scheduler::kOriginalThread;
+
+// The scheduler whose guard pages the fault handler checks. There is only
+// ever one per process.
+static const Scheduler* faulting_scheduler = nullptr;
+static const size_t kSignalStackSize = 64 * 1024;
+
+static int64_t& mapped_stacks = RegisterStatistic<int64_t>("mapped-stacks");
+
+CODEX_TIMER(switch_timer, "timer-switch");
+#ifdef CODEX_TIMERS
+static uint64_t switch_started;
+#endif
+
+Scheduler::Scheduler(size_t stack_size, bool preserve_fpu, bool huge_pages,
+    void (*entry)(void* arg, int thread), void* arg) :
+    entry_(entry), arg_(arg), preserve_fpu_(preserve_fpu),
+    current_thread_(kOriginalThread) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  stack_size_ = (stack_size + page_size - 1) / page_size * page_size;
+  mapping_size_ = stack_size_ + page_size;
+  page_size_ = page_size;
+  huge_pages_ = huge_pages;
   for (int i = 0; i < kMaxThreads; i++) {
-    stacks_[i] = new uint8_t[kStackSize];
+    mappings_[i] = nullptr;
+    created_[i] = false;
+  }
+
+  // The handler needs a stack of its own, as the faulting one is full.
+  stack_t signal_stack;
+  signal_stack.ss_sp = malloc(kSignalStackSize);
+  signal_stack.ss_size = kSignalStackSize;
+  signal_stack.ss_flags = 0;
+  if (sigaltstack(&signal_stack, nullptr) != 0) {
+    perror("sigaltstack");
+    exit(1);
   }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &Scheduler::HandleFault;
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGSEGV, &action, nullptr) != 0 ||
+      sigaction(SIGBUS, &action, nullptr) != 0) {
+    perror("sigaction");
+    exit(1);
+  }
+  faulting_scheduler = this;
 }
 
 Scheduler::~Scheduler() {
   for (int i = 0; i < kMaxThreads; i++) {
-    delete[] stacks_[i];
+    if (mappings_[i] != nullptr) {
+      munmap(mappings_[i], mapping_size_);
+    }
+  }
+  if (faulting_scheduler == this) {
+    faulting_scheduler = nullptr;
   }
 }
 
@@ -26,14 +82,53 @@ void Scheduler::SwitchTo(int new_thread) {
   }
   int thread = current_thread_;
   current_thread_ = new_thread;
-  ctx::jump_fcontext(contexts_[thread], contexts_[current_thread_],
-      reinterpret_cast<intptr_t>(this));
+  codex_current_thread = new_thread;
+  codex_intercepting = new_thread != kOriginalThread;
+#ifdef CODEX_TIMERS
+  // A switch ends in whichever fiber resumes, which is handed the start time.
+  switch_started = ReadCycleCounter();
+#endif
+  FiberContext::Switch(&contexts_[thread], &contexts_[new_thread],
+      preserve_fpu_);
+#ifdef CODEX_TIMERS
+  switch_timer.calls++;
+  switch_timer.cycles += ReadCycleCounter() - switch_started;
+#endif
 }
 
-void Scheduler::AddThread(int thread, std::function<void()> task) {
-  contexts_[thread] = ctx::make_fcontext(stacks_[thread] + kStackSize,
-      kStackSize, &Scheduler::ThreadEntryPointWrapper);
-  tasks_[thread] = task;
+void Scheduler::MapStack(int thread) {
+  void* mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (mprotect(mapping, page_size_, PROT_NONE) != 0) {
+    perror("mprotect");
+    exit(1);
+  }
+  mappings_[thread] = reinterpret_cast<uint8_t*>(mapping);
+  if (huge_pages_) {
+    AdviseHugePages(mappings_[thread] + page_size_, stack_size_);
+  }
+  mapped_stacks++;
+}
+
+void Scheduler::AddThread(int thread) {
+  if (!created_[thread]) {
+    if (mappings_[thread] == nullptr) {
+      MapStack(thread);
+    }
+    contexts_[thread].Make(mappings_[thread] + mapping_size_, stack_size_,
+        &Scheduler::ThreadEntryPointWrapper, reinterpret_cast<intptr_t>(this),
+        preserve_fpu_);
+    created_[thread] = true;
+  }
+}
+
+void Scheduler::DiscardThread(int thread) {
+  assert(thread != current_thread_);
+  created_[thread] = false;
 }
 
 void Scheduler::ThreadEntryPointWrapper(intptr_t p) {
@@ -41,7 +136,31 @@ void Scheduler::ThreadEntryPointWrapper(intptr_t p) {
 }
 
 void Scheduler::ThreadEntryPoint() {
-  tasks_[current_thread_]();
-  assert(0);
+  while (true) {
+    entry_(arg_, current_thread_);
+  }
 }
 
+// Reports faults in a guard page as a stack overflow. Any fault is then
+// re-raised on return, as SA_RESETHAND restored the default action.
+void Scheduler::HandleFault(int signal, siginfo_t* info, void* context) {
+  const Scheduler* scheduler = faulting_scheduler;
+  if (scheduler == nullptr) {
+    return;
+  }
+  uint8_t* address = reinterpret_cast<uint8_t*>(info->si_addr);
+  size_t guard_size = scheduler->mapping_size_ - scheduler->stack_size_;
+  for (int i = 0; i < kMaxThreads; i++) {
+    uint8_t* guard = scheduler->mappings_[i];
+    if (guard != nullptr && guard <= address && address < guard + guard_size) {
+      char message[128];
+      int length = snprintf(message, sizeof(message),
+          "stack overflow in thread %d, stacks are %zu KB (--stack-kb)\n",
+          i, scheduler->stack_size_ >> 10);
+      if (write(STDERR_FILENO, message, length) < 0) {
+        // Nothing left to report to.
+      }
+      _exit(1);
+    }
+  }
+}
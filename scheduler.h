@@ -1,40 +1,74 @@
 #pragma once
 
-#include <atomic>
-#include <functional>
-#include <map>
+#include <cstddef>
+#include <cstdint>
 
-#include <boost/context/all.hpp>
+#include <signal.h>
 
 #include "config.h"
+#include "fiber_context.h"
 
-namespace ctx = boost::context;
+// Set while a program thread runs, rather than the original thread. The
+// instrumentation checks it inline and only calls into the runtime for
+// accesses made while it is set; interface.cc also clears it while code runs
+// transparently.
+extern "C" int8_t codex_intercepting;
+// The thread that runs, as current_thread, which the pass indexes the copies
+// of thread_local globals with; see GiveFibersThreadLocals in
+// llvm_mod/pass.cc.
+extern "C" int32_t codex_current_thread;
 
 class Scheduler {
  public:
   static const int kOriginalThread = kMaxThreads;
-  static const size_t kStackSize = 1024 * 8;
 
-  Scheduler();
+  // Added threads run entry(arg, thread). Each run of entry has to end by
+  // switching to another thread, which parks the thread there. Once added
+  // again, it returns from that switch and runs entry anew, so the contexts
+  // of threads are only created once.
+  //
+  // Stacks are mmap-ed with a guard page below each when their thread is
+  // first added, and only take up memory as far as threads use them, so
+  // generous sizes and builds for many more threads than programs start are
+  // cheap. Running into a guard page is reported as a stack overflow of that
+  // thread.
+  //
+  // Switches only keep the floating point control state of threads apart if
+  // preserve_fpu is set. With huge_pages, stacks of at least kHugePageSize
+  // are backed with transparent huge pages where the kernel has them.
+  Scheduler(size_t stack_size, bool preserve_fpu, bool huge_pages,
+      void (*entry)(void* arg, int thread), void* arg);
   ~Scheduler();
 
   void SwitchTo(int new_thread);
-  void AddThread(int thread, std::function<void()> task);
+  void AddThread(int thread);
+  // Drops the stack of a thread that is blocked halfway through entry, so
+  // that it runs entry anew once added again. Nothing on the stack is
+  // unwound.
+  void DiscardThread(int thread);
 
   inline int current_thread() const {
     return current_thread_;
   }
 
  private:
-  std::function<void()> tasks_[kMaxThreads];
+  void (*entry_)(void* arg, int thread);
+  void* arg_;
 
-  ctx::fcontext_t original_context_;
-  uint8_t* stacks_[kMaxThreads];
-  ctx::fcontext_t* contexts_[kMaxThreads + 1];
+  // The mapping of each stack, which starts with its guard page, or null
+  // until its thread is first added.
+  size_t stack_size_, mapping_size_, page_size_;
+  uint8_t* mappings_[kMaxThreads];
+  bool huge_pages_;
+  bool preserve_fpu_;
+  bool created_[kMaxThreads];
+  FiberContext contexts_[kMaxThreads + 1];
 
-  std::atomic<int> current_thread_;
+  // Everything runs on one OS thread, so this needs no atomic.
+  int current_thread_;
 
+  void MapStack(int thread);
   void ThreadEntryPoint();
   static void ThreadEntryPointWrapper(intptr_t p);
+  static void HandleFault(int signal, siginfo_t* info, void* context);
 };
-
@@ -0,0 +1,148 @@
+#include "spill_vector.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "statistics.h"
+
+std::string spill_directory;
+size_t spill_window_bytes = 64 << 20;
+
+SpillBuffer* SpillBuffer::spilled_ = nullptr;
+
+static int64_t& spilled_arrays = RegisterStatistic<int64_t>("spilled-arrays");
+static int64_t& spill_drops = RegisterStatistic<int64_t>("spill-drops");
+
+static size_t PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+// Creates an unlinked file in spill_directory, of bytes.
+static int CreateSpillFile(size_t bytes) {
+  std::string path = spill_directory + "/codex-spill-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    perror(path.c_str());
+    exit(1);
+  }
+  unlink(path.c_str());
+  if (ftruncate(fd, bytes) != 0) {
+    perror("ftruncate");
+    exit(1);
+  }
+  return fd;
+}
+
+SpillBuffer::~SpillBuffer() {
+  if (fd_ < 0) {
+    free(data_);
+    return;
+  }
+  munmap(data_, capacity_);
+  close(fd_);
+  if (previous_ != nullptr) {
+    previous_->next_ = next_;
+  } else {
+    spilled_ = next_;
+  }
+  if (next_ != nullptr) {
+    next_->previous_ = previous_;
+  }
+}
+
+void SpillBuffer::Reserve(size_t bytes, size_t used) {
+  if (fd_ >= 0) {
+    // The file keeps the contents while the mapping is replaced.
+    bytes = (bytes + PageSize() - 1) / PageSize() * PageSize();
+    munmap(data_, capacity_);
+    if (ftruncate(fd_, bytes) != 0) {
+      perror("ftruncate");
+      exit(1);
+    }
+    Map(bytes);
+  } else if (!spill_directory.empty() && bytes > spill_window_bytes) {
+    Spill(bytes, used);
+  } else {
+    char* data = static_cast<char*>(realloc(data_, bytes));
+    if (data == nullptr) {
+      perror("realloc");
+      exit(1);
+    }
+    data_ = data;
+    capacity_ = bytes;
+  }
+}
+
+void SpillBuffer::Spill(size_t bytes, size_t used) {
+  static bool registered = false;
+  if (!registered) {
+    pthread_atfork(nullptr, nullptr, CopySpilledAfterFork);
+    registered = true;
+  }
+
+  bytes = (bytes + PageSize() - 1) / PageSize() * PageSize();
+  char* old = data_;
+  fd_ = CreateSpillFile(bytes);
+  Map(bytes);
+  memcpy(data_, old, used);
+  free(old);
+
+  next_ = spilled_;
+  if (next_ != nullptr) {
+    next_->previous_ = this;
+  }
+  spilled_ = this;
+  spilled_arrays++;
+}
+
+void SpillBuffer::Map(size_t bytes) {
+  void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+      0);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  data_ = static_cast<char*>(data);
+  capacity_ = bytes;
+}
+
+size_t SpillBuffer::DropBehind(size_t used) {
+  if (fd_ < 0) {
+    return SIZE_MAX;
+  }
+  if (used > spill_window_bytes) {
+    size_t end = (used - spill_window_bytes) / PageSize() * PageSize();
+    // Dirty pages are written back to the file before the kernel frees them.
+    if (end > 0 && madvise(data_, end, MADV_DONTNEED) == 0) {
+      spill_drops++;
+    }
+  }
+  return used + spill_window_bytes / 2;
+}
+
+void SpillBuffer::CopySpilledAfterFork() {
+  for (SpillBuffer* buffer = spilled_; buffer != nullptr;
+      buffer = buffer->next_) {
+    int fd = CreateSpillFile(buffer->capacity_);
+    size_t written = 0;
+    while (written < buffer->capacity_) {
+      ssize_t result = pwrite(fd, buffer->data_ + written,
+          buffer->capacity_ - written, written);
+      if (result <= 0) {
+        perror("pwrite");
+        exit(1);
+      }
+      written += result;
+    }
+    munmap(buffer->data_, buffer->capacity_);
+    close(buffer->fd_);
+    buffer->fd_ = fd;
+    buffer->Map(buffer->capacity_);
+  }
+}
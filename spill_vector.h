@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+// Directory that the per-step arrays of long histories spill to, see
+// SpillBuffer; empty keeps them in memory.
+extern std::string spill_directory;
+// The memory each spilled array keeps of its latest elements.
+extern size_t spill_window_bytes;
+
+// The memory behind a SpillVector. It is allocated on the heap until it
+// outgrows spill_window_bytes, and then moves to a file in spill_directory
+// that is mapped shared, so that the kernel can write its pages back and drop
+// them rather than keep them in memory. The pages before the latest
+// spill_window_bytes that are used are dropped every spill_window_bytes / 2
+// the array grows by, and read back from the file if they are used again, as
+// when a search backtracks far. Runs of millions of steps thus need disk for
+// their histories, but only a window of memory.
+//
+// A forked process copies its spilled buffers to files of its own, so that it
+// does not write into those of its parent; forking in the middle of a long
+// run costs as much.
+class SpillBuffer {
+ public:
+  SpillBuffer() : data_(nullptr), capacity_(0), fd_(-1), next_(nullptr),
+      previous_(nullptr) {}
+  ~SpillBuffer();
+  SpillBuffer(const SpillBuffer&) = delete;
+  SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+  inline char* data() const {
+    return data_;
+  }
+  inline size_t capacity() const {
+    return capacity_;
+  }
+  // Makes room for bytes, keeping the first used.
+  void Reserve(size_t bytes, size_t used);
+  // Drops the pages before the window of the first used bytes, once spilled,
+  // and returns how many bytes may be used before calling it again.
+  size_t DropBehind(size_t used);
+
+ private:
+  void Spill(size_t bytes, size_t used);
+  void Map(size_t bytes);
+  static void CopySpilledAfterFork();
+
+  char* data_;
+  size_t capacity_;
+  int fd_; // of the file, once spilled
+  // The spilled buffers are listed for CopySpilledAfterFork.
+  SpillBuffer* next_;
+  SpillBuffer* previous_;
+  static SpillBuffer* spilled_;
+};
+
+// The subset of std::vector that histories use, for trivially copyable
+// elements, kept in a SpillBuffer. Appending costs a comparison more than a
+// vector's, as growing and dropping pages share the slow path.
+template<class T>
+class SpillVector {
+  static_assert(std::is_trivially_copyable<T>::value,
+      "SpillVector elements are moved as bytes");
+
+ public:
+  SpillVector() : size_(0), check_at_(0) {}
+
+  inline size_t size() const {
+    return size_;
+  }
+  inline bool empty() const {
+    return size_ == 0;
+  }
+  inline T* data() {
+    return reinterpret_cast<T*>(buffer_.data());
+  }
+  inline const T* data() const {
+    return reinterpret_cast<const T*>(buffer_.data());
+  }
+  inline T& operator[](size_t i) {
+    return data()[i];
+  }
+  inline const T& operator[](size_t i) const {
+    return data()[i];
+  }
+  inline T& back() {
+    return data()[size_ - 1];
+  }
+  inline const T& back() const {
+    return data()[size_ - 1];
+  }
+
+  inline void push_back(const T& value) {
+    if (size_ >= check_at_) {
+      // value may be an element, which growing moves.
+      T copy = value;
+      Grow(size_ + 1);
+      data()[size_++] = copy;
+      return;
+    }
+    data()[size_++] = value;
+  }
+  inline void pop_back() {
+    size_--;
+  }
+  void clear() {
+    resize(0);
+  }
+  void resize(size_t size) {
+    if (size > size_) {
+      Grow(size);
+      std::fill(data() + size_, data() + size, T());
+    }
+    size_ = size;
+    Recheck();
+  }
+  void reserve(size_t capacity) {
+    if (capacity * sizeof(T) > buffer_.capacity()) {
+      buffer_.Reserve(capacity * sizeof(T), size_ * sizeof(T));
+    }
+    Recheck();
+  }
+
+ private:
+  void Grow(size_t size) {
+    size_t capacity = buffer_.capacity() / sizeof(T);
+    if (size > capacity) {
+      reserve(std::max<size_t>(std::max<size_t>(size, 2 * capacity), 16));
+    }
+    Recheck();
+  }
+  void Recheck() {
+    check_at_ = std::min(buffer_.capacity(),
+        buffer_.DropBehind(size_ * sizeof(T))) / sizeof(T);
+  }
+
+  SpillBuffer buffer_;
+  size_t size_;
+  // The size at which appending takes the slow path.
+  size_t check_at_;
+};
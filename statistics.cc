@@ -1,15 +1,184 @@
 #include "statistics.h"
 
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <map>
 #include <string>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "background_writer.h"
+
 std::map<std::string, StatisticHolder*>* statistics;
 
-void DumpStatisticsToStderr() {
+// Statistics are registered from static initializers in any order, so the pool
+// only relies on zero-initialization.
+static const size_t kStatisticPoolSize = 64 * 1024;
+static char* statistic_pool;
+static size_t statistic_pool_used;
+
+static char* MapStatisticPool(void* address) {
+  void* pool = mmap(address, kStatisticPoolSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS | (address ? MAP_FIXED : 0), -1, 0);
+  if (pool == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return reinterpret_cast<char*>(pool);
+}
+
+void* AllocateStatisticValue(size_t size) {
+  if (statistic_pool == nullptr) {
+    statistic_pool = MapStatisticPool(nullptr);
+  }
+  size += (16 - size % 16) % 16;
+  if (statistic_pool_used + size > kStatisticPoolSize) {
+    fprintf(stderr, "out of statistic space\n");
+    exit(1);
+  }
+  void* value = statistic_pool + statistic_pool_used;
+  statistic_pool_used += size;
+  return value;
+}
+
+void DetachStatistics() {
+  if (statistic_pool == nullptr) {
+    return;
+  }
+  char* copy = new char[statistic_pool_used];
+  memcpy(copy, statistic_pool, statistic_pool_used);
+  MapStatisticPool(statistic_pool);
+  memcpy(statistic_pool, copy, statistic_pool_used);
+  delete[] copy;
+}
+
+std::ostream& operator<<(std::ostream& stream, const Histogram& histogram) {
+  int end = Histogram::kBuckets;
+  while (end > 0 && histogram.counts[end - 1] == 0) {
+    end--;
+  }
+  stream << "[";
+  for (int bucket = 0; bucket < end; bucket++) {
+    stream << (bucket > 0 ? ", " : "") << histogram.counts[bucket];
+  }
+  return stream << "]";
+}
+
+std::ostream& operator<<(std::ostream& stream,
+    const DepthHistogram& histogram) {
+  int rows = DepthHistogram::kDepths;
+  int ends[DepthHistogram::kDepths];
+  for (int row = 0; row < DepthHistogram::kDepths; row++) {
+    ends[row] = DepthHistogram::kValues;
+    while (ends[row] > 0 && histogram.counts[row][ends[row] - 1] == 0) {
+      ends[row]--;
+    }
+  }
+  while (rows > 0 && ends[rows - 1] == 0) {
+    rows--;
+  }
+  stream << "[";
+  for (int row = 0; row < rows; row++) {
+    stream << (row > 0 ? ", [" : "[");
+    for (int value = 0; value < ends[row]; value++) {
+      stream << (value > 0 ? ", " : "") << histogram.counts[row][value];
+    }
+    stream << "]";
+  }
+  return stream << "]";
+}
+
+int statistics_stream_fd = -1;
+
+// Where the previous line left off, shared with forked processes like the
+// statistics themselves.
+struct StreamState {
+  double interval;
+  double start;
+  double last;
+  int64_t last_runs;
+  int64_t last_transitions;
+  int64_t last_distinct;
+};
+
+static StreamState* stream_state;
+
+static double Now() {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StreamStatisticsTo(int fd, double interval) {
+  statistics_stream_fd = fd;
+  stream_state = new (AllocateStatisticValue(sizeof(StreamState)))
+      StreamState();
+  stream_state->interval = interval;
+  stream_state->start = stream_state->last = Now();
+}
+
+static int64_t ValueOf(const std::string& name) {
+  auto it = statistics->find(name);
+  if (it == statistics->end()) {
+    return 0;
+  }
+  auto statistic = dynamic_cast<StatisticHolderImpl<int64_t>*>(it->second);
+  return statistic ? *statistic->pointer_to_value() : 0;
+}
+
+void StreamStatistics() {
+  if (statistics_stream_fd < 0) {
+    return;
+  }
   EnsureStatistics();
 
-  fprintf(stderr, "{");
+  double now = Now();
+  double elapsed = now - stream_state->last;
+  int64_t runs = ValueOf("runs");
+  int64_t transitions = ValueOf("transitions");
+  int64_t distinct = ValueOf("distinct");
+
+  std::stringstream ss;
+  ss << "{\"seconds\": " << now - stream_state->start << ", \"pid\": " <<
+      getpid() << ", \"statistics\": {";
+  bool first = true;
+  for (auto statistic : *statistics) {
+    if (!statistic.second->ShouldDump()) {
+      continue;
+    }
+    ss << (first ? "" : ", ") << "\"" << statistic.first << "\": " <<
+        statistic.second->Dump();
+    first = false;
+  }
+  ss << "}, \"rates\": {";
+  if (elapsed > 0) {
+    ss << "\"runs\": " << (runs - stream_state->last_runs) / elapsed <<
+        ", \"transitions\": " <<
+        (transitions - stream_state->last_transitions) / elapsed <<
+        ", \"distinct\": " << (distinct - stream_state->last_distinct) / elapsed;
+  }
+  ss << "}}\n";
+
+  stream_state->last = now;
+  stream_state->last_runs = runs;
+  stream_state->last_transitions = transitions;
+  stream_state->last_distinct = distinct;
+
+  WriteInBackground(statistics_stream_fd, ss.str());
+}
+
+void StreamStatisticsIfDue() {
+  if (Now() - stream_state->last >= stream_state->interval) {
+    StreamStatistics();
+  }
+}
+
+std::string DumpStatistics() {
+  EnsureStatistics();
+  std::stringstream ss;
+  ss << "{";
   bool first = true;
   for (auto statistic : *statistics) {
     if (!statistic.second->ShouldDump()) {
@@ -19,12 +188,18 @@ void DumpStatisticsToStderr() {
     if (first) {
       first = false;
     } else {
-      fprintf(stderr, ", ");
+      ss << ", ";
     }
-    fprintf(stderr, "'%s': %s", 
-        statistic.first.c_str(),
-        statistic.second->Dump().c_str());
+    ss << "'" << statistic.first << "': " << statistic.second->Dump();
   }
-  fprintf(stderr, "}\n");
+  ss << "}\n";
+  return ss.str();
+}
+
+void DumpStatisticsToStderr() {
+  EnsureStatistics();
+  StreamStatistics();
+  // Written as a single line, so that other output can not split it.
+  WriteInBackground(STDERR_FILENO, DumpStatistics());
 }
 
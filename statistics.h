@@ -1,9 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <new>
+#include <ostream>
 #include <string>
 #include <sstream>
 
+// Statistic values live in a MAP_SHARED mapping, so that processes forked for
+// checkpoints (see TraceBuilder::ExploreFromCheckpoint) count into the same
+// totals as their parent.
+extern void* AllocateStatisticValue(size_t size);
+// Gives this process its own copy of all statistic values, still shared with
+// processes it forks later on. Used by parallel workers, which must not race
+// on a common copy.
+extern void DetachStatistics();
+
 class StatisticHolder {
  public:
   virtual std::string Dump() const = 0;
@@ -15,24 +30,26 @@ template<class T>
 class StatisticHolderImpl : public StatisticHolder {
  public:
   StatisticHolderImpl(T initial, bool output_initial) : 
-      initial_(initial), value_(initial), output_initial_(output_initial) {}
+      initial_(initial),
+      value_(new (AllocateStatisticValue(sizeof(T))) T(initial)),
+      output_initial_(output_initial) {}
   T* pointer_to_value() {
-    return &value_;
+    return value_;
   }
   virtual std::string Dump() const {
     std::stringstream ss;
-    ss << value_;
+    ss << *value_;
     return ss.str();
   }
   virtual bool ShouldDump() const {
-    return output_initial_ || initial_ != value_;
+    return output_initial_ || initial_ != *value_;
   }
   virtual void Reset() {
-    value_ = initial_;
+    *value_ = initial_;
   }
  private:
   T initial_;
-  T value_;
+  T* value_;
   bool output_initial_;
 };
 
@@ -52,5 +69,111 @@ T& RegisterStatistic(std::string name, T value=T(), bool output_initial=false) {
   return *statistic->pointer_to_value();
 }
 
+// Returns the statistic registered as name, which must have type T.
+template<class T>
+const T& GetStatistic(const std::string& name) {
+  EnsureStatistics();
+  auto it = statistics->find(name);
+  assert(it != statistics->end());
+  auto statistic = dynamic_cast<StatisticHolderImpl<T>*>(it->second);
+  assert(statistic != nullptr);
+  return *statistic->pointer_to_value();
+}
+
+// Counts of values by magnitude: bucket 0 holds zero, and bucket b > 0 the
+// values from 2^(b-1) up to 2^b.
+struct Histogram {
+  static const int kBuckets = 48;
+
+  Histogram() {
+    for (int bucket = 0; bucket < kBuckets; bucket++) {
+      counts[bucket] = 0;
+    }
+  }
+
+  static inline int BucketOf(int64_t value) {
+    int bucket = value <= 0 ? 0 : 64 - __builtin_clzll(value);
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+  }
+
+  inline void Add(int64_t value) {
+    counts[BucketOf(value)]++;
+  }
+
+  bool operator!=(const Histogram& other) const {
+    for (int bucket = 0; bucket < kBuckets; bucket++) {
+      if (counts[bucket] != other.counts[bucket]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int64_t counts[kBuckets];
+};
+
+// Prints the counts up to the last non-zero one as a list.
+std::ostream& operator<<(std::ostream& stream, const Histogram& histogram);
+
+// Counts of small values, such as the sizes of thread sets, by depth: row r
+// holds the values added at depths in bucket r of a Histogram, and counts
+// each value up to kValues - 1 in its own column, and larger ones in the
+// last.
+struct DepthHistogram {
+  static const int kDepths = 20;
+  static const int kValues = 17;
+
+  DepthHistogram() {
+    for (int row = 0; row < kDepths; row++) {
+      for (int value = 0; value < kValues; value++) {
+        counts[row][value] = 0;
+      }
+    }
+  }
+
+  inline void Add(int64_t depth, int value) {
+    int row = std::min(Histogram::BucketOf(depth), kDepths - 1);
+    counts[row][std::min(value, kValues - 1)]++;
+  }
+
+  bool operator!=(const DepthHistogram& other) const {
+    for (int row = 0; row < kDepths; row++) {
+      for (int value = 0; value < kValues; value++) {
+        if (counts[row][value] != other.counts[row][value]) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  int64_t counts[kDepths][kValues];
+};
+
+// Prints the rows up to the last non-empty one as a list of lists, each up
+// to its last non-zero count.
+std::ostream& operator<<(std::ostream& stream,
+    const DepthHistogram& histogram);
+
+// The statistics to dump, as a line of a Python dict.
+extern std::string DumpStatistics();
 extern void DumpStatisticsToStderr();
 
+// Statistics can also be streamed as JSON lines to a file descriptor, every
+// interval seconds while exploring and at every DumpStatisticsToStderr. Each
+// line holds the seconds since streaming started, the process id, all
+// statistics, and the rates of runs, transitions and distinct hashes since the
+// previous line. Processes forked afterwards share the interval.
+extern void StreamStatisticsTo(int fd, double interval);
+extern void StreamStatistics();
+
+extern int statistics_stream_fd;
+extern void StreamStatisticsIfDue();
+
+// Called once per run, and cheap unless streaming.
+inline void MaybeStreamStatistics() {
+  if (statistics_stream_fd >= 0) {
+    StreamStatisticsIfDue();
+  }
+}
+
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#include "transition.h"
+
+// The stores of a thread running under TSO that have not reached memory yet,
+// oldest first. The buffer is a fixed ring, so buffering a store costs no
+// allocation.
+class StoreBuffer {
+ public:
+  static const int kCapacity = 32;
+
+  StoreBuffer() : head_(0), size_(0) {}
+
+  void Reset() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  inline bool empty() const {
+    return size_ == 0;
+  }
+
+  inline bool full() const {
+    return size_ == kCapacity;
+  }
+
+  // The BUFFERED_WRITE of the oldest store.
+  inline const Transition& front() const {
+    return entries_[head_];
+  }
+
+  inline int size() const {
+    return size_;
+  }
+
+  // The BUFFERED_WRITE of the store with i older ones before it.
+  inline const Transition& at(int i) const {
+    return entries_[(head_ + i) % kCapacity];
+  }
+
+  inline void Push(const Transition& store) {
+    entries_[(head_ + size_) % kCapacity] = store;
+    size_++;
+  }
+
+  inline void Pop() {
+    head_ = (head_ + 1) % kCapacity;
+    size_--;
+  }
+
+  // The value a load of length bytes at address reads when memory holds
+  // value: the buffered stores to any of its bytes overwrite them, newer
+  // ones last. Assumes a little-endian machine, as TSO ones are.
+  int64_t Forward(const int8_t* address, int32_t length, int64_t value) const {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(&value);
+    for (int i = 0; i < size_; i++) {
+      const Transition& store = entries_[(head_ + i) % kCapacity];
+      int64_t stored = store.stored_value();
+      for (int byte = 0; byte < store.length(); byte++) {
+        int64_t offset = store.address() + byte - address;
+        if (0 <= offset && offset < length) {
+          bytes[offset] = static_cast<uint8_t>(stored >> (8 * byte));
+        }
+      }
+    }
+    return value;
+  }
+
+  // What the steps that update the buffer, and fences that wait for it to
+  // drain, access to be ordered against each other: its size.
+  inline int8_t* address() {
+    return reinterpret_cast<int8_t*>(&size_);
+  }
+
+ private:
+  Transition entries_[kCapacity];
+  int32_t head_;
+  int32_t size_;
+};
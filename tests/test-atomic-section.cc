@@ -0,0 +1,30 @@
+#include "helper.h"
+
+// Each thread logs what it saw in harness bookkeeping that only the threads'
+// atomic sections touch, so that logging is a single step rather than one
+// per access, and never loses an entry to another thread's.
+std::atomic<int> x;
+int seen[3];
+int logged;
+
+void Thread(int i) {
+  int value = x.fetch_add(1);
+  AtomicSection section;
+  seen[logged] = value;
+  logged++;
+}
+
+void Setup() {
+  x = 0;
+  logged = 0;
+  for (int i = 0; i < 3; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  if (logged != 3) {
+    Found();
+  }
+  Output("%d %d %d\n", seen[0], seen[1], seen[2]);
+}
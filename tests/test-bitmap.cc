@@ -0,0 +1,46 @@
+#include "helper.h"
+
+const int kThreads = 3;
+
+// A lock-free bitmap allocator built on fetch_or and fetch_and, which only
+// hands out a slot to one thread at a time.
+std::atomic<unsigned> bitmap;
+std::atomic<int> owners[8];
+std::atomic<unsigned> used;
+
+int Allocate() {
+  for (int slot = 0; slot < 8; slot++) {
+    if (!(bitmap.fetch_or(1u << slot) & (1u << slot))) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void Free(int slot) {
+  bitmap.fetch_and(~(1u << slot));
+}
+
+void thread(int i) {
+  int slot = Allocate();
+  if (owners[slot].fetch_add(1) != 0) {
+    Found();
+  }
+  used.fetch_or(1u << slot);
+  owners[slot].fetch_sub(1);
+  Free(slot);
+}
+
+void Setup() {
+  bitmap = 0;
+  used = 0;
+  for (int slot = 0; slot < 8; slot++) {
+    owners[slot] = 0;
+  }
+  for (int i = 0; i < kThreads; i++)
+    StartThread(thread, i);
+}
+
+void Finish() {
+  Output("bitmap=%x used=%x\n", bitmap.load(), used.load());
+}
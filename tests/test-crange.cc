@@ -4,9 +4,10 @@
 #include "linearizability.h"
 #define printf Output
 #define cprintf printf
-#define gc_begin_epoch(x)
-#define gc_end_epoch(x)
-#define gc_delayed(x)
+// Ranges are reclaimed by the epochs of helper.h, which Create resets.
+#define gc_begin_epoch(x) gc_epochs.BeginReadSection()
+#define gc_end_epoch(x) gc_epochs.EndReadSection()
+#define gc_delayed(x) gc_epochs.Retire(x)
 #define acquire(lock) lock.Acquire()
 #define release(lock) lock.Release()
 
@@ -14,6 +15,7 @@
 #include "test-crange.hh"
 
 ThreadLocalStorage<u64> seed_tls;
+Epochs gc_epochs;
 
 u64 
 rnd(void)
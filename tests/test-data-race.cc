@@ -0,0 +1,30 @@
+#include "helper.h"
+
+// Message passing through a release store and an acquire load orders the
+// plain accesses to data. Nothing orders those to hits when thread 1 does
+// not see the flag yet, which --detect-races reports as a data race.
+std::atomic<int> ready;
+int data, hits;
+
+void Thread(int i) {
+  if (i == 0) {
+    data = 42;
+    hits++;
+    ready.store(1, std::memory_order_release);
+  } else if (ready.load(std::memory_order_acquire) == 1) {
+    Output("%d\n", data);
+  } else {
+    hits++;
+  }
+}
+
+void Setup() {
+  ready = 0;
+  data = hits = 0;
+  for (int i = 0; i < 2; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+}
@@ -0,0 +1,30 @@
+#include "helper.h"
+
+// Each thread bumps a counter and its version tag together, with a 16-byte
+// compare-and-swap of both halves at once, as a lock-free stack does its top
+// and tag. No increment is lost, and the halves always agree.
+struct alignas(16) Tagged {
+  uint64_t value;
+  uint64_t tag;
+};
+std::atomic<Tagged> top;
+
+void Thread(int i) {
+  Tagged old = top.load();
+  while (!top.compare_exchange_weak(old, Tagged{old.value + 1, old.tag + 1})) {
+  }
+}
+
+void Setup() {
+  top = Tagged{0, 0};
+  for (int i = 0; i < 3; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  Tagged result = top.load();
+  if (result.value != 3 || result.tag != 3) {
+    Found();
+  }
+}
@@ -0,0 +1,82 @@
+#include "helper.h"
+#include "linearizability.h"
+#include "reference_model.h"
+
+#include <atomic>
+
+// A set of small keys, a flag per key, checked with keyed steps given as
+// plain functions of their key: every step operates on one key, so each run
+// is checked one key at a time. The set is correct, and every run has a
+// linearization.
+const int kKeys = 4;
+
+std::atomic<bool> present[kKeys];
+
+Linearizability linearizability(3);
+SetModel model;
+
+void Create() {
+  for (std::atomic<bool>& flag : present) {
+    flag.store(false);
+  }
+}
+
+void Destroy() {
+}
+
+int Insert(int key) {
+  return !present[key].exchange(true);
+}
+
+int Erase(int key) {
+  return present[key].exchange(false);
+}
+
+int Find(int key) {
+  return present[key].load();
+}
+
+struct Configure {
+  Configure() {
+    linearizability.RegisterImplementation(&Create, &Destroy);
+    model.Register(linearizability);
+    for (int thread = 0; thread < 3; thread++) {
+      for (int i = 0; i < 3; i++) {
+        int key = (thread + i) % kKeys;
+        switch ((thread + 2 * i) % 3) {
+          case 0:
+            linearizability.AddStep(thread, Insert,
+                [](int key) -> int { return model.insert(key); }, key,
+                "insert", key);
+            break;
+          case 1:
+            linearizability.AddStep(thread, Erase,
+                [](int key) -> int { return model.erase(key); }, key,
+                "erase", key);
+            break;
+          default:
+            linearizability.AddStep(thread, Find,
+                [](int key) -> int { return model.find(key); }, key,
+                "find", key);
+        }
+      }
+    }
+  }
+};
+
+static Configure c;
+
+void ThreadBody(int n) {
+  linearizability.ThreadBody(n);
+}
+
+void Setup() {
+  linearizability.Setup();
+  for (int i = 0; i < 3; i++) {
+    StartThread(&ThreadBody, i);
+  }
+}
+
+void Finish() {
+  linearizability.Finish();
+}
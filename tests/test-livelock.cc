@@ -0,0 +1,40 @@
+#include "helper.h"
+
+// Each thread raises its flag and backs off while the other's is up. Run in
+// lockstep, the threads back off forever, so without --max-run-steps the
+// search never gets past that run; with it, the run is cut off and counted
+// as a livelock, or dropped with --prune-cut-off. Thread 2 waits for either
+// flag to stay up, reading the two in turn, which --spin-reads does not
+// catch but --retry-cutoff does.
+std::atomic<int> want[2], done;
+
+void Thread(int i) {
+  if (i == 2) {
+    while (want[0].load() == 0 && want[1].load() == 0) {
+    }
+    return;
+  }
+  for (;;) {
+    want[i].store(1);
+    if (want[1 - i].load() == 0) {
+      break;
+    }
+    want[i].store(0);
+  }
+  done.fetch_add(1);
+}
+
+void Setup() {
+  want[0] = 0;
+  want[1] = 0;
+  done = 0;
+  for (int i = 0; i < 3; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  if (done.load() == 0) {
+    Found();
+  }
+}
@@ -0,0 +1,56 @@
+#include "helper.h"
+
+#include <pthread.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Plain pthreads and std::thread code, run as it is: a producer signals a
+// condition variable under a mutex, and a std::thread counts under a
+// std::mutex. Having joined both, the main thread always sees both counts.
+pthread_mutex_t mutex;
+pthread_cond_t cond;
+std::mutex std_mutex;
+int ready, produced, counted;
+
+void* Producer(void*) {
+  pthread_mutex_lock(&mutex);
+  produced++;
+  ready = 1;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mutex);
+  return nullptr;
+}
+
+void Main() {
+  pthread_t producer;
+  pthread_create(&producer, nullptr, Producer, nullptr);
+  std::thread counter([]() {
+    std::lock_guard<std::mutex> lock(std_mutex);
+    counted++;
+  });
+
+  pthread_mutex_lock(&mutex);
+  while (!ready) {
+    pthread_cond_wait(&cond, &mutex);
+  }
+  pthread_mutex_unlock(&mutex);
+
+  pthread_join(producer, nullptr);
+  counter.join();
+  if (produced + counted != 2) {
+    Found();
+  }
+}
+
+void Setup() {
+  pthread_mutex_init(&mutex, nullptr);
+  pthread_cond_init(&cond, nullptr);
+  ready = 0;
+  produced = counted = 0;
+  StartThread(Main);
+}
+
+void Finish() {
+}
@@ -0,0 +1,26 @@
+#include "helper.h"
+
+// Three threads store to a twice each, and nothing reads a until Finish, so
+// only the thread that stores last tells runs apart by what they read. dpor
+// runs all 90 orders of the stores; --explorer=reads-from only reorders
+// stores that something observes, and runs a few per thread that can store
+// last. Either finds thread 0 storing last.
+std::atomic<int> a;
+
+void Thread(int i) {
+  a.store(2 * i + 1);
+  a.store(2 * i + 2);
+}
+
+void Setup() {
+  a = 0;
+  for (int i = 0; i < 3; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  if (a.load() == 2) {
+    Found();
+  }
+}
@@ -0,0 +1,27 @@
+#include "helper.h"
+
+// Two threads increment a counter with a relaxed load and a relaxed store,
+// and lose an update when both load before either stores. With
+// --scheduling-points=sync, neither access is a step at first, so each
+// increment runs as one step, but the first run finds them racing and makes
+// them scheduling points; the search then starts over and finds the lost
+// update with any explorer.
+std::atomic<int> counter;
+
+void Thread(int i) {
+  int value = counter.load(std::memory_order_relaxed);
+  counter.store(value + 1, std::memory_order_relaxed);
+}
+
+void Setup() {
+  counter = 0;
+  for (int i = 0; i < 2; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  if (counter.load() != 2) {
+    Found();
+  }
+}
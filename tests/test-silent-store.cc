@@ -0,0 +1,35 @@
+#include "helper.h"
+
+// Thread 0 stores the 0 that x already holds, which only reads until thread
+// 1 stores 1 first; the search has to find that order, in which thread 2
+// sees x back at 0 after thread 1 is done. Silent stores count as reads for
+// the happens-before of a run, so the stores of threads 3 and 4, which set a
+// flag that is already set, are never reordered.
+std::atomic<int> x, done, flag;
+
+void Thread(int i) {
+  if (i == 0) {
+    x.store(0);
+  } else if (i == 1) {
+    x.store(1);
+    done.store(1);
+  } else if (i == 2) {
+    if (done.load() == 1 && x.load() == 0) {
+      Found();
+    }
+  } else {
+    flag.store(1);
+  }
+}
+
+void Setup() {
+  x = 0;
+  done = 0;
+  flag = 1;
+  for (int i = 0; i < 5; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+}
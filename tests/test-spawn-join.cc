@@ -0,0 +1,37 @@
+#include "helper.h"
+
+// The main thread spawns workers two at a time, and joins them before it
+// reads what they wrote. Spawning and joining order the accesses, so every
+// run sees all of them, and the joined workers' slots are reused, so the
+// twelve workers fit in fewer slots than that.
+std::atomic<int> data[12];
+int sum;
+
+void Worker(int i) {
+  data[i].store(i + 1, std::memory_order_relaxed);
+}
+
+void Main() {
+  for (int i = 0; i < 12; i += 2) {
+    int a = StartThread(Worker, i);
+    int b = StartThread(Worker, i + 1);
+    JoinThread(a);
+    JoinThread(b);
+    sum += data[i].load(std::memory_order_relaxed) +
+        data[i + 1].load(std::memory_order_relaxed);
+  }
+}
+
+void Setup() {
+  for (std::atomic<int>& value : data) {
+    value = 0;
+  }
+  sum = 0;
+  StartThread(Main);
+}
+
+void Finish() {
+  if (sum != 78) {
+    Found();
+  }
+}
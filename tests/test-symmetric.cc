@@ -0,0 +1,29 @@
+#include "helper.h"
+
+// Identical workers, which --symmetry explores in one order of first steps
+// rather than all N! of them.
+const int N = 4;
+
+Mutex lock;
+std::atomic<int> counter;
+
+void Worker() {
+  lock.Acquire();
+  counter = counter + 1;
+  lock.Release();
+}
+
+void Setup() {
+  lock.Reset();
+  counter = 0;
+  for (int i = 0; i < N; i++) {
+    SymmetricStartThread(Worker, 0);
+  }
+}
+
+void Finish() {
+  if (counter != N) {
+    Found();
+  }
+  Output("counter=%d\n", counter.load());
+}
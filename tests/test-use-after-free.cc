@@ -0,0 +1,35 @@
+#include "helper.h"
+
+// Thread 0 unlinks the node and deletes it, while thread 1 may have loaded
+// the pointer just before, and reads the deleted node, which --detect-frees
+// reports. Without it, the read sees the old value and nothing goes wrong.
+struct Node {
+  int value;
+};
+
+std::atomic<Node*> head;
+int seen;
+
+void Thread(int i) {
+  if (i == 0) {
+    Node* node = head.exchange(nullptr);
+    delete node;
+  } else {
+    Node* node = head.load();
+    if (node != nullptr) {
+      seen = node->value;
+    }
+  }
+}
+
+void Setup() {
+  head = new Node{42};
+  seen = 0;
+  for (int i = 0; i < 2; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  Output("%d\n", seen);
+}
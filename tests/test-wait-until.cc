@@ -0,0 +1,29 @@
+#include "helper.h"
+
+// A barrier followed by a flag, waited for with single blocking steps rather
+// than spin loops, so exploring it takes a handful of runs.
+std::atomic<int> arrived, go;
+
+void Thread(int i) {
+  arrived.fetch_add(1);
+  WaitUntilAtLeast(arrived, 3);
+  if (i == 0) {
+    go.store(1);
+  } else {
+    FutexWait(go, 0);
+  }
+}
+
+void Setup() {
+  arrived = 0;
+  go = 0;
+  for (int i = 0; i < 3; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  if (go.load() != 1) {
+    Found();
+  }
+}
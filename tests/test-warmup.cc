@@ -0,0 +1,35 @@
+#include "helper.h"
+
+// The first worker fills the table before either contends, outside of
+// interleaving, so the search only explores the contended increments.
+const int N = 64;
+
+int table[N];
+std::atomic<int> filled, counter;
+
+void Worker(int id) {
+  if (id == 0) {
+    EndInterleaving();
+    for (int i = 0; i < N; i++) {
+      table[i] = i;
+    }
+    filled = 1;
+    BeginInterleaving();
+  }
+  counter = counter + 1;
+}
+
+void Setup() {
+  filled = 0;
+  counter = 0;
+  for (int i = 0; i < 2; i++) {
+    StartThread(Worker, i);
+  }
+}
+
+void Finish() {
+  if (filled && table[N - 1] != N - 1) {
+    Found();
+  }
+  Output("counter=%d\n", counter.load());
+}
@@ -0,0 +1,30 @@
+#include "helper.h"
+
+// Store buffering with release stores and acquire loads, which C11 lets both
+// threads read 0 from, as --weak-atomics finds. With seq_cst stores, or
+// without the flag, one of them always reads 1.
+std::atomic<int> x, y, a, b;
+
+void Thread(int i) {
+  if (i == 0) {
+    x.store(1, std::memory_order_release);
+    a = y.load(std::memory_order_acquire);
+  } else {
+    y.store(1, std::memory_order_release);
+    b = x.load(std::memory_order_acquire);
+  }
+}
+
+void Setup() {
+  x = y = a = b = 0;
+  for (int i = 0; i < 2; i++) {
+    StartThread(Thread, i);
+  }
+}
+
+void Finish() {
+  if (a == 0 && b == 0) {
+    Found();
+  }
+  Output("%d %d\n", a.load(), b.load());
+}
@@ -6,17 +6,21 @@
 #include <cassert>
 #include <cstdint>
 
+// Only the keys in have hold values. Clearing and erasing just drop keys,
+// and a value is reset to T() when its key is next added, so that runs and
+// steps that clear a map of clock vectors or transitions pay for the threads
+// they use, not for kMaxThreads of them. Values of erased keys, and what they
+// own, live until then.
 template<class T>
 class ThreadMap {
  public:
-  ThreadMap() : have() {
-    for (int i = 0; i < kMaxThreads; i++) {
-      data[i] = T();
-    }
-  }
+  ThreadMap() : have() {}
 
   inline T& operator[](int thread) {
-    have.insert(thread);
+    if (!have.count(thread)) {
+      have.insert(thread);
+      data[thread] = T();
+    }
     return data[thread];
   }
 
@@ -27,14 +31,10 @@ class ThreadMap {
 
   inline void erase(int thread) {
     have.erase(thread);
-    data[thread] = T();
   }
 
   inline void clear() {
     have.clear();
-    for (int i = 0; i < kMaxThreads; i++) {
-      data[i] = T();
-    }
   }
 
   inline bool count(int thread) const {
@@ -5,112 +5,168 @@
 #include <cassert>
 #include <cstdint>
 
+// Thread sets are bitsets of as many 64-bit words as kMaxThreads needs. Loops
+// over the words are unrolled away for the usual single word.
+static const int kThreadSetWords = (kMaxThreads + 63) / 64;
+
 class ThreadSetIterator {
   friend class ThreadSet;
 
  public:
-  inline ThreadSetIterator(uint64_t bitset) : bitset(bitset) {}
+  inline ThreadSetIterator() : words() {}
 
   inline ThreadSetIterator& operator++() {
-    bitset &= bitset - 1;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      if (words[i] != 0) {
+        words[i] &= words[i] - 1;
+        break;
+      }
+    }
     return *this;
   }
 
   inline int operator*() const {
-    assert(bitset != 0);
-    return __builtin_ctzl(bitset);
+    for (int i = 0; i < kThreadSetWords; i++) {
+      if (words[i] != 0) {
+        return 64 * i + __builtin_ctzll(words[i]);
+      }
+    }
+    assert(false);
+    return -1;
   }
 
   inline bool operator==(const ThreadSetIterator& o) const {
-    return bitset == o.bitset;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      if (words[i] != o.words[i]) {
+        return false;
+      }
+    }
+    return true;
   }
 
   inline bool operator!=(const ThreadSetIterator& o) const {
-    return bitset != o.bitset;
+    return !(*this == o);
   }
 
  public:
-  uint64_t bitset;
+  // The threads yet to be visited.
+  uint64_t words[kThreadSetWords];
 };
 
 class ThreadSet {
  public:
-  inline ThreadSet() : bitset(0) {}
+  inline ThreadSet() : words() {}
   inline void insert(int value) {
-    assert(0 <= value && value < 64);
-    bitset |= 1ULL << value;
+    assert(0 <= value && value < 64 * kThreadSetWords);
+    words[value / 64] |= 1ULL << (value % 64);
   }
 
   inline static ThreadSet Singleton(int value) {
-    assert(0 <= value && value < 64);
-    return ThreadSet(1ULL << value);
+    ThreadSet set;
+    set.insert(value);
+    return set;
   }
 
   inline void erase(int value) {
-    assert(0 <= value && value < 64);
-    bitset &= ~(1ULL << value);
+    assert(0 <= value && value < 64 * kThreadSetWords);
+    words[value / 64] &= ~(1ULL << (value % 64));
   }
 
   inline bool empty() const {
-    return bitset == 0;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      if (words[i] != 0) {
+        return false;
+      }
+    }
+    return true;
   }
 
   inline void clear() {
-    bitset = 0;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      words[i] = 0;
+    }
   }
 
   inline bool count(int value) const {
-    assert(0 <= value && value < 64);
-    return bitset & (1ULL << value);
-  } 
+    assert(0 <= value && value < 64 * kThreadSetWords);
+    return words[value / 64] & (1ULL << (value % 64));
+  }
 
   inline void add(const ThreadSetIterator& begin, const ThreadSetIterator& end) {
-    bitset |= begin.bitset & ~end.bitset;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      words[i] |= begin.words[i] & ~end.words[i];
+    }
   }
 
   inline ThreadSetIterator begin() const {
-    return ThreadSetIterator(bitset);
+    ThreadSetIterator it;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      it.words[i] = words[i];
+    }
+    return it;
   }
 
   inline ThreadSetIterator upper_bound(int value) const {
-    assert(0 <= value && value < 64);
-    if (value == 63) {
-      return 0;
-    } else {
-      return ThreadSetIterator(bitset & ~((1ULL << (value + 1)) - 1));
+    assert(0 <= value && value < 64 * kThreadSetWords);
+    ThreadSetIterator it;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      if (i > value / 64) {
+        it.words[i] = words[i];
+      } else if (i == value / 64 && value % 64 != 63) {
+        it.words[i] = words[i] & ~((1ULL << (value % 64 + 1)) - 1);
+      }
     }
+    return it;
   }
 
   inline int size() const {
-    return __builtin_popcountl(bitset);
+    int size = 0;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      size += __builtin_popcountll(words[i]);
+    }
+    return size;
   }
 
   inline ThreadSetIterator end() const {
-    return 0;
+    return ThreadSetIterator();
   }
 
   inline ThreadSet operator-(const ThreadSet& o) const {
-    return ThreadSet(bitset & ~o.bitset);
+    ThreadSet set;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      set.words[i] = words[i] & ~o.words[i];
+    }
+    return set;
   }
 
   inline ThreadSet operator&(const ThreadSet& o) const {
-    return ThreadSet(bitset & o.bitset);
+    ThreadSet set;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      set.words[i] = words[i] & o.words[i];
+    }
+    return set;
   }
 
   inline ThreadSet operator|(const ThreadSet& o) const {
-    return ThreadSet(bitset | o.bitset);
+    ThreadSet set;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      set.words[i] = words[i] | o.words[i];
+    }
+    return set;
   }
 
   inline bool operator==(const ThreadSet& o) const {
-    return bitset == o.bitset;
+    for (int i = 0; i < kThreadSetWords; i++) {
+      if (words[i] != o.words[i]) {
+        return false;
+      }
+    }
+    return true;
   }
 
   inline bool operator!=(const ThreadSet& o) const {
-    return bitset != o.bitset;
+    return !(*this == o);
   }
 
-  uint64_t bitset;
- private:
-  inline ThreadSet(uint64_t bitset) : bitset(bitset) {}
+  uint64_t words[kThreadSetWords];
 };
-
@@ -0,0 +1,113 @@
+#include "timer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static const Clock::time_point start_time = Clock::now();
+static const uint64_t start_cycles = ReadCycleCounter();
+
+double CyclesPerSecond() {
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start_time).count();
+  uint64_t cycles = ReadCycleCounter() - start_cycles;
+  if (seconds <= 0 || cycles == 0) {
+    return 1e9;
+  }
+  return cycles / seconds;
+}
+
+bool perf_counters_enabled = false;
+
+static const uint64_t kPerfEvents[kPerfCounters] = {
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static int perf_fds[kPerfCounters];
+// The page of each counter that tells whether, and with which index, rdpmc
+// can read it.
+static perf_event_mmap_page* perf_pages[kPerfCounters];
+
+static void OpenPerfCounters() {
+  for (int counter = 0; counter < kPerfCounters; counter++) {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = kPerfEvents[counter];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+      perror("perf_event_open");
+      exit(1);
+    }
+    void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+        fd, 0);
+    perf_fds[counter] = fd;
+    perf_pages[counter] =
+        page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+  }
+}
+
+// The counters of the parent count its thread, not the child's.
+static void ReopenPerfCounters() {
+  for (int counter = 0; counter < kPerfCounters; counter++) {
+    if (perf_pages[counter] != nullptr) {
+      munmap(perf_pages[counter], sysconf(_SC_PAGESIZE));
+    }
+    close(perf_fds[counter]);
+  }
+  OpenPerfCounters();
+}
+
+void EnablePerfCounters() {
+  OpenPerfCounters();
+  pthread_atfork(nullptr, nullptr, ReopenPerfCounters);
+  perf_counters_enabled = true;
+}
+
+static uint64_t ReadPerfCounter(int counter) {
+#if defined(__x86_64__) || defined(__i386__)
+  // The seqlock protocol of perf_event_mmap_page.
+  volatile perf_event_mmap_page* page = perf_pages[counter];
+  if (page != nullptr && page->cap_user_rdpmc) {
+    uint32_t sequence, index;
+    uint64_t count;
+    do {
+      sequence = page->lock;
+      __sync_synchronize();
+      index = page->index;
+      count = page->offset;
+      if (index != 0) {
+        int shift = 64 - page->pmc_width;
+        count += static_cast<int64_t>(__rdpmc(index - 1) << shift) >> shift;
+      }
+      __sync_synchronize();
+    } while (page->lock != sequence);
+    if (index != 0) {
+      return count;
+    }
+  }
+#endif
+  uint64_t count = 0;
+  if (read(perf_fds[counter], &count, sizeof(count)) != sizeof(count)) {
+    return 0;
+  }
+  return count;
+}
+
+void ReadPerfCounters(uint64_t* values) {
+  for (int counter = 0; counter < kPerfCounters; counter++) {
+    values[counter] = ReadPerfCounter(counter);
+  }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <atomic>
+#include <chrono>
+#endif
+
+#include "statistics.h"
+
+// Cycle counters for the hot paths, which are only built in with
+// CODEX_TIMERS (make TIMERS=1) so that they cost nothing otherwise:
+//
+//   CODEX_TIMER(replay_timer, "timer-replay");
+//   ...
+//   CODEX_TIMED_SCOPE(replay_timer);
+//
+// A timer is a statistic holding the number of timed scopes and the time
+// spent in them, in seconds. Nested scopes each count their full time.
+//
+// With --perf-counters, timed scopes also count the instructions, cache
+// misses and branch misses of the thread running them, from hardware
+// counters that EnablePerfCounters opens with perf_event_open and that are
+// read with rdpmc where the kernel allows it, and with read otherwise.
+
+inline uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t value;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// ReadCycleCounter fenced on both sides: every access of the thread before
+// it is visible to other threads by the time it reads the counter, and none
+// after it starts before, so that counts taken on different cores order what
+// their threads did in real time. This assumes the counters of all cores are
+// in sync, as the invariant TSC of current x86 processors is.
+inline uint64_t ReadFencedCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int core;
+  _mm_mfence();
+  uint64_t value = __rdtscp(&core);
+  _mm_lfence();
+  return value;
+#elif defined(__aarch64__)
+  uint64_t value;
+  asm volatile("dmb ish; isb; mrs %0, cntvct_el0; isb" : "=r"(value) : :
+      "memory");
+  return value;
+#else
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint64_t value = ReadCycleCounter();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return value;
+#endif
+}
+
+// The rate of ReadCycleCounter, measured since the program started.
+extern double CyclesPerSecond();
+
+// Instructions, cache misses and branch misses.
+static const int kPerfCounters = 3;
+extern bool perf_counters_enabled;
+// Opens the hardware counters for this thread, and again in every process
+// forked from it, or exits if the kernel does not let it.
+extern void EnablePerfCounters();
+// Reads the counters into values.
+extern void ReadPerfCounters(uint64_t* values);
+
+struct Timer {
+  Timer() : calls(0), cycles(0) {
+    for (int counter = 0; counter < kPerfCounters; counter++) {
+      counts[counter] = 0;
+    }
+  }
+
+  bool operator!=(const Timer& other) const {
+    return calls != other.calls || cycles != other.cycles;
+  }
+
+  int64_t calls;
+  uint64_t cycles;
+  uint64_t counts[kPerfCounters];
+};
+
+inline std::ostream& operator<<(std::ostream& stream, const Timer& timer) {
+  stream << "{\"calls\": " << timer.calls << ", \"seconds\": " <<
+      timer.cycles / CyclesPerSecond();
+  if (perf_counters_enabled) {
+    stream << ", \"instructions\": " << timer.counts[0] <<
+        ", \"cache-misses\": " << timer.counts[1] <<
+        ", \"branch-misses\": " << timer.counts[2];
+  }
+  return stream << "}";
+}
+
+inline Timer& RegisterTimer(const std::string& name) {
+  return RegisterStatistic<Timer>(name);
+}
+
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Timer* timer) : timer_(timer) {
+    if (perf_counters_enabled) {
+      ReadPerfCounters(start_counts_);
+    }
+    start_ = ReadCycleCounter();
+  }
+
+  ~ScopedTimer() {
+    timer_->calls++;
+    timer_->cycles += ReadCycleCounter() - start_;
+    if (perf_counters_enabled) {
+      uint64_t counts[kPerfCounters];
+      ReadPerfCounters(counts);
+      for (int counter = 0; counter < kPerfCounters; counter++) {
+        timer_->counts[counter] += counts[counter] - start_counts_[counter];
+      }
+    }
+  }
+
+ private:
+  Timer* timer_;
+  uint64_t start_;
+  uint64_t start_counts_[kPerfCounters];
+};
+
+#ifdef CODEX_TIMERS
+#define CODEX_TIMER(variable, name) \
+  static Timer& variable = RegisterTimer(name)
+#define CODEX_TIMED_SCOPE(variable) ScopedTimer scoped_##variable(&variable)
+#else
+#define CODEX_TIMER(variable, name) static_assert(true, "")
+#define CODEX_TIMED_SCOPE(variable) do {} while (false)
+#endif
@@ -1,12 +1,113 @@
 #include "trace_builder.h"
 
 #include <algorithm>
+#include <chrono>
 #include <functional>
-#include <memory>
-#include <sstream>
 #include <vector>
 
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "background_writer.h"
 #include "interceptor.h"
+#include "memory_governor.h"
+#include "parallel.h"
+#include "schedule.h"
+#include "statistics.h"
+#include "timer.h"
+
+static int64_t& checkpoint_forks = RegisterStatistic<int64_t>(
+    "checkpoint-forks");
+static int64_t& checkpoint_failures = RegisterStatistic<int64_t>(
+    "checkpoint-failures");
+static int64_t& checkpoint_pageouts = RegisterStatistic<int64_t>(
+    "checkpoint-pageouts");
+// The memory held by frames, which only grows with the deepest path built.
+static int64_t& trace_frame_bytes = RegisterStatistic<int64_t>(
+    "trace-frame-bytes");
+CODEX_TIMER(replay_timer, "timer-replay");
+
+bool page_out_checkpoints = false;
+
+#if defined(__linux__) && !defined(MADV_PAGEOUT)
+#define MADV_PAGEOUT 21
+#endif
+
+// Asks the kernel to reclaim the private writable memory of this process, of
+// which it only takes the pages no other process maps.
+static void PageOutPrivateMemory() {
+#ifdef __linux__
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps == nullptr) {
+    return;
+  }
+  char* line = nullptr;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, maps) > 0) {
+    unsigned long start, end;
+    char permissions[5];
+    if (sscanf(line, "%lx-%lx %4s", &start, &end, permissions) == 3 &&
+        permissions[1] == 'w' && permissions[3] == 'p') {
+      // Fails on kernels before 5.4, which leaves the memory where it is.
+      madvise(reinterpret_cast<void*>(start), end - start, MADV_PAGEOUT);
+    }
+  }
+  free(line);
+  fclose(maps);
+  checkpoint_pageouts++;
+#endif
+}
+
+// Waits until fd can be read. With page_out_checkpoints, pages out the memory
+// of this process after a second of waiting, and again after twice as long
+// each time, as the child writes to more of the pages it shares with this
+// one. Pages it out as well whenever the memory governor is under pressure,
+// checked every second.
+static void WaitAsCheckpoint(int fd) {
+  int timeout = 1000;
+  auto next_page_out = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeout);
+  pollfd waiting = {fd, POLLIN, 0};
+  while (poll(&waiting, 1, 1000) == 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (page_out_checkpoints && now >= next_page_out) {
+      PageOutPrivateMemory();
+      timeout *= 2;
+      next_page_out = now + std::chrono::milliseconds(timeout);
+    } else if (UnderMemoryPressure()) {
+      PageOutPrivateMemory();
+    }
+  }
+}
+
+ThreadSet TraceNode::FindConflicts(int thread) const {
+  const PendingAccess& access = pending_accesses_[thread];
+  ThreadSet conflicts;
+  for (int other : next_transitions_.keys()) {
+    const PendingAccess& other_access = pending_accesses_[other];
+    bool conflict;
+    if (access.simple && other_access.simple) {
+      conflict = (access.begin < other_access.end) &
+          (other_access.begin < access.end) &
+          (access.write | other_access.write) &
+          !(access.commutes & other_access.commutes &
+            (access.begin == other_access.begin) &
+            (access.end == other_access.end));
+    } else {
+      conflict = next_transitions_[other].ConflictsWith(
+          next_transitions_[thread]);
+    }
+    conflicts.words[other / 64] |= static_cast<uint64_t>(conflict) <<
+        (other % 64);
+  }
+  return conflicts;
+}
 
 std::string TraceNode::CalculatePath() const {
   std::vector<int> path;
@@ -14,63 +115,146 @@ std::string TraceNode::CalculatePath() const {
   auto current = this;
   while (current->parent_) {
     path.push_back(current->last_thread_);
-    current = current->parent_.get();
+    current = current->parent_;
   }
 
   std::reverse(path.begin(), path.end());
 
-  std::stringstream ss;
+  PackedSchedule schedule;
   for (int thread : path) {
-    ss << thread;
+    schedule.Append(thread);
   }
-  return ss.str();
+  return schedule.ToString();
 }
 
 TraceBuilder::TraceBuilder(Interceptor* interceptor, HHBHistory* history) :
-    interceptor_(interceptor), history_(history) {
+    interceptor_(interceptor), history_(history), depth_(0), path_depth_(0) {
+  frames_.push_back(TraceNode());
   interceptor_->StartNewRun(history_);
-  root_ = current_ = std::shared_ptr<TraceNode>(new TraceNode());
-  FillTraceNodeFromInterceptor(*current_);
+  FillTraceNodeFromInterceptor(frames_[0]);
 }
 
-void TraceBuilder::MoveTo(std::shared_ptr<TraceNode> node) {
-  std::vector<int> path;
+void TraceBuilder::MoveTo(const TraceNode* node) {
+  CODEX_TIMED_SCOPE(replay_timer);
+  int depth = node->depth_;
+  assert(depth <= path_depth_ && node == &frames_[depth]);
 
-  auto base = node;
-  while (base != current_ && base->parent()) {
-    path.push_back(base->last_thread());
-    base = base->parent();
+  if (depth < depth_) {
+    // The history still holds the path up to the node.
+    interceptor_->StartNewRun(history_, depth);
+    depth_ = 0;
   }
-  std::reverse(path.begin(), path.end());
 
-  if (base != current_) {
-    interceptor_->StartNewRun(history_);
+  // Replaying reproduces the frames along the way, so they are left as is.
+  schedule_.clear();
+  while (depth_ < depth) {
+    depth_++;
+    schedule_.push_back(frames_[depth_].last_thread_);
   }
+  interceptor_->AdvanceThreads(schedule_);
+}
 
-  for (int thread : path) {
-    interceptor_->AdvanceThread(thread);
+const TraceNode* TraceBuilder::Extend(int thread) {
+  interceptor_->AdvanceThread(thread);
+
+  int depth = depth_ + 1;
+  if (depth == static_cast<int>(frames_.size())) {
+    frames_.push_back(TraceNode());
+    trace_frame_bytes = frames_.size() * sizeof(TraceNode);
   }
 
-  current_ = node;
+  TraceNode& node = frames_[depth];
+  node.parent_ = &frames_[depth_];
+  node.last_thread_ = thread;
+  node.depth_ = depth;
+  node.path_hash_ = ExtendPathHash(frames_[depth_].path_hash_, thread);
+  FillTraceNodeFromInterceptor(node);
+
+  depth_ = path_depth_ = depth;
+  return &node;
 }
 
-std::shared_ptr<TraceNode> TraceBuilder::Extend(int thread) {
-  interceptor_->AdvanceThread(thread);
+void TraceBuilder::ExploreFromCheckpoint(const std::function<void()>& explore,
+    std::vector<ThreadSet>* sets) {
+  size_t count = sets->size();
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  checkpoint_forks++;
 
-  if (!current_->next_[thread].expired()) {
-    // FIXME: Not thread safe?
-    current_ = current_->next_[thread].lock();
-  } else {
-    current_ = std::shared_ptr<TraceNode>(new TraceNode(current_, thread));
-    current_->parent()->next_[thread] = current_;
-    FillTraceNodeFromInterceptor(*current_);
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  } else if (pid == 0) {
+    close(fds[0]);
+    explore();
+    // explore must leave sets as large as it found them.
+    assert(sets->size() == count);
+    const char* data = reinterpret_cast<const char*>(sets->data());
+    size_t size = count * sizeof(ThreadSet);
+    while (size > 0) {
+      ssize_t written = write(fds[1], data, size);
+      if (written <= 0) {
+        break;
+      }
+      data += written;
+      size -= written;
+    }
+    FlushBackgroundWrites();
+    fflush(stdout);
+    fflush(stderr);
+    _exit(0);
   }
 
-  return current_;
+  close(fds[1]);
+  if (page_out_checkpoints || memory_budget_bytes > 0) {
+    WaitAsCheckpoint(fds[0]);
+  }
+  std::vector<ThreadSet> child_sets(count);
+  char* data = reinterpret_cast<char*>(child_sets.data());
+  size_t size = count * sizeof(ThreadSet);
+  while (size > 0) {
+    ssize_t got = read(fds[0], data, size);
+    if (got <= 0) {
+      break;
+    }
+    data += got;
+    size -= got;
+  }
+  close(fds[0]);
+
+  int status;
+  waitpid(pid, &status, 0);
+  if (size > 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    // The subtree is lost, but the rest of the search can carry on.
+    checkpoint_failures++;
+    fprintf(stderr, "checkpoint child failed below %s\n",
+        current()->CalculatePath().c_str());
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    (*sets)[i] = (*sets)[i] | child_sets[i];
+  }
 }
 
 void TraceBuilder::FillTraceNodeFromInterceptor(TraceNode& node) {
   node.next_transitions_ = interceptor_->next_transitions();
   node.runnable_ = interceptor_->runnable();
+  for (int thread : node.next_transitions_.keys()) {
+    const Transition& transition = node.next_transitions_[thread];
+    PendingAccess& access = node.pending_accesses_[thread];
+    access.begin = reinterpret_cast<uintptr_t>(transition.address());
+    access.end = access.begin + transition.length();
+    access.write = transition.can_write();
+    access.simple = transition.is_simple();
+    access.commutes = transition.commutes();
+  }
 }
-
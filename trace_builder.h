@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <functional>
-#include <memory>
+#include <string>
+#include <vector>
 
 #include "threadset.h"
 #include "threadmap.h"
@@ -9,66 +12,114 @@
 
 class TraceBuilder;
 
+// The bytes a pending transition accesses, packed so that finding the threads
+// whose next transitions conflict takes a few comparisons per thread.
+struct PendingAccess {
+  uintptr_t begin;
+  uintptr_t end;
+  bool write;
+  bool simple;
+  bool commutes; // see Transition::commutes
+};
+
+// TraceNodes live in frames owned by the TraceBuilder, one per depth along the
+// path it most recently built. A node stays valid until the builder extends a
+// path through its depth with a different sibling, which in a depth-first
+// search happens only after the node has been fully explored. Memory thus
+// grows with the depth of the deepest path, never with the size of the tree,
+// and nodes are never rebuilt; the trace-frame-bytes statistic tracks it.
 class TraceNode {
  public:
-  inline std::shared_ptr<TraceNode> parent() const {
+  inline const TraceNode* parent() const {
     return parent_;
   }
   inline int last_thread() const {
     assert(parent_);
     return last_thread_;
   }
-  inline ThreadSet runnable() const {
+  inline int depth() const {
+    return depth_;
+  }
+  // The hash of the threads along the path from the root, see
+  // ExtendPathHash, which names the node across frames and runs.
+  inline uint64_t path_hash() const {
+    return path_hash_;
+  }
+  inline const ThreadSet& runnable() const {
     return runnable_;
   }
-  inline ThreadMap<Transition> next_transitions() const {
+  inline const ThreadMap<Transition>& next_transitions() const {
     return next_transitions_;
   }
   inline bool is_leaf() const {
     return next_transitions_.size() == 0;
   }
 
+  // The threads whose next transitions conflict with that of thread, which
+  // DPOR takes out of the sleepset of the child it extends with thread.
+  ThreadSet FindConflicts(int thread) const;
+
   std::string CalculatePath() const;
 
  private:
-  TraceNode() : parent_(nullptr) {}
-  TraceNode(std::shared_ptr<TraceNode> parent, int last_thread) :
-    parent_(parent), last_thread_(last_thread) {}
+  TraceNode() : parent_(nullptr), last_thread_(-1), depth_(0),
+      path_hash_(0) {}
 
-  std::shared_ptr<TraceNode> parent_; // null for root
+  const TraceNode* parent_; // null for root
   int last_thread_; // undefined for root
+  int depth_;
+  uint64_t path_hash_;
 
   ThreadSet runnable_;
   ThreadMap<Transition> next_transitions_;
-
-  ThreadMap<std::weak_ptr<TraceNode>> next_; // useful cache to ensure pointer equality
+  PendingAccess pending_accesses_[kMaxThreads];
 
   friend class TraceBuilder;
 };
 
+// With page_out_checkpoints, a process waiting for the child it forked for a
+// checkpoint has the kernel page out its memory, from a second into the wait
+// on. The pages it still shares with the child stay, so what goes is the
+// pages that differ between the two, and with swap on zram, whose pages are
+// LZ4-compressed by default, each live checkpoint costs about its compressed
+// difference from the next. Without swap, the kernel keeps the pages.
+extern bool page_out_checkpoints;
+
 class Interceptor;
 class HHBHistory;
 class TraceBuilder {
  public:
   TraceBuilder(Interceptor* interceptor, HHBHistory* history);
 
-  void MoveTo(std::shared_ptr<TraceNode> node);
-  std::shared_ptr<TraceNode> Extend(int thread);
-
-  inline std::shared_ptr<TraceNode> root() const {
-    return root_;
+  // node must lie on the current path: be an ancestor of the current node, or
+  // a frame below it that has not been replaced by a later Extend.
+  void MoveTo(const TraceNode* node);
+  const TraceNode* Extend(int thread);
+
+  // Runs explore, which may move anywhere below the current node, in a forked
+  // child process. This process stays at the current node, so a following
+  // MoveTo to it needs no replay. The child sends back its copy of sets, which
+  // gets merged into ours; everything else it changes is lost, except for
+  // statistics, which live in memory shared with forked children.
+  void ExploreFromCheckpoint(const std::function<void()>& explore,
+      std::vector<ThreadSet>* sets);
+
+  inline const TraceNode* root() const {
+    return &frames_[0];
   }
-  inline std::shared_ptr<TraceNode> current() const {
-    return current_;
+  inline const TraceNode* current() const {
+    return &frames_[depth_];
   }
 
  private:
   Interceptor* interceptor_;
   HHBHistory* history_;
 
-  std::shared_ptr<TraceNode> root_;
-  std::shared_ptr<TraceNode> current_;
+  // A deque keeps frames in place as it grows.
+  std::deque<TraceNode> frames_;
+  int depth_; // of the node the interceptor is at
+  int path_depth_; // of the deepest frame on the current path
+  std::vector<int> schedule_; // scratch space for MoveTo
 
   void FillTraceNodeFromInterceptor(TraceNode& node);
 };
-
@@ -0,0 +1,123 @@
+#include "trace_file.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "background_writer.h"
+
+TraceWriter::TraceWriter(const char* path, size_t expected_records) :
+    path_(path), closed_(false), num_records_(0) {
+  data_.reserve(sizeof(TraceHeader) + expected_records * sizeof(TraceRecord));
+  // The header is filled in at Close.
+  data_.append(sizeof(TraceHeader), '\0');
+}
+
+uint32_t TraceWriter::InternString(const std::string& text) {
+  auto it = string_ids_.find(text);
+  if (it != string_ids_.end()) {
+    return it->second;
+  }
+  uint32_t id = strings_.size();
+  strings_.push_back(text);
+  string_ids_[text] = id;
+  return id;
+}
+
+void TraceWriter::WriteRecord(const TraceRecord& record) {
+  data_.append(reinterpret_cast<const char*>(&record), sizeof(record));
+  num_records_++;
+}
+
+void TraceWriter::AddTransition(int thread, int step,
+    const Transition& transition, int64_t value) {
+  TraceRecord record;
+  transition.Dump(thread, step, value, &record);
+  if (record.location != 0) {
+    locations_.insert(record.location);
+  }
+  WriteRecord(record);
+}
+
+void TraceWriter::AddAnnotation(int thread, const std::string& text) {
+  TraceRecord record;
+  memset(&record, 0, sizeof(record));
+  record.location = InternString(text);
+  record.step = -1;
+  record.thread = thread;
+  record.type = kAnnotationRecord;
+  WriteRecord(record);
+}
+
+void TraceWriter::Close() {
+  if (closed_) {
+    return;
+  }
+
+  // Locations are looked up, and their texts interned, before the strings
+  // are written. Adding the locations a location was inlined at only adds
+  // smaller ids, which the loop has yet to reach.
+  std::vector<TraceLocation> locations;
+  for (auto it = locations_.rbegin(); it != locations_.rend(); ++it) {
+    uint32_t inlined_at;
+    const Location& l = FindLocation(*it, &inlined_at);
+    locations.push_back(TraceLocation{*it, InternString(l.file),
+        InternString(l.function), l.line, l.column, inlined_at});
+    if (inlined_at != 0) {
+      locations_.insert(inlined_at);
+    }
+  }
+
+  TraceHeader header;
+  memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.record_size = sizeof(TraceRecord);
+  header.num_records = num_records_;
+  header.tables_offset = data_.size();
+
+  uint32_t num_strings = strings_.size();
+  data_.append(reinterpret_cast<const char*>(&num_strings),
+      sizeof(num_strings));
+  for (const std::string& text : strings_) {
+    uint32_t length = text.size();
+    data_.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    data_.append(text);
+  }
+  uint32_t num_locations = locations.size();
+  data_.append(reinterpret_cast<const char*>(&num_locations),
+      sizeof(num_locations));
+  data_.append(reinterpret_cast<const char*>(locations.data()),
+      num_locations * sizeof(TraceLocation));
+
+  memcpy(&data_[0], &header, sizeof(header));
+  WriteFileInBackground(path_, std::move(data_));
+  data_ = std::string();
+  closed_ = true;
+}
+
+void LoadTraceSchedule(const std::string& path, std::vector<int>* schedule) {
+  FlushBackgroundWrites();
+  FILE* file = fopen(path.c_str(), "rb");
+  TraceHeader header;
+  bool ok = file != nullptr && fread(&header, sizeof(header), 1, file) == 1 &&
+      memcmp(header.magic, kTraceMagic, sizeof(header.magic)) == 0 &&
+      header.version == kTraceVersion &&
+      header.record_size == sizeof(TraceRecord);
+
+  schedule->clear();
+  TraceRecord record;
+  for (uint64_t i = 0; ok && i < header.num_records; i++) {
+    ok = fread(&record, sizeof(record), 1, file) == 1;
+    if (ok && record.type != kAnnotationRecord) {
+      schedule->push_back(record.thread);
+    }
+  }
+  if (file != nullptr) {
+    fclose(file);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "failed to load a trace from %s\n", path.c_str());
+    exit(1);
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "transition.h"
+
+// Traces are dumped in a binary format that is written as the steps go by and
+// read back through mmap by dumper.py. A file holds a TraceHeader, then one
+// fixed-size TraceRecord per step or annotation, then the tables the records
+// refer to:
+//
+//   uint32_t num_strings, then per string a uint32_t length and its bytes;
+//   uint32_t num_locations, then that many TraceLocations.
+//
+// Everything is in the byte order of the machine that wrote it.
+
+// Where History::Dump writes the trace of a bug.
+static const char kTraceFile[] = "trace.bin";
+
+static const char kTraceMagic[8] = {'C', 'O', 'D', 'E', 'X', 'T', 'R', 'C'};
+static const uint32_t kTraceVersion = 1;
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  // Both are left zero until the writer is closed.
+  uint64_t num_records;
+  uint64_t tables_offset;
+};
+
+// The type of records that hold an annotation rather than a step.
+static const uint8_t kAnnotationRecord = 0xff;
+
+struct TraceRecord {
+  uint64_t address;
+  // The value at address before the step, and the one it wrote, if any.
+  int64_t value;
+  int64_t written_value;
+  // The operands of the step, as in Transition.
+  int64_t arg0;
+  int64_t arg1;
+  int64_t length;
+  // The location id of a step, see transition.h, or the string id of the
+  // text of an annotation.
+  uint32_t location;
+  int32_t step;
+  int32_t thread;
+  uint8_t type;
+  uint8_t does_write;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 64, "TraceRecord is read as 64 bytes");
+
+// A location, with its texts as string ids, and the one it was inlined at by
+// its location id, or 0.
+struct TraceLocation {
+  uint32_t id;
+  uint32_t file;
+  uint32_t function;
+  int32_t line;
+  int32_t column;
+  uint32_t inlined_at;
+};
+
+static_assert(sizeof(TraceLocation) == 24, "TraceLocation is read as 24 bytes");
+
+// Packs records into a buffer as they are added, and hands the whole file to
+// the background writer at Close, see background_writer.h, so that dumping a
+// long trace costs the explorer no file I/O. The strings and locations the
+// records refer to are kept aside until then.
+class TraceWriter {
+ public:
+  // Makes room for expected_records up front.
+  explicit TraceWriter(const char* path, size_t expected_records = 0);
+  ~TraceWriter() {
+    Close();
+  }
+
+  void AddTransition(int thread, int step, const Transition& transition,
+      int64_t value);
+  void AddAnnotation(int thread, const std::string& text);
+  // Appends the tables, completes the header and queues the file.
+  void Close();
+
+ private:
+  uint32_t InternString(const std::string& text);
+  void WriteRecord(const TraceRecord& record);
+
+  std::string path_;
+  std::string data_;
+  bool closed_;
+  uint64_t num_records_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, uint32_t> string_ids_;
+  std::set<uint32_t> locations_;
+};
+
+// Reads the threads that took the steps of the trace in path, in order, into
+// schedule, once the writes queued so far are done. Exits if the file is not a
+// trace.
+void LoadTraceSchedule(const std::string& path, std::vector<int>* schedule);
@@ -1,13 +1,154 @@
 #include "transition.h"
 
 #include <cassert>
+#include <cstring>
 
+#include <map>
 #include <string>
 #include <sstream>
 #include <vector>
 
+#include "trace_file.h"
+
+// The registered tables, by the id of their first location.
+static std::map<uint32_t, const Location*>& LocationTables() {
+  static std::map<uint32_t, const Location*> tables;
+  return tables;
+}
+
+// Id zero stands for no location.
+static uint32_t next_location = 1;
+
+int32_t CodexRegisterLocations(const Location* locations, int32_t count) {
+  uint32_t base = next_location;
+  LocationTables()[base] = locations;
+  next_location += count;
+  return base;
+}
+
+const Location& FindLocation(uint32_t location, uint32_t* inlined_at) {
+  auto table = --LocationTables().upper_bound(location);
+  const Location& l = table->second[location - table->first];
+  *inlined_at = l.inlined_at == -1 ? 0 : table->first + l.inlined_at;
+  return l;
+}
+
+uint32_t CountLocations() {
+  return next_location;
+}
+
+std::string FormatLocation(uint32_t location) {
+  if (location == 0) {
+    return "an unknown location";
+  }
+  std::stringstream ss;
+  uint32_t inlined_at;
+  const Location& l = FindLocation(location, &inlined_at);
+  ss << l.function << " at " << l.file << ":" << l.line << ":" << l.column;
+  while (inlined_at != 0) {
+    const Location& outer = FindLocation(inlined_at, &inlined_at);
+    ss << ", inlined in " << outer.function << " at " << outer.file << ":" <<
+        outer.line;
+  }
+  return ss.str();
+}
+
+static inline bool Overlap(const int8_t* a, int64_t a_length,
+    const int8_t* b, int64_t b_length) {
+  return a < b + b_length && b < a + a_length;
+}
+
+int Transition::AccessRanges(AccessRange ranges[2]) const {
+  switch (type()) {
+  case TransitionType::MEMCPY:
+    ranges[0] = AccessRange{address_, arg1_, true};
+    ranges[1] = AccessRange{source(), arg1_, false};
+    return 2;
+  case TransitionType::BUFFERED_WRITE:
+    // Only the thread's own loads see the store before it is flushed, and
+    // those are ordered after it anyway.
+    ranges[0] = AccessRange{buffer(), sizeof(int32_t), true};
+    return 1;
+  case TransitionType::FLUSH:
+    ranges[0] = AccessRange{address_, length_, true};
+    ranges[1] = AccessRange{buffer(), sizeof(int32_t), true};
+    return 2;
+  default:
+    ranges[0] = AccessRange{address_, range_length(), can_write()};
+    return 1;
+  }
+}
+
+bool Transition::RangeConflictsWith(const Transition& o) const {
+  AccessRange ranges[2], other_ranges[2];
+  int num_ranges = AccessRanges(ranges);
+  int num_other_ranges = o.AccessRanges(other_ranges);
+  for (int i = 0; i < num_ranges; i++) {
+    for (int j = 0; j < num_other_ranges; j++) {
+      if ((ranges[i].write || other_ranges[j].write) &&
+          Overlap(ranges[i].start, ranges[i].length, other_ranges[j].start,
+            other_ranges[j].length)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Transition::WriteRange() const {
+  if (type() == TransitionType::MEMSET) {
+    memset(address_, arg0_, arg1_);
+  } else if (type() == TransitionType::MEMCPY) {
+    memmove(address_, source(), arg1_);
+  }
+}
+
+// Values are passed around zero-extended from their length.
+static inline int64_t SignExtend(int64_t value, int length) {
+  int shift = 64 - 8 * length;
+  return static_cast<int64_t>(static_cast<uint64_t>(value) << shift) >> shift;
+}
+
+int64_t Transition::ApplyRMW(int64_t value) const {
+  switch (arg0_) {
+  case RMW_XCHG:
+    return arg1_;
+  case RMW_ADD:
+    return value + arg1_;
+  case RMW_SUB:
+    return value - arg1_;
+  case RMW_AND:
+    return value & arg1_;
+  case RMW_NAND:
+    return ~(value & arg1_);
+  case RMW_OR:
+    return value | arg1_;
+  case RMW_XOR:
+    return value ^ arg1_;
+  case RMW_MAX:
+    return SignExtend(value, length_) >= SignExtend(arg1_, length_) ?
+        value : arg1_;
+  case RMW_MIN:
+    return SignExtend(value, length_) <= SignExtend(arg1_, length_) ?
+        value : arg1_;
+  case RMW_UMAX:
+    return static_cast<uint64_t>(value) >= static_cast<uint64_t>(arg1_) ?
+        value : arg1_;
+  case RMW_UMIN:
+    return static_cast<uint64_t>(value) <= static_cast<uint64_t>(arg1_) ?
+        value : arg1_;
+  default:
+    assert(0);
+    return value;
+  }
+}
+
+static const char* const kRMWOperators[] = {
+  "=", "+=", "-=", "&=", "~&=", "|=", "^=", "max=", "min=", "umax=", "umin=",
+};
+
 Result Transition::DetermineResult(int64_t value) const {
-  switch (type_) {
+  switch (type()) {
   case TransitionType::READ:
     return Result(value);
   case TransitionType::WRITE:
@@ -20,16 +161,22 @@ Result Transition::DetermineResult(int64_t value) const {
     }
   case TransitionType::READ_GE:
     return Result(value >= arg0_);
-  case TransitionType::ATOMICRMW: {
-    switch (arg0_) {
-    case 0:
-      return Result(value, arg1_);
-    case 1:
-      return Result(value, value + arg1_);
-    case 2:
-      return Result(value, value - arg1_);
-    }
-  }
+  case TransitionType::ATOMICRMW:
+    return Result(value, ApplyRMW(value));
+  case TransitionType::MEMSET:
+  case TransitionType::MEMCPY:
+  case TransitionType::FREE:
+    // The bytes are written by WriteRange.
+    return Result(0);
+  case TransitionType::BUFFERED_WRITE:
+    // The store goes to the store buffer, see Interceptor::BufferStore.
+    return Result(0);
+  case TransitionType::FLUSH:
+    return Result(0, arg0_);
+  case TransitionType::LOCK:
+    return value == 0 ? Result(value, 1) : Result(value);
+  case TransitionType::UNLOCK:
+    return Result(0, 0);
   default:
     assert(0);
   }
@@ -38,7 +185,7 @@ Result Transition::DetermineResult(int64_t value) const {
 std::string Transition::Format(int64_t value) const {
   std::stringstream ss;
 
-  switch (type_) {
+  switch (type()) {
   case TransitionType::READ:
     ss << "Read *" << (void*)address_ << " = " << (void*)value;
     break;
@@ -58,90 +205,57 @@ std::string Transition::Format(int64_t value) const {
     ss << "Compared *" << (void*)address_ << " = " << (void*)value << " to " <<
         (void*)arg0_;
     break;
-  case TransitionType::ATOMICRMW: {
-    switch (arg0_) {
-    case 0:
-      ss << "Exchanged *" << (void*)address_ << " = " << (void*)value << 
-          " with " << (void*)arg0_;
-      break;
-    case 1:
-      ss << "*" << (void*)address_ << " = " << (void*)value << " += " <<
-        (void*)arg0_;
-      break;
-    case 2:
-      ss << "*" << (void*)address_ << " = " << (void*)value << " -= " <<
-        (void*)arg0_;
-      break;
+  case TransitionType::ATOMICRMW:
+    if (arg0_ == RMW_XCHG) {
+      ss << "Exchanged *" << (void*)address_ << " = " << (void*)value <<
+          " with " << (void*)arg1_;
+    } else {
+      ss << "*" << (void*)address_ << " = " << (void*)value << " " <<
+          kRMWOperators[arg0_] << " " << (void*)arg1_;
     }
     break;
-  }
-  default:
-    assert(0);
-  }
-  ss << " (" << length() << " bytes)";
-  return ss.str();
-}
-
-std::string Transition::Dump(int thread, int step, int64_t value) const {
-  std::stringstream ss;
-
-  Result res = DetermineResult(value);
-
-  ss << "{'does_write': " << (res.does_write ? "True": "False") << ", ";
-  ss << "'address': '" << (void*)address_ << "', ";
-  ss << "'type': 'transition', ";
-  ss << "'value': '" << (void*)value << "', ";
-  ss << "'thread': " << thread << ", ";
-  ss << "'step': " << step << ", ";
-  if (res.does_write) {
-    ss << "'new_value': '" << (void*)res.written_value << "', ";
-  }
-  ss << "'length': " << length_ << ", ";
-  ss << "'description': '";
-
-  switch (type_) {
-  case TransitionType::READ:
-    ss << "Read " << (void*)address_ << " = " << (void*)value;
+  case TransitionType::MEMSET:
+    ss << "Set *" << (void*)address_ << " to " << (void*)arg0_;
     break;
-  case TransitionType::WRITE:
-    ss << "Write " << (void*)address_ << " = " << (void*)arg0_;
+  case TransitionType::MEMCPY:
+    ss << "Copied *" << (void*)source() << " to *" << (void*)address_;
     break;
-  case TransitionType::CAS:
-    if (value == arg0_) {
-      ss << "CAS " << (void*)address_ << " from " << (void*)arg0_ << " to " <<
-          (void*)arg1_;
-    } else {
-      ss << "CAS fail " << (void*)address_ << " from " << (void*)arg0_ << 
-          " to " << (void*)arg1_ << "; was " << (void*)value;
-    }
+  case TransitionType::BUFFERED_WRITE:
+    ss << "Buffered write *" << (void*)address_ << " = " << (void*)arg0_;
     break;
-  case TransitionType::READ_GE:
-    ss << "Compared " << (void*)address_ << " = " << (void*)value << " to " <<
-        (void*)arg0_;
+  case TransitionType::FLUSH:
+    ss << "Flushed write *" << (void*)address_ << " = " << (void*)arg0_;
     break;
-  case TransitionType::ATOMICRMW: {
-    switch (arg0_) {
-    case 0:
-      ss << "Exchanged " << (void*)address_ << " = " << (void*)value << 
-          " with " << (void*)arg0_;
-      break;
-    case 1:
-      ss << (void*)address_ << " = " << (void*)value << " += " << (void*)arg0_;
-      break;
-    case 2:
-      ss << (void*)address_ << " = " << (void*)value << " -= " << (void*)arg0_;
-      break;
-    }
+  case TransitionType::FREE:
+    ss << "Freed *" << (void*)address_;
+    break;
+  case TransitionType::LOCK:
+    ss << "Locked *" << (void*)address_;
+    break;
+  case TransitionType::UNLOCK:
+    ss << "Unlocked *" << (void*)address_;
     break;
-  }
   default:
     assert(0);
   }
-  ss << "'";
-  if (file_ != nullptr) {
-    ss << ", 'trace': " << file_;
-  }
-  ss << "}";
+  ss << " (" << range_length() << " bytes)";
   return ss.str();
 }
 
+void Transition::Dump(int thread, int step, int64_t value,
+    TraceRecord* record) const {
+  Result res = DetermineResult(value);
+
+  memset(record, 0, sizeof(*record));
+  record->address = reinterpret_cast<uint64_t>(address_);
+  record->value = value;
+  record->written_value = res.does_write ? res.written_value : 0;
+  record->arg0 = arg0_;
+  record->arg1 = arg1_;
+  record->length = range_length();
+  record->location = location_;
+  record->step = step;
+  record->thread = thread;
+  record->type = type_;
+  record->does_write = res.does_write;
+}
@@ -2,17 +2,93 @@
 
 #include <cassert>
 
-#include <memory>
 #include <string>
-#include <vector>
 
-enum class TransitionType : int {
+#include "annotation.h"
+#include "config.h"
+
+enum class TransitionType : uint8_t {
   NONE = 0,
   WRITE = 1,
   READ = 2,
   CAS = 3,
   READ_GE = 4,
   ATOMICRMW = 5,
+  // Ranged transitions cover [address, address + range_length()) as a single
+  // step. A MEMCPY also reads the same number of bytes at source().
+  MEMSET = 6,
+  MEMCPY = 7,
+  // Under TSO, a store is a BUFFERED_WRITE that appends it to the store
+  // buffer of its thread, which only updates the buffer at buffer(). The
+  // thread's flusher later makes it visible with a FLUSH, which writes the
+  // memory and takes the store off the buffer.
+  BUFFERED_WRITE = 8,
+  FLUSH = 9,
+  // With detect_frees, a delete is a FREE of the allocation at address, a
+  // ranged transition that writes all of it, so that it conflicts with every
+  // access to it, but leaves memory as it is.
+  FREE = 10,
+  // A LOCK acquires the lock byte at address, which is 0 while it is free:
+  // it is only runnable then, and sets it to 1. An UNLOCK sets it back to 0.
+  // Both are simple transitions that write the byte, so that acquires and
+  // releases of a lock conflict with each other and with nothing else.
+  LOCK = 11,
+  UNLOCK = 12,
+};
+
+// The operation of an ATOMICRMW, numbered as LLVM's AtomicRMWInst::BinOp,
+// which the instrumentation passes along as is.
+enum AtomicRMWOperation : int64_t {
+  RMW_XCHG = 0,
+  RMW_ADD = 1,
+  RMW_SUB = 2,
+  RMW_AND = 3,
+  RMW_NAND = 4,
+  RMW_OR = 5,
+  RMW_XOR = 6,
+  RMW_MAX = 7,
+  RMW_MIN = 8,
+  RMW_UMAX = 9,
+  RMW_UMIN = 10,
+};
+
+// The memory order of an access, as C11 has them. Plain accesses are not
+// atomic.
+enum class MemoryOrder : uint8_t {
+  NOT_ATOMIC = 0,
+  RELAXED = 1,
+  ACQUIRE = 2,
+  RELEASE = 3,
+  ACQ_REL = 4,
+  SEQ_CST = 5,
+};
+
+// The instrumentation passes orders as LLVM's AtomicOrdering numbers them,
+// in which unordered accesses, which only rule out tearing, count as plain
+// ones and consume ones as acquire.
+inline MemoryOrder MemoryOrderFromLLVM(int32_t ordering) {
+  switch (ordering) {
+    case 2:
+      return MemoryOrder::RELAXED;
+    case 3:
+    case 4:
+      return MemoryOrder::ACQUIRE;
+    case 5:
+      return MemoryOrder::RELEASE;
+    case 6:
+      return MemoryOrder::ACQ_REL;
+    case 7:
+      return MemoryOrder::SEQ_CST;
+    default:
+      return MemoryOrder::NOT_ATOMIC;
+  }
+}
+
+// Bytes that a transition reads, or writes if write is set.
+struct AccessRange {
+  int8_t* start;
+  int64_t length;
+  bool write;
 };
 
 struct Result {
@@ -27,32 +103,82 @@ struct Result {
     returned_value(returned_value), does_write(false) {}
 };
 
+// The source location of an instrumented access, as the instrumentation
+// lays it out in the table of each module it registers at startup. A
+// location that was inlined refers to the one it was inlined at by its index
+// in the same table, or -1.
+struct Location {
+  const char* file;
+  const char* function;
+  int32_t line;
+  int32_t column;
+  int32_t inlined_at;
+};
+
+// Locations are passed along with accesses by id: the base id a module's
+// table was registered at plus the index in it. Id 0 stands for an unknown
+// location, as do ids of kMaxLocations and up, which transitions have no
+// room for.
+static const uint32_t kMaxLocations = 1 << 21;
+extern "C" int32_t CodexRegisterLocations(const Location* locations,
+    int32_t count);
+// The registered location with the given nonzero id. Sets inlined_at to the
+// id of the location it was inlined at, or 0.
+const Location& FindLocation(uint32_t location, uint32_t* inlined_at);
+// One more than the highest location id registered so far.
+uint32_t CountLocations();
+// The function, file, line and column of a location id, and those it was
+// inlined at, for messages.
+std::string FormatLocation(uint32_t location);
+
+struct TraceRecord;
+
+// Transitions are copied into the history and the explorers' per-node state
+// on every step, so they are kept small and trivially copyable: annotations
+// and locations are referred to by id, and the small fields are packed
+// together.
 class Transition {
  public:
   Transition() {}
 
   Transition(TransitionType type, int8_t *address, int32_t length, 
-      int8_t* file, bool is_atomic) :
-          type_(type), address_(address), has_required_(false), required_(0),
-          length_(length), arg0_(0), arg1_(0), is_atomic_(is_atomic),
-          file_(file) {}
+      uint32_t location, MemoryOrder order) :
+          Transition(type, address, length, 0, 0, location, order) {}
   Transition(TransitionType type, int8_t *address, int32_t length,
-      int64_t arg, int8_t* file, bool is_atomic) :
-          type_(type), address_(address), has_required_(false), required_(0),
-          length_(length), arg0_(arg), arg1_(0), is_atomic_(is_atomic),
-          file_(file) {}
+      int64_t arg, uint32_t location, MemoryOrder order) :
+          Transition(type, address, length, arg, 0, location, order) {}
   Transition(TransitionType type, int8_t *address, int32_t length,
-      int64_t arg0, int64_t arg1, int8_t* file, bool is_atomic) :
-          type_(type), address_(address), has_required_(false), required_(0),
-          length_(length), arg0_(arg0), arg1_(arg1), is_atomic_(is_atomic),
-          file_(file) {}
+      int64_t arg0, int64_t arg1, uint32_t location, MemoryOrder order) :
+          address_(address), arg0_(arg0), arg1_(arg1), required_(0),
+          annotations_(kNoAnnotations), order_(static_cast<uint32_t>(order)),
+          location_(location < kMaxLocations ? location : 0),
+          length_(length), type_(static_cast<uint32_t>(type)),
+          has_required_(false), required_differs_(false) {
+    assert(length_ == length);
+  }
 
   Result DetermineResult(int64_t value) const;
   std::string Format(int64_t value) const;
-  std::string Dump(int thread, int step, int64_t value) const;
+  // Fills in the record of the transition as the given step for a trace
+  // dump, see trace_file.h.
+  void Dump(int thread, int step, int64_t value, TraceRecord* record) const;
+
+  // Whether o is the same step, as a replay must take it again: everything
+  // but its annotations and requirements agrees.
+  inline bool SameStepAs(const Transition& o) const {
+    return type_ == o.type_ && address_ == o.address_ &&
+        length_ == o.length_ && arg0_ == o.arg0_ && arg1_ == o.arg1_ &&
+        location_ == o.location_;
+  }
 
   inline bool ConflictsWith(const Transition& o) const {
-    if (address_ != o.address_) {
+    if (!is_simple() || !o.is_simple()) {
+      return RangeConflictsWith(o);
+    } else if (address_ >= o.address_ + o.length_ ||
+        o.address_ >= address_ + length_) {
+      return false;
+    } else if (commutes() && o.commutes() && address_ == o.address_ &&
+        length_ == o.length_) {
       return false;
     } else if (can_write() && o.can_write()) {
       return true;
@@ -65,26 +191,48 @@ class Transition {
 
   bool DetermineRunnable(int64_t value) const {
     if (has_required_) {
-      return DetermineResult(value).returned_value == required_;
+      return (DetermineResult(value).returned_value == required_) !=
+          required_differs_;
     } else {
-      return true;
+      return type() != TransitionType::LOCK || value == 0;
     }
   }
 
+  // Whether the transition may wait for memory to hold some value.
+  inline bool can_block() const {
+    return has_required_ || type() == TransitionType::LOCK;
+  }
+
   inline bool DetermineRunnable() const {
-    return !has_required_ || DetermineRunnable(Read());
+    return !can_block() || DetermineRunnable(Read());
+  }
+
+  // Reads and writes the value of a transition of sizeof(T) bytes, for
+  // callers that know its length when they are compiled.
+  template <typename T>
+  inline int64_t ReadAs() const {
+    return *reinterpret_cast<T*>(address_);
+  }
+  template <typename T>
+  inline void WriteAs(int64_t value) const {
+    *reinterpret_cast<T*>(address_) = value;
   }
 
   inline int64_t Read() const {
     switch (length_) {
       case 1:
-        return (uint8_t)(*reinterpret_cast<int8_t*>(address_));
+        return ReadAs<uint8_t>();
       case 2:
-        return (uint16_t)(*reinterpret_cast<int16_t*>(address_));
+        return ReadAs<uint16_t>();
       case 4:
-        return (uint32_t)(*reinterpret_cast<int32_t*>(address_));
+        return ReadAs<uint32_t>();
       case 8:
-        return *reinterpret_cast<int64_t*>(address_);
+        return ReadAs<int64_t>();
+      case 16:
+        return FoldWide(*reinterpret_cast<unsigned __int128*>(address_));
+      case 0:
+        // Ranged transitions have no single value.
+        return 0;
       default:
         assert(0);
     }
@@ -93,24 +241,60 @@ class Transition {
   inline void Write(int64_t value) const {
     switch (length_) {
       case 1:
-        *reinterpret_cast<int8_t*>(address_) = value;
+        WriteAs<uint8_t>(value);
         break;
       case 2:
-        *reinterpret_cast<int16_t*>(address_) = value;
+        WriteAs<uint16_t>(value);
         break;
       case 4:
-        *reinterpret_cast<int32_t*>(address_) = value;
+        WriteAs<uint32_t>(value);
         break;
       case 8:
-        *reinterpret_cast<int64_t*>(address_) = value;
+        WriteAs<int64_t>(value);
         break;
       default:
         assert(0);
     }
   }
 
+  // Copies or sets the bytes of a ranged transition.
+  void WriteRange() const;
+
+  // 16-byte transitions, such as the double-width CAS of tagged pointers,
+  // only carry their operands, and have their values read, folded to 64
+  // bits, see FoldWide, which is enough to tell them apart. The entry points
+  // of interface.cc run their steps on all 16 bytes.
+  inline bool is_wide() const {
+    return length_ == 16;
+  }
+  static inline int64_t FoldWide(unsigned __int128 value) {
+    return static_cast<uint64_t>(value) ^
+        static_cast<uint64_t>(value >> 64) * 0x9e3779b97f4a7c15ULL;
+  }
+
   inline bool can_write() const {
-    return type_ != TransitionType::READ && type_ != TransitionType::READ_GE;
+    return type() != TransitionType::READ && type() != TransitionType::READ_GE;
+  }
+  // Whether running the transition when memory holds value changes memory.
+  // A CAS that fails, a read-modify-write that leaves the value as it was,
+  // or a store of the value memory already holds, such as a flag set again
+  // or a hazard pointer cleared again, only reads: either order of it and
+  // another read, or another such step, leaves both as they were.
+  inline bool DoesWrite(int64_t value) const {
+    if (type() != TransitionType::CAS &&
+        type() != TransitionType::ATOMICRMW &&
+        (type() != TransitionType::WRITE || is_wide())) {
+      return can_write();
+    }
+    Result result = DetermineResult(value);
+    uint64_t mask = length_ >= 8 ? ~0ULL : (1ULL << (8 * length_)) - 1;
+    return result.does_write && ((result.written_value ^ value) & mask) != 0;
+  }
+  // Whether the transition is an add or subtract that, with commuting_adds,
+  // commutes with the others of the same bytes.
+  inline bool commutes() const {
+    return commuting_adds && type() == TransitionType::ATOMICRMW &&
+        (arg0_ == RMW_ADD || arg0_ == RMW_SUB) && !is_wide();
   }
   inline bool has_required() const {
     return has_required_;
@@ -120,10 +304,20 @@ class Transition {
   }
   inline void set_required(int64_t required) {
     has_required_ = true;
+    required_differs_ = false;
     required_ = required;
   }
+  // Makes the transition only runnable when its result differs from
+  // result, rather than equals it.
+  inline void set_required_other_than(int64_t result) {
+    set_required(result);
+    required_differs_ = true;
+  }
+  inline bool required_differs() const {
+    return required_differs_;
+  }
   inline TransitionType type() const {
-    return type_;
+    return static_cast<TransitionType>(type_);
   }
   inline int8_t* address() const {
     return address_;
@@ -131,26 +325,84 @@ class Transition {
   inline int32_t length() const {
     return length_;
   }
+  // A simple transition only accesses the length() bytes at address().
+  inline bool is_simple() const {
+    return type() <= TransitionType::ATOMICRMW ||
+        type() >= TransitionType::LOCK;
+  }
+  // Fills ranges with the bytes the transition accesses, and returns how
+  // many ranges there are.
+  int AccessRanges(AccessRange ranges[2]) const;
+  inline bool is_ranged() const {
+    return type() == TransitionType::MEMSET ||
+        type() == TransitionType::MEMCPY || type() == TransitionType::FREE;
+  }
+  // The number of bytes accessed at address().
+  inline int64_t range_length() const {
+    return is_ranged() ? arg1_ : length_;
+  }
+  // Where a MEMCPY reads from.
+  inline int8_t* source() const {
+    return reinterpret_cast<int8_t*>(arg0_);
+  }
+  // The store buffer a BUFFERED_WRITE or FLUSH updates, see StoreBuffer.
+  inline int8_t* buffer() const {
+    return reinterpret_cast<int8_t*>(arg1_);
+  }
+  // The value a WRITE, BUFFERED_WRITE or FLUSH stores.
+  inline int64_t stored_value() const {
+    return arg0_;
+  }
+  // The BUFFERED_WRITE that puts a WRITE in the store buffer at buffer.
+  inline Transition Buffered(int8_t* buffer) const {
+    Transition buffered = *this;
+    buffered.type_ = static_cast<uint32_t>(TransitionType::BUFFERED_WRITE);
+    buffered.arg1_ = reinterpret_cast<int64_t>(buffer);
+    return buffered;
+  }
+  // The FLUSH that takes a BUFFERED_WRITE off its store buffer.
+  inline Transition Flushed() const {
+    Transition flushed = *this;
+    flushed.type_ = static_cast<uint32_t>(TransitionType::FLUSH);
+    flushed.annotations_ = kNoAnnotations;
+    flushed.has_required_ = false;
+    return flushed;
+  }
+  inline MemoryOrder order() const {
+    return static_cast<MemoryOrder>(order_);
+  }
   inline bool is_atomic() const {
-    return is_atomic_;
+    return order() != MemoryOrder::NOT_ATOMIC;
   }
-  inline std::shared_ptr<std::vector<std::string>> annotations() const {
+  // The id of the source location, see kMaxLocations.
+  inline uint32_t location() const {
+    return location_;
+  }
+  // The id of the interned list of annotations, see annotation.h.
+  inline int32_t annotations() const {
     return annotations_;
   }
-  inline void set_annotations(
-      std::shared_ptr<std::vector<std::string>> annotations) {
+  inline void set_annotations(int32_t annotations) {
     annotations_ = annotations;
   }
 
  private:
+  bool RangeConflictsWith(const Transition& o) const;
+  // The value an ATOMICRMW writes when memory holds value.
+  int64_t ApplyRMW(int64_t value) const;
+
   int8_t *address_;
-  bool has_required_;
-  int64_t required_;
   int64_t arg0_, arg1_;
-  int32_t length_;
-  TransitionType type_;
-  bool is_atomic_;
-  int8_t* file_;
-  std::shared_ptr<std::vector<std::string>> annotations_;
+  int64_t required_;
+  // Interned annotation lists are few, so their ids leave room for the order.
+  int32_t annotations_ : 29;
+  uint32_t order_ : 3;
+  uint32_t location_ : 21;
+  uint32_t length_ : 5;
+  uint32_t type_ : 4;
+  uint32_t has_required_ : 1;
+  uint32_t required_differs_ : 1;
 };
 
+static_assert(sizeof(Transition) == 40, "Transition should stay compact");
+
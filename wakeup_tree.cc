@@ -0,0 +1,103 @@
+#include "wakeup_tree.h"
+
+#include <algorithm>
+
+// Whether v[index] is the first event of its thread in v and depends on no
+// event before it, and so starts v up to reordering.
+static bool IsInitial(const std::vector<WakeupEvent>& v, int index) {
+  for (int i = 0; i < index; i++) {
+    if (v[i].thread == v[index].thread ||
+        v[i].transition.ConflictsWith(v[index].transition)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool IsIndependentOfAll(const Transition& transition,
+    const std::vector<WakeupEvent>& v) {
+  for (const WakeupEvent& event : v) {
+    if (event.transition.ConflictsWith(transition)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int FindThread(const std::vector<WakeupEvent>& v, int thread) {
+  for (int i = 0; i < static_cast<int>(v.size()); i++) {
+    if (v[i].thread == thread) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void WakeupTree::Start(const WakeupEvent& event) {
+  children_.clear();
+  children_.emplace_back(new WakeupTree());
+  children_.back()->thread_ = event.thread;
+  children_.back()->transition_ = event.transition;
+}
+
+WakeupTree WakeupTree::TakeFirst() {
+  WakeupTree first;
+  first.children_.swap(children_.front()->children_);
+  children_.erase(children_.begin());
+  return first;
+}
+
+ThreadSet WakeupTree::WeakInitials(const std::vector<WakeupEvent>& v,
+    ThreadSet enabled, const ThreadMap<Transition>& next) {
+  ThreadSet initials;
+  for (int i = 0; i < static_cast<int>(v.size()); i++) {
+    if (IsInitial(v, i)) {
+      initials.insert(v[i].thread);
+    }
+  }
+  for (int thread : enabled) {
+    if (FindThread(v, thread) == -1 &&
+        IsIndependentOfAll(next[thread], v)) {
+      initials.insert(thread);
+    }
+  }
+  return initials;
+}
+
+bool WakeupTree::Insert(std::vector<WakeupEvent> v) {
+  WakeupTree* node = this;
+  while (true) {
+    if (v.empty() || (node != this && node->empty())) {
+      // An existing sequence already covers v.
+      return false;
+    }
+
+    WakeupTree* child = nullptr;
+    for (auto& candidate : node->children_) {
+      int thread = candidate->thread_;
+      int index = FindThread(v, thread);
+      if (index != -1) {
+        if (IsInitial(v, index)) {
+          v.erase(v.begin() + index);
+          child = candidate.get();
+        }
+      } else if (IsIndependentOfAll(candidate->transition_, v)) {
+        child = candidate.get();
+      }
+      if (child != nullptr) {
+        break;
+      }
+    }
+
+    if (child == nullptr) {
+      for (const WakeupEvent& event : v) {
+        node->children_.emplace_back(new WakeupTree());
+        node = node->children_.back().get();
+        node->thread_ = event.thread;
+        node->transition_ = event.transition;
+      }
+      return true;
+    }
+    node = child;
+  }
+}
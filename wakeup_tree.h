@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "threadmap.h"
+#include "threadset.h"
+#include "transition.h"
+
+// The wakeup trees of Optimal DPOR (Abdulla et al., "Optimal Dynamic Partial
+// Order Reduction", POPL 2014). A wakeup tree at a node is an ordered tree of
+// thread sequences that still have to be explored from it; each sequence is
+// a witness for a trace that the explored ones do not cover.
+//
+// Threads are deterministic, so a sequence is run by scheduling its threads
+// in order. Every node of the tree also keeps the transition its thread
+// takes, so that insertions can tell which events commute.
+
+struct WakeupEvent {
+  int thread;
+  Transition transition;
+};
+
+class WakeupTree {
+ public:
+  WakeupTree() : thread_(-1) {}
+
+  inline bool empty() const {
+    return children_.empty();
+  }
+  // The thread the first sequence starts with.
+  inline int first_thread() const {
+    return children_.front()->thread_;
+  }
+
+  // Replaces this tree with a single sequence of one event.
+  void Start(const WakeupEvent& event);
+
+  // Removes the sequences starting with first_thread() from this tree, and
+  // returns what remains of them after that thread has taken a step.
+  WakeupTree TakeFirst();
+
+  // The weak initials of v after the node the tree starts from: the threads
+  // whose next event can be moved to the front of v without reordering
+  // dependent events. enabled and next describe the threads at the node.
+  static ThreadSet WeakInitials(const std::vector<WakeupEvent>& v,
+      ThreadSet enabled, const ThreadMap<Transition>& next);
+
+  // Adds v as a new sequence, unless one of the tree already starts with
+  // something equivalent. Returns whether the tree changed.
+  bool Insert(std::vector<WakeupEvent> v);
+
+ private:
+  int thread_;
+  Transition transition_;
+  std::vector<std::unique_ptr<WakeupTree>> children_;
+};